@@ -0,0 +1,782 @@
+/**
+ * @file blake3.c
+ * An implementation of the BLAKE3 algorithm, described in the BLAKE3 paper
+ *  (2020), with multi-lane chunk compression and multithreaded subtrees
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../global.h"
+#include "../stats/stats.h"
+#include "../sparse/sparse.h"
+#include "blake3.h"
+
+/** Bytes in a block */
+#define BLAKE3_BLOCK_LEN 64
+/** Bytes in a chunk (16 blocks) */
+#define BLAKE3_CHUNK_LEN 1024
+/** Bytes in the default digest */
+#define BLAKE3_OUT_LEN 32
+/** Maximum depth of the chaining value stack (2^54 chunks is 2^64 bytes) */
+#define BLAKE3_MAX_DEPTH 54
+
+/** Domain flag for the first block of a chunk */
+#define BLAKE3_CHUNK_START (1 << 0)
+/** Domain flag for the last block of a chunk */
+#define BLAKE3_CHUNK_END (1 << 1)
+/** Domain flag for parent nodes */
+#define BLAKE3_PARENT (1 << 2)
+/** Domain flag for the root node */
+#define BLAKE3_ROOT (1 << 3)
+
+/** Chunks in a subtree handed to a thread (must be a power of 2) */
+#define BLAKE3_PIECE_CHUNKS 256
+/** log2 of BLAKE3_PIECE_CHUNKS - the tree level of a piece */
+#define BLAKE3_PIECE_LEVEL 8
+
+/** 32 bit right rotate - a macro so the multi-lane loops stay inlined */
+#define BLAKE3_ROT(X, S) (((X) >> (S)) | ((X) << (32 - (S))))
+
+/** Little endian 32 bit load - a macro so the multi-lane loops stay inlined */
+#define BLAKE3_LOAD(P) ((unsigned int) (P)[0] | ((unsigned int) (P)[1] << 8) | \
+		((unsigned int) (P)[2] << 16) | ((unsigned int) (P)[3] << 24))
+
+/** Quarter-round G function on one state - from the BLAKE3 paper */
+#define BLAKE3_G(V, A, B, C, D, X, Y) do { \
+		V[A] = V[A] + V[B] + (X); \
+		V[D] = BLAKE3_ROT(V[D] ^ V[A], 16); \
+		V[C] = V[C] + V[D]; \
+		V[B] = BLAKE3_ROT(V[B] ^ V[C], 12); \
+		V[A] = V[A] + V[B] + (Y); \
+		V[D] = BLAKE3_ROT(V[D] ^ V[A], 8); \
+		V[C] = V[C] + V[D]; \
+		V[B] = BLAKE3_ROT(V[B] ^ V[C], 7); \
+	} while (0)
+
+/** Quarter-round G function on every lane of a multi-lane state */
+#define BLAKE3_G_L(V, A, B, C, D, X, Y) do { \
+		for (l = 0; l < BLAKE3_LANES; l++) { \
+			V[A][l] = V[A][l] + V[B][l] + (X)[l]; \
+			V[D][l] = BLAKE3_ROT(V[D][l] ^ V[A][l], 16); \
+			V[C][l] = V[C][l] + V[D][l]; \
+			V[B][l] = BLAKE3_ROT(V[B][l] ^ V[C][l], 12); \
+			V[A][l] = V[A][l] + V[B][l] + (Y)[l]; \
+			V[D][l] = BLAKE3_ROT(V[D][l] ^ V[A][l], 8); \
+			V[C][l] = V[C][l] + V[D][l]; \
+			V[B][l] = BLAKE3_ROT(V[B][l] ^ V[C][l], 7); \
+		} \
+	} while (0)
+
+/*
+ * Build the multi-lane chunk function once per instruction set (SSE4.1,
+ *  AVX2, AVX-512) and pick the best at load time, where the toolchain
+ *  supports it (GCC/Clang on x86-64 ELF). The function is static, so the
+ *  clones and their resolver aren't exported from libhasher.
+ */
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__)
+#define BLAKE3_SIMD \
+	__attribute__((target_clones("avx512f", "avx2", "sse4.1", "default")))
+#else
+#define BLAKE3_SIMD
+#endif
+
+/** Initial values (shared with SHA256) - from the BLAKE3 paper */
+const unsigned int blake3_iv[8] = {
+		0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+		0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+/** Message word order for each of the 7 rounds (the permutation applied) */
+const unsigned char blake3_schedule[7][16] = {
+		{ 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+		{ 2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8},
+		{ 3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1},
+		{10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6},
+		{12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4},
+		{ 9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7},
+		{11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13}};
+
+extern char in_hash;
+
+/** Chaining value of the current chunk */
+unsigned int blake3_cv[8];
+/** Buffered (not yet compressed) block of the current chunk */
+unsigned char blake3_block[BLAKE3_BLOCK_LEN];
+/** Bytes in the buffered block */
+unsigned int blake3_block_len;
+/** Blocks of the current chunk already compressed */
+unsigned int blake3_blocks_done;
+/** Index of the current chunk */
+unsigned long long blake3_chunk_counter;
+/** Chaining values of completed subtrees, largest first */
+unsigned int blake3_cv_stack[BLAKE3_MAX_DEPTH][8];
+/** Number of chaining values in the stack */
+unsigned int blake3_cv_stack_len;
+/** Threads used for large inputs (0 - one per online processor) */
+unsigned int blake3_threads = 0;
+
+/** Work for one subtree thread */
+struct blake3_job {
+	/** Start of the first piece */
+	unsigned char *input;
+	/** Chunk index of the first piece */
+	unsigned long long counter;
+	/** Number of pieces */
+	unsigned long long pieces;
+	/** First piece for this thread (then every threads'th piece) */
+	unsigned long long first;
+	/** Number of threads sharing the pieces */
+	unsigned int threads;
+	/** Chaining value of each piece */
+	unsigned int (*cvs)[8];
+};
+
+void blake3_compress(unsigned int [], unsigned int [], unsigned long long,
+		unsigned int, unsigned int, unsigned int []);
+static void blake3_hash_chunks_lanes(unsigned char *[], unsigned long long,
+		unsigned int [][8]);
+void blake3_hash_chunks(unsigned char *, unsigned long long,
+		unsigned long long, unsigned int [][8]);
+void blake3_parent_cv(unsigned int [], unsigned int [], unsigned int []);
+void blake3_subtree_cv(unsigned char *, unsigned long long,
+		unsigned long long, unsigned int []);
+void blake3_push_cv(unsigned int [], unsigned int);
+void blake3_add_chunks_lanes(unsigned char *, unsigned long long);
+void blake3_add_whole_chunks(unsigned char *, unsigned long long);
+void blake3_update(unsigned char *, unsigned long long);
+
+/**
+ * Initialise BLAKE3 hashing
+ *
+ * @return 1 if BLAKE3 hashing was initialised (nothing else initialised),
+ *          else 0
+ */
+char blake3_init()
+{
+	/* Begin hashing if not currently hashing */
+	if (!in_hash) {
+		/* The first chunk starts from the initial values */
+		memcpy(blake3_cv, blake3_iv, sizeof(blake3_cv));
+
+		/* Initialise length and position variables */
+		blake3_block_len = 0;
+		blake3_blocks_done = 0;
+		blake3_chunk_counter = 0;
+		blake3_cv_stack_len = 0;
+
+		/* Now in hash */
+		in_hash = 1;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Set the number of threads used to hash large inputs
+ *
+ * @param threads Number of threads (0 - one per online processor)
+ */
+void blake3_set_threads(unsigned int threads)
+{
+	blake3_threads = threads;
+}
+
+/**
+ * Add a string into the current hash
+ *
+ * @param str Null terminated string
+ * @return 1 if the string was added, else 0
+ */
+char blake3_add_string(char *str)
+{
+	return blake3_add_bytes((unsigned char *) str, strlen(str));
+}
+
+/**
+ * Add an array of bytes into the current hash
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char blake3_add_bytes(unsigned char *bytes, unsigned int length)
+{
+	/* Ensure we're currently hashing */
+	if (in_hash) {
+		blake3_update(bytes, length);
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Add a file into the current hash
+ *
+ * Regular files are memory mapped and hashed in one go, so large files are
+ *  split across threads; anything else is read in large blocks.
+ *
+ * @param fp File pointer to the file to be read from
+ * @return 1 if the file's contents was added, else 0
+ */
+char blake3_add_file(FILE *fp)
+{
+	/* Ensure we're currently hashing */
+	if (in_hash) {
+		struct stat st;
+		off_t offset = ftello(fp);
+		unsigned char buffer[64 * BLAKE3_CHUNK_LEN], *bytes;
+		unsigned long long start;
+		size_t read_length;
+		struct sparse sparse;
+
+		if (offset >= 0 && fstat(fileno(fp), &st) == 0 &&
+				S_ISREG(st.st_mode) && st.st_size > offset) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+					fileno(fp), 0);
+
+			if (map != MAP_FAILED) {
+				madvise(map, st.st_size, MADV_SEQUENTIAL);
+				STATS_ADD(S_BYTES_MAPPED, st.st_size - offset);
+				start = stats_now();
+				blake3_update((unsigned char *) map + offset,
+						st.st_size - offset);
+				stats_hashed(start, st.st_size - offset);
+				munmap(map, st.st_size);
+				fseeko(fp, st.st_size, SEEK_SET);
+
+				return 1;
+			}
+		}
+
+		/* Not mappable - read it instead */
+		sparse_begin_file(&sparse, fp);
+		while ((read_length = sparse_read(&sparse, buffer, sizeof(buffer),
+				&bytes)) > 0) {
+			start = stats_now();
+			blake3_update(bytes, read_length);
+			stats_hashed(start, read_length);
+		}
+
+		return sparse_end(&sparse);
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Complete hashing and get a copy of the hash
+ *
+ * @param hash_out Array of at least 32 bytes
+ * @return 1 if the hash was copied, else 0
+ */
+char blake3_get_hash(unsigned char hash_out[])
+{
+	if (in_hash) {
+		unsigned int cv[8], block[16], out[16];
+		unsigned long long counter = blake3_chunk_counter;
+		unsigned int block_len = blake3_block_len;
+		unsigned int flags = BLAKE3_CHUNK_END;
+		unsigned int i;
+		int node;
+
+		/* The current chunk's last block, zero padded */
+		memset(blake3_block + blake3_block_len, 0,
+				BLAKE3_BLOCK_LEN - blake3_block_len);
+		for (i = 0; i < 16; i++)
+			block[i] = le_b_to_w(blake3_block + (i * 4));
+		memcpy(cv, blake3_cv, sizeof(cv));
+		if (blake3_blocks_done == 0)
+			flags |= BLAKE3_CHUNK_START;
+
+		/* Fold the chunk into each subtree on the stack, right to left */
+		for (node = blake3_cv_stack_len - 1; node >= 0; node--) {
+			blake3_compress(cv, block, counter, block_len, flags, out);
+
+			memcpy(block, blake3_cv_stack[node], 8 * sizeof(unsigned int));
+			memcpy(block + 8, out, 8 * sizeof(unsigned int));
+			memcpy(cv, blake3_iv, sizeof(cv));
+			counter = 0;
+			block_len = BLAKE3_BLOCK_LEN;
+			flags = BLAKE3_PARENT;
+		}
+
+		/* Whatever is left is the root */
+		blake3_compress(cv, block, counter, block_len, flags | BLAKE3_ROOT,
+				out);
+		for (i = 0; i < BLAKE3_OUT_LEN / 4; i++)
+			le_i_to_b(out[i], hash_out + (i * 4));
+
+		/* End hashing */
+		in_hash = 0;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Add input to the current hash
+ *
+ * A completed chunk is only folded in once more input arrives, so the last
+ *  chunk is always left for blake3_get_hash (it may be the root).
+ *
+ * @param input Bytes to add
+ * @param length Number of bytes
+ */
+void blake3_update(unsigned char *input, unsigned long long length)
+{
+	while (length > 0) {
+		unsigned int chunk_len =
+				(blake3_blocks_done * BLAKE3_BLOCK_LEN) + blake3_block_len;
+		unsigned int take;
+
+		if (chunk_len == BLAKE3_CHUNK_LEN) {
+			/* The current chunk is complete and more input follows */
+			unsigned int block[16], out[16];
+			unsigned int i, flags = BLAKE3_CHUNK_END;
+
+			for (i = 0; i < 16; i++)
+				block[i] = le_b_to_w(blake3_block + (i * 4));
+			blake3_compress(blake3_cv, block, blake3_chunk_counter,
+					BLAKE3_BLOCK_LEN, flags, out);
+
+			blake3_chunk_counter++;
+			blake3_push_cv(out, 0);
+
+			/* Start a new chunk */
+			memcpy(blake3_cv, blake3_iv, sizeof(blake3_cv));
+			blake3_block_len = 0;
+			blake3_blocks_done = 0;
+			chunk_len = 0;
+		}
+
+		if (chunk_len == 0 && length > BLAKE3_CHUNK_LEN) {
+			/* Whole chunks straight from the input, keeping at least a byte */
+			unsigned long long chunks = (length - 1) / BLAKE3_CHUNK_LEN;
+
+			blake3_add_whole_chunks(input, chunks);
+			input += chunks * BLAKE3_CHUNK_LEN;
+			length -= chunks * BLAKE3_CHUNK_LEN;
+			continue;
+		}
+
+		if (blake3_block_len == BLAKE3_BLOCK_LEN) {
+			/* The buffered block isn't the last one - compress it */
+			unsigned int block[16], out[16];
+			unsigned int i, flags = 0;
+
+			if (blake3_blocks_done == 0)
+				flags |= BLAKE3_CHUNK_START;
+			for (i = 0; i < 16; i++)
+				block[i] = le_b_to_w(blake3_block + (i * 4));
+			blake3_compress(blake3_cv, block, blake3_chunk_counter,
+					BLAKE3_BLOCK_LEN, flags, out);
+			memcpy(blake3_cv, out, sizeof(blake3_cv));
+
+			blake3_blocks_done++;
+			blake3_block_len = 0;
+		}
+
+		/* Buffer as much of the block as possible */
+		take = BLAKE3_BLOCK_LEN - blake3_block_len;
+		if (take > length)
+			take = length;
+		memcpy(blake3_block + blake3_block_len, input, take);
+		blake3_block_len += take;
+		input += take;
+		length -= take;
+	}
+}
+
+/**
+ * Push a completed subtree onto the chaining value stack
+ *
+ * The stack works like a binary counter of chunks: adding a subtree of
+ *  2^level chunks merges with the top of the stack for every carry.
+ *  blake3_chunk_counter must already include the subtree.
+ *
+ * @param cv Chaining value of the subtree
+ * @param level log2 of the number of chunks in the subtree
+ */
+void blake3_push_cv(unsigned int cv[], unsigned int level)
+{
+	unsigned long long total = blake3_chunk_counter >> level;
+	unsigned int merged[8];
+
+	memcpy(merged, cv, sizeof(merged));
+	while ((total & 1) == 0) {
+		blake3_cv_stack_len--;
+		blake3_parent_cv(blake3_cv_stack[blake3_cv_stack_len], merged,
+				merged);
+		total >>= 1;
+	}
+
+	memcpy(blake3_cv_stack[blake3_cv_stack_len], merged, sizeof(merged));
+	blake3_cv_stack_len++;
+}
+
+/**
+ * Subtree thread - hash every threads'th piece
+ *
+ * @param arg The thread's struct blake3_job
+ * @return NULL
+ */
+void *blake3_worker(void *arg)
+{
+	struct blake3_job *job = arg;
+	unsigned long long piece;
+
+	for (piece = job->first; piece < job->pieces; piece += job->threads) {
+		blake3_subtree_cv(
+				job->input + (piece * BLAKE3_PIECE_CHUNKS * BLAKE3_CHUNK_LEN),
+				BLAKE3_PIECE_CHUNKS,
+				job->counter + (piece * BLAKE3_PIECE_CHUNKS),
+				job->cvs[piece]);
+	}
+
+	return NULL;
+}
+
+/**
+ * Add whole chunks to the hash on this thread, BLAKE3_LANES at a time
+ *
+ * @param input Start of the chunks
+ * @param chunks Number of chunks (more input must follow them)
+ */
+void blake3_add_chunks_lanes(unsigned char *input, unsigned long long chunks)
+{
+	unsigned int cvs[BLAKE3_LANES][8];
+	unsigned long long batch, i;
+
+	while (chunks > 0) {
+		batch = chunks < BLAKE3_LANES ? chunks : BLAKE3_LANES;
+
+		blake3_hash_chunks(input, batch, blake3_chunk_counter, cvs);
+		for (i = 0; i < batch; i++) {
+			blake3_chunk_counter++;
+			blake3_push_cv(cvs[i], 0);
+		}
+
+		input += batch * BLAKE3_CHUNK_LEN;
+		chunks -= batch;
+	}
+}
+
+/**
+ * Add whole chunks to the hash, while no partial chunk is buffered
+ *
+ * When there are enough chunks, aligned pieces of BLAKE3_PIECE_CHUNKS are
+ *  hashed as subtrees on separate threads and pushed as single chaining
+ *  values; the rest go through the lanes on this thread.
+ *
+ * @param input Start of the chunks
+ * @param chunks Number of chunks (more input must follow them)
+ */
+void blake3_add_whole_chunks(unsigned char *input, unsigned long long chunks)
+{
+	unsigned int threads = blake3_threads;
+
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (unsigned int) online : 1;
+	}
+
+	if (threads > 1 && chunks >= 2 * BLAKE3_PIECE_CHUNKS) {
+		unsigned long long lead, pieces, i;
+		unsigned int (*piece_cvs)[8];
+		pthread_t *ids;
+		struct blake3_job *jobs;
+		unsigned int t, started;
+
+		/* Hash up to the next piece boundary first */
+		lead = (BLAKE3_PIECE_CHUNKS -
+				(blake3_chunk_counter % BLAKE3_PIECE_CHUNKS)) %
+				BLAKE3_PIECE_CHUNKS;
+		pieces = (chunks - lead) / BLAKE3_PIECE_CHUNKS;
+		if (threads > pieces)
+			threads = pieces;
+
+		piece_cvs = malloc(pieces * sizeof(*piece_cvs));
+		ids = malloc(threads * sizeof(*ids));
+		jobs = malloc(threads * sizeof(*jobs));
+
+		if (pieces > 0 && piece_cvs != NULL && ids != NULL && jobs != NULL) {
+			blake3_add_chunks_lanes(input, lead);
+			input += lead * BLAKE3_CHUNK_LEN;
+			chunks -= lead;
+
+			for (t = 0; t < threads; t++) {
+				jobs[t].input = input;
+				jobs[t].counter = blake3_chunk_counter;
+				jobs[t].pieces = pieces;
+				jobs[t].first = t;
+				jobs[t].threads = threads;
+				jobs[t].cvs = piece_cvs;
+			}
+
+			for (t = 1; t < threads; t++) {
+				if (pthread_create(&ids[t], NULL, blake3_worker, &jobs[t]))
+					break;
+			}
+			started = t;
+
+			/*
+			 * The calling thread takes the first share itself, and that of
+			 *  any thread that failed to start
+			 */
+			blake3_worker(&jobs[0]);
+			for (t = started; t < threads; t++)
+				blake3_worker(&jobs[t]);
+			for (t = 1; t < started; t++)
+				pthread_join(ids[t], NULL);
+
+			for (i = 0; i < pieces; i++) {
+				blake3_chunk_counter += BLAKE3_PIECE_CHUNKS;
+				blake3_push_cv(piece_cvs[i], BLAKE3_PIECE_LEVEL);
+			}
+			input += pieces * BLAKE3_PIECE_CHUNKS * BLAKE3_CHUNK_LEN;
+			chunks -= pieces * BLAKE3_PIECE_CHUNKS;
+		}
+
+		free(piece_cvs);
+		free(ids);
+		free(jobs);
+	}
+
+	blake3_add_chunks_lanes(input, chunks);
+}
+
+/**
+ * Compute the chaining value of a whole subtree
+ *
+ * @param input Start of the subtree's chunks
+ * @param chunks Number of chunks (a power of 2)
+ * @param counter Chunk index of the first chunk
+ * @param cv Array of 8 unsigned ints to store the chaining value
+ */
+void blake3_subtree_cv(unsigned char *input, unsigned long long chunks,
+		unsigned long long counter, unsigned int cv[])
+{
+	if (chunks <= BLAKE3_LANES) {
+		/* Compress the chunks together, then merge pairs up to one */
+		unsigned int cvs[BLAKE3_LANES][8];
+		unsigned long long i;
+
+		blake3_hash_chunks(input, chunks, counter, cvs);
+		while (chunks > 1) {
+			for (i = 0; i < chunks / 2; i++)
+				blake3_parent_cv(cvs[2 * i], cvs[(2 * i) + 1], cvs[i]);
+			chunks /= 2;
+		}
+
+		memcpy(cv, cvs[0], sizeof(cvs[0]));
+	} else {
+		unsigned int left[8], right[8];
+		unsigned long long half = chunks / 2;
+
+		blake3_subtree_cv(input, half, counter, left);
+		blake3_subtree_cv(input + (half * BLAKE3_CHUNK_LEN), half,
+				counter + half, right);
+		blake3_parent_cv(left, right, cv);
+	}
+}
+
+/**
+ * Compute the chaining value of a (non-root) parent node
+ *
+ * @param left Chaining value of the left child
+ * @param right Chaining value of the right child
+ * @param cv Array of 8 unsigned ints to store the chaining value
+ *            (may be either child)
+ */
+void blake3_parent_cv(unsigned int left[], unsigned int right[],
+		unsigned int cv[])
+{
+	unsigned int block[16], out[16];
+
+	memcpy(block, left, 8 * sizeof(unsigned int));
+	memcpy(block + 8, right, 8 * sizeof(unsigned int));
+	blake3_compress((unsigned int *) blake3_iv, block, 0, BLAKE3_BLOCK_LEN,
+			BLAKE3_PARENT, out);
+	memcpy(cv, out, 8 * sizeof(unsigned int));
+}
+
+/**
+ * Compress one block
+ *
+ * @param cv Input chaining value (8 words)
+ * @param block Block words (16 words)
+ * @param counter Chunk index (0 for parent nodes)
+ * @param block_len Number of bytes used in the block
+ * @param flags Domain flags
+ * @param out Array of 16 unsigned ints to store the output - the first 8 are
+ *             the new chaining value
+ */
+void blake3_compress(unsigned int cv[], unsigned int block[],
+		unsigned long long counter, unsigned int block_len,
+		unsigned int flags, unsigned int out[])
+{
+	unsigned int v[16];
+	const unsigned char *m;
+	int r, i;
+
+	STATS_ADD(S_BLAKE3_BLOCKS, 1);
+
+	for (i = 0; i < 8; i++)
+		v[i] = cv[i];
+	v[8] = blake3_iv[0];
+	v[9] = blake3_iv[1];
+	v[10] = blake3_iv[2];
+	v[11] = blake3_iv[3];
+	v[12] = (unsigned int) counter;
+	v[13] = (unsigned int) (counter >> 32);
+	v[14] = block_len;
+	v[15] = flags;
+
+	for (r = 0; r < 7; r++) {
+		m = blake3_schedule[r];
+
+		/* Columns */
+		BLAKE3_G(v, 0, 4,  8, 12, block[m[0]], block[m[1]]);
+		BLAKE3_G(v, 1, 5,  9, 13, block[m[2]], block[m[3]]);
+		BLAKE3_G(v, 2, 6, 10, 14, block[m[4]], block[m[5]]);
+		BLAKE3_G(v, 3, 7, 11, 15, block[m[6]], block[m[7]]);
+		/* Diagonals */
+		BLAKE3_G(v, 0, 5, 10, 15, block[m[8]], block[m[9]]);
+		BLAKE3_G(v, 1, 6, 11, 12, block[m[10]], block[m[11]]);
+		BLAKE3_G(v, 2, 7,  8, 13, block[m[12]], block[m[13]]);
+		BLAKE3_G(v, 3, 4,  9, 14, block[m[14]], block[m[15]]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+/**
+ * Hash up to BLAKE3_LANES whole chunks to their chaining values
+ *
+ * @param input Start of the chunks
+ * @param chunks Number of chunks (1 to BLAKE3_LANES)
+ * @param counter Chunk index of the first chunk
+ * @param cvs Array to store the chaining value of each chunk
+ */
+void blake3_hash_chunks(unsigned char *input, unsigned long long chunks,
+		unsigned long long counter, unsigned int cvs[][8])
+{
+	unsigned char *inputs[BLAKE3_LANES];
+	unsigned int lane_cvs[BLAKE3_LANES][8];
+	unsigned int l;
+
+	/* Spare lanes repeat the first chunk and are thrown away */
+	for (l = 0; l < BLAKE3_LANES; l++)
+		inputs[l] = input + ((l < chunks ? l : 0) * BLAKE3_CHUNK_LEN);
+
+	blake3_hash_chunks_lanes(inputs, counter, lane_cvs);
+	memcpy(cvs, lane_cvs, chunks * sizeof(lane_cvs[0]));
+}
+
+/**
+ * Hash BLAKE3_LANES whole chunks at once
+ *
+ * Every block of every chunk is compressed in lock-step, one state per
+ *  lane, so the inner loops vectorise across the lanes.
+ *
+ * @param inputs Start of each chunk
+ * @param counter Chunk index of the first chunk (the rest follow on)
+ * @param cvs Array to store the chaining value of each chunk
+ */
+BLAKE3_SIMD
+static void blake3_hash_chunks_lanes(unsigned char *inputs[],
+		unsigned long long counter, unsigned int cvs[][8])
+{
+	unsigned int v[16][BLAKE3_LANES], m[16][BLAKE3_LANES];
+	unsigned int cv[8][BLAKE3_LANES];
+	const unsigned char *s;
+	unsigned int b, i, l, flags;
+	int r;
+
+	STATS_ADD(S_BLAKE3_BLOCKS, BLAKE3_LANES *
+			(BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN));
+
+	for (i = 0; i < 8; i++)
+		for (l = 0; l < BLAKE3_LANES; l++)
+			cv[i][l] = blake3_iv[i];
+
+	for (b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+		flags = 0;
+		if (b == 0)
+			flags |= BLAKE3_CHUNK_START;
+		if (b == (BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN) - 1)
+			flags |= BLAKE3_CHUNK_END;
+
+		/* Load the block of each lane and set up the states */
+		for (i = 0; i < 16; i++)
+			for (l = 0; l < BLAKE3_LANES; l++)
+				m[i][l] = BLAKE3_LOAD(inputs[l] + (b * BLAKE3_BLOCK_LEN) +
+						(i * 4));
+		for (l = 0; l < BLAKE3_LANES; l++) {
+			for (i = 0; i < 8; i++)
+				v[i][l] = cv[i][l];
+			v[8][l] = blake3_iv[0];
+			v[9][l] = blake3_iv[1];
+			v[10][l] = blake3_iv[2];
+			v[11][l] = blake3_iv[3];
+			v[12][l] = (unsigned int) (counter + l);
+			v[13][l] = (unsigned int) ((counter + l) >> 32);
+			v[14][l] = BLAKE3_BLOCK_LEN;
+			v[15][l] = flags;
+		}
+
+		for (r = 0; r < 7; r++) {
+			s = blake3_schedule[r];
+
+			/* Columns */
+			BLAKE3_G_L(v, 0, 4,  8, 12, m[s[0]], m[s[1]]);
+			BLAKE3_G_L(v, 1, 5,  9, 13, m[s[2]], m[s[3]]);
+			BLAKE3_G_L(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+			BLAKE3_G_L(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+			/* Diagonals */
+			BLAKE3_G_L(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+			BLAKE3_G_L(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+			BLAKE3_G_L(v, 2, 7,  8, 13, m[s[12]], m[s[13]]);
+			BLAKE3_G_L(v, 3, 4,  9, 14, m[s[14]], m[s[15]]);
+		}
+
+		for (i = 0; i < 8; i++)
+			for (l = 0; l < BLAKE3_LANES; l++)
+				cv[i][l] = v[i][l] ^ v[i + 8][l];
+	}
+
+	for (l = 0; l < BLAKE3_LANES; l++)
+		for (i = 0; i < 8; i++)
+			cvs[l][i] = cv[i][l];
+}
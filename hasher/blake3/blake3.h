@@ -0,0 +1,36 @@
+/**
+ * @file blake3.h
+ * Header for blake3.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BLAKE3_H_
+#define BLAKE3_H_
+
+/** Number of chunks compressed together by the multi-lane chunk function */
+#define BLAKE3_LANES 8
+
+char blake3_init();
+char blake3_add_string(char *);
+char blake3_add_bytes(unsigned char *, unsigned int);
+char blake3_add_file(FILE *);
+char blake3_get_hash(unsigned char []);
+void blake3_set_threads(unsigned int);
+
+#endif /* BLAKE3_H_ */
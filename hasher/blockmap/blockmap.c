@@ -0,0 +1,456 @@
+/**
+ * @file blockmap.c
+ * Fixed-size block hashing of files and block devices, and maps of the
+ *  block digests for finding changed regions
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../global.h"
+#include "../hash.h"
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "blockmap.h"
+
+/** A share of the blocks of a file, for one thread */
+struct blockmap_job {
+	/** File descriptor read from */
+	int fd;
+	/** The map being filled in */
+	struct blockmap *map;
+	/** First block of the share */
+	unsigned long long first;
+	/** Blocks between those of the share */
+	unsigned long long stride;
+	/** 1 if every block of the share was hashed, else 0 */
+	char ok;
+};
+
+/**
+ * Parse a block size, with an optional k, m or g (binary) suffix
+ *
+ * @param arg Size, e.g. 4m
+ * @param size Number of bytes
+ * @return 1 if the size is from 1 byte to BLOCKMAP_MAX_BLOCK, else 0
+ */
+char blockmap_parse_size(char *arg, unsigned long long *size)
+{
+	char *end;
+	unsigned int shift = 0;
+
+	*size = strtoull(arg, &end, 10);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		end++;
+		break;
+	}
+
+	/* Check before shifting, so high bits can't be shifted out */
+	if (*size > (BLOCKMAP_MAX_BLOCK >> shift))
+		return 0;
+	*size <<= shift;
+
+	return end != arg && *end == '\0' && *size > 0 &&
+			*size <= BLOCKMAP_MAX_BLOCK;
+}
+
+/**
+ * Get the rsync-style rolling checksum of some bytes
+ *
+ * The low 16 bits are the sum of the bytes and the high 16 bits the sum of
+ *  each byte times its distance from the end, so the checksum of a window
+ *  one byte further on can be had from this one (see delta.c).
+ *
+ * @param bytes Bytes
+ * @param length Number of bytes
+ * @return Checksum
+ */
+unsigned int blockmap_weak(const unsigned char *bytes, size_t length)
+{
+	unsigned int a = 0, b = 0;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		a += bytes[i];
+		b += a;
+	}
+
+	return (a & 0xffff) | (b << 16);
+}
+
+/**
+ * Read a whole block, however many reads that takes
+ *
+ * @param fd File descriptor
+ * @param buffer Where to read to
+ * @param length Number of bytes to read
+ * @param offset Offset in the file
+ * @return 1 if every byte was read, else 0
+ */
+char blockmap_pread(int fd, unsigned char *buffer, size_t length,
+		unsigned long long offset)
+{
+	unsigned long long start;
+	ssize_t got;
+
+	while (length > 0) {
+		start = stats_now();
+		HASHER_PROBE1(read__start, length);
+		got = pread(fd, buffer, length, (off_t) offset);
+		HASHER_PROBE1(read__done, got < 0 ? 0 : got);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return 0;
+		stats_read(start, got);
+		buffer += got;
+		length -= got;
+		offset += got;
+	}
+
+	return 1;
+}
+
+/**
+ * Hash a share of the blocks of a file
+ *
+ * @param arg The job
+ * @return NULL
+ */
+void *blockmap_worker(void *arg)
+{
+	struct blockmap_job *job = arg;
+	struct blockmap *map = job->map;
+	unsigned int size = hash_digest_size(map->type);
+	unsigned long long b, offset, length;
+	unsigned char *buffer = malloc(map->block_size);
+
+	job->ok = buffer != NULL;
+
+	for (b = job->first; job->ok && b < map->count; b += job->stride) {
+		offset = b * map->block_size;
+		length = map->file_size - offset < map->block_size ?
+				map->file_size - offset : map->block_size;
+
+		job->ok = blockmap_pread(job->fd, buffer, length, offset) &&
+				hash_oneshot(map->type, buffer, length,
+						map->digests + (b * size));
+		map->weak[b] = blockmap_weak(buffer, length);
+	}
+
+	free(buffer);
+
+	return NULL;
+}
+
+/**
+ * Hash each block of a file or block device
+ *
+ * Thread t hashes blocks t, t + threads, ... reading each with pread, so
+ *  the threads share the file descriptor without seeking. Hash types whose
+ *  one-shot hashing uses the hash globals are hashed on the calling thread.
+ *
+ * @param fd File descriptor, open for reading
+ * @param type The hash type
+ * @param block_size Bytes in each block
+ * @param threads Number of threads, or 0 for one per online processor
+ * @param map Map to be filled in (free with blockmap_free)
+ * @return 1 if every block was hashed, else 0
+ */
+char blockmap_build(int fd, enum hash_t type, unsigned long long block_size,
+		unsigned int threads, struct blockmap *map)
+{
+	struct blockmap_job *jobs;
+	pthread_t *ids;
+	off_t end;
+	unsigned int t, started;
+	char ok = 1;
+
+	/* Block devices have no size in stat, but can seek to their end */
+	end = lseek(fd, 0, SEEK_END);
+	if (end < 0 || block_size == 0)
+		return 0;
+
+	map->type = type;
+	map->block_size = block_size;
+	map->file_size = (unsigned long long) end;
+	map->count = (map->file_size + block_size - 1) / block_size;
+	map->digests = malloc(map->count * hash_digest_size(type) + 1);
+	map->weak = malloc((map->count + 1) * sizeof(unsigned int));
+	if (map->digests == NULL || map->weak == NULL) {
+		blockmap_free(map);
+		return 0;
+	}
+
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (unsigned int) online : 1;
+	}
+	if (!hash_reentrant(type))
+		threads = 1;
+	if (threads > map->count)
+		threads = map->count > 0 ? map->count : 1;
+
+	jobs = malloc(threads * sizeof(*jobs));
+	ids = malloc(threads * sizeof(*ids));
+	if (jobs == NULL || ids == NULL) {
+		free(jobs);
+		free(ids);
+		blockmap_free(map);
+		return 0;
+	}
+
+	for (t = 0; t < threads; t++) {
+		jobs[t].fd = fd;
+		jobs[t].map = map;
+		jobs[t].first = t;
+		jobs[t].stride = threads;
+	}
+
+	for (t = 1; t < threads; t++) {
+		if (pthread_create(&ids[t], NULL, blockmap_worker, &jobs[t]))
+			break;
+	}
+	started = t;
+
+	/* As with BLAKE3, the calling thread takes any share not started */
+	blockmap_worker(&jobs[0]);
+	for (t = started; t < threads; t++)
+		blockmap_worker(&jobs[t]);
+	for (t = 1; t < started; t++)
+		pthread_join(ids[t], NULL);
+
+	for (t = 0; t < threads; t++)
+		if (!jobs[t].ok)
+			ok = 0;
+
+	free(jobs);
+	free(ids);
+	if (!ok)
+		blockmap_free(map);
+
+	return ok;
+}
+
+/**
+ * Write a block map
+ *
+ * @param fp File pointer to write to
+ * @param map The map
+ * @return 1 if the whole map was written, else 0
+ */
+char blockmap_write(FILE *fp, const struct blockmap *map)
+{
+	unsigned char header[BLOCKMAP_HEADER_SIZE], weak[4];
+	size_t length = map->count * hash_digest_size(map->type);
+	unsigned long long b;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, BLOCKMAP_MAGIC, 4);
+	header[4] = (unsigned char) map->type;
+	header[5] = (unsigned char) hash_digest_size(map->type);
+	header[6] = map->weak != NULL ? BLOCKMAP_WEAK : 0;
+	be_ll_to_b(map->block_size, header + 8);
+	be_ll_to_b(map->file_size, header + 16);
+	be_ll_to_b(map->count, header + 24);
+
+	if (fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+			fwrite(map->digests, 1, length, fp) != length)
+		return 0;
+
+	for (b = 0; map->weak != NULL && b < map->count; b++) {
+		be_i_to_b(map->weak[b], weak);
+		if (fwrite(weak, 1, 4, fp) != 4)
+			return 0;
+	}
+
+	return fflush(fp) == 0;
+}
+
+/**
+ * Read a block map
+ *
+ * @param fp File pointer to read from
+ * @param map Map to be filled in (free with blockmap_free)
+ * @return 1 if a whole, consistent map was read, else 0
+ */
+char blockmap_read(FILE *fp, struct blockmap *map)
+{
+	unsigned char header[BLOCKMAP_HEADER_SIZE], weak[4];
+	unsigned long long b, left;
+	size_t length;
+	struct stat st;
+
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+			memcmp(header, BLOCKMAP_MAGIC, 4) != 0 ||
+			header[4] > H_SHA256D ||
+			header[5] != hash_digest_size((enum hash_t) header[4]))
+		return 0;
+
+	map->type = (enum hash_t) header[4];
+	map->block_size = be_ll_b_to_w(header + 8);
+	map->file_size = be_ll_b_to_w(header + 16);
+	map->count = be_ll_b_to_w(header + 24);
+
+	if (map->block_size == 0 || map->block_size > BLOCKMAP_MAX_BLOCK ||
+			map->count != (map->file_size + map->block_size - 1) /
+					map->block_size)
+		return 0;
+
+	/* The digests must fit in memory and in the rest of the file */
+	left = fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) ?
+			(unsigned long long) st.st_size - sizeof(header) : ULLONG_MAX;
+	if (map->count > (SIZE_MAX - 1) / header[5])
+		return 0;
+	length = map->count * header[5];
+	if (length > left)
+		return 0;
+
+	map->digests = malloc(length + 1);
+	map->weak = NULL;
+	if (map->digests == NULL)
+		return 0;
+	if (fread(map->digests, 1, length, fp) != length) {
+		blockmap_free(map);
+		return 0;
+	}
+
+	if (header[6] & BLOCKMAP_WEAK) {
+		/* As must the weak checksums, 4 bytes each */
+		if (map->count > (SIZE_MAX / sizeof(unsigned int)) - 1 ||
+				map->count * 4 > left - length) {
+			blockmap_free(map);
+			return 0;
+		}
+		map->weak = malloc((map->count + 1) * sizeof(unsigned int));
+		if (map->weak == NULL) {
+			blockmap_free(map);
+			return 0;
+		}
+		for (b = 0; b < map->count; b++) {
+			if (fread(weak, 1, 4, fp) != 4) {
+				blockmap_free(map);
+				return 0;
+			}
+			map->weak[b] = be_i_b_to_w(weak);
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Free the digests of a block map
+ *
+ * @param map The map
+ */
+void blockmap_free(struct blockmap *map)
+{
+	free(map->digests);
+	free(map->weak);
+	map->digests = NULL;
+	map->weak = NULL;
+	map->count = 0;
+}
+
+/**
+ * Find the regions of a file that changed between two block maps
+ *
+ * A block of the new file has changed if the old file had no such block,
+ *  or it had a different length or digest. Runs of changed blocks are
+ *  given as one region. A file that only lost blocks from its end has no
+ *  changed regions, but is still reported as changed.
+ *
+ * @param old Map of the file before
+ * @param new Map of the file after
+ * @param region Called with each changed region of the new file
+ * @param changed Set to 1 if the files differ, else 0
+ * @return 1 if the maps could be compared (same hash type and block size),
+ *          else 0
+ */
+char blockmap_compare(const struct blockmap *old, const struct blockmap *new,
+		blockmap_region_t region, char *changed)
+{
+	unsigned int size = hash_digest_size(new->type);
+	unsigned long long b, start = 0, old_length, new_length;
+	char in_region = 0, differs;
+
+	if (old->type != new->type || old->block_size != new->block_size)
+		return 0;
+
+	*changed = old->file_size != new->file_size;
+
+	for (b = 0; b <= new->count; b++) {
+		differs = 0;
+		if (b < new->count) {
+			new_length = new->file_size - (b * new->block_size);
+			if (new_length > new->block_size)
+				new_length = new->block_size;
+			old_length = 0;
+			if (b < old->count) {
+				old_length = old->file_size - (b * old->block_size);
+				if (old_length > old->block_size)
+					old_length = old->block_size;
+			}
+
+			differs = old_length != new_length ||
+					memcmp(old->digests + (b * size),
+							new->digests + (b * size), size) != 0;
+		}
+
+		if (differs && !in_region) {
+			start = b;
+			in_region = 1;
+		} else if (!differs && in_region) {
+			/* The region ends at this block, or the end of the file */
+			new_length = b * new->block_size;
+			if (new_length > new->file_size)
+				new_length = new->file_size;
+			if (!region(start * new->block_size,
+					new_length - (start * new->block_size)))
+				return 0;
+			in_region = 0;
+			*changed = 1;
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file blockmap.h
+ * Header for blockmap.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BLOCKMAP_H_
+#define BLOCKMAP_H_
+
+/** Identifies a block map file */
+#define BLOCKMAP_MAGIC "HBM1"
+/** Bytes in a block map header */
+#define BLOCKMAP_HEADER_SIZE 32
+/** Header flag - rolling checksums follow the digests */
+#define BLOCKMAP_WEAK 0x01
+/** Largest block size allowed (each thread holds a block) */
+#define BLOCKMAP_MAX_BLOCK (1ULL << 30)
+
+/**
+ * Digests of the fixed-size blocks of a file
+ *
+ * On disk, the header is BLOCKMAP_MAGIC, the hash type, digest size and
+ *  flags as single bytes, a zero byte, then the block size, file size and
+ *  block count as big endian 64 bit numbers. The digests follow, packed in
+ *  block order, then (with BLOCKMAP_WEAK) the rolling checksum of each
+ *  block as a big endian 32 bit number.
+ */
+struct blockmap {
+	/** Hash type of the digests */
+	enum hash_t type;
+	/** Bytes in each block (the last may be shorter) */
+	unsigned long long block_size;
+	/** Bytes in the file */
+	unsigned long long file_size;
+	/** Number of blocks */
+	unsigned long long count;
+	/** count * hash_digest_size() digest bytes */
+	unsigned char *digests;
+	/** Rolling checksum of each block (from blockmap_weak), or NULL */
+	unsigned int *weak;
+};
+
+/** Called with the offset and length of each changed region, in order */
+typedef char (*blockmap_region_t)(unsigned long long, unsigned long long);
+
+char blockmap_parse_size(char *, unsigned long long *);
+unsigned int blockmap_weak(const unsigned char *, size_t);
+char blockmap_pread(int, unsigned char *, size_t, unsigned long long);
+
+char blockmap_build(int, enum hash_t, unsigned long long, unsigned int,
+		struct blockmap *);
+char blockmap_write(FILE *, const struct blockmap *);
+char blockmap_read(FILE *, struct blockmap *);
+void blockmap_free(struct blockmap *);
+
+char blockmap_compare(const struct blockmap *, const struct blockmap *,
+		blockmap_region_t, char *);
+
+#endif /* BLOCKMAP_H_ */
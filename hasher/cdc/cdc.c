@@ -0,0 +1,437 @@
+/**
+ * @file cdc.c
+ * Content-defined chunking (FastCDC) of files, with a digest of each
+ *  chunk for deduplication
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../hash.h"
+#include "../many/many.h"
+#include "../stats/stats.h"
+#include "cdc.h"
+
+/** A buffer of file data and the chunks cut from it */
+struct cdc_batch {
+	/** File data, led by up to CDC_WINDOW bytes of history */
+	unsigned char *data;
+	/** Chunks in the buffer */
+	const void **msgs;
+	/** Number of bytes in each chunk */
+	size_t *lengths;
+	/** File offset of each chunk */
+	unsigned long long *offsets;
+	/** Digest of each chunk */
+	unsigned char *digests;
+	/** Number of chunks */
+	size_t count;
+	/** Hash type of the digests */
+	enum hash_t type;
+	/** Where the records go */
+	cdc_record_t record;
+	/** 1 if every chunk was hashed and recorded, else 0 */
+	char ok;
+};
+
+/**
+ * Random values for each byte, added into the gear hash - from a splitmix64
+ *  sequence, so chunk boundaries never change between versions
+ */
+unsigned long long cdc_gear[256];
+
+/**
+ * Fill in the gear table, if it isn't already
+ */
+void cdc_gear_init()
+{
+	unsigned long long seed = 0, z;
+	int i;
+
+	if (cdc_gear[0] != 0)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		seed += 0x9e3779b97f4a7c15ULL;
+		z = seed;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		cdc_gear[i] = z ^ (z >> 31);
+	}
+}
+
+/**
+ * Set up chunk size limits
+ *
+ * The boundary masks take the top bits of the gear hash, as the low bits
+ *  only depend on the last few bytes. Below the average size the mask has
+ *  two bits more than the average size, and from there on two bits fewer
+ *  (FastCDC's normalised chunking), so chunk sizes bunch around the average.
+ *
+ * @param params Limits to be filled in
+ * @param min Smallest chunk (at least CDC_WINDOW)
+ * @param avg Average chunk
+ * @param max Largest chunk (at most CDC_MAX_LIMIT)
+ * @return 1 if the limits are usable, else 0
+ */
+char cdc_params_init(struct cdc_params *params, size_t min, size_t avg,
+		size_t max)
+{
+	unsigned int bits = 0;
+
+	if (min < CDC_WINDOW || min > avg || avg > max || max > CDC_MAX_LIMIT)
+		return 0;
+
+	while ((2UL << bits) <= avg)
+		bits++;
+
+	params->min = min;
+	params->avg = avg;
+	params->max = max;
+	params->mask_s = ~0ULL << (64 - (bits + 2));
+	params->mask_l = ~0ULL << (64 - (bits - 2));
+
+	cdc_gear_init();
+
+	return 1;
+}
+
+/**
+ * Set up chunk size limits from a command line argument
+ *
+ * @param arg min:avg:max in bytes, or just avg (then min is avg / 4 and max
+ *             is avg * 8)
+ * @param params Limits to be filled in
+ * @return 1 if the argument is usable, else 0
+ */
+char cdc_params_parse(char *arg, struct cdc_params *params)
+{
+	unsigned long min, avg, max;
+	char *end;
+
+	min = strtoul(arg, &end, 10);
+	if (*end == '\0')
+		return cdc_params_init(params, min / 4, min, min * 8);
+
+	if (*end != ':')
+		return 0;
+	avg = strtoul(end + 1, &end, 10);
+	if (*end != ':')
+		return 0;
+	max = strtoul(end + 1, &end, 10);
+	if (*end != '\0')
+		return 0;
+
+	return cdc_params_init(params, min, avg, max);
+}
+
+/**
+ * Add one byte into a gear hash, marking the position if it matches
+ *
+ * Matches are rare, and mask_l's bits are a subset of mask_s's, so mask_s is
+ *  only tried where mask_l matches.
+ */
+#define CDC_STEP(H, P) do { \
+		(H) = ((H) << 1) + cdc_gear[data[P]]; \
+		if (((H) & mask_l) == 0) { \
+			bits_l[((P) - start) / 64] |= 1ULL << (((P) - start) % 64); \
+			if (((H) & mask_s) == 0) \
+				bits_s[((P) - start) / 64] |= 1ULL << (((P) - start) % 64); \
+		} \
+	} while (0)
+
+/**
+ * Get the gear hash of the bytes before a position
+ *
+ * @param data Data
+ * @param p Position
+ * @return Hash of the CDC_WINDOW - 1 bytes before p (fewer at the start)
+ */
+unsigned long long cdc_warm(const unsigned char *data, size_t p)
+{
+	unsigned long long h = 0;
+	size_t i;
+
+	for (i = p >= CDC_WINDOW - 1 ? p - (CDC_WINDOW - 1) : 0; i < p; i++)
+		h = (h << 1) + cdc_gear[data[i]];
+
+	return h;
+}
+
+/**
+ * Mark the boundary candidates in a stretch of data
+ *
+ * The gear hash at a position only depends on the CDC_WINDOW bytes up to
+ *  it, so the stretch is split into CDC_LANES segments which are hashed side
+ *  by side, each starting CDC_WINDOW bytes early. The lanes are independent
+ *  chains the processor can overlap, instead of one byte after another.
+ *
+ * @param params Chunk size limits
+ * @param data Data, with at least CDC_WINDOW bytes before start unless data
+ *              is the start of the file
+ * @param start Position of the first byte to be marked
+ * @param end Position after the last byte to be marked
+ * @param bits_s Bit (p - start) set where mask_s matches, (end - start) / 64
+ *                + 1 words
+ * @param bits_l Bit (p - start) set where mask_l matches, as bits_s
+ */
+void cdc_scan(const struct cdc_params *params, const unsigned char *data,
+		size_t start, size_t end, unsigned long long bits_s[],
+		unsigned long long bits_l[])
+{
+	unsigned long long mask_s = params->mask_s, mask_l = params->mask_l;
+	unsigned long long h0, h1, h2, h3;
+	size_t segment = (end - start) / CDC_LANES, j, p;
+
+	memset(bits_s, 0, (((end - start) / 64) + 1) * sizeof(unsigned long long));
+	memset(bits_l, 0, (((end - start) / 64) + 1) * sizeof(unsigned long long));
+
+	/* Kept in registers - the lanes are written out */
+	h0 = cdc_warm(data, start);
+	h1 = cdc_warm(data, start + segment);
+	h2 = cdc_warm(data, start + (2 * segment));
+	h3 = cdc_warm(data, start + (3 * segment));
+
+	for (j = start; j < start + segment; j++) {
+		CDC_STEP(h0, j);
+		CDC_STEP(h1, j + segment);
+		CDC_STEP(h2, j + (2 * segment));
+		CDC_STEP(h3, j + (3 * segment));
+	}
+
+	/* The rest carries on from the last lane */
+	for (p = start + (CDC_LANES * segment); p < end; p++)
+		CDC_STEP(h3, p);
+}
+
+/**
+ * Find the first set bit in a range of a bitmap
+ *
+ * @param bits Bitmap
+ * @param from First bit to look at
+ * @param to Bit after the last to look at
+ * @return Index of the bit, or to if none is set
+ */
+size_t cdc_find(const unsigned long long bits[], size_t from, size_t to)
+{
+	unsigned long long word;
+	size_t i;
+
+	if (from >= to)
+		return to;
+
+	word = bits[from / 64] & (~0ULL << (from % 64));
+	for (i = from / 64; ; word = bits[++i]) {
+		if (word != 0) {
+			i = (i * 64) + __builtin_ctzll(word);
+			return i < to ? i : to;
+		}
+		if ((i + 1) * 64 >= to)
+			return to;
+	}
+}
+
+/**
+ * Find where the chunk starting at a position ends
+ *
+ * @param params Chunk size limits
+ * @param bits_s Marks from cdc_scan
+ * @param bits_l Marks from cdc_scan
+ * @param start Position of the chunk, relative to the marks
+ * @param end Position after the last marked byte
+ * @param last 1 if the data ends at end, else 0
+ * @return Length of the chunk, or 0 if more data is needed to tell
+ */
+size_t cdc_cut(const struct cdc_params *params, const unsigned long long bits_s[],
+		const unsigned long long bits_l[], size_t start, size_t end, char last)
+{
+	size_t normal = start + params->avg - 1, limit = start + params->max - 1;
+	size_t p;
+
+	/* Too short for a boundary */
+	if (end - start <= params->min)
+		return last ? end - start : 0;
+
+	/* Cut after the byte where the hash matches, harder then easier */
+	p = cdc_find(bits_s, start + params->min - 1, normal < end ? normal : end);
+	if (p < end && p < normal)
+		return p - start + 1;
+	if (normal < end) {
+		p = cdc_find(bits_l, normal, limit < end ? limit : end);
+		if (p < end && p < limit)
+			return p - start + 1;
+	}
+
+	if (limit < end)
+		return params->max;
+
+	return last ? end - start : 0;
+}
+
+/**
+ * Hash and record the chunks of a batch
+ *
+ * @param arg The batch
+ * @return NULL
+ */
+void *cdc_worker(void *arg)
+{
+	struct cdc_batch *batch = arg;
+	unsigned int size = hash_digest_size(batch->type);
+	size_t c;
+
+	batch->ok = hash_many(batch->type, batch->msgs, batch->lengths,
+			batch->count, batch->digests);
+
+	for (c = 0; batch->ok && c < batch->count; c++)
+		batch->ok = batch->record(batch->offsets[c], batch->lengths[c],
+				batch->digests + (c * size));
+
+	return NULL;
+}
+
+/**
+ * Split a file into content-defined chunks and hash each one
+ *
+ * The file is read once, into two buffers in turn. While the chunks cut
+ *  from one buffer are hashed (SHA2 chunks going through the multi-lane
+ *  compression) and recorded on a worker thread, the next buffer is read
+ *  and scanned for boundaries. The chunk that runs off the end of a buffer
+ *  is carried over to the start of the next.
+ *
+ * @param fp File pointer to the file to be read from
+ * @param params Chunk size limits
+ * @param type The hash type
+ * @param record Called with each chunk's offset, length and digest
+ * @return 1 if the whole file was chunked and recorded, else 0
+ */
+char cdc_file(FILE *fp, const struct cdc_params *params, enum hash_t type,
+		cdc_record_t record)
+{
+	struct cdc_batch batches[2], *batch, *next;
+	size_t capacity = params->max * 2 > CDC_BUFFER_SIZE ?
+			params->max * 2 : CDC_BUFFER_SIZE;
+	/* Chunks in up to CDC_WINDOW + capacity bytes, and a short last one */
+	size_t most = ((CDC_WINDOW + capacity) / params->min) + 2;
+	unsigned long long *bits_s, *bits_l, offset = 0;
+	size_t history = 0, carry = 0, end, start, cut, got;
+	pthread_t worker;
+	char running = 0, ok = 1, last = 0;
+	int b;
+
+	/* Marks for up to CDC_WINDOW + capacity bytes */
+	bits_s = malloc(((capacity / 64) + 2) * sizeof(unsigned long long));
+	bits_l = malloc(((capacity / 64) + 2) * sizeof(unsigned long long));
+	for (b = 0; b < 2; b++) {
+		batches[b].data = malloc(CDC_WINDOW + capacity);
+		batches[b].msgs = malloc(most * sizeof(void *));
+		batches[b].lengths = malloc(most * sizeof(size_t));
+		batches[b].offsets = malloc(most * sizeof(unsigned long long));
+		batches[b].digests = malloc(most * hash_digest_size(type));
+		batches[b].type = type;
+		batches[b].record = record;
+		batches[b].ok = 1;
+		if (batches[b].data == NULL || batches[b].msgs == NULL ||
+				batches[b].lengths == NULL || batches[b].offsets == NULL ||
+				batches[b].digests == NULL)
+			ok = 0;
+	}
+	if (bits_s == NULL || bits_l == NULL)
+		ok = 0;
+
+	batch = &batches[0];
+	while (ok && !last) {
+		/* Fill up behind the history and the carried chunk */
+		end = history + carry;
+		got = stats_fread(batch->data + end, CDC_WINDOW + capacity - end,
+				fp);
+		end += got;
+		if (got < CDC_WINDOW + capacity - (history + carry)) {
+			if (ferror(fp)) {
+				ok = 0;
+				break;
+			}
+			last = 1;
+		}
+
+		cdc_scan(params, batch->data, history, end, bits_s, bits_l);
+
+		batch->count = 0;
+		for (start = history; start < end; start += cut) {
+			cut = cdc_cut(params, bits_s, bits_l, start - history,
+					end - history, last);
+			if (cut == 0)
+				break;
+			batch->msgs[batch->count] = batch->data + start;
+			batch->lengths[batch->count] = cut;
+			batch->offsets[batch->count] = offset + (start - history);
+			batch->count++;
+		}
+
+		/* The last batch must be recorded before this one */
+		if (running) {
+			pthread_join(worker, NULL);
+			running = 0;
+			if (!batches[0].ok || !batches[1].ok)
+				ok = 0;
+		}
+		if (!ok)
+			break;
+
+		batch->ok = 1;
+		if (batch->count > 0) {
+			if (pthread_create(&worker, NULL, cdc_worker, batch))
+				cdc_worker(batch);
+			else
+				running = 1;
+		}
+
+		/* Carry the unfinished chunk and its history into the other buffer */
+		next = batch == &batches[0] ? &batches[1] : &batches[0];
+		offset += start - history;
+		history = start < CDC_WINDOW ? start : CDC_WINDOW;
+		carry = end - start;
+		memcpy(next->data, batch->data + start - history, history + carry);
+		batch = next;
+	}
+
+	if (running) {
+		pthread_join(worker, NULL);
+		if (!batches[0].ok || !batches[1].ok)
+			ok = 0;
+	}
+
+	for (b = 0; b < 2; b++) {
+		free(batches[b].data);
+		free(batches[b].msgs);
+		free(batches[b].lengths);
+		free(batches[b].offsets);
+		free(batches[b].digests);
+	}
+	free(bits_s);
+	free(bits_l);
+
+	return ok;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file cdc.h
+ * Header for cdc.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CDC_H_
+#define CDC_H_
+
+/** Default average chunk size, in bytes (minimum a quarter, maximum 8x) */
+#define CDC_AVG_DEFAULT 8192
+/** Bytes of data the gear hash at a position depends on */
+#define CDC_WINDOW 64
+/** Largest maximum chunk size allowed */
+#define CDC_MAX_LIMIT (16UL << 20)
+/** Bytes read into each buffer at a time, if more than twice the maximum */
+#define CDC_BUFFER_SIZE (4UL << 20)
+/** Number of segments of a buffer the boundary scanner runs side by side
+ *  (its loop is written out for four) */
+#define CDC_LANES 4
+
+/** Chunk size limits and the boundary masks they give */
+struct cdc_params {
+	/** Smallest chunk, other than the last one */
+	size_t min;
+	/** Chunk size from which the easier mask is used */
+	size_t avg;
+	/** Largest chunk */
+	size_t max;
+	/** Mask used below the average size (two bits more than the average) */
+	unsigned long long mask_s;
+	/** Mask used from the average size on (two bits fewer) */
+	unsigned long long mask_l;
+};
+
+/** Called with the offset, length and digest of each chunk, in file order */
+typedef char (*cdc_record_t)(unsigned long long, unsigned long long,
+		unsigned char []);
+
+char cdc_params_init(struct cdc_params *, size_t, size_t, size_t);
+char cdc_params_parse(char *, struct cdc_params *);
+
+void cdc_scan(const struct cdc_params *, const unsigned char *, size_t,
+		size_t, unsigned long long [], unsigned long long []);
+size_t cdc_cut(const struct cdc_params *, const unsigned long long [],
+		const unsigned long long [], size_t, size_t, char);
+
+char cdc_file(FILE *, const struct cdc_params *, enum hash_t, cdc_record_t);
+
+#endif /* CDC_H_ */
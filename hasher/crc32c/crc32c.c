@@ -0,0 +1,398 @@
+/**
+ * @file crc32c.c
+ * An implementation of CRC32C (Castagnoli), described in RFC 3720, using the
+ *  SSE4.2 crc32 instruction with PCLMUL combining where available
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <string.h>
+
+#include "../global.h"
+#include "../stats/stats.h"
+#include "../sparse/sparse.h"
+#include "crc32c.h"
+
+/*
+ * Use the SSE4.2 crc32 and PCLMUL instructions when the toolchain can build
+ *  them (they are only run if the processor has them)
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_HW
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/** Reflected Castagnoli polynomial - from RFC 3720 */
+#define CRC32C_POLY 0x82F63B78
+/** Bytes per stream for large buffers (3 streams are run at once) */
+#define CRC32C_LONG 8192
+/** Bytes per stream for medium buffers */
+#define CRC32C_SHORT 256
+
+extern char in_hash;
+
+/** Slicing-by-8 tables for the software path */
+unsigned int crc32c_table[8][256];
+/** Whether the software tables (and combining constants) are built */
+char crc32c_ready = 0;
+/** Whether the processor has SSE4.2 and PCLMUL */
+char crc32c_hw = 0;
+/** Combining constants - x^(8 * n - 33) for n = LONG, 2 LONG, SHORT, 2 SHORT */
+unsigned int crc32c_long_k[2], crc32c_short_k[2];
+
+/** Current CRC register (not inverted) */
+unsigned int crc32c_crc;
+
+unsigned int crc32c_sw(unsigned int, unsigned char *, unsigned long);
+#ifdef CRC32C_HW
+unsigned int crc32c_hw_update(unsigned int, unsigned char *, unsigned long);
+#endif
+
+/**
+ * Multiply two polynomials modulo the CRC polynomial (reflected)
+ *
+ * @param a First polynomial
+ * @param b Second polynomial
+ * @return a * b mod P
+ */
+unsigned int crc32c_multmodp(unsigned int a, unsigned int b)
+{
+	unsigned int m = 1U << 31, p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+
+	return p;
+}
+
+/**
+ * Compute x^n modulo the CRC polynomial (reflected)
+ *
+ * @param n Power of x
+ * @return x^n mod P
+ */
+unsigned int crc32c_xnmodp(unsigned long n)
+{
+	/* x^0 and x^1, reflected */
+	unsigned int p = 1U << 31, x = 1U << 30;
+
+	while (n) {
+		if (n & 1)
+			p = crc32c_multmodp(x, p);
+		x = crc32c_multmodp(x, x);
+		n >>= 1;
+	}
+
+	return p;
+}
+
+/**
+ * Build the software tables and combining constants, and detect the
+ *  instructions, the first time round
+ */
+void crc32c_setup()
+{
+	unsigned int i, j, crc;
+
+	if (crc32c_ready)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+
+	/* A 32 bit carry-less multiply then a 64 bit crc32 adds x^33 */
+	crc32c_long_k[0] = crc32c_xnmodp((8UL * CRC32C_LONG) - 33);
+	crc32c_long_k[1] = crc32c_xnmodp((16UL * CRC32C_LONG) - 33);
+	crc32c_short_k[0] = crc32c_xnmodp((8UL * CRC32C_SHORT) - 33);
+	crc32c_short_k[1] = crc32c_xnmodp((16UL * CRC32C_SHORT) - 33);
+
+#ifdef CRC32C_HW
+	crc32c_hw = __builtin_cpu_supports("sse4.2") &&
+			__builtin_cpu_supports("pclmul");
+#endif
+
+	crc32c_ready = 1;
+}
+
+/**
+ * Initialise CRC32C hashing
+ *
+ * @return 1 if CRC32C hashing was initialised (nothing else initialised),
+ *          else 0
+ */
+char crc32c_init()
+{
+	/* Begin hashing if not currently hashing */
+	if (!in_hash) {
+		crc32c_setup();
+
+		/* The register starts inverted - from RFC 3720 */
+		crc32c_crc = 0xFFFFFFFF;
+
+		/* Now in hash */
+		in_hash = 1;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Add a string into the current CRC
+ *
+ * @param str Null terminated string
+ * @return 1 if the string was added, else 0
+ */
+char crc32c_add_string(char *str)
+{
+	return crc32c_add_bytes((unsigned char *) str, strlen(str));
+}
+
+/**
+ * Add an array of bytes into the current CRC
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char crc32c_add_bytes(unsigned char *bytes, unsigned int length)
+{
+	/* Ensure we're currently hashing */
+	if (in_hash) {
+		STATS_ADD(S_CRC32C_BYTES, length);
+#ifdef CRC32C_HW
+		if (crc32c_hw) {
+			crc32c_crc = crc32c_hw_update(crc32c_crc, bytes, length);
+			return 1;
+		}
+#endif
+		crc32c_crc = crc32c_sw(crc32c_crc, bytes, length);
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Add a file into the current CRC
+ *
+ * @param fp File pointer to the file to be read from
+ * @return 1 if the file's contents was added, else 0
+ */
+char crc32c_add_file(FILE *fp)
+{
+	/* Ensure we're currently hashing */
+	if (in_hash) {
+		unsigned char buffer[16 * CRC32C_LONG], *bytes;
+		unsigned long long start;
+		size_t read_length;
+		struct sparse sparse;
+
+		sparse_begin_file(&sparse, fp);
+		while ((read_length = sparse_read(&sparse, buffer, sizeof(buffer),
+				&bytes)) > 0) {
+			start = stats_now();
+			crc32c_add_bytes(bytes, read_length);
+			stats_hashed(start, read_length);
+		}
+
+		return sparse_end(&sparse);
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Complete hashing and get a copy of the CRC
+ *
+ * @param hash_out Array of at least 1 unsigned int
+ * @return 1 if the CRC was copied, else 0
+ */
+char crc32c_get_hash(unsigned int hash_out[])
+{
+	if (in_hash) {
+		/* The register is inverted again at the end - from RFC 3720 */
+		hash_out[0] = ~crc32c_crc;
+
+		/* End hashing */
+		in_hash = 0;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Software CRC, 8 bytes at a time (slicing-by-8)
+ *
+ * @param crc Current register
+ * @param buf Bytes to add
+ * @param len Number of bytes
+ * @return Updated register
+ */
+unsigned int crc32c_sw(unsigned int crc, unsigned char *buf, unsigned long len)
+{
+	while (len >= 8) {
+		crc ^= le_b_to_w(buf);
+		crc = crc32c_table[7][crc & 0xFF] ^
+				crc32c_table[6][(crc >> 8) & 0xFF] ^
+				crc32c_table[5][(crc >> 16) & 0xFF] ^
+				crc32c_table[4][crc >> 24] ^
+				crc32c_table[3][buf[4]] ^
+				crc32c_table[2][buf[5]] ^
+				crc32c_table[1][buf[6]] ^
+				crc32c_table[0][buf[7]];
+		buf += 8;
+		len -= 8;
+	}
+
+	while (len > 0) {
+		crc = crc32c_table[0][(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+		buf++;
+		len--;
+	}
+
+	return crc;
+}
+
+#ifdef CRC32C_HW
+/**
+ * Shift a register over n zero bytes, n given by its combining constant
+ *
+ * @param crc Register
+ * @param k Combining constant, x^(8 * n - 33) mod P
+ * @return crc * x^(8 * n) mod P
+ */
+__attribute__((target("sse4.2,pclmul")))
+unsigned int crc32c_hw_shift(unsigned int crc, unsigned int k)
+{
+	__m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+			_mm_cvtsi32_si128(k), 0x00);
+
+	return (unsigned int) _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+/**
+ * Run three crc32 streams over three adjacent blocks, then combine them
+ *
+ * The crc32 instruction has a latency of 3 cycles but a throughput of 1 per
+ *  cycle, so three independent streams keep it busy. The streams are then
+ *  joined with two carry-less multiplies.
+ *
+ * @param crc Current register
+ * @param buf Start of the three blocks
+ * @param block Bytes per block
+ * @param k Combining constants for block and 2 block bytes
+ * @return Updated register
+ */
+__attribute__((target("sse4.2,pclmul")))
+unsigned int crc32c_hw_3way(unsigned int crc, unsigned char *buf,
+		unsigned long block, unsigned int k[])
+{
+	unsigned long long crc0 = crc, crc1 = 0, crc2 = 0, word[3];
+	unsigned long i;
+
+	for (i = 0; i < block; i += 8) {
+		memcpy(&word[0], buf + i, 8);
+		memcpy(&word[1], buf + block + i, 8);
+		memcpy(&word[2], buf + (2 * block) + i, 8);
+		crc0 = _mm_crc32_u64(crc0, word[0]);
+		crc1 = _mm_crc32_u64(crc1, word[1]);
+		crc2 = _mm_crc32_u64(crc2, word[2]);
+	}
+
+	return crc32c_hw_shift((unsigned int) crc0, k[1]) ^
+			crc32c_hw_shift((unsigned int) crc1, k[0]) ^
+			(unsigned int) crc2;
+}
+
+/**
+ * Hardware CRC
+ *
+ * @param crc Current register
+ * @param buf Bytes to add
+ * @param len Number of bytes
+ * @return Updated register
+ */
+__attribute__((target("sse4.2,pclmul")))
+unsigned int crc32c_hw_update(unsigned int crc, unsigned char *buf,
+		unsigned long len)
+{
+	unsigned long long crc64, word;
+
+	/* Bytes up to an 8 byte boundary */
+	while (len > 0 && ((unsigned long) buf & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *buf);
+		buf++;
+		len--;
+	}
+
+	while (len >= 3 * CRC32C_LONG) {
+		crc = crc32c_hw_3way(crc, buf, CRC32C_LONG, crc32c_long_k);
+		buf += 3 * CRC32C_LONG;
+		len -= 3 * CRC32C_LONG;
+	}
+
+	while (len >= 3 * CRC32C_SHORT) {
+		crc = crc32c_hw_3way(crc, buf, CRC32C_SHORT, crc32c_short_k);
+		buf += 3 * CRC32C_SHORT;
+		len -= 3 * CRC32C_SHORT;
+	}
+
+	crc64 = crc;
+	while (len >= 8) {
+		memcpy(&word, buf, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		buf += 8;
+		len -= 8;
+	}
+	crc = (unsigned int) crc64;
+
+	while (len > 0) {
+		crc = _mm_crc32_u8(crc, *buf);
+		buf++;
+		len--;
+	}
+
+	return crc;
+}
+#endif
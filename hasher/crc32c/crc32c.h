@@ -0,0 +1,32 @@
+/**
+ * @file crc32c.h
+ * Header for crc32c.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+char crc32c_init();
+char crc32c_add_string(char *);
+char crc32c_add_bytes(unsigned char *, unsigned int);
+char crc32c_add_file(FILE *);
+char crc32c_get_hash(unsigned int []);
+
+#endif /* CRC32C_H_ */
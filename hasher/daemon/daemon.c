@@ -0,0 +1,1031 @@
+/**
+ * @file daemon.c
+ * Local hashing daemon - a persistent pool of workers answering requests
+ *  on a Unix socket, for files passed by descriptor or data in a shared ring
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* memfd_create, SO_PEERCRED */
+#define _GNU_SOURCE
+
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "../hash.h"
+#include "../blockmap/blockmap.h"
+#include "../pool/pool.h"
+#include "../sparse/sparse.h"
+#include "daemon.h"
+
+/**
+ * Find the daemon's socket - $HASHER_SOCKET, else hasherd.sock in
+ *  $XDG_RUNTIME_DIR, else /tmp/hasherd-<user ID>.sock
+ *
+ * @param path Array to store the path
+ * @param size Bytes in the array
+ * @return 1 if the path fits, else 0
+ */
+char daemon_socket_path(char *path, size_t size)
+{
+	char *dir = getenv("XDG_RUNTIME_DIR");
+	int written;
+
+	if (getenv("HASHER_SOCKET") != NULL)
+		written = snprintf(path, size, "%s", getenv("HASHER_SOCKET"));
+	else if (dir != NULL && dir[0] != '\0')
+		written = snprintf(path, size, "%s/%s", dir, DAEMON_SOCKET_NAME);
+	else
+		written = snprintf(path, size, "/tmp/hasherd-%u.sock",
+				(unsigned int) getuid());
+
+	return written > 0 && (size_t) written < size;
+}
+
+/*
+ * The daemon passes descriptors and shares memfds, which only Linux has -
+ *  elsewhere no daemon answers, and everything is hashed by the client
+ */
+#ifdef __linux__
+
+/** Guards the hash globals, for the hash types that use them */
+pthread_mutex_t daemon_globals = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Check that the other end of a connection is run by this user
+ *
+ * @param sock The connection
+ * @return 1 if it is, else 0
+ */
+char daemon_peer_trusted(int sock)
+{
+	struct ucred cred;
+	socklen_t length = sizeof(cred);
+
+	return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 &&
+			cred.uid == getuid();
+}
+
+/**
+ * Set how long receiving and sending on a connection may wait
+ *
+ * @param sock The connection
+ * @param milliseconds The wait
+ */
+void daemon_timeout(int sock, unsigned int milliseconds)
+{
+	struct timeval wait;
+
+	wait.tv_sec = milliseconds / 1000;
+	wait.tv_usec = (milliseconds % 1000) * 1000;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+}
+
+/**
+ * Send a message, and a file descriptor with it
+ *
+ * @param sock The socket
+ * @param message The message
+ * @param length Bytes in the message
+ * @param fd File descriptor to pass, or -1
+ * @return 1 if the whole message was sent, else 0
+ */
+char daemon_send(int sock, const void *message, size_t length, int fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	const char *bytes = message;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t sent;
+
+	while (length > 0) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = (void *) bytes;
+		iov.iov_len = length;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (fd >= 0) {
+			/* The descriptor goes with the first byte */
+			memset(control, 0, sizeof(control));
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		}
+
+		sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return 0;
+		bytes += sent;
+		length -= sent;
+		fd = -1;
+	}
+
+	return 1;
+}
+
+/**
+ * Receive a whole message, and any file descriptor with it
+ *
+ * @param sock The socket
+ * @param message Where to store the message
+ * @param length Bytes in the message
+ * @param fd Set to the descriptor passed, or -1 (may be NULL if none is
+ *            expected - any passed is closed)
+ * @return 1 if the whole message arrived, else 0 (including at the end of
+ *          the connection)
+ */
+char daemon_recv(int sock, void *message, size_t length, int *fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	char *bytes = message;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t got;
+	int passed;
+
+	if (fd != NULL)
+		*fd = -1;
+	while (length > 0) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = bytes;
+		iov.iov_len = length;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return 0;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET ||
+					cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+			if (fd != NULL && *fd < 0)
+				*fd = passed;
+			else
+				close(passed);
+		}
+		bytes += got;
+		length -= got;
+	}
+
+	return 1;
+}
+
+/**
+ * Connect to a running daemon
+ *
+ * Only a daemon of this user's is trusted with digests - the socket must be
+ *  this user's alone (the default path may be in /tmp, where anyone could
+ *  make it), and so must the process answering on it. A daemon too busy to
+ *  greet the connection soon is passed over.
+ *
+ * @param client Connection to be filled in
+ * @return 1 if connected, else 0 (no trusted daemon is free)
+ */
+char daemon_connect(struct daemon_client *client)
+{
+	struct sockaddr_un addr;
+	struct daemon_reply greeting;
+	struct stat st;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (!daemon_socket_path(addr.sun_path, sizeof(addr.sun_path)))
+		return 0;
+	if (lstat(addr.sun_path, &st) < 0 || !S_ISSOCK(st.st_mode) ||
+			st.st_uid != getuid() || (st.st_mode & 077) != 0)
+		return 0;
+
+	client->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (client->sock < 0)
+		return 0;
+	daemon_timeout(client->sock, DAEMON_GREETING_TIMEOUT);
+	if (connect(client->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			!daemon_peer_trusted(client->sock) ||
+			!daemon_recv(client->sock, &greeting, sizeof(greeting), NULL) ||
+			greeting.magic != DAEMON_MAGIC ||
+			greeting.kind != D_GREETING || !greeting.ok) {
+		close(client->sock);
+		return 0;
+	}
+	daemon_timeout(client->sock, DAEMON_REPLY_TIMEOUT);
+	client->ring = NULL;
+	client->ring_next = 0;
+	client->broken = 0;
+
+	return 1;
+}
+
+/**
+ * Close a connection to the daemon
+ *
+ * @param client The connection
+ */
+void daemon_disconnect(struct daemon_client *client)
+{
+	if (client->ring != NULL)
+		munmap(client->ring, DAEMON_RING_SIZE);
+	close(client->sock);
+}
+
+/**
+ * Fill in a request
+ *
+ * @param request Request to fill in
+ * @param kind What is asked for
+ * @param type The hash type
+ * @param offset Offset of the bytes in the ring (D_DATA)
+ * @param length Number of bytes in the ring (D_DATA)
+ */
+void daemon_request(struct daemon_request *request, enum daemon_request_t kind,
+		enum hash_t type, unsigned long long offset, unsigned long long length)
+{
+	memset(request, 0, sizeof(*request));
+	request->magic = DAEMON_MAGIC;
+	request->kind = (uint8_t) kind;
+	request->type = (uint8_t) type;
+	request->offset = offset;
+	request->length = length;
+}
+
+/**
+ * Send a request, giving up on the connection if it can't be sent
+ *
+ * @param client The connection
+ * @param request The request
+ * @param fd File descriptor to pass, or -1
+ * @return 1 if the request was sent, else 0
+ */
+char daemon_submit(struct daemon_client *client,
+		const struct daemon_request *request, int fd)
+{
+	if (!client->broken &&
+			!daemon_send(client->sock, request, sizeof(*request), fd))
+		client->broken = 1;
+
+	return !client->broken;
+}
+
+/**
+ * Receive the reply to a request, giving up on the connection if the daemon
+ *  falls silent (or sends something other than a reply)
+ *
+ * D_WORKING replies, sent while a request takes long, are passed over, so
+ *  only silence times out - not a file that takes long to hash.
+ *
+ * @param client The connection
+ * @param type The hash type asked for
+ * @param digest Array to store the digest
+ * @return 1 if the digest was made, else 0
+ */
+char daemon_reply(struct daemon_client *client, enum hash_t type,
+		unsigned char digest[])
+{
+	struct daemon_reply reply;
+
+	if (client->broken)
+		return 0;
+	do {
+		if (!daemon_recv(client->sock, &reply, sizeof(reply), NULL) ||
+				reply.magic != DAEMON_MAGIC) {
+			client->broken = 1;
+			return 0;
+		}
+	} while (reply.kind == D_WORKING);
+	if (reply.kind != D_DIGEST) {
+		client->broken = 1;
+		return 0;
+	}
+	if (!reply.ok || reply.size != hash_digest_size(type))
+		return 0;
+	memcpy(digest, reply.digest, reply.size);
+
+	return 1;
+}
+
+/**
+ * Hash bytes with the daemon
+ *
+ * The bytes are placed in a ring of memory shared with the daemon (a memfd,
+ *  passed once per connection), which the daemon hashes where they are.
+ *  Bytes too many for the ring are passed in a memfd of their own.
+ *
+ * @param client The connection
+ * @param type The hash type
+ * @param bytes The bytes
+ * @param length Number of bytes
+ * @param digest Array to store the digest
+ * @return 1 if the bytes were hashed, else 0
+ */
+char daemon_hash_bytes(struct daemon_client *client, enum hash_t type,
+		const unsigned char *bytes, size_t length, unsigned char digest[])
+{
+	struct daemon_request request;
+	size_t written;
+	ssize_t wrote;
+	char sent;
+	int fd;
+
+	if (length > DAEMON_RING_SIZE) {
+		fd = memfd_create("hasher-data", MFD_CLOEXEC);
+		if (fd < 0)
+			return 0;
+		for (written = 0; written < length; written += wrote) {
+			wrote = write(fd, bytes + written, length - written);
+			if (wrote < 0 && errno == EINTR)
+				wrote = 0;
+			else if (wrote <= 0)
+				break;
+		}
+		daemon_request(&request, D_FILE, type, 0, 0);
+		sent = written == length && daemon_submit(client, &request, fd);
+		close(fd);
+
+		return sent && daemon_reply(client, type, digest);
+	}
+
+	if (client->ring == NULL) {
+		fd = memfd_create("hasher-ring", MFD_CLOEXEC);
+		if (fd < 0)
+			return 0;
+		if (ftruncate(fd, DAEMON_RING_SIZE) < 0) {
+			close(fd);
+			return 0;
+		}
+		client->ring = mmap(NULL, DAEMON_RING_SIZE, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+		daemon_request(&request, D_RING, type, 0, DAEMON_RING_SIZE);
+		sent = client->ring != MAP_FAILED &&
+				daemon_submit(client, &request, fd);
+		close(fd);
+		if (client->ring == MAP_FAILED)
+			client->ring = NULL;
+		if (!sent)
+			return 0;
+	}
+
+	/* Every earlier request has its reply, so the ring is free to reuse */
+	if (client->ring_next + length > DAEMON_RING_SIZE)
+		client->ring_next = 0;
+	memcpy(client->ring + client->ring_next, bytes, length);
+	daemon_request(&request, D_DATA, type, client->ring_next, length);
+	client->ring_next += length;
+
+	return daemon_submit(client, &request, -1) &&
+			daemon_reply(client, type, digest);
+}
+
+/**
+ * Hash files with the daemon, passing each by its file descriptor
+ *
+ * Up to DAEMON_WINDOW requests are sent ahead of their replies. The daemon
+ *  reads the files through the descriptors, so it can only hash files the
+ *  client could open. Once the connection gives out, the rest of the files
+ *  are left unreported, for the caller to hash.
+ *
+ * @param client The connection
+ * @param type The hash type
+ * @param files Paths of the files
+ * @param count Number of files
+ * @param result Called with the digest of each file reported, in order
+ * @return Number of files reported (all but those left when the connection
+ *          gave out)
+ */
+unsigned int daemon_hash_files(struct daemon_client *client, enum hash_t type,
+		char *files[], unsigned int count, pool_result_t result)
+{
+	struct daemon_request request;
+	unsigned char digest[HASH_MAX_DIGEST];
+	char sent[DAEMON_WINDOW], ok;
+	unsigned int next = 0, done = 0;
+	int fd;
+
+	daemon_request(&request, D_FILE, type, 0, 0);
+	while (done < count && !client->broken) {
+		if (next < count && next - done < DAEMON_WINDOW) {
+			fd = open(files[next], O_RDONLY | O_CLOEXEC);
+			sent[next % DAEMON_WINDOW] = fd >= 0 &&
+					daemon_submit(client, &request, fd);
+			if (fd >= 0)
+				close(fd);
+			next++;
+			continue;
+		}
+
+		memset(digest, 0, sizeof(digest));
+		ok = sent[done % DAEMON_WINDOW] && daemon_reply(client, type, digest);
+		if (client->broken)
+			break;
+		result(done, digest, ok);
+		done++;
+	}
+
+	return done;
+}
+
+/** A connection the daemon is answering */
+struct daemon_conn {
+	/** The socket */
+	int sock;
+	/** Guards the rest, and sending on the socket */
+	pthread_mutex_t lock;
+	/** Signalled as replies are sent */
+	pthread_cond_t changed;
+	/** Replies in the making, by request number (DAEMON_WINDOW slots) */
+	struct daemon_reply replies[DAEMON_WINDOW];
+	/** Whether each slot's reply is ready to send */
+	char ready[DAEMON_WINDOW];
+	/** Number of the oldest request whose reply isn't sent */
+	unsigned int head;
+	/** Number of the next request */
+	unsigned int tail;
+	/** Files queued or being hashed for the connection */
+	unsigned int jobs;
+	/** Set once the connection is gone, so its files are dropped */
+	char closed;
+};
+
+/** A file waiting for a hashing worker */
+struct daemon_job {
+	/** The connection that asked for it */
+	struct daemon_conn *conn;
+	/** Number of the request */
+	unsigned int request;
+	/** The hash type */
+	enum hash_t type;
+	/** File descriptor */
+	int fd;
+	/** Next job in the queue */
+	struct daemon_job *next;
+};
+
+/** Guards the job queue and the connection count */
+pthread_mutex_t daemon_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+/** Signalled as jobs are queued */
+pthread_cond_t daemon_queue_ready = PTHREAD_COND_INITIALIZER;
+/** Oldest job queued, or NULL */
+struct daemon_job *daemon_queue_first;
+/** Newest job queued, or NULL */
+struct daemon_job *daemon_queue_last;
+/** Number of connections being answered */
+unsigned int daemon_connections;
+
+/**
+ * Hash a file passed to the daemon
+ *
+ * @param type The hash type
+ * @param fd File descriptor
+ * @param buffer DAEMON_BUFFER_SIZE bytes to read into
+ * @param digest Array to store the digest
+ * @param dropped Set if the file is no longer wanted, to stop early
+ * @return 1 if the whole file was hashed, else 0
+ */
+char daemon_hash_fd(enum hash_t type, int fd, unsigned char *buffer,
+		unsigned char digest[], const char *dropped)
+{
+	struct hash_ctx ctx;
+	struct sparse sparse;
+	unsigned char *bytes;
+	size_t got;
+	char ok;
+	FILE *fp;
+
+	/* The descriptor shares its offset with the client's */
+	lseek(fd, 0, SEEK_SET);
+
+	if (hash_reentrant(type)) {
+		hash_ctx_init(&ctx, type);
+		sparse_begin_fd(&sparse, fd);
+		while (!__atomic_load_n(dropped, __ATOMIC_RELAXED) &&
+				(got = sparse_read(&sparse, buffer, DAEMON_BUFFER_SIZE,
+				&bytes)) > 0)
+			hash_ctx_add(&ctx, bytes, got);
+		hash_ctx_final(&ctx, digest);
+
+		return sparse_end(&sparse) &&
+				!__atomic_load_n(dropped, __ATOMIC_RELAXED);
+	}
+
+	fp = fdopen(dup(fd), "rb");
+	if (fp == NULL)
+		return 0;
+	pthread_mutex_lock(&daemon_globals);
+	ok = hash_init(type) && hash_add_file(fp);
+	ok = hash_get_digest(digest) && ok;
+	pthread_mutex_unlock(&daemon_globals);
+	fclose(fp);
+
+	return ok;
+}
+
+/**
+ * Send a connection's replies that are ready, in the order of the requests
+ *  (the connection's lock must be held)
+ *
+ * @param conn The connection
+ */
+void daemon_flush(struct daemon_conn *conn)
+{
+	unsigned int slot;
+
+	while (conn->head != conn->tail &&
+			conn->ready[conn->head % DAEMON_WINDOW]) {
+		slot = conn->head % DAEMON_WINDOW;
+		if (!conn->closed && !daemon_send(conn->sock, &conn->replies[slot],
+				sizeof(struct daemon_reply), -1))
+			__atomic_store_n(&conn->closed, 1, __ATOMIC_RELAXED);
+		conn->ready[slot] = 0;
+		conn->head++;
+	}
+	pthread_cond_broadcast(&conn->changed);
+}
+
+/**
+ * Fill in a reply and send it once those before it are sent
+ *
+ * @param conn The connection
+ * @param request Number of the request
+ * @param digest The digest
+ * @param ok Whether the digest was made
+ * @param queued Whether the request was a job of the hashing workers
+ */
+void daemon_answer(struct daemon_conn *conn, unsigned int request,
+		unsigned char digest[], char ok, char queued)
+{
+	struct daemon_reply *reply;
+
+	/* Once the last job is answered, the connection may be freed */
+	pthread_mutex_lock(&conn->lock);
+	if (queued)
+		conn->jobs--;
+	reply = &conn->replies[request % DAEMON_WINDOW];
+	reply->ok = ok;
+	if (ok)
+		memcpy(reply->digest, digest, reply->size);
+	conn->ready[request % DAEMON_WINDOW] = 1;
+	daemon_flush(conn);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+/**
+ * Queue a file for the hashing workers
+ *
+ * @param job The file
+ */
+void daemon_queue(struct daemon_job *job)
+{
+	job->next = NULL;
+	pthread_mutex_lock(&daemon_queue_lock);
+	if (daemon_queue_last != NULL)
+		daemon_queue_last->next = job;
+	else
+		daemon_queue_first = job;
+	daemon_queue_last = job;
+	pthread_cond_signal(&daemon_queue_ready);
+	pthread_mutex_unlock(&daemon_queue_lock);
+}
+
+/**
+ * Hash queued files, for as long as the daemon runs
+ *
+ * The workers are shared by every connection, taking files in the order
+ *  they were queued. Files of a connection that has gone are dropped.
+ *
+ * @param arg DAEMON_BUFFER_SIZE bytes to read files into
+ * @return NULL (never returns)
+ */
+void *daemon_hasher(void *arg)
+{
+	unsigned char *buffer = arg;
+	unsigned char digest[HASH_MAX_DIGEST];
+	struct daemon_job *job;
+	struct daemon_conn *conn;
+	char ok;
+
+	for (;;) {
+		pthread_mutex_lock(&daemon_queue_lock);
+		while (daemon_queue_first == NULL)
+			pthread_cond_wait(&daemon_queue_ready, &daemon_queue_lock);
+		job = daemon_queue_first;
+		daemon_queue_first = job->next;
+		if (daemon_queue_first == NULL)
+			daemon_queue_last = NULL;
+		pthread_mutex_unlock(&daemon_queue_lock);
+
+		conn = job->conn;
+		ok = !__atomic_load_n(&conn->closed, __ATOMIC_RELAXED) &&
+				daemon_hash_fd(job->type, job->fd, buffer, digest,
+						&conn->closed);
+		close(job->fd);
+		daemon_answer(conn, job->request, digest, ok, 1);
+		free(job);
+	}
+
+	return NULL;
+}
+
+/**
+ * Answer the requests on a connection until it closes or sits idle
+ *
+ * Files are queued for the hashing workers, so a connection's files are
+ *  hashed side by side, and the replies are sent in order as they become
+ *  ready. Ring data is small, so it is hashed here. While replies are
+ *  outstanding, a D_WORKING reply goes out every DAEMON_KEEPALIVE, so the
+ *  client can tell a long hash from a daemon that has gone quiet.
+ *
+ * @param conn The connection
+ */
+void daemon_serve_connection(struct daemon_conn *conn)
+{
+	struct daemon_request request;
+	struct daemon_reply working, *reply;
+	struct daemon_job *job;
+	struct pollfd wait;
+	unsigned char digest[HASH_MAX_DIGEST];
+	unsigned char *ring = NULL;
+	struct stat st;
+	size_t ring_size = 0;
+	unsigned int idle = 0, number;
+	char outstanding, ok;
+	int fd, ready;
+
+	memset(&working, 0, sizeof(working));
+	working.magic = DAEMON_MAGIC;
+	working.kind = D_WORKING;
+
+	wait.fd = conn->sock;
+	wait.events = POLLIN;
+	for (;;) {
+		ready = poll(&wait, 1, DAEMON_KEEPALIVE);
+		if (ready < 0 && errno == EINTR)
+			continue;
+		if (ready < 0)
+			break;
+
+		pthread_mutex_lock(&conn->lock);
+		outstanding = conn->head != conn->tail;
+		if (ready == 0 && outstanding && !conn->closed &&
+				!daemon_send(conn->sock, &working, sizeof(working), -1))
+			__atomic_store_n(&conn->closed, 1, __ATOMIC_RELAXED);
+		/* A client never has more than DAEMON_WINDOW requests waiting */
+		if (ready > 0 && conn->tail - conn->head == DAEMON_WINDOW)
+			__atomic_store_n(&conn->closed, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&conn->lock);
+		if (__atomic_load_n(&conn->closed, __ATOMIC_RELAXED))
+			break;
+
+		if (ready == 0) {
+			/* An idle connection is dropped, so it holds no thread */
+			idle = outstanding ? 0 : idle + DAEMON_KEEPALIVE;
+			if (idle >= DAEMON_IDLE_TIMEOUT)
+				break;
+			continue;
+		}
+		idle = 0;
+
+		if (!daemon_recv(conn->sock, &request, sizeof(request), &fd))
+			break;
+		if (request.magic != DAEMON_MAGIC || request.type > H_SHA256D) {
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+
+		if (request.kind == D_RING) {
+			/* A new ring replaces any before it */
+			if (ring != NULL)
+				munmap(ring, ring_size);
+			ring = NULL;
+			if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+				ring_size = (size_t) st.st_size;
+				ring = mmap(NULL, ring_size, PROT_READ, MAP_SHARED, fd, 0);
+				if (ring == MAP_FAILED)
+					ring = NULL;
+			}
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+
+		job = request.kind == D_FILE && fd >= 0 ?
+				malloc(sizeof(struct daemon_job)) : NULL;
+
+		/* The reply waits in its slot until those before it are sent */
+		pthread_mutex_lock(&conn->lock);
+		number = conn->tail++;
+		reply = &conn->replies[number % DAEMON_WINDOW];
+		memset(reply, 0, sizeof(*reply));
+		reply->magic = DAEMON_MAGIC;
+		reply->kind = D_DIGEST;
+		reply->size = hash_digest_size(request.type);
+		if (job != NULL)
+			conn->jobs++;
+		pthread_mutex_unlock(&conn->lock);
+
+		if (job != NULL) {
+			job->conn = conn;
+			job->request = number;
+			job->type = request.type;
+			job->fd = fd;
+			daemon_queue(job);
+			continue;
+		}
+
+		ok = 0;
+		if (request.kind == D_DATA && ring != NULL &&
+				request.offset <= ring_size &&
+				request.length <= ring_size - request.offset) {
+			if (!hash_reentrant(request.type))
+				pthread_mutex_lock(&daemon_globals);
+			ok = hash_oneshot(request.type, ring + request.offset,
+					request.length, digest);
+			if (!hash_reentrant(request.type))
+				pthread_mutex_unlock(&daemon_globals);
+		}
+		if (fd >= 0)
+			close(fd);
+		daemon_answer(conn, number, digest, ok, 0);
+	}
+
+	/* Drop the files still queued, and wait out those being hashed */
+	pthread_mutex_lock(&conn->lock);
+	__atomic_store_n(&conn->closed, 1, __ATOMIC_RELAXED);
+	while (conn->jobs > 0)
+		pthread_cond_wait(&conn->changed, &conn->lock);
+	pthread_mutex_unlock(&conn->lock);
+
+	if (ring != NULL)
+		munmap(ring, ring_size);
+}
+
+/**
+ * Free a connection, closing its socket
+ *
+ * @param conn The connection
+ */
+void daemon_drop(struct daemon_conn *conn)
+{
+	close(conn->sock);
+	pthread_cond_destroy(&conn->changed);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+
+	pthread_mutex_lock(&daemon_queue_lock);
+	daemon_connections--;
+	pthread_mutex_unlock(&daemon_queue_lock);
+}
+
+/**
+ * Greet a connection, then answer it until it closes
+ *
+ * @param arg The connection
+ * @return NULL
+ */
+void *daemon_reader(void *arg)
+{
+	struct daemon_conn *conn = arg;
+	struct daemon_reply greeting;
+
+	memset(&greeting, 0, sizeof(greeting));
+	greeting.magic = DAEMON_MAGIC;
+	greeting.kind = D_GREETING;
+	greeting.ok = 1;
+
+	daemon_timeout(conn->sock, DAEMON_IDLE_TIMEOUT);
+	if (daemon_peer_trusted(conn->sock) &&
+			daemon_send(conn->sock, &greeting, sizeof(greeting), -1))
+		daemon_serve_connection(conn);
+	daemon_drop(conn);
+
+	return NULL;
+}
+
+/**
+ * Run the daemon - listen on the socket and answer with a pool of workers
+ *
+ * The hashing workers are shared by every connection, and each connection
+ *  has a thread of its own reading its requests. Only connections from this
+ *  user are answered. The calling thread takes the connections, so this
+ *  only returns if the daemon fails.
+ *
+ * @param threads Number of hashing workers, or 0 for one per online
+ *                 processor
+ * @return 0 (the daemon could not start, or stopped)
+ */
+char daemon_serve(unsigned int threads)
+{
+	struct sockaddr_un addr;
+	struct daemon_conn *conn;
+	struct stat st;
+	pthread_attr_t detached;
+	pthread_t id;
+	unsigned char *buffers;
+	unsigned int t;
+	mode_t mask;
+	int listener, sock;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (!daemon_socket_path(addr.sun_path, sizeof(addr.sun_path))) {
+		fprintf(stderr, "The daemon's socket path is too long\n");
+		return 0;
+	}
+
+	/* Only a socket of this user's, left by a daemon now gone, is replaced */
+	if (lstat(addr.sun_path, &st) == 0 &&
+			(!S_ISSOCK(st.st_mode) || st.st_uid != getuid())) {
+		fprintf(stderr, "%s is not this user's socket\n", addr.sun_path);
+		return 0;
+	}
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		return 0;
+	if (connect(listener, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "A daemon is already running on %s\n",
+				addr.sun_path);
+		close(listener);
+		return 0;
+	}
+	close(listener);
+	unlink(addr.sun_path);
+
+	/* Reachable by this user only */
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+		return 0;
+	mask = umask(077);
+	if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+			listen(listener, SOMAXCONN) < 0) {
+		umask(mask);
+		fprintf(stderr, "Unable to listen on %s\n", addr.sun_path);
+		close(listener);
+		return 0;
+	}
+	umask(mask);
+
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 0 ? (unsigned int) online : 1;
+	}
+	/* The workers run until the process exits, so the buffers are kept */
+	buffers = malloc((size_t) threads * DAEMON_BUFFER_SIZE);
+	for (t = 0; buffers != NULL && t < threads; t++)
+		if (pthread_create(&id, NULL, daemon_hasher,
+				buffers + ((size_t) t * DAEMON_BUFFER_SIZE)))
+			break;
+	if (buffers == NULL || t == 0) {
+		fprintf(stderr, "Unable to start the daemon's workers\n");
+		free(buffers);
+		close(listener);
+		unlink(addr.sun_path);
+		return 0;
+	}
+
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+	for (;;) {
+		sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (sock < 0 && (errno == EINTR || errno == ECONNABORTED ||
+				errno == EMFILE || errno == ENFILE))
+			continue;
+		if (sock < 0)
+			break;
+
+		/* Past the most connections, the client gets no greeting */
+		conn = NULL;
+		pthread_mutex_lock(&daemon_queue_lock);
+		if (daemon_connections < DAEMON_MAX_CONNECTIONS &&
+				(conn = calloc(1, sizeof(struct daemon_conn))) != NULL)
+			daemon_connections++;
+		pthread_mutex_unlock(&daemon_queue_lock);
+		if (conn == NULL) {
+			close(sock);
+			continue;
+		}
+
+		conn->sock = sock;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_cond_init(&conn->changed, NULL);
+		if (pthread_create(&id, &detached, daemon_reader, conn))
+			daemon_drop(conn);
+	}
+
+	pthread_attr_destroy(&detached);
+	close(listener);
+	unlink(addr.sun_path);
+
+	return 0;
+}
+
+#else
+
+/**
+ * Connect to a running daemon
+ *
+ * @param client Connection to be filled in
+ * @return 0 (there is no daemon without Linux)
+ */
+char daemon_connect(struct daemon_client *client)
+{
+	return 0;
+}
+
+/**
+ * Close a connection to the daemon
+ *
+ * @param client The connection
+ */
+void daemon_disconnect(struct daemon_client *client)
+{
+}
+
+/**
+ * Hash bytes with the daemon
+ *
+ * @param client The connection
+ * @param type The hash type
+ * @param bytes The bytes
+ * @param length Number of bytes
+ * @param digest Array to store the digest
+ * @return 0 (there is no daemon without Linux)
+ */
+char daemon_hash_bytes(struct daemon_client *client, enum hash_t type,
+		const unsigned char *bytes, size_t length, unsigned char digest[])
+{
+	return 0;
+}
+
+/**
+ * Hash files with the daemon
+ *
+ * @param client The connection
+ * @param type The hash type
+ * @param files Paths of the files
+ * @param count Number of files
+ * @param result Called with the digest of each file reported, in order
+ * @return 0 (there is no daemon without Linux, so no file is reported)
+ */
+unsigned int daemon_hash_files(struct daemon_client *client, enum hash_t type,
+		char *files[], unsigned int count, pool_result_t result)
+{
+	return 0;
+}
+
+/**
+ * Run the daemon
+ *
+ * @param threads Number of workers
+ * @return 0 (there is no daemon without Linux)
+ */
+char daemon_serve(unsigned int threads)
+{
+	fprintf(stderr, "The daemon needs Linux\n");
+
+	return 0;
+}
+
+#endif /* __linux__ */
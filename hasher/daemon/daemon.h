@@ -0,0 +1,126 @@
+/**
+ * @file daemon.h
+ * Header for daemon.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+/** Starts every request and reply ("HSD2") */
+#define DAEMON_MAGIC 0x48534432
+/** Name of the socket in $XDG_RUNTIME_DIR (or /tmp, with the user ID) */
+#define DAEMON_SOCKET_NAME "hasherd.sock"
+/** Bytes in a client's shared ring for data sent to be hashed */
+#define DAEMON_RING_SIZE (1024 * 1024)
+/** Most requests a client has waiting on replies */
+#define DAEMON_WINDOW 64
+/** Most connections the daemon answers at once (more aren't greeted) */
+#define DAEMON_MAX_CONNECTIONS 256
+/** Bytes each daemon worker reads at a time */
+#define DAEMON_BUFFER_SIZE (1024 * 1024)
+/** Milliseconds a client waits for the daemon to take its connection */
+#define DAEMON_GREETING_TIMEOUT 1000
+/** Milliseconds between D_WORKING replies while requests are outstanding */
+#define DAEMON_KEEPALIVE 1000
+/** Milliseconds a client waits without hearing from the daemon */
+#define DAEMON_REPLY_TIMEOUT 10000
+/** Milliseconds the daemon waits for a request before dropping a connection */
+#define DAEMON_IDLE_TIMEOUT 10000
+
+/** What a request asks for */
+enum daemon_request_t {
+	/** Hash the whole file passed with the request */
+	D_FILE,
+	/** Take the memfd passed with the request as the shared ring (no reply) */
+	D_RING,
+	/** Hash bytes in the shared ring */
+	D_DATA
+};
+
+/**
+ * A request, sent on the daemon's socket - a file descriptor goes with
+ *  D_FILE and D_RING requests (SCM_RIGHTS)
+ */
+struct daemon_request {
+	/** DAEMON_MAGIC */
+	uint32_t magic;
+	/** What is asked for (enum daemon_request_t) */
+	uint8_t kind;
+	/** The hash type (enum hash_t) */
+	uint8_t type;
+	/** Zero */
+	uint16_t reserved;
+	/** Offset of the bytes in the ring (D_DATA) */
+	uint64_t offset;
+	/** Number of bytes in the ring (D_DATA) */
+	uint64_t length;
+};
+
+/** What a reply is */
+enum daemon_reply_t {
+	/** The daemon has taken the connection (sent first, no digest) */
+	D_GREETING,
+	/** The answer to the oldest request without one */
+	D_DIGEST,
+	/** Requests are still being worked on (no digest) */
+	D_WORKING
+};
+
+/**
+ * A reply, sent on the daemon's socket - D_FILE and D_DATA requests are
+ *  answered by D_DIGEST replies in the order of the requests
+ */
+struct daemon_reply {
+	/** DAEMON_MAGIC */
+	uint32_t magic;
+	/** What the reply is (enum daemon_reply_t) */
+	uint8_t kind;
+	/** 1 if the digest was made, else 0 */
+	uint8_t ok;
+	/** Number of digest bytes */
+	uint8_t size;
+	/** Zero */
+	uint8_t reserved;
+	/** The digest */
+	uint8_t digest[HASH_MAX_DIGEST];
+};
+
+/** A connection to the daemon */
+struct daemon_client {
+	/** The socket */
+	int sock;
+	/** The shared ring, or NULL until data is first sent */
+	unsigned char *ring;
+	/** Offset in the ring to place the next data at */
+	size_t ring_next;
+	/** Set once a request or reply went astray, to stop using the connection */
+	char broken;
+};
+
+char daemon_socket_path(char *, size_t);
+char daemon_connect(struct daemon_client *);
+void daemon_disconnect(struct daemon_client *);
+char daemon_hash_bytes(struct daemon_client *, enum hash_t,
+		const unsigned char *, size_t, unsigned char []);
+unsigned int daemon_hash_files(struct daemon_client *, enum hash_t, char *[],
+		unsigned int, pool_result_t);
+char daemon_serve(unsigned int);
+
+#endif /* DAEMON_H_ */
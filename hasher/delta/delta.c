@@ -0,0 +1,268 @@
+/**
+ * @file delta.c
+ * rsync-style delta of a file against the block map of an older version
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../hash.h"
+#include "../blockmap/blockmap.h"
+#include "../stats/stats.h"
+#include "delta.h"
+
+/** A slot of the checksum table */
+struct delta_slot {
+	/** Rolling checksum of the block */
+	unsigned int weak;
+	/** Block number plus 1, or 0 for an empty slot */
+	unsigned int block;
+};
+
+/** The checksum table and the instruction being built up */
+struct delta_state {
+	/** Open-addressed table of whole blocks, keyed by rolling checksum */
+	struct delta_slot *slots;
+	/** Number of slots minus 1 (a power of 2 minus 1) */
+	unsigned int mask;
+	/** Where instructions go */
+	delta_instruction_t instruction;
+	/** Operation being built up */
+	enum delta_op_t op;
+	/** New file offset, old file offset and length of it (0 for none) */
+	unsigned long long new_offset, old_offset, length;
+};
+
+/**
+ * Spread a rolling checksum over the table
+ *
+ * @param weak Rolling checksum
+ * @param mask Number of slots minus 1
+ * @return First slot to look in
+ */
+unsigned int delta_slot_of(unsigned int weak, unsigned int mask)
+{
+	return (unsigned int) ((weak * 0x9e3779b1U) >> 7) & mask;
+}
+
+/**
+ * Add bytes to the instruction being built up, starting a new one if they
+ *  don't follow on from it
+ *
+ * @param state Delta state
+ * @param op Operation
+ * @param new_offset Offset in the new file
+ * @param old_offset Offset in the old file (copies only)
+ * @param length Number of bytes
+ * @return 1 if any finished instruction was taken, else 0
+ */
+char delta_emit(struct delta_state *state, enum delta_op_t op,
+		unsigned long long new_offset, unsigned long long old_offset,
+		unsigned long long length)
+{
+	if (state->length > 0 && state->op == op &&
+			(op == D_LITERAL ||
+			state->old_offset + state->length == old_offset)) {
+		state->length += length;
+		return 1;
+	}
+
+	if (state->length > 0 && !state->instruction(state->op,
+			state->new_offset, state->old_offset, state->length))
+		return 0;
+
+	state->op = op;
+	state->new_offset = new_offset;
+	state->old_offset = old_offset;
+	state->length = length;
+
+	return 1;
+}
+
+/**
+ * Find the block a window of the new file matches
+ *
+ * Blocks with the same rolling checksum are checked against the window's
+ *  strong digest, which is only made once the first of them is found.
+ *
+ * @param state Delta state
+ * @param map Block map of the old file
+ * @param window Window of block_size bytes
+ * @param weak Rolling checksum of the window
+ * @return Block number plus 1, or 0 if no block matches
+ */
+unsigned int delta_match(struct delta_state *state, const struct blockmap *map,
+		const unsigned char *window, unsigned int weak)
+{
+	unsigned char digest[HASH_MAX_DIGEST];
+	unsigned int size = hash_digest_size(map->type);
+	unsigned int slot = delta_slot_of(weak, state->mask);
+	char hashed = 0;
+
+	for (; state->slots[slot].block != 0; slot = (slot + 1) & state->mask) {
+		if (state->slots[slot].weak != weak)
+			continue;
+
+		if (!hashed) {
+			hash_oneshot(map->type, window, map->block_size, digest);
+			hashed = 1;
+		}
+		if (memcmp(digest, map->digests +
+				((state->slots[slot].block - 1) * size), size) == 0)
+			return state->slots[slot].block;
+	}
+
+	return 0;
+}
+
+/**
+ * Work out how to build a new file from an older version and new bytes
+ *
+ * Every whole block of the old file goes into an open-addressed table keyed
+ *  by its rolling checksum. A window of block_size bytes slides over the new
+ *  file a byte at a time, with its checksum rolled along rather than redone.
+ *  When the checksum is in the table the window's strong digest confirms
+ *  the match, the block is copied and the window jumps past it. Bytes the
+ *  window slid over are sent as literals. The old file's short last block
+ *  is only tried at the end of the new file. Copies of consecutive blocks,
+ *  and consecutive literals, are joined into single instructions.
+ *
+ * @param fd File descriptor of the new file
+ * @param map Block map of the old file, with rolling checksums
+ * @param instruction Called with each instruction
+ * @return 1 if the whole file was covered by instructions, else 0
+ */
+char delta_file(int fd, const struct blockmap *map,
+		delta_instruction_t instruction)
+{
+	struct delta_state state;
+	unsigned char digest[HASH_MAX_DIGEST];
+	unsigned long long blocks, b, p, literal, size, block_size, tail;
+	unsigned int weak, a, s, match, slot;
+	const unsigned char *data = NULL;
+	off_t end;
+	char ok = 1;
+
+	if (map->weak == NULL || map->block_size > 0xffffffffULL)
+		return 0;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end < 0)
+		return 0;
+	size = (unsigned long long) end;
+	block_size = map->block_size;
+
+	/* Whole blocks only, in a table at most half full */
+	blocks = map->file_size / block_size;
+	if (blocks > DELTA_MAX_BLOCKS)
+		return 0;
+
+	if (size > 0) {
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			return 0;
+		madvise((void *) data, size, MADV_SEQUENTIAL);
+		STATS_ADD(S_BYTES_MAPPED, size);
+	}
+
+	for (state.mask = 1; state.mask < 2 * blocks; state.mask <<= 1)
+		;
+	state.slots = calloc(state.mask, sizeof(struct delta_slot));
+	state.mask--;
+	state.instruction = instruction;
+	state.length = 0;
+	if (state.slots == NULL) {
+		free(state.slots);
+		if (data != NULL)
+			munmap((void *) data, size);
+		return 0;
+	}
+
+	/* Later duplicates are never reached, so earlier blocks are copied */
+	for (b = 0; b < blocks; b++) {
+		slot = delta_slot_of(map->weak[b], state.mask);
+		while (state.slots[slot].block != 0)
+			slot = (slot + 1) & state.mask;
+		state.slots[slot].weak = map->weak[b];
+		state.slots[slot].block = b + 1;
+	}
+
+	p = literal = 0;
+	while (ok && blocks > 0 && p + block_size <= size) {
+		weak = blockmap_weak(data + p, block_size);
+		a = weak & 0xffff;
+		s = weak >> 16;
+
+		for (;;) {
+			match = delta_match(&state, map, data + p, weak);
+			if (match != 0 || p + block_size >= size)
+				break;
+
+			/* Roll the window on a byte */
+			a += data[p + block_size] - data[p];
+			s += a - (unsigned int) (block_size * data[p]);
+			weak = (a & 0xffff) | (s << 16);
+			p++;
+		}
+
+		if (match == 0)
+			break;
+
+		if (p > literal)
+			ok = delta_emit(&state, D_LITERAL, literal, 0, p - literal);
+		ok = ok && delta_emit(&state, D_COPY, p,
+				(match - 1) * block_size, block_size);
+		p += block_size;
+		literal = p;
+	}
+
+	/* The old file's short last block can only match the end of the new */
+	tail = map->file_size - (blocks * block_size);
+	if (ok && tail > 0 && size - literal >= tail &&
+			blockmap_weak(data + size - tail, tail) == map->weak[blocks]) {
+		hash_oneshot(map->type, data + size - tail, tail, digest);
+		if (memcmp(digest, map->digests + (blocks * hash_digest_size(map->type)),
+				hash_digest_size(map->type)) == 0) {
+			if (size - tail > literal)
+				ok = delta_emit(&state, D_LITERAL, literal, 0,
+						size - tail - literal);
+			ok = ok && delta_emit(&state, D_COPY, size - tail,
+					blocks * block_size, tail);
+			literal = size;
+		}
+	}
+
+	/* Whatever is left is new */
+	if (ok && size > literal)
+		ok = delta_emit(&state, D_LITERAL, literal, 0, size - literal);
+	if (ok && state.length > 0)
+		ok = instruction(state.op, state.new_offset, state.old_offset,
+				state.length);
+
+	free(state.slots);
+	if (data != NULL)
+		munmap((void *) data, size);
+
+	return ok;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file delta.h
+ * Header for delta.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DELTA_H_
+#define DELTA_H_
+
+/** Most whole blocks in the old file (a half full table, with a 32 bit mask) */
+#define DELTA_MAX_BLOCKS (1ULL << 30)
+
+/** Delta instructions */
+enum delta_op_t {
+	/** Copy bytes of the old file */
+	D_COPY,
+	/** Send bytes of the new file */
+	D_LITERAL
+};
+
+/**
+ * Called with each instruction in order - the operation, the offset of its
+ *  bytes in the new file, the offset in the old file (copies only) and the
+ *  number of bytes
+ */
+typedef char (*delta_instruction_t)(enum delta_op_t, unsigned long long,
+		unsigned long long, unsigned long long);
+
+char delta_file(int, const struct blockmap *, delta_instruction_t);
+
+#endif /* DELTA_H_ */
@@ -0,0 +1,349 @@
+/**
+ * @file direct.c
+ * Direct (O_DIRECT) file reading - hashes files without filling the page
+ *  cache, reading ahead into huge page buffers
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* O_DIRECT, MAP_HUGETLB */
+#define _GNU_SOURCE
+
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../hash.h"
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "direct.h"
+
+/** A buffer of a direct stream */
+struct direct_slot {
+	/** DIRECT_BUFFER_SIZE bytes, aligned to DIRECT_BUFFER_SIZE */
+	unsigned char *buffer;
+	/** Buffer number of the file it holds, or is waiting for */
+	unsigned long long block;
+	/** Bytes read, or -1 on an error */
+	long long length;
+	/** Whether it went through the page cache */
+	char buffered;
+	/** Whether the read has finished */
+	char ready;
+};
+
+/** Reading a file bypassing the page cache, for one hashing thread */
+struct direct_stream {
+	/** File descriptor opened with O_DIRECT, or -1 if it was refused */
+	int fd;
+	/** Set once an O_DIRECT read has been refused, to stop trying */
+	char refused;
+	/** File descriptor through the page cache, for what O_DIRECT refuses */
+	int buffered_fd;
+	/** Number of buffers the file fills */
+	unsigned long long blocks;
+	/** The buffers */
+	struct direct_slot slots[DIRECT_DEPTH];
+	/** Memory behind the buffers */
+	void *memory;
+	/** Whether the memory is mapped huge pages (else from posix_memalign) */
+	char huge;
+	/** Guards the slots */
+	pthread_mutex_t lock;
+	/** Signalled when a read finishes */
+	pthread_cond_t filled;
+	/** Signalled when a buffer has been hashed */
+	pthread_cond_t freed;
+	/** Set to stop the readers early */
+	char stop;
+};
+
+/** A reader thread's share of the buffers */
+struct direct_job {
+	/** The stream */
+	struct direct_stream *stream;
+	/** First buffer number of the share (the rest are DIRECT_READERS on) */
+	unsigned long long first;
+};
+
+/**
+ * Get aligned memory for the buffers
+ *
+ * Explicit huge pages are tried first. Otherwise the memory is aligned to
+ *  a huge page and transparent huge pages asked for, which the kernel may
+ *  or may not provide.
+ *
+ * @param stream Stream whose buffers to set up
+ * @return 1 if the buffers were set up, else 0
+ */
+char direct_buffers(struct direct_stream *stream)
+{
+	size_t size = (size_t) DIRECT_DEPTH * DIRECT_BUFFER_SIZE;
+	unsigned int s;
+
+#ifdef __linux__
+	stream->memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	stream->huge = stream->memory != MAP_FAILED;
+#else
+	stream->huge = 0;
+#endif
+	if (!stream->huge) {
+		if (posix_memalign(&stream->memory, DIRECT_BUFFER_SIZE, size) != 0)
+			return 0;
+#ifdef __linux__
+		madvise(stream->memory, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	for (s = 0; s < DIRECT_DEPTH; s++)
+		stream->slots[s].buffer = (unsigned char *) stream->memory +
+				((size_t) s * DIRECT_BUFFER_SIZE);
+
+	return 1;
+}
+
+/**
+ * Read one buffer's worth of a file
+ *
+ * O_DIRECT reads must be aligned, so whatever O_DIRECT turns down (the
+ *  filesystem doesn't support it, or the rest of a block after a short
+ *  read) is read through the page cache instead.
+ *
+ * @param stream The stream
+ * @param slot Buffer to read into
+ * @return Bytes read (less than DIRECT_BUFFER_SIZE only at the end of the
+ *          file), or -1 on an error
+ */
+long long direct_read(struct direct_stream *stream, struct direct_slot *slot)
+{
+	unsigned long long offset = slot->block * DIRECT_BUFFER_SIZE, start;
+	size_t done = 0;
+	ssize_t got;
+	int fd;
+
+	slot->buffered = 0;
+	while (done < DIRECT_BUFFER_SIZE) {
+		/* Only whole, aligned reads can be direct */
+		if (done == 0 && stream->fd >= 0 && !stream->refused) {
+			fd = stream->fd;
+		} else {
+			fd = stream->buffered_fd;
+			slot->buffered = 1;
+		}
+
+		start = stats_now();
+		HASHER_PROBE1(read__start, DIRECT_BUFFER_SIZE - done);
+		got = pread(fd, slot->buffer + done, DIRECT_BUFFER_SIZE - done,
+				(off_t) (offset + done));
+		HASHER_PROBE1(read__done, got < 0 ? 0 : got);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && errno == EINVAL && fd == stream->fd) {
+			/* Refused - the page cache it is, from here on */
+			stream->refused = 1;
+			continue;
+		}
+		if (got < 0)
+			return -1;
+		stats_read(start, got);
+		if (got == 0)
+			break;
+		done += got;
+	}
+
+	return done;
+}
+
+/**
+ * Read a share of the buffers of a file, ahead of the hashing
+ *
+ * Buffer number b goes in slot b % DIRECT_DEPTH once the hashing has
+ *  finished with buffer b - DIRECT_DEPTH.
+ *
+ * @param arg The job
+ * @return NULL
+ */
+void *direct_reader(void *arg)
+{
+	struct direct_job *job = arg;
+	struct direct_stream *stream = job->stream;
+	struct direct_slot *slot;
+	unsigned long long b;
+	long long length;
+
+	for (b = job->first; b < stream->blocks; b += DIRECT_READERS) {
+		slot = &stream->slots[b % DIRECT_DEPTH];
+
+		pthread_mutex_lock(&stream->lock);
+		while (!stream->stop && (slot->block != b || slot->ready))
+			pthread_cond_wait(&stream->freed, &stream->lock);
+		pthread_mutex_unlock(&stream->lock);
+		if (stream->stop)
+			break;
+
+		length = direct_read(stream, slot);
+
+		pthread_mutex_lock(&stream->lock);
+		slot->length = length;
+		slot->ready = 1;
+		pthread_cond_broadcast(&stream->filled);
+		pthread_mutex_unlock(&stream->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Add a file into the current hash, bypassing the page cache
+ *
+ * The file is opened with O_DIRECT and read a huge page at a time by
+ *  DIRECT_READERS threads into DIRECT_DEPTH aligned buffers, which are
+ *  hashed in order as they fill. If the filesystem refuses O_DIRECT, or a
+ *  read can't be aligned (the tail of the file), the page cache is used
+ *  instead and told to drop each buffer's pages once hashed, so a large
+ *  file still doesn't push everything else out of memory.
+ *
+ * Anything other than a regular file is added with hash_add_file.
+ *
+ * @param path File to add
+ * @return 1 if the file's contents were added, else 0
+ */
+char direct_add_file(char *path)
+{
+	struct direct_stream stream;
+	struct direct_job jobs[DIRECT_READERS];
+	pthread_t ids[DIRECT_READERS];
+	char running[DIRECT_READERS];
+	struct direct_slot *slot;
+	unsigned long long b;
+	struct stat st;
+	unsigned int r, s;
+	char ok = 1;
+	FILE *fp;
+
+	stream.buffered_fd = open(path, O_RDONLY);
+	if (stream.buffered_fd < 0)
+		return 0;
+	if (fstat(stream.buffered_fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+			!direct_buffers(&stream)) {
+		fp = fdopen(stream.buffered_fd, "rb");
+		if (fp == NULL) {
+			close(stream.buffered_fd);
+			return 0;
+		}
+		ok = hash_add_file(fp);
+		fclose(fp);
+
+		return ok;
+	}
+
+	/* Filesystems without O_DIRECT (tmpfs) refuse it here */
+#ifdef __linux__
+	stream.fd = open(path, O_RDONLY | O_DIRECT);
+	posix_fadvise(stream.buffered_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+	/* Elsewhere every buffer is read through the page cache */
+	stream.fd = -1;
+#endif
+	stream.refused = 0;
+
+	stream.blocks = ((unsigned long long) st.st_size + DIRECT_BUFFER_SIZE - 1) /
+			DIRECT_BUFFER_SIZE;
+	for (s = 0; s < DIRECT_DEPTH; s++) {
+		stream.slots[s].block = s;
+		stream.slots[s].ready = 0;
+	}
+	stream.stop = 0;
+	pthread_mutex_init(&stream.lock, NULL);
+	pthread_cond_init(&stream.filled, NULL);
+	pthread_cond_init(&stream.freed, NULL);
+
+	for (r = 0; r < DIRECT_READERS; r++) {
+		jobs[r].stream = &stream;
+		jobs[r].first = r;
+		running[r] = pthread_create(&ids[r], NULL, direct_reader,
+				&jobs[r]) == 0;
+	}
+
+	for (b = 0; b < stream.blocks; b++) {
+		slot = &stream.slots[b % DIRECT_DEPTH];
+
+		/* A reader that didn't start has its buffers read here */
+		if (!running[b % DIRECT_READERS]) {
+			slot->length = direct_read(&stream, slot);
+			slot->ready = 1;
+		}
+
+		pthread_mutex_lock(&stream.lock);
+		while (!slot->ready)
+			pthread_cond_wait(&stream.filled, &stream.lock);
+		pthread_mutex_unlock(&stream.lock);
+
+		if (slot->length < 0) {
+			ok = 0;
+			break;
+		}
+		if (slot->length > 0)
+			hash_add_bytes(slot->buffer, (unsigned int) slot->length);
+#ifdef __linux__
+		if (slot->buffered)
+			posix_fadvise(stream.buffered_fd,
+					(off_t) (b * DIRECT_BUFFER_SIZE), slot->length,
+					POSIX_FADV_DONTNEED);
+#endif
+
+		/* A short buffer is the end, even if the file has since grown */
+		if (slot->length < DIRECT_BUFFER_SIZE)
+			break;
+
+		pthread_mutex_lock(&stream.lock);
+		slot->ready = 0;
+		slot->block = b + DIRECT_DEPTH;
+		pthread_cond_broadcast(&stream.freed);
+		pthread_mutex_unlock(&stream.lock);
+	}
+
+	pthread_mutex_lock(&stream.lock);
+	stream.stop = 1;
+	pthread_cond_broadcast(&stream.freed);
+	pthread_mutex_unlock(&stream.lock);
+	for (r = 0; r < DIRECT_READERS; r++)
+		if (running[r])
+			pthread_join(ids[r], NULL);
+
+	pthread_mutex_destroy(&stream.lock);
+	pthread_cond_destroy(&stream.filled);
+	pthread_cond_destroy(&stream.freed);
+	if (stream.huge)
+		munmap(stream.memory, (size_t) DIRECT_DEPTH * DIRECT_BUFFER_SIZE);
+	else
+		free(stream.memory);
+	if (stream.fd >= 0)
+		close(stream.fd);
+	close(stream.buffered_fd);
+
+	return ok;
+}
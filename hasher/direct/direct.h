@@ -0,0 +1,35 @@
+/**
+ * @file direct.h
+ * Header for direct.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DIRECT_H_
+#define DIRECT_H_
+
+/** Bytes in each read buffer - one huge page, and the buffers' alignment */
+#define DIRECT_BUFFER_SIZE (2 * 1024 * 1024)
+/** Threads reading ahead of the hashing */
+#define DIRECT_READERS 2
+/** Buffers, so each reader has two reads in flight or waiting */
+#define DIRECT_DEPTH (2 * DIRECT_READERS)
+
+char direct_add_file(char *);
+
+#endif /* DIRECT_H_ */
@@ -22,6 +22,14 @@
  */
 #import "global.h"
 
+unsigned int i_hash[8];
+unsigned long long ll_hash[8];
+unsigned long long hash_length;
+unsigned long long hash_length2;
+char in_hash;
+unsigned char cur_chunk[80][8];
+unsigned int cur_chunk_pos;
+
 /**
  * Left rotate for unsigned integers
  *
@@ -153,6 +161,20 @@ void be_llll_to_b(unsigned long long ms_ll, unsigned long long ls_ll,
 	b[0] = (ms_ll & 0xFF00000000000000) >> 56;
 }
 
+/**
+ * Convert a 32 bit word to a big endian array of 4 bytes
+ *
+ * @param i Unsigned 32 bit word to be converted
+ * @param b Array of 4 bytes to store the big endian representation of the word
+ */
+void be_i_to_b(unsigned int i, unsigned char b[])
+{
+	b[3] = (i & 0x000000FF) >>  0;
+	b[2] = (i & 0x0000FF00) >>  8;
+	b[1] = (i & 0x00FF0000) >> 16;
+	b[0] = (i & 0xFF000000) >> 24;
+}
+
 /**
  * Convert a little endian array of 4 bytes to 32 bit word
  *
@@ -164,6 +186,20 @@ unsigned int le_b_to_w(unsigned char b[])
 	return b[0] | (b[1] << 8) | (b[2] << 16) | (b[3] << 24);
 }
 
+/**
+ * Convert a 32 bit word to a little endian array of 4 bytes
+ *
+ * @param i Unsigned 32 bit word to be converted
+ * @param b Array of 4 bytes to store the little endian representation
+ */
+void le_i_to_b(unsigned int i, unsigned char b[])
+{
+	b[0] = (i & 0x000000FF) >>  0;
+	b[1] = (i & 0x0000FF00) >>  8;
+	b[2] = (i & 0x00FF0000) >> 16;
+	b[3] = (i & 0xFF000000) >> 24;
+}
+
 /**
  * Convert a 64 bit word to a little endian array of 8 bytes
  *
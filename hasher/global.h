@@ -24,19 +24,19 @@
 #define GLOBAL_H_
 
 /** Array of 32 bit unsigned ints for MD5, SHA1, SHA256, SHA224 */
-unsigned int i_hash[8];
+extern unsigned int i_hash[8];
 /** Array of 64 bit unsigned ints for SHA512, SHA384 */
-unsigned long long ll_hash[8];
+extern unsigned long long ll_hash[8];
 /** Current message length */
-unsigned long long hash_length;
+extern unsigned long long hash_length;
 /** Current message length for SHA512 and SHA384 (128 bit length) */
-unsigned long long hash_length2;
+extern unsigned long long hash_length2;
 /** Stores whether the hash globals are being used */
-char in_hash;
+extern char in_hash;
 /** 80 64 bit words containing the current chunk */
-unsigned char cur_chunk[80][8];
+extern unsigned char cur_chunk[80][8];
 /** Position within the current chunk */
-unsigned int cur_chunk_pos;
+extern unsigned int cur_chunk_pos;
 
 unsigned int i_l_rot(unsigned int, unsigned int);
 unsigned int i_r_rot(unsigned int, unsigned int);
@@ -45,10 +45,12 @@ unsigned long long ll_r_rot(unsigned long long, unsigned long long);
 void be_w_l_rot(unsigned char [], unsigned int);
 unsigned int be_i_b_to_w(unsigned char []);
 unsigned long long be_ll_b_to_w(unsigned char []);
+void be_i_to_b(unsigned int, unsigned char []);
 void be_ll_to_b(unsigned long long, unsigned char []);
 void be_llll_to_b(unsigned long long, unsigned long long, unsigned char []);
 
 unsigned int le_b_to_w(unsigned char []);
+void le_i_to_b(unsigned int, unsigned char []);
 void le_ll_to_b(unsigned long long, unsigned char []);
 
 #endif /* GLOBAL_H_ */
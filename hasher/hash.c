@@ -0,0 +1,684 @@
+/**
+ * @file hash.c
+ * Dispatches to the hashing libraries by hash type, producing byte digests
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "hash.h"
+#include "probes/probes.h"
+#include "stats/stats.h"
+#include "md5/md5.h"
+#include "sha1/sha1.h"
+#include "sha2/sha2.h"
+#include "blake3/blake3.h"
+#include "crc32c/crc32c.h"
+#include "xxh3/xxh3.h"
+
+/** Stores the current hash type */
+enum hash_t hash_type;
+
+/**
+ * Get the digest size of a hash type
+ *
+ * @param type The hash type
+ * @return Number of bytes in the digest
+ */
+unsigned int hash_digest_size(enum hash_t type)
+{
+	switch (type) {
+	case H_MD5:
+		return 16;
+	case H_SHA1:
+		return 20;
+	case H_SHA256:
+		return 32;
+	case H_SHA224:
+		return 28;
+	case H_SHA512:
+		return 64;
+	case H_SHA384:
+		return 48;
+	case H_SHA512_256:
+		return 32;
+	case H_SHA512_224:
+		return 28;
+	case H_BLAKE3:
+		return 32;
+	case H_CRC32C:
+		return 4;
+	case H_XXH3_64:
+		return 8;
+	case H_XXH3_128:
+		return 16;
+	case H_SHA256D:
+		return 32;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the name of a hash type, as given on the command line
+ *
+ * @param type The hash type
+ * @return Null terminated name
+ */
+char *hash_name(enum hash_t type)
+{
+	switch (type) {
+	case H_MD5:
+		return "md5";
+	case H_SHA1:
+		return "sha1";
+	case H_SHA256:
+		return "sha256";
+	case H_SHA224:
+		return "sha224";
+	case H_SHA512:
+		return "sha512";
+	case H_SHA384:
+		return "sha384";
+	case H_SHA512_256:
+		return "sha512-256";
+	case H_SHA512_224:
+		return "sha512-224";
+	case H_BLAKE3:
+		return "blake3";
+	case H_CRC32C:
+		return "crc32c";
+	case H_XXH3_64:
+		return "xxh3";
+	case H_XXH3_128:
+		return "xxh128";
+	case H_SHA256D:
+		return "sha256d";
+	}
+
+	return "";
+}
+
+/**
+ * Get the chunk (block) size of a hash type
+ *
+ * @param type The hash type
+ * @return Number of bytes in a chunk
+ */
+unsigned int hash_block_size(enum hash_t type)
+{
+	switch (type) {
+	case H_SHA512:
+	case H_SHA384:
+	case H_SHA512_256:
+	case H_SHA512_224:
+		return 128;
+	default:
+		return 64;
+	}
+}
+
+/**
+ * Check whether hash_oneshot of a hash type is safe from several threads
+ *
+ * @param type The hash type
+ * @return 1 if it never touches the hash globals, else 0
+ */
+char hash_reentrant(enum hash_t type)
+{
+	switch (type) {
+	case H_BLAKE3:
+	case H_CRC32C:
+	case H_XXH3_64:
+	case H_XXH3_128:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/**
+ * Initialise hashing of the given type
+ *
+ * @param type The hash type
+ * @return 1 if hashing was initialised (nothing else initialised), else 0
+ */
+char hash_init(enum hash_t type)
+{
+	char ret = 0;
+
+	switch (type) {
+	case H_MD5:
+		ret = md5_init();
+		break;
+	case H_SHA1:
+		ret = sha1_init();
+		break;
+	case H_SHA256:
+		ret = sha2_init(SHA256);
+		break;
+	case H_SHA224:
+		ret = sha2_init(SHA224);
+		break;
+	case H_SHA512:
+		ret = sha2_init(SHA512);
+		break;
+	case H_SHA384:
+		ret = sha2_init(SHA384);
+		break;
+	case H_SHA512_256:
+		ret = sha2_init(SHA512_256);
+		break;
+	case H_SHA512_224:
+		ret = sha2_init(SHA512_224);
+		break;
+	case H_BLAKE3:
+		ret = blake3_init();
+		break;
+	case H_CRC32C:
+		ret = crc32c_init();
+		break;
+	case H_XXH3_64:
+		ret = xxh3_init(XXH3_64);
+		break;
+	case H_XXH3_128:
+		ret = xxh3_init(XXH3_128);
+		break;
+	case H_SHA256D:
+		ret = sha2_init(SHA256);
+		break;
+	}
+
+	/* Only take over the hash type if hashing was initialised */
+	if (ret)
+		hash_type = type;
+
+	return ret;
+}
+
+/**
+ * Add a string into the current hash
+ *
+ * @param str Null terminated string
+ * @return 1 if the string was added, else 0
+ */
+char hash_add_string(char *str)
+{
+	switch (hash_type) {
+	case H_MD5:
+		return md5_add_string(str);
+	case H_SHA1:
+		return sha1_add_string(str);
+	case H_BLAKE3:
+		return blake3_add_string(str);
+	case H_CRC32C:
+		return crc32c_add_string(str);
+	case H_XXH3_64:
+	case H_XXH3_128:
+		return xxh3_add_string(str);
+	default:
+		return sha2_add_string(str);
+	}
+}
+
+/**
+ * Add an array of bytes into the current hash
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char hash_add_bytes(unsigned char *bytes, unsigned int length)
+{
+	unsigned long long start = stats_now();
+	char ret;
+
+	switch (hash_type) {
+	case H_MD5:
+		ret = md5_add_bytes(bytes, length);
+		break;
+	case H_SHA1:
+		ret = sha1_add_bytes(bytes, length);
+		break;
+	case H_BLAKE3:
+		ret = blake3_add_bytes(bytes, length);
+		break;
+	case H_CRC32C:
+		ret = crc32c_add_bytes(bytes, length);
+		break;
+	case H_XXH3_64:
+	case H_XXH3_128:
+		ret = xxh3_add_bytes(bytes, length);
+		break;
+	default:
+		ret = sha2_add_bytes(bytes, length);
+		break;
+	}
+	stats_hashed(start, length);
+
+	return ret;
+}
+
+/**
+ * Add a file into the current hash
+ *
+ * @param fp File pointer to the file to be read from
+ * @return 1 if the file's contents was added, else 0
+ */
+char hash_add_file(FILE *fp)
+{
+	switch (hash_type) {
+	case H_MD5:
+		return md5_add_file(fp);
+	case H_SHA1:
+		return sha1_add_file(fp);
+	case H_BLAKE3:
+		return blake3_add_file(fp);
+	case H_CRC32C:
+		return crc32c_add_file(fp);
+	case H_XXH3_64:
+	case H_XXH3_128:
+		return xxh3_add_file(fp);
+	default:
+		return sha2_add_file(fp);
+	}
+}
+
+/**
+ * Serialise the words of an MD5, SHA1 or SHA2 hash as digest bytes
+ *
+ * @param type The hash type
+ * @param i_words Words from md5_get_hash or sha1_get_hash
+ * @param ll_words Words from sha2_get_hash
+ * @param digest Array of at least hash_digest_size() bytes
+ */
+void hash_words_to_digest(enum hash_t type, unsigned int i_words[],
+		unsigned long long ll_words[], unsigned char digest[])
+{
+	unsigned char ll_digest[64];
+	unsigned int i;
+
+	switch (type) {
+	case H_MD5:
+		for (i = 0; i < 4; i++)
+			le_i_to_b(i_words[i], digest + (i * 4));
+		break;
+	case H_SHA1:
+		for (i = 0; i < 5; i++)
+			be_i_to_b(i_words[i], digest + (i * 4));
+		break;
+	case H_SHA256:
+	case H_SHA224:
+		for (i = 0; i < hash_digest_size(type) / 4; i++)
+			be_i_to_b((unsigned int) ll_words[i], digest + (i * 4));
+		break;
+	case H_SHA512:
+	case H_SHA384:
+	case H_SHA512_256:
+	case H_SHA512_224:
+		/* Truncate - SHA512/224 ends half way through a word */
+		for (i = 0; i < 8; i++)
+			be_ll_to_b(ll_words[i], ll_digest + (i * 8));
+		for (i = 0; i < hash_digest_size(type); i++)
+			digest[i] = ll_digest[i];
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Complete hashing and get the digest as bytes
+ *
+ * The digest is in its canonical byte order (little endian words for MD5
+ *  and BLAKE3, big endian words for SHA1, SHA2, CRC32C and XXH3), ready for
+ *  printing or for feeding into another hash.
+ *
+ * @param digest Array of at least hash_digest_size() bytes
+ * @return 1 if the digest was copied, else 0
+ */
+char hash_get_digest(unsigned char digest[])
+{
+	unsigned int i_hash_out[8];
+	unsigned long long ll_hash_out[8];
+	unsigned int i;
+	/* Whether the digest is still in the words */
+	char words = 1;
+
+	switch (hash_type) {
+	case H_MD5:
+		if (!md5_get_hash(i_hash_out))
+			return 0;
+		break;
+	case H_SHA1:
+		if (!sha1_get_hash(i_hash_out))
+			return 0;
+		break;
+	case H_SHA256:
+	case H_SHA224:
+	case H_SHA512:
+	case H_SHA384:
+	case H_SHA512_256:
+	case H_SHA512_224:
+		if (!sha2_get_hash(ll_hash_out))
+			return 0;
+		break;
+	case H_BLAKE3:
+		if (!blake3_get_hash(digest))
+			return 0;
+		words = 0;
+		break;
+	case H_CRC32C:
+		if (!crc32c_get_hash(i_hash_out))
+			return 0;
+		be_i_to_b(i_hash_out[0], digest);
+		words = 0;
+		break;
+	case H_XXH3_64:
+	case H_XXH3_128:
+		if (!xxh3_get_hash(ll_hash_out))
+			return 0;
+		for (i = 0; i < hash_digest_size(hash_type) / 8; i++)
+			be_ll_to_b(ll_hash_out[i], digest + (i * 8));
+		words = 0;
+		break;
+	case H_SHA256D:
+		/* The SHA256 digest, hashed again */
+		if (!sha2_get_hash(ll_hash_out))
+			return 0;
+		for (i = 0; i < 8; i++)
+			i_hash_out[i] = (unsigned int) ll_hash_out[i];
+		sha2_256_32(i_hash_out, i_hash_out);
+		for (i = 0; i < 8; i++)
+			be_i_to_b(i_hash_out[i], digest + (i * 4));
+		words = 0;
+		break;
+	}
+
+	if (words)
+		hash_words_to_digest(hash_type, i_hash_out, ll_hash_out, digest);
+	HASHER_PROBE2(digest, hash_type, hash_digest_size(hash_type));
+
+	return 1;
+}
+
+/**
+ * Hash a whole message in one go and get the digest as bytes
+ *
+ * MD5, SHA1 and SHA2 messages never touch the hash globals - the padding is
+ *  built on the stack, and messages of up to 55 bytes (111 for the SHA512
+ *  types) are a single compression - so they can be hashed even while
+ *  another hash is in progress. Other types go through the streaming
+ *  functions.
+ *
+ * @param type The hash type
+ * @param bytes Message bytes
+ * @param length Number of bytes in the message
+ * @param digest Array of at least hash_digest_size() bytes
+ * @return 1 if the digest was copied, else 0
+ */
+char hash_oneshot(enum hash_t type, const unsigned char *bytes, size_t length,
+		unsigned char digest[])
+{
+	unsigned int i_hash_out[8];
+	unsigned long long ll_hash_out[8];
+	unsigned long long start = stats_now();
+	unsigned int piece;
+
+	switch (type) {
+	case H_MD5:
+		md5_oneshot(bytes, length, i_hash_out);
+		break;
+	case H_SHA1:
+		sha1_oneshot(bytes, length, i_hash_out);
+		break;
+	case H_SHA256:
+		sha2_oneshot(SHA256, bytes, length, ll_hash_out);
+		break;
+	case H_SHA224:
+		sha2_oneshot(SHA224, bytes, length, ll_hash_out);
+		break;
+	case H_SHA512:
+		sha2_oneshot(SHA512, bytes, length, ll_hash_out);
+		break;
+	case H_SHA384:
+		sha2_oneshot(SHA384, bytes, length, ll_hash_out);
+		break;
+	case H_SHA512_256:
+		sha2_oneshot(SHA512_256, bytes, length, ll_hash_out);
+		break;
+	case H_SHA512_224:
+		sha2_oneshot(SHA512_224, bytes, length, ll_hash_out);
+		break;
+	case H_SHA256D:
+		sha2_256d(bytes, length, digest);
+		stats_hashed(start, length);
+		HASHER_PROBE2(digest, type, hash_digest_size(type));
+		return 1;
+	default:
+		if (!hash_init(type))
+			return 0;
+
+		/* The streaming functions take unsigned int lengths */
+		do {
+			piece = length > (1U << 30) ? (1U << 30) : (unsigned int) length;
+			hash_add_bytes((unsigned char *) bytes, piece);
+			bytes += piece;
+			length -= piece;
+		} while (length > 0);
+
+		return hash_get_digest(digest);
+	}
+
+	hash_words_to_digest(type, i_hash_out, ll_hash_out, digest);
+	stats_hashed(start, length);
+	HASHER_PROBE2(digest, type, hash_digest_size(type));
+
+	return 1;
+}
+
+/**
+ * Start a hash kept in a context rather than the hash globals
+ *
+ * @param ctx Context to initialise
+ * @param type The hash type
+ * @return 1 if the context was initialised, else 0 (the type isn't
+ *          reentrant)
+ */
+char hash_ctx_init(struct hash_ctx *ctx, enum hash_t type)
+{
+	if (!hash_reentrant(type))
+		return 0;
+
+	ctx->type = type;
+	ctx->buffered = 0;
+	ctx->length = 0;
+
+	switch (type) {
+	case H_MD5:
+		/* From RFC 1321 */
+		ctx->i_state[0] = 0x67452301;
+		ctx->i_state[1] = 0xEFCDAB89;
+		ctx->i_state[2] = 0x98BADCFE;
+		ctx->i_state[3] = 0x10325476;
+		break;
+	case H_SHA1:
+		/* From FIPS 180-3 */
+		ctx->i_state[0] = 0x67452301;
+		ctx->i_state[1] = 0xEFCDAB89;
+		ctx->i_state[2] = 0x98BADCFE;
+		ctx->i_state[3] = 0x10325476;
+		ctx->i_state[4] = 0xC3D2E1F0;
+		break;
+	case H_SHA224:
+		sha2_iv(SHA224, ctx->i_state, ctx->ll_state);
+		break;
+	case H_SHA512:
+		sha2_iv(SHA512, ctx->i_state, ctx->ll_state);
+		break;
+	case H_SHA384:
+		sha2_iv(SHA384, ctx->i_state, ctx->ll_state);
+		break;
+	case H_SHA512_256:
+		sha2_iv(SHA512_256, ctx->i_state, ctx->ll_state);
+		break;
+	case H_SHA512_224:
+		sha2_iv(SHA512_224, ctx->i_state, ctx->ll_state);
+		break;
+	default:
+		/* SHA256, and the inner hash of double SHA256 */
+		sha2_iv(SHA256, ctx->i_state, ctx->ll_state);
+		break;
+	}
+
+	return 1;
+}
+
+/**
+ * Compress whole chunks into a context's state
+ *
+ * @param ctx The context
+ * @param bytes Chunks
+ * @param chunks Number of chunks
+ */
+void hash_ctx_compress(struct hash_ctx *ctx, const unsigned char *bytes,
+		size_t chunks)
+{
+	unsigned int i_words[16];
+	unsigned long long ll_words[16];
+	unsigned char *chunk;
+	size_t c;
+	int i;
+
+	for (c = 0; c < chunks; c++) {
+		chunk = (unsigned char *) bytes + (c * hash_block_size(ctx->type));
+
+		switch (ctx->type) {
+		case H_MD5:
+			for (i = 0; i < 16; i++)
+				i_words[i] = le_b_to_w(chunk + (i * 4));
+			md5_compress(ctx->i_state, i_words);
+			break;
+		case H_SHA1:
+			for (i = 0; i < 16; i++)
+				i_words[i] = be_i_b_to_w(chunk + (i * 4));
+			sha1_compress(ctx->i_state, i_words);
+			break;
+		case H_SHA512:
+		case H_SHA384:
+		case H_SHA512_256:
+		case H_SHA512_224:
+			for (i = 0; i < 16; i++)
+				ll_words[i] = be_ll_b_to_w(chunk + (i * 8));
+			sha2_ll_compress(ctx->ll_state, ll_words);
+			break;
+		default:
+			for (i = 0; i < 16; i++)
+				i_words[i] = be_i_b_to_w(chunk + (i * 4));
+			sha2_i_compress(ctx->i_state, i_words);
+			break;
+		}
+	}
+}
+
+/**
+ * Add bytes to a hash kept in a context
+ *
+ * @param ctx The context
+ * @param bytes Bytes to add
+ * @param length Number of bytes
+ */
+void hash_ctx_add(struct hash_ctx *ctx, const unsigned char *bytes,
+		size_t length)
+{
+	unsigned int block = hash_block_size(ctx->type), fill;
+	unsigned long long start = stats_now();
+	size_t whole, total = length;
+
+	ctx->length += length;
+
+	/* Top up a part chunk first */
+	if (ctx->buffered > 0) {
+		fill = block - ctx->buffered < length ? block - ctx->buffered :
+				(unsigned int) length;
+		memcpy(ctx->chunk + ctx->buffered, bytes, fill);
+		ctx->buffered += fill;
+		bytes += fill;
+		length -= fill;
+		if (ctx->buffered < block) {
+			stats_hashed(start, total);
+			return;
+		}
+		hash_ctx_compress(ctx, ctx->chunk, 1);
+		ctx->buffered = 0;
+	}
+
+	/* Whole chunks straight from the bytes, then keep the rest */
+	whole = length / block;
+	hash_ctx_compress(ctx, bytes, whole);
+	ctx->buffered = length - (whole * block);
+	memcpy(ctx->chunk, bytes + (whole * block), ctx->buffered);
+
+	stats_hashed(start, total);
+}
+
+/**
+ * Complete a hash kept in a context and get the digest as bytes
+ *
+ * @param ctx The context (no longer usable)
+ * @param digest Array of at least hash_digest_size() bytes
+ */
+void hash_ctx_final(struct hash_ctx *ctx, unsigned char digest[])
+{
+	unsigned char tail[2 * HASH_MAX_BLOCK];
+	unsigned long long ll_words[8];
+	unsigned int outer[8];
+	unsigned int block = hash_block_size(ctx->type);
+	unsigned int size = block == 128 ? 16 : 8, tail_length, i;
+
+	/* Tail, 0b10000000, 0's, then the bit length - one or two chunks */
+	tail_length = ctx->buffered < block - size ? block : 2 * block;
+	memset(tail, 0, tail_length);
+	memcpy(tail, ctx->chunk, ctx->buffered);
+	tail[ctx->buffered] = 0x80;
+	if (ctx->type == H_MD5)
+		le_ll_to_b(ctx->length * 8, tail + tail_length - 8);
+	else if (size == 16)
+		be_llll_to_b(ctx->length >> 61, ctx->length << 3,
+				tail + tail_length - 16);
+	else
+		be_ll_to_b(ctx->length * 8, tail + tail_length - 8);
+	hash_ctx_compress(ctx, tail, tail_length / block);
+
+	if (ctx->type == H_SHA256D) {
+		/* The SHA256 digest, hashed again */
+		sha2_256_32(ctx->i_state, outer);
+		for (i = 0; i < 8; i++)
+			be_i_to_b(outer[i], digest + (i * 4));
+	} else {
+		/* SHA256 and SHA224 words go through the 64 bit words */
+		for (i = 0; i < 8; i++)
+			ll_words[i] = block == 128 ? ctx->ll_state[i] : ctx->i_state[i];
+		hash_words_to_digest(ctx->type, ctx->i_state, ll_words, digest);
+	}
+	HASHER_PROBE2(digest, ctx->type, hash_digest_size(ctx->type));
+}
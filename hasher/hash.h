@@ -0,0 +1,84 @@
+/**
+ * @file hash.h
+ * Header for hash.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HASH_H_
+#define HASH_H_
+
+/** Hash types known */
+enum hash_t {
+	H_MD5,
+	H_SHA1,
+	H_SHA256,
+	H_SHA224,
+	H_SHA512,
+	H_SHA384,
+	H_SHA512_256,
+	H_SHA512_224,
+	H_BLAKE3,
+	H_CRC32C,
+	H_XXH3_64,
+	H_XXH3_128,
+	H_SHA256D
+};
+
+/** Largest digest produced by any of the hash types, in bytes */
+#define HASH_MAX_DIGEST 64
+/** Largest chunk (block) used by any of the hash types, in bytes */
+#define HASH_MAX_BLOCK 128
+
+/**
+ * A hash in progress kept apart from the hash globals, so any number can be
+ *  in progress at once (MD5, SHA1 and SHA2 only - see hash_reentrant)
+ */
+struct hash_ctx {
+	/** The hash type */
+	enum hash_t type;
+	/** Hash state for MD5, SHA1, SHA256, SHA224 */
+	unsigned int i_state[8];
+	/** Hash state for the SHA512 types */
+	unsigned long long ll_state[8];
+	/** Bytes waiting for a whole chunk */
+	unsigned char chunk[HASH_MAX_BLOCK];
+	/** Number of bytes in chunk */
+	unsigned int buffered;
+	/** Message length so far, in bytes */
+	unsigned long long length;
+};
+
+unsigned int hash_digest_size(enum hash_t);
+unsigned int hash_block_size(enum hash_t);
+char *hash_name(enum hash_t);
+char hash_reentrant(enum hash_t);
+
+char hash_init(enum hash_t);
+char hash_add_string(char *);
+char hash_add_bytes(unsigned char *, unsigned int);
+char hash_add_file(FILE *);
+char hash_get_digest(unsigned char []);
+char hash_oneshot(enum hash_t, const unsigned char *, size_t,
+		unsigned char []);
+
+char hash_ctx_init(struct hash_ctx *, enum hash_t);
+void hash_ctx_add(struct hash_ctx *, const unsigned char *, size_t);
+void hash_ctx_final(struct hash_ctx *, unsigned char []);
+
+#endif /* HASH_H_ */
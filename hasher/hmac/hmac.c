@@ -0,0 +1,240 @@
+/**
+ * @file hmac.c
+ * An implementation of HMAC, described in RFC 2104, on top of MD5, SHA1 and SHA2
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+
+#include "../global.h"
+#include "../hash.h"
+#include "hmac.h"
+
+/** Inner padding byte - from RFC 2104 */
+#define HMAC_IPAD 0x36
+/** Outer padding byte - from RFC 2104 */
+#define HMAC_OPAD 0x5C
+
+extern unsigned int i_hash[8];
+extern unsigned long long ll_hash[8];
+extern unsigned long long hash_length;
+extern char in_hash;
+
+char hmac_save_midstate(enum hash_t, unsigned char *, unsigned int,
+		unsigned char, unsigned int [], unsigned long long []);
+char hmac_load_midstate(enum hash_t, unsigned int [], unsigned long long []);
+
+/**
+ * Compress one padded key chunk and save the resulting midstate
+ *
+ * @param type The hash type
+ * @param key Key, already at most one chunk long
+ * @param key_length Number of bytes in the key
+ * @param pad Padding byte to XOR the key with
+ * @param i_mid Array of 8 unsigned ints to store a 32 bit midstate
+ * @param ll_mid Array of 8 unsigned double longs to store a 64 bit midstate
+ * @return 1 if the midstate was saved, else 0
+ */
+char hmac_save_midstate(enum hash_t type, unsigned char *key,
+		unsigned int key_length, unsigned char pad, unsigned int i_mid[],
+		unsigned long long ll_mid[])
+{
+	unsigned char chunk[HASH_MAX_BLOCK];
+	unsigned int block_size = hash_block_size(type);
+	unsigned int i;
+
+	if (!hash_init(type))
+		return 0;
+
+	/* Build the padded key chunk (key is zero extended to a full chunk) */
+	for (i = 0; i < block_size; i++)
+		chunk[i] = (i < key_length ? key[i] : 0x00) ^ pad;
+
+	/* A full chunk is processed straight away, leaving the midstate */
+	hash_add_bytes(chunk, block_size);
+
+	for (i = 0; i < 8; i++) {
+		i_mid[i] = i_hash[i];
+		ll_mid[i] = ll_hash[i];
+	}
+
+	/* Abandon the hash - it is never completed */
+	in_hash = 0;
+
+	return 1;
+}
+
+/**
+ * Start a hash from a saved midstate, as if one chunk had been added
+ *
+ * @param type The hash type
+ * @param i_mid 32 bit midstate
+ * @param ll_mid 64 bit midstate
+ * @return 1 if hashing was initialised (nothing else initialised), else 0
+ */
+char hmac_load_midstate(enum hash_t type, unsigned int i_mid[],
+		unsigned long long ll_mid[])
+{
+	unsigned int i;
+
+	if (!hash_init(type))
+		return 0;
+
+	for (i = 0; i < 8; i++) {
+		i_hash[i] = i_mid[i];
+		ll_hash[i] = ll_mid[i];
+	}
+
+	/* The padded key chunk counts towards the message length */
+	hash_length = hash_block_size(type) * 8;
+
+	return 1;
+}
+
+/**
+ * Prepare a key for HMAC hashing
+ *
+ * @param key Key structure to be filled in
+ * @param type The underlying hash type
+ * @param bytes Key bytes
+ * @param length Number of bytes in the key
+ * @return 1 if the key was prepared, else 0 (including for BLAKE3, CRC32C
+ *          and XXH3, which have no midstate to save)
+ */
+char hmac_key_init(struct hmac_key *key, enum hash_t type,
+		unsigned char *bytes, unsigned int length)
+{
+	unsigned char digest[HASH_MAX_DIGEST];
+
+	if (type == H_BLAKE3 || type == H_CRC32C || type == H_XXH3_64 ||
+			type == H_XXH3_128)
+		return 0;
+
+	/* Keys longer than a chunk are replaced by their hash */
+	if (length > hash_block_size(type)) {
+		if (!hash_init(type))
+			return 0;
+		hash_add_bytes(bytes, length);
+		hash_get_digest(digest);
+
+		bytes = digest;
+		length = hash_digest_size(type);
+	}
+
+	key->type = type;
+	return hmac_save_midstate(type, bytes, length, HMAC_IPAD,
+			key->i_inner, key->ll_inner) &&
+		hmac_save_midstate(type, bytes, length, HMAC_OPAD,
+			key->i_outer, key->ll_outer);
+}
+
+/**
+ * Prepare a key for HMAC hashing, reading the key from a file
+ *
+ * @param key Key structure to be filled in
+ * @param type The underlying hash type
+ * @param fp File pointer to the key file
+ * @return 1 if the key was prepared, else 0
+ */
+char hmac_key_init_file(struct hmac_key *key, enum hash_t type, FILE *fp)
+{
+	unsigned char bytes[HASH_MAX_BLOCK + 1];
+	unsigned char digest[HASH_MAX_DIGEST];
+	unsigned int block_size = hash_block_size(type);
+	unsigned int length;
+
+	/* Read one byte more than a chunk to find out if the key fits */
+	length = fread(bytes, 1, block_size + 1, fp);
+	if (length <= block_size)
+		return hmac_key_init(key, type, bytes, length);
+
+	/* Too long - hash what was read plus the rest of the file */
+	if (!hash_init(type))
+		return 0;
+	hash_add_bytes(bytes, length);
+	hash_add_file(fp);
+	hash_get_digest(digest);
+
+	return hmac_key_init(key, type, digest, hash_digest_size(type));
+}
+
+/**
+ * Initialise HMAC hashing of a message
+ *
+ * The message is added with the hash_add_* functions.
+ *
+ * @param key Prepared key
+ * @return 1 if HMAC hashing was initialised (nothing else initialised), else 0
+ */
+char hmac_init(struct hmac_key *key)
+{
+	return hmac_load_midstate(key->type, key->i_inner, key->ll_inner);
+}
+
+/**
+ * Complete HMAC hashing and get the digest
+ *
+ * @param key Prepared key (the same one given to hmac_init)
+ * @param digest Array of at least hash_digest_size() bytes
+ * @return 1 if the digest was copied, else 0
+ */
+char hmac_get_digest(struct hmac_key *key, unsigned char digest[])
+{
+	unsigned char inner[HASH_MAX_DIGEST];
+
+	/* Complete the inner hash */
+	if (!hash_get_digest(inner))
+		return 0;
+
+	/* Hash the inner digest on top of the outer midstate */
+	if (!hmac_load_midstate(key->type, key->i_outer, key->ll_outer))
+		return 0;
+	hash_add_bytes(inner, hash_digest_size(key->type));
+
+	return hash_get_digest(digest);
+}
+
+/**
+ * HMAC a batch of messages with the same key
+ *
+ * @param key Prepared key
+ * @param messages Array of messages
+ * @param lengths Number of bytes in each message
+ * @param count Number of messages
+ * @param digests Array of count * hash_digest_size() bytes, filled in with
+ *                 the digests back to back
+ * @return 1 if all of the digests were copied, else 0
+ */
+char hmac_batch(struct hmac_key *key, unsigned char *messages[],
+		unsigned int lengths[], unsigned int count, unsigned char digests[])
+{
+	unsigned int digest_size = hash_digest_size(key->type);
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (!hmac_init(key))
+			return 0;
+		hash_add_bytes(messages[i], lengths[i]);
+		if (!hmac_get_digest(key, digests + (i * digest_size)))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file hmac.h
+ * Header for hmac.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HMAC_H_
+#define HMAC_H_
+
+/**
+ * A prepared HMAC key
+ *
+ * Holds the hash state after compressing the key XOR ipad and key XOR opad
+ *  chunks, so each message only pays for its own chunks plus one outer chunk
+ */
+struct hmac_key {
+	/** Underlying hash type */
+	enum hash_t type;
+	/** Inner (ipad) midstate for MD5, SHA1, SHA256, SHA224 */
+	unsigned int i_inner[8];
+	/** Outer (opad) midstate for MD5, SHA1, SHA256, SHA224 */
+	unsigned int i_outer[8];
+	/** Inner (ipad) midstate for SHA512, SHA384 */
+	unsigned long long ll_inner[8];
+	/** Outer (opad) midstate for SHA512, SHA384 */
+	unsigned long long ll_outer[8];
+};
+
+char hmac_key_init(struct hmac_key *, enum hash_t, unsigned char *,
+		unsigned int);
+char hmac_key_init_file(struct hmac_key *, enum hash_t, FILE *);
+char hmac_init(struct hmac_key *);
+char hmac_get_digest(struct hmac_key *, unsigned char []);
+char hmac_batch(struct hmac_key *, unsigned char *[], unsigned int [],
+		unsigned int, unsigned char []);
+
+#endif /* HMAC_H_ */
@@ -0,0 +1,455 @@
+/**
+ * @file known.c
+ * Known digest sets - a memory-mapped sorted digest index behind a
+ *  Bloom filter, and the builder that compiles text hash lists into one
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../global.h"
+#include "../hash.h"
+#include "../stats/stats.h"
+#include "known.h"
+
+/** Multipliers picking one bit of each word of a Bloom block - from Parquet */
+const unsigned int known_salts[8] = {
+		0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+		0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+
+/** Digest size of the records being sorted by the builder */
+unsigned int known_sort_size;
+
+/**
+ * Hash a digest for the Bloom filter
+ *
+ * Digests are already well mixed, but short ones (CRC32C, XXH3) and the
+ *  leading bytes the fan-out table uses are folded in all the same.
+ *
+ * @param digest Digest bytes
+ * @param size Number of bytes in the digest
+ * @return 64 bit hash - the high half picks the block, the low half the bits
+ */
+unsigned long long known_bloom_hash(const unsigned char digest[],
+		unsigned int size)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		h = (h ^ digest[i]) * 0x100000001b3ULL;
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+
+	return h ^ (h >> 31);
+}
+
+/**
+ * Find the bits of a digest in a split block Bloom filter
+ *
+ * Each block is eight 32 bit words and a digest sets one bit in each, so a
+ *  lookup touches a single cache line.
+ *
+ * @param h Hash from known_bloom_hash
+ * @param blocks Number of blocks (a power of 2)
+ * @param bytes Byte of the filter holding each bit
+ * @param masks The bit in each byte
+ */
+void known_bloom_bits(unsigned long long h, unsigned long long blocks,
+		unsigned long long bytes[], unsigned char masks[])
+{
+	unsigned long long block = (h >> 32) & (blocks - 1);
+	unsigned int bit, w;
+
+	for (w = 0; w < 8; w++) {
+		bit = ((unsigned int) h * known_salts[w]) >> 27;
+		bytes[w] = (block * 32) + (w * 4) + (bit / 8);
+		masks[w] = 1 << (bit % 8);
+	}
+}
+
+/**
+ * Get the offsets of the parts of an index
+ *
+ * @param size Digest size
+ * @param tag_count Number of tags
+ * @param count Number of digests
+ * @param blocks Number of Bloom filter blocks
+ * @param offsets Offsets of the tags, fan-out table, Bloom filter, digests
+ *                 and tag numbers, then the end of the file
+ */
+void known_layout(unsigned int size, unsigned int tag_count,
+		unsigned long long count, unsigned long long blocks,
+		unsigned long long offsets[])
+{
+	offsets[0] = KNOWN_HEADER_SIZE;
+	offsets[1] = offsets[0] + (tag_count * KNOWN_TAG_SIZE);
+	offsets[2] = (offsets[1] + (KNOWN_FANOUT * 8) + 63) & ~63ULL;
+	offsets[3] = offsets[2] + (blocks * 32);
+	offsets[4] = offsets[3] + (count * size);
+	offsets[5] = offsets[4] + count;
+}
+
+/**
+ * Map a known digest index into memory
+ *
+ * Nothing is copied into the heap - lookups read the mapping, so the page
+ *  cache is shared between processes sweeping with the same index.
+ *
+ * @param path Index file
+ * @param set Index to be filled in (close with known_close)
+ * @return 1 if a whole, consistent index was mapped, else 0
+ */
+char known_open(char *path, struct known *set)
+{
+	unsigned long long offsets[6], entry, last = 0;
+	const unsigned char *header;
+	struct stat st;
+	unsigned int t;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) < 0 || st.st_size < KNOWN_HEADER_SIZE) {
+		close(fd);
+		return 0;
+	}
+
+	set->map_size = (size_t) st.st_size;
+	set->map = mmap(NULL, set->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (set->map == MAP_FAILED)
+		return 0;
+	header = set->map;
+
+	set->type = (enum hash_t) header[4];
+	set->tag_count = header[6];
+	set->count = be_ll_b_to_w((unsigned char *) header + 8);
+	set->blocks = be_ll_b_to_w((unsigned char *) header + 16);
+
+	if (memcmp(header, KNOWN_MAGIC, 4) != 0 || header[4] > H_SHA256D ||
+			header[5] != hash_digest_size(set->type) ||
+			set->blocks == 0 || (set->blocks & (set->blocks - 1)) != 0 ||
+			set->count > set->map_size || set->blocks > set->map_size) {
+		munmap(set->map, set->map_size);
+		return 0;
+	}
+
+	known_layout(header[5], set->tag_count, set->count, set->blocks, offsets);
+	if (offsets[5] != set->map_size) {
+		munmap(set->map, set->map_size);
+		return 0;
+	}
+
+	set->tags = (const char *) header + offsets[0];
+	set->fanout = header + offsets[1];
+	set->bloom = header + offsets[2];
+	set->digests = header + offsets[3];
+	set->classes = header + offsets[4];
+
+	/* Lookups trust the fan-out table to stay within the digests */
+	for (t = 0; t < KNOWN_FANOUT; t++) {
+		entry = be_ll_b_to_w((unsigned char *) set->fanout + (t * 8));
+		if (entry < last || (t == KNOWN_FANOUT - 1 && entry != set->count)) {
+			munmap(set->map, set->map_size);
+			return 0;
+		}
+		last = entry;
+	}
+
+	/* Lookups jump about */
+	madvise(set->map, set->map_size, MADV_RANDOM);
+
+	return 1;
+}
+
+/**
+ * Unmap a known digest index
+ *
+ * @param set The index
+ */
+void known_close(struct known *set)
+{
+	munmap(set->map, set->map_size);
+	set->map = NULL;
+}
+
+/**
+ * Look a digest up in a known digest index
+ *
+ * The Bloom filter turns away almost every unknown digest with one cache
+ *  line. Otherwise the fan-out table narrows the sorted digests down to
+ *  those sharing the leading 16 bits, which are binary searched.
+ *
+ * @param set The index
+ * @param digest Digest of the index's hash type
+ * @return Tag of the digest, or NULL if it isn't in the index
+ */
+const char *known_lookup(const struct known *set, const unsigned char digest[])
+{
+	unsigned int size = hash_digest_size(set->type), w;
+	unsigned long long bytes[8], low, high, mid;
+	unsigned char masks[8];
+	unsigned int lead = (digest[0] << 8) | (size > 1 ? digest[1] : 0);
+	int cmp;
+
+	STATS_ADD(S_KNOWN_LOOKUPS, 1);
+	known_bloom_bits(known_bloom_hash(digest, size), set->blocks, bytes, masks);
+	for (w = 0; w < 8; w++)
+		if (!(set->bloom[bytes[w]] & masks[w]))
+			return NULL;
+
+	low = be_ll_b_to_w((unsigned char *) set->fanout + (lead * 8));
+	high = be_ll_b_to_w((unsigned char *) set->fanout + ((lead + 1) * 8));
+	while (low < high) {
+		mid = low + ((high - low) / 2);
+		cmp = memcmp(set->digests + (mid * size), digest, size);
+		if (cmp == 0) {
+			STATS_ADD(S_KNOWN_HITS, 1);
+			return set->classes[mid] < set->tag_count ?
+					set->tags + (set->classes[mid] * KNOWN_TAG_SIZE) : "";
+		}
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+/**
+ * Compare two builder records by digest
+ *
+ * @param a First record
+ * @param b Second record
+ * @return memcmp of the digests
+ */
+int known_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, known_sort_size);
+}
+
+/**
+ * Read a hex digest from the start of a line
+ *
+ * @param line Line of text
+ * @param size Digest size
+ * @param digest Array to store the digest
+ * @return 1 if the line starts with exactly size bytes of hex, else 0
+ */
+char known_parse_hex(char *line, unsigned int size, unsigned char digest[])
+{
+	unsigned int i, nibble, value = 0;
+	char c;
+
+	for (i = 0; i < 2 * size; i++) {
+		c = line[i];
+		if (c >= '0' && c <= '9')
+			nibble = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			nibble = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			nibble = c - 'A' + 10;
+		else
+			return 0;
+		value = (i % 2) ? (value << 4) | nibble : nibble;
+		if (i % 2)
+			digest[i / 2] = (unsigned char) value;
+	}
+
+	/* The digest must end there - md5sum style names may follow */
+	c = line[2 * size];
+	return c == '\0' || c == '\n' || c == '\r' || c == ' ' || c == '\t' ||
+			c == ',';
+}
+
+/**
+ * Compile text hash lists into a known digest index
+ *
+ * Each list line starts with a hex digest - anything after it (such as the
+ *  file name in md5sum output) is ignored, as are blank lines and lines
+ *  starting with #. Every digest of a list gets the list's tag. A digest in
+ *  several lists keeps the tag of the first.
+ *
+ * @param path Index file to write
+ * @param type Hash type of the digests
+ * @param lists List files, each path or path:tag (the tag defaults to
+ *               "known")
+ * @param list_count Number of lists
+ * @return 1 if the index was written, else 0
+ */
+char known_build(char *path, enum hash_t type, char *lists[],
+		unsigned int list_count)
+{
+	unsigned int size = hash_digest_size(type), stride = size + 2;
+	char tags[KNOWN_MAX_TAGS][KNOWN_TAG_SIZE], line[4096], *tag, *colon;
+	unsigned long long count = 0, capacity = 1 << 16, m, kept, blocks;
+	unsigned long long offsets[6], *fanout, bytes[8];
+	unsigned char header[KNOWN_HEADER_SIZE], number[8], masks[8];
+	unsigned char *records, *bloom, *grown;
+	unsigned long line_number;
+	unsigned int l, t, w;
+	FILE *fp, *out;
+	char ok = 1;
+
+	if (list_count > KNOWN_MAX_TAGS)
+		return 0;
+
+	records = malloc(capacity * stride);
+	if (records == NULL)
+		return 0;
+
+	/* Records are the digest, then the list number (to keep the first) */
+	for (l = 0; ok && l < list_count; l++) {
+		colon = strrchr(lists[l], ':');
+		tag = colon != NULL ? colon + 1 : "known";
+		memset(tags[l], 0, KNOWN_TAG_SIZE);
+		strncpy(tags[l], tag, KNOWN_TAG_SIZE - 1);
+		if (colon != NULL)
+			*colon = '\0';
+
+		fp = fopen(lists[l], "r");
+		if (colon != NULL)
+			*colon = ':';
+		if (fp == NULL) {
+			fprintf(stderr, "Unable to open hash list %s\n", lists[l]);
+			ok = 0;
+			break;
+		}
+
+		for (line_number = 1; ok && fgets(line, sizeof(line), fp) != NULL;
+				line_number++) {
+			if (line[0] == '#' || line[0] == '\n' || line[0] == '\r' ||
+					line[0] == '\0')
+				continue;
+
+			if (count == capacity) {
+				grown = realloc(records, capacity * 2 * stride);
+				if (grown == NULL) {
+					ok = 0;
+					break;
+				}
+				records = grown;
+				capacity *= 2;
+			}
+
+			if (!known_parse_hex(line, size, records + (count * stride))) {
+				fprintf(stderr, "%s:%lu: not a %s digest\n", lists[l],
+						line_number, hash_name(type));
+				ok = 0;
+				break;
+			}
+			records[(count * stride) + size] = (unsigned char) (l >> 8);
+			records[(count * stride) + size + 1] = (unsigned char) l;
+			count++;
+		}
+		fclose(fp);
+	}
+
+	if (!ok) {
+		free(records);
+		return 0;
+	}
+
+	/* Sorting by digest and list number puts each digest's first list first */
+	known_sort_size = stride;
+	qsort(records, count, stride, known_compare);
+	for (m = 0, kept = 0; m < count; m++) {
+		if (kept > 0 && memcmp(records + ((kept - 1) * stride),
+				records + (m * stride), size) == 0)
+			continue;
+		memmove(records + (kept * stride), records + (m * stride), stride);
+		kept++;
+	}
+	count = kept;
+
+	for (blocks = 1; blocks * 256 < count * KNOWN_BLOOM_BITS; blocks <<= 1)
+		;
+	bloom = calloc(blocks, 32);
+	fanout = calloc(KNOWN_FANOUT, sizeof(unsigned long long));
+	if (bloom == NULL || fanout == NULL) {
+		free(records);
+		free(bloom);
+		free(fanout);
+		return 0;
+	}
+
+	for (m = 0; m < count; m++) {
+		unsigned char *digest = records + (m * stride);
+
+		known_bloom_bits(known_bloom_hash(digest, size), blocks, bytes,
+				masks);
+		for (w = 0; w < 8; w++)
+			bloom[bytes[w]] |= masks[w];
+
+		fanout[((digest[0] << 8) | (size > 1 ? digest[1] : 0)) + 1]++;
+	}
+	for (t = 1; t < KNOWN_FANOUT; t++)
+		fanout[t] += fanout[t - 1];
+
+	known_layout(size, list_count, count, blocks, offsets);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, KNOWN_MAGIC, 4);
+	header[4] = (unsigned char) type;
+	header[5] = (unsigned char) size;
+	header[6] = (unsigned char) list_count;
+	be_ll_to_b(count, header + 8);
+	be_ll_to_b(blocks, header + 16);
+
+	out = fopen(path, "wb");
+	if (out == NULL) {
+		free(records);
+		free(bloom);
+		free(fanout);
+		return 0;
+	}
+
+	ok = fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+			fwrite(tags, KNOWN_TAG_SIZE, list_count, out) == list_count;
+	for (t = 0; ok && t < KNOWN_FANOUT; t++) {
+		be_ll_to_b(fanout[t], number);
+		ok = fwrite(number, 1, 8, out) == 8;
+	}
+	for (m = offsets[1] + (KNOWN_FANOUT * 8); ok && m < offsets[2]; m++)
+		ok = fputc(0, out) != EOF;
+	ok = ok && fwrite(bloom, 32, blocks, out) == blocks;
+	for (m = 0; ok && m < count; m++)
+		ok = fwrite(records + (m * stride), 1, size, out) == size;
+	for (m = 0; ok && m < count; m++)
+		ok = fputc(records[(m * stride) + size + 1], out) != EOF;
+	if (fclose(out) != 0)
+		ok = 0;
+
+	free(records);
+	free(bloom);
+	free(fanout);
+
+	return ok;
+}
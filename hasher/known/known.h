@@ -0,0 +1,82 @@
+/**
+ * @file known.h
+ * Header for known.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KNOWN_H_
+#define KNOWN_H_
+
+/** Identifies a known digest index file */
+#define KNOWN_MAGIC "HKS1"
+/** Bytes in an index header */
+#define KNOWN_HEADER_SIZE 64
+/** Bytes in a tag (class name), including at least one null */
+#define KNOWN_TAG_SIZE 16
+/** Most tags an index can hold */
+#define KNOWN_MAX_TAGS 255
+/** Entries in the fan-out table - one per leading 16 bits, plus the end */
+#define KNOWN_FANOUT 65537
+/** Bloom filter bits per digest, rounded up to a power of 2 of blocks */
+#define KNOWN_BLOOM_BITS 16
+
+/**
+ * A memory-mapped known digest index
+ *
+ * On disk, the header is KNOWN_MAGIC, the hash type, digest size and tag
+ *  count as single bytes, a zero byte, then the digest count and Bloom
+ *  filter block count as big endian 64 bit numbers, zero padded to
+ *  KNOWN_HEADER_SIZE. The tags follow, null padded to KNOWN_TAG_SIZE each,
+ *  then the fan-out table as big endian 64 bit numbers (entry n is the
+ *  number of digests whose leading 16 bits are below n). After padding to
+ *  a multiple of 64 bytes come the split block Bloom filter's 32 byte
+ *  blocks, then the sorted digests, then a tag number for each digest.
+ */
+struct known {
+	/** Hash type of the digests */
+	enum hash_t type;
+	/** Number of digests */
+	unsigned long long count;
+	/** Number of 32 byte Bloom filter blocks (a power of 2) */
+	unsigned long long blocks;
+	/** Number of tags */
+	unsigned int tag_count;
+	/** Tags, KNOWN_TAG_SIZE bytes each */
+	const char *tags;
+	/** Fan-out table */
+	const unsigned char *fanout;
+	/** Bloom filter */
+	const unsigned char *bloom;
+	/** Sorted digests */
+	const unsigned char *digests;
+	/** Tag number of each digest */
+	const unsigned char *classes;
+	/** The mapped file */
+	void *map;
+	/** Bytes mapped */
+	size_t map_size;
+};
+
+char known_open(char *, struct known *);
+void known_close(struct known *);
+const char *known_lookup(const struct known *, const unsigned char []);
+
+char known_build(char *, enum hash_t, char *[], unsigned int);
+
+#endif /* KNOWN_H_ */
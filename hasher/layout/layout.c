@@ -0,0 +1,192 @@
+/**
+ * @file layout.c
+ * Where files lie - physical extents (FIEMAP) and page cache residency
+ *  (mincore, or RWF_NOWAIT reads) - to hash files in disk order
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* preadv2 */
+#define _GNU_SOURCE
+
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "layout.h"
+
+/**
+ * Find the byte offset of a file's first extent on its device
+ *
+ * @param fd File descriptor
+ * @param physical Set to the offset
+ * @return 1 if the file has a mapped extent, else 0 (no FIEMAP, or no
+ *          extents - empty, sparse or inline)
+ */
+char layout_physical(int fd, unsigned long long *physical)
+{
+#ifdef __linux__
+	/* Room for a single extent */
+	union {
+		struct fiemap map;
+		char bytes[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+	} request;
+
+	memset(&request, 0, sizeof(request));
+	request.map.fm_start = 0;
+	request.map.fm_length = FIEMAP_MAX_OFFSET;
+	request.map.fm_extent_count = 1;
+	if (ioctl(fd, FS_IOC_FIEMAP, &request.map) < 0 ||
+			request.map.fm_mapped_extents < 1)
+		return 0;
+
+	*physical = request.map.fm_extents[0].fe_physical;
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Check whether the start of a file is all in the page cache
+ *
+ * The file is mapped and the pages checked with mincore, which reads
+ *  nothing. Files that cannot be mapped get a RWF_NOWAIT read of their
+ *  first page, which fails rather than wait on the disk (on Linux - they
+ *  are taken as not cached elsewhere).
+ *
+ * @param fd File descriptor
+ * @param size Bytes in the file
+ * @return 1 if the first LAYOUT_PROBE_SIZE bytes (or the whole file, if
+ *          shorter) are cached, else 0
+ */
+char layout_cached(int fd, unsigned long long size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t length = size < LAYOUT_PROBE_SIZE ? size : LAYOUT_PROBE_SIZE;
+	size_t pages, p;
+	unsigned char *resident;
+#ifdef RWF_NOWAIT
+	unsigned char first[1];
+	struct iovec iov;
+#endif
+	char cached = 1;
+	void *map;
+
+	if (length == 0)
+		return 1;
+	if (page <= 0)
+		page = 4096;
+
+	map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+#ifdef RWF_NOWAIT
+		iov.iov_base = first;
+		iov.iov_len = sizeof(first);
+		return preadv2(fd, &iov, 1, 0, RWF_NOWAIT) > 0;
+#else
+		return 0;
+#endif
+	}
+
+	pages = (length + page - 1) / page;
+	resident = malloc(pages);
+	if (resident == NULL || mincore(map, length, (void *) resident) < 0) {
+		cached = 0;
+	} else {
+		for (p = 0; p < pages; p++) {
+			if (!(resident[p] & 1)) {
+				cached = 0;
+				break;
+			}
+		}
+	}
+
+	free(resident);
+	munmap(map, length);
+
+	return cached;
+}
+
+/**
+ * Find where a file lies
+ *
+ * @param path The file
+ * @param where Set to where the file lies - files that cannot be opened
+ *               are put last, as not cached on an unknown device
+ * @return 1 if the file could be looked at, else 0
+ */
+char layout_probe(char *path, struct layout *where)
+{
+	struct stat st;
+	int fd;
+
+	where->cached = 0;
+	where->device = ~0ULL;
+	where->physical = ~0ULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return 0;
+	}
+
+	where->device = (unsigned long long) st.st_dev;
+	if (!layout_physical(fd, &where->physical))
+		where->physical = (unsigned long long) st.st_ino;
+	if (S_ISREG(st.st_mode))
+		where->cached = layout_cached(fd, (unsigned long long) st.st_size);
+	close(fd);
+
+	return 1;
+}
+
+/**
+ * Order files to hash - cached files first, then by device and offset on it
+ *
+ * @param a Where a file lies
+ * @param b Where another file lies
+ * @return Less than, equal to or greater than 0 as a's file goes before,
+ *          with or after b's
+ */
+int layout_compare(const struct layout *a, const struct layout *b)
+{
+	if (a->cached != b->cached)
+		return a->cached ? -1 : 1;
+	if (a->device != b->device)
+		return a->device < b->device ? -1 : 1;
+	if (a->physical != b->physical)
+		return a->physical < b->physical ? -1 : 1;
+
+	return 0;
+}
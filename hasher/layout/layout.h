@@ -0,0 +1,45 @@
+/**
+ * @file layout.h
+ * Header for layout.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LAYOUT_H_
+#define LAYOUT_H_
+
+/** Bytes at the start of a file checked for being in the page cache */
+#define LAYOUT_PROBE_SIZE (64 * 1024 * 1024)
+
+/** Where a file lies, to hash files in the order they lie on disk */
+struct layout {
+	/** Whether the start of the file is all in the page cache */
+	char cached;
+	/** Device holding the file */
+	unsigned long long device;
+	/**
+	 * Byte offset of the file's first extent on the device, or without
+	 *  FIEMAP, its inode number (which tends to follow allocation order)
+	 */
+	unsigned long long physical;
+};
+
+char layout_probe(char *, struct layout *);
+int layout_compare(const struct layout *, const struct layout *);
+
+#endif /* LAYOUT_H_ */
@@ -0,0 +1,206 @@
+/**
+ * @file libhasher.c
+ * Public interface of libhasher, on top of the hash type dispatcher
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hash.h"
+#include "many/many.h"
+#include "libhasher.h"
+
+/**
+ * Convert a public algorithm to the internal hash type, checking it's known
+ *
+ * @param alg Public algorithm
+ * @param type Internal hash type
+ * @return 1 if the algorithm is known, else 0
+ */
+int hasher_type(enum hasher_alg alg, enum hash_t *type)
+{
+	if ((unsigned int) alg > HASHER_SHA256D)
+		return 0;
+
+	/* The public values follow enum hash_t */
+	*type = (enum hash_t) alg;
+
+	return 1;
+}
+
+/**
+ * Get the library version
+ *
+ * @return Null terminated version
+ */
+HASHER_API const char *hasher_version(void)
+{
+	return HASHER_VERSION;
+}
+
+/**
+ * Get the digest size of an algorithm
+ *
+ * @param alg Algorithm
+ * @return Number of bytes in the digest, or 0 if the algorithm is unknown
+ */
+HASHER_API size_t hasher_digest_size(enum hasher_alg alg)
+{
+	enum hash_t type;
+
+	if (!hasher_type(alg, &type))
+		return 0;
+
+	return hash_digest_size(type);
+}
+
+/**
+ * Get the name of an algorithm
+ *
+ * @param alg Algorithm
+ * @return Null terminated name, or NULL if the algorithm is unknown
+ */
+HASHER_API const char *hasher_name(enum hasher_alg alg)
+{
+	enum hash_t type;
+
+	if (!hasher_type(alg, &type))
+		return NULL;
+
+	return hash_name(type);
+}
+
+/**
+ * Start a streaming hash
+ *
+ * @param alg Algorithm (not BLAKE3, CRC32C or XXH3, which have no contexts)
+ * @return A new context, or NULL if the algorithm can't stream or there's no
+ *          memory
+ */
+HASHER_API struct hasher_ctx *hasher_ctx_new(enum hasher_alg alg)
+{
+	enum hash_t type;
+	struct hash_ctx *ctx;
+
+	if (!hasher_type(alg, &type) || !hash_reentrant(type))
+		return NULL;
+
+	ctx = malloc(sizeof(struct hash_ctx));
+	if (ctx == NULL)
+		return NULL;
+
+	if (!hash_ctx_init(ctx, type)) {
+		free(ctx);
+		return NULL;
+	}
+
+	return (struct hasher_ctx *) ctx;
+}
+
+/**
+ * Add bytes to a streaming hash
+ *
+ * @param ctx Context from hasher_ctx_new
+ * @param data Bytes to add
+ * @param length Number of bytes
+ * @return 1 if the bytes were added, else 0
+ */
+HASHER_API int hasher_ctx_update(struct hasher_ctx *ctx, const void *data,
+		size_t length)
+{
+	if (ctx == NULL)
+		return 0;
+
+	hash_ctx_add((struct hash_ctx *) ctx, data, length);
+
+	return 1;
+}
+
+/**
+ * Finish a streaming hash and free its context
+ *
+ * @param ctx Context from hasher_ctx_new
+ * @param digest At least hasher_digest_size() bytes
+ * @return 1 if the digest was copied, else 0
+ */
+HASHER_API int hasher_ctx_final(struct hasher_ctx *ctx, uint8_t *digest)
+{
+	if (ctx == NULL)
+		return 0;
+
+	hash_ctx_final((struct hash_ctx *) ctx, digest);
+	free(ctx);
+
+	return 1;
+}
+
+/**
+ * Free a streaming hash without finishing it
+ *
+ * @param ctx Context from hasher_ctx_new, or NULL
+ */
+HASHER_API void hasher_ctx_free(struct hasher_ctx *ctx)
+{
+	free(ctx);
+}
+
+/**
+ * Hash one buffer
+ *
+ * @param alg Algorithm
+ * @param data Bytes to hash
+ * @param length Number of bytes
+ * @param digest At least hasher_digest_size() bytes
+ * @return 1 if the digest was copied, else 0
+ */
+HASHER_API int hasher_hash(enum hasher_alg alg, const void *data,
+		size_t length, uint8_t *digest)
+{
+	enum hash_t type;
+
+	if (!hasher_type(alg, &type))
+		return 0;
+
+	return hash_oneshot(type, data, length, digest);
+}
+
+/**
+ * Hash several independent buffers
+ *
+ * @param alg Algorithm
+ * @param data Buffers to hash
+ * @param lengths Number of bytes in each buffer
+ * @param count Number of buffers
+ * @param digests count * hasher_digest_size() bytes
+ * @return 1 if every digest was copied, else 0
+ */
+HASHER_API int hasher_hash_batch(enum hasher_alg alg, const void *data[],
+		const size_t lengths[], size_t count, uint8_t *digests)
+{
+	enum hash_t type;
+
+	if (!hasher_type(alg, &type))
+		return 0;
+
+	return hash_many(type, data, lengths, count, digests);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file libhasher.h
+ * Public interface of libhasher - the hashing libraries without main.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LIBHASHER_H_
+#define LIBHASHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Library version */
+#define HASHER_VERSION "0.3"
+
+/*
+ * The library is every source file except main.c and output/, built by
+ *  make libhasher.a libhasher.so with -fvisibility=hidden -fPIC, so
+ *  only the functions marked HASHER_API are exported
+ */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define HASHER_API __attribute__((visibility("default")))
+#else
+#define HASHER_API
+#endif
+
+/** Hash algorithms (values are stable) */
+enum hasher_alg {
+	HASHER_MD5 = 0,
+	HASHER_SHA1 = 1,
+	HASHER_SHA256 = 2,
+	HASHER_SHA224 = 3,
+	HASHER_SHA512 = 4,
+	HASHER_SHA384 = 5,
+	HASHER_SHA512_256 = 6,
+	HASHER_SHA512_224 = 7,
+	HASHER_BLAKE3 = 8,
+	HASHER_CRC32C = 9,
+	HASHER_XXH3_64 = 10,
+	HASHER_XXH3_128 = 11,
+	HASHER_SHA256D = 12
+};
+
+/** Largest digest of any algorithm, in bytes */
+#define HASHER_MAX_DIGEST 64
+
+/** A streaming hash in progress (opaque) */
+struct hasher_ctx;
+
+/*
+ * Streaming hashes keep their state in a hasher_ctx, so any number may be in
+ *  progress at once, each used by one thread at a time. Only MD5, SHA1 and
+ *  SHA2 can stream - hasher_ctx_new returns NULL for the others.
+ *  One-shot and batch MD5, SHA1 and SHA2 hashes use no global state, so may
+ *  be called from any thread at any time. One-shot BLAKE3, CRC32C and XXH3
+ *  hashes share global state - callers with several threads must serialise
+ *  them.
+ *  Every int function returns 1 on success and 0 on failure (an unknown
+ *  algorithm, or a hash already in progress).
+ */
+
+HASHER_API const char *hasher_version(void);
+HASHER_API size_t hasher_digest_size(enum hasher_alg);
+HASHER_API const char *hasher_name(enum hasher_alg);
+
+/* One-shot */
+HASHER_API int hasher_hash(enum hasher_alg, const void *, size_t, uint8_t *);
+
+/* Streaming - hasher_ctx_final frees the context */
+HASHER_API struct hasher_ctx *hasher_ctx_new(enum hasher_alg);
+HASHER_API int hasher_ctx_update(struct hasher_ctx *, const void *, size_t);
+HASHER_API int hasher_ctx_final(struct hasher_ctx *, uint8_t *);
+HASHER_API void hasher_ctx_free(struct hasher_ctx *);
+
+/* Batch - digests are written back to back, hasher_digest_size() apart */
+HASHER_API int hasher_hash_batch(enum hasher_alg, const void *[],
+		const size_t [], size_t, uint8_t *);
+
+#endif /* LIBHASHER_H_ */
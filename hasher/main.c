@@ -25,12 +25,32 @@
  */
 /* Includes */
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "global.h"
-#include "md5/md5.h"
-#include "sha1/sha1.h"
+#include "hash.h"
 #include "sha2/sha2.h"
+#include "blake3/blake3.h"
+#include "hmac/hmac.h"
+#include "pbkdf2/pbkdf2.h"
+#include "many/many.h"
+#include "cdc/cdc.h"
+#include "blockmap/blockmap.h"
+#include "delta/delta.h"
+#include "direct/direct.h"
+#include "known/known.h"
+#include "pool/pool.h"
+#include "prefix/prefix.h"
+#include "records/records.h"
+#include "daemon/daemon.h"
+#include "probes/probes.h"
+#include "stats/stats.h"
+#include "output/output.h"
 
 /** Version number */
 #define VERSION "0.3"
@@ -40,16 +60,6 @@
 /** Boolean False definition */
 #define FALSE 0
 
-/** Hash types known */
-enum hash_t {
-	H_MD5,
-	H_SHA1,
-	H_SHA256,
-	H_SHA224,
-	H_SHA512,
-	H_SHA384
-};
-
 extern char in_hash;
 
 /** Print version to stdout */
@@ -65,15 +75,265 @@ void print_version()
  */
 void print_help(char *program)
 {
-	printf("usage: %s [-h] [--md5] [--sha1] [-s string] [-f file]\n\n",
-			program);
+	printf("usage: %s [-h] [--md5] [--sha1] [--hmac-key-file file] "
+			"[-s string] [-f file]\n\n", program);
 	printf("\t    --md5\tuse md5\n");
 	printf("\t    --sha1\tuse sha1\n");
+	printf("\t    --sha512-256\tuse sha512/256\n");
+	printf("\t    --sha512-224\tuse sha512/224\n");
+	printf("\t    --blake3\tuse blake3\n");
+	printf("\t    --crc32c\tuse crc32c\n");
+	printf("\t    --xxh3\tuse xxh3 (64 bit)\n");
+	printf("\t    --xxh128\tuse xxh3 (128 bit)\n");
+	printf("\t    --sha256d\tuse double sha256\n");
+	printf("\t    --hmac-key-file\tHMAC with the key in file\n");
+	printf("\t    --pbkdf2 n\tPBKDF2 of the string input, n iterations\n");
+	printf("\t    --salt\tPBKDF2 salt\n");
+	printf("\t    --pbkdf2-bench n\tPBKDF2 iterations per second per core\n");
+	printf("\t    --many-bench\tthroughput of batches of 64B-64KB messages\n");
+	printf("\t    --format f\thex, base64, raw or json digests\n");
+	printf("\t    --chunk s\tdigest (sha256 by default) of each content-defined "
+			"chunk of the file, s is min:avg:max or avg bytes\n");
+	printf("\t    --block-size n\tdigest of each n byte block of the file "
+			"(k, m or g suffix)\n");
+	printf("\t    --map file\twrite the block digests as a block map\n");
+	printf("\t    --compare-maps old new\tregions changed between two block "
+			"maps\n");
+	printf("\t    --delta map\tcopy and literal instructions making the file "
+			"from the one in the block map\n");
+	printf("\t    --known index\ttag the digest with the known set holding "
+			"it\n");
+	printf("\t    --build-known index list[:tag]...\tcompile hash lists "
+			"into a known set index\n");
+	printf("\t    --direct\tread the file with O_DIRECT, bypassing the page "
+			"cache\n");
+	printf("\t    --threads n\tworkers hashing the files (-f given more than "
+			"once), and most threads hashing one BLAKE3 input\n");
+	printf("\t    --cpus list\tCPUs to pin the workers to, e.g. 0-3,8\n");
+	printf("\t    --numa m\tauto or off - place workers and files by NUMA "
+			"node\n");
+	printf("\t    --per-record\ta digest for each record of the file (or "
+			"stdin)\n");
+	printf("\t    --delim c\trecords end with c - a character, \\n "
+			"(default) or \\0\n");
+	printf("\t    --len-prefixed\trecords follow their length, as a big "
+			"endian 32 bit number\n");
+	printf("\t    --prefix-file file\tdigests of the file's bytes followed by "
+			"each input\n");
+	printf("\t    --layout\thash cached files first, then the rest in the "
+			"order they lie on disk\n");
+	printf("\t    --unordered\tprint the files' digests as they finish, not "
+			"in order\n");
+	printf("\t    --daemon\tserve digests to other runs on a Unix socket "
+			"($HASHER_SOCKET, else hasherd.sock in $XDG_RUNTIME_DIR), with "
+			"--threads workers\n");
+	printf("\t    --no-daemon\thash here, even if a daemon is running\n");
+	printf("\t    --stats\treport reading and hashing counters to stderr "
+			"at exit (json with --format json)\n");
 	printf("\t-s, --string\tstring input\n");
 	printf("\t-f, --file\tfile input\n");
 	printf("\t-h, --help\tthis message\n");
 }
 
+/** Hash type of the chunks' digests */
+enum hash_t chunk_hash;
+
+/**
+ * Print the record of a content-defined chunk
+ *
+ * @param offset Byte offset of the chunk in the file
+ * @param length Number of bytes in the chunk
+ * @param digest Digest of the chunk
+ * @return 1 if the record was queued, else 0
+ */
+char print_chunk(unsigned long long offset, unsigned long long length,
+		unsigned char digest[])
+{
+	return output_chunk(chunk_hash, offset, length, digest, NULL);
+}
+
+/**
+ * Print a region changed between two block maps
+ *
+ * @param offset Byte offset of the region in the new file
+ * @param length Number of bytes in the region
+ * @return 1 (the region was printed)
+ */
+char print_region(unsigned long long offset, unsigned long long length)
+{
+	printf("%llu %llu\n", offset, length);
+
+	return 1;
+}
+
+/**
+ * Add a file into the current hash
+ *
+ * @param path File to add
+ * @param direct Whether to bypass the page cache
+ * @return 1 if the file's contents were added, else 0
+ */
+char hash_file(char *path, char direct)
+{
+	/* File pointer for buffered reading */
+	FILE *fp;
+	char added;
+
+	STATS_ADD(S_FILES_OPENED, 1);
+	HASHER_PROBE1(file__open, path);
+	if (direct) {
+		added = direct_add_file(path);
+	} else {
+		fp = fopen(path, "r");
+		added = fp != NULL && hash_add_file(fp);
+		if (fp != NULL)
+			fclose(fp);
+	}
+	HASHER_PROBE1(file__close, path);
+
+	return added;
+}
+
+/**
+ * Open a known set index for classifying digests
+ *
+ * @param index Index file
+ * @param hash Hash type of the digests to classify
+ * @param set Index to be filled in (close with known_close)
+ * @return 1 if the index was opened and holds digests of the hash type,
+ *          else 0 (with a message printed)
+ */
+char open_known(char *index, enum hash_t hash, struct known *set)
+{
+	if (!known_open(index, set)) {
+		printf("Unable to open known set index %s\n", index);
+		return 0;
+	}
+	if (set->type != hash) {
+		printf("Known set index %s holds %s digests\n", index,
+				hash_name(set->type));
+		known_close(set);
+		return 0;
+	}
+
+	return 1;
+}
+
+/** Whether the statistics report is JSON */
+char stats_json = FALSE;
+
+/** Print the statistics report to stderr (at exit) */
+void print_stats()
+{
+	stats_report(stderr, stats_json);
+}
+
+/** Files hashed by the pool */
+char **pooled_files;
+/** Hash type of the pool's digests */
+enum hash_t pooled_hash;
+/** Known set to classify the pool's digests with, or NULL */
+struct known *pooled_known;
+/** Number of files that couldn't be hashed */
+unsigned int pooled_failures;
+
+/**
+ * Print the digest of a file hashed by the pool (names always go with the
+ *  digests, as with md5sum)
+ *
+ * @param file Index of the file
+ * @param digest The digest
+ * @param ok Whether the file was hashed
+ */
+void print_pooled(unsigned int file, unsigned char digest[], char ok)
+{
+	if (!ok) {
+		fprintf(stderr, "Unable to hash file %s\n", pooled_files[file]);
+		pooled_failures++;
+	} else if (pooled_known != NULL) {
+		output_known(pooled_hash, digest, pooled_files[file],
+				known_lookup(pooled_known, digest));
+	} else {
+		output_digest(pooled_hash, digest, pooled_files[file]);
+	}
+}
+
+/**
+ * Print the digest of a file hashed by the daemon, or hash it here if the
+ *  daemon couldn't
+ *
+ * @param file Index of the file
+ * @param digest The digest
+ * @param ok Whether the file was hashed
+ */
+void print_forwarded(unsigned int file, unsigned char digest[], char ok)
+{
+	unsigned char local[HASH_MAX_DIGEST];
+
+	if (!ok && hash_init(pooled_hash)) {
+		ok = hash_file(pooled_files[file], FALSE);
+		ok = hash_get_digest(local) && ok;
+		digest = local;
+	}
+	print_pooled(file, digest, ok);
+}
+
+/** Where to keep the digest of a single file hashed by the daemon */
+unsigned char *daemon_file_digest;
+/** Whether the daemon hashed the single file */
+char daemon_file_hashed;
+
+/**
+ * Keep the digest of a single file hashed by the daemon, to print as a file
+ *  hashed here would be
+ *
+ * @param file Index of the file (0)
+ * @param digest The digest
+ * @param ok Whether the file was hashed
+ */
+void keep_daemon_digest(unsigned int file, unsigned char digest[], char ok)
+{
+	daemon_file_hashed = ok;
+	if (ok)
+		memcpy(daemon_file_digest, digest, hash_digest_size(pooled_hash));
+}
+
+/**
+ * Print the digest of a record
+ *
+ * @param type Hash type that made the digest
+ * @param digest The digest
+ * @return 1 if the digest was queued, else 0
+ */
+char print_record(enum hash_t type, unsigned char digest[])
+{
+	return output_digest(type, digest, NULL);
+}
+
+/** Bytes of the new file copied and sent as literals by delta instructions */
+unsigned long long delta_bytes[2];
+
+/**
+ * Print a delta instruction
+ *
+ * @param op Copy or literal
+ * @param offset Offset of the bytes in the new file
+ * @param from Offset of the bytes in the old file (copies only)
+ * @param length Number of bytes
+ * @return 1 (the instruction was printed)
+ */
+char print_instruction(enum delta_op_t op, unsigned long long offset,
+		unsigned long long from, unsigned long long length)
+{
+	if (op == D_COPY)
+		printf("copy %llu %llu %llu\n", offset, length, from);
+	else
+		printf("literal %llu %llu\n", offset, length);
+	delta_bytes[op] += length;
+
+	return 1;
+}
+
 /**
  * Main method
  *
@@ -84,12 +344,58 @@ int main(int argc, char *argv[])
 {
 	/* Type of input */
 	char string_input = FALSE, file_input = FALSE;
-	/* Hash type */
-	enum hash_t hash;
+	/* Hash type, and whether it was chosen (chunks default to SHA256) */
+	enum hash_t hash = H_MD5;
+	char hash_given = FALSE;
 
 	/* Pointers to strings */
-	char *string_to_process;
+	char *string_to_process = NULL;
 	char *file_to_process;
+	char *hmac_key_file = NULL;
+	char *salt = "";
+
+	/* PBKDF2 iteration count, and whether to benchmark it */
+	unsigned long pbkdf2_iterations = 0;
+	char pbkdf2_benchmark = FALSE;
+
+	/* Whether to benchmark batch hashing */
+	char many_benchmark = FALSE;
+
+	/* Digest encoding */
+	enum output_t format = O_HEX;
+
+	/* Whether to chunk the file, and the chunk sizes */
+	char chunking = FALSE;
+	struct cdc_params chunk_params;
+
+	/* Block size for block digests, block map file, maps to compare */
+	unsigned long long block_size = 0;
+	char *map_file = NULL;
+	char *compare_old = NULL, *compare_new = NULL;
+	/* Block map to make a delta against */
+	char *delta_map = NULL;
+	/* Every file input, and how to run the pool hashing them */
+	char **files = malloc(argc * sizeof(char *));
+	unsigned int file_count = 0;
+	struct pool_options pool_options = {0, NULL, 0, POOL_NUMA_AUTO, FALSE,
+			FALSE, NULL};
+	/* Whether to hash each record of the input, and how they are split */
+	char per_record = FALSE;
+	enum records_t record_format = R_DELIMITED;
+	unsigned char record_delim = '\n';
+	/* File holding the prefix of every message, and its midstate */
+	char *prefix_file = NULL;
+	struct hash_ctx prefix;
+	/* Whether the files go to the pool (more than one, or a pool asked for) */
+	char pooled;
+	/* Whether to be the daemon or forward to one, and the connection */
+	char run_daemon = FALSE, no_daemon = FALSE, daemon_wanted;
+	struct daemon_client daemon;
+	/* Whether to read the input file bypassing the page cache */
+	char direct = FALSE;
+	/* Known set index to classify with, or to build from the lists after */
+	char *known_index = NULL;
+	int known_lists = 0;
 
 	/* Not in hash yet */
 	in_hash = 0;
@@ -102,21 +408,55 @@ int main(int argc, char *argv[])
 			if (strcmp(argv[i] + 2, "md5") == 0) {
 				/* --md5 */
 				hash = H_MD5;
+				hash_given = TRUE;
 			} else if (strcmp(argv[i] + 2, "sha1") == 0) {
 				/* --sha1 */
 				hash = H_SHA1;
+				hash_given = TRUE;
 			} else if (strcmp(argv[i] + 2, "sha256") == 0) {
 				/* --sha256 */
 				hash = H_SHA256;
+				hash_given = TRUE;
 			} else if (strcmp(argv[i] + 2, "sha224") == 0) {
 				/* --sha224 */
 				hash = H_SHA224;
+				hash_given = TRUE;
 			} else if (strcmp(argv[i] + 2, "sha512") == 0) {
 				/* --sha512 */
 				hash = H_SHA512;
+				hash_given = TRUE;
 			} else if (strcmp(argv[i] + 2, "sha384") == 0) {
 				/* --sha384 */
 				hash = H_SHA384;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "sha512-256") == 0) {
+				/* --sha512-256 */
+				hash = H_SHA512_256;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "sha512-224") == 0) {
+				/* --sha512-224 */
+				hash = H_SHA512_224;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "blake3") == 0) {
+				/* --blake3 */
+				hash = H_BLAKE3;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "crc32c") == 0) {
+				/* --crc32c */
+				hash = H_CRC32C;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "xxh3") == 0) {
+				/* --xxh3 */
+				hash = H_XXH3_64;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "xxh128") == 0) {
+				/* --xxh128 */
+				hash = H_XXH3_128;
+				hash_given = TRUE;
+			} else if (strcmp(argv[i] + 2, "sha256d") == 0) {
+				/* --sha256d */
+				hash = H_SHA256D;
+				hash_given = TRUE;
 			} else if (strcmp(argv[i] + 2, "string") == 0) {
 				/* --string */
 				string_input = TRUE;
@@ -125,6 +465,147 @@ int main(int argc, char *argv[])
 				/* --file */
 				file_input = TRUE;
 				file_to_process = argv[++i];
+				files[file_count++] = file_to_process;
+			} else if (strcmp(argv[i] + 2, "hmac-key-file") == 0) {
+				/* --hmac-key-file */
+				hmac_key_file = argv[++i];
+			} else if (strcmp(argv[i] + 2, "pbkdf2") == 0) {
+				/* --pbkdf2 */
+				pbkdf2_iterations = strtoul(argv[++i], NULL, 10);
+			} else if (strcmp(argv[i] + 2, "pbkdf2-bench") == 0) {
+				/* --pbkdf2-bench */
+				pbkdf2_iterations = strtoul(argv[++i], NULL, 10);
+				pbkdf2_benchmark = TRUE;
+			} else if (strcmp(argv[i] + 2, "format") == 0) {
+				/* --format */
+				if (!output_format(argv[++i], &format)) {
+					printf("Unknown format %s\n\n", argv[i]);
+					print_help(argv[0]);
+					return 1;
+				}
+			} else if (strcmp(argv[i] + 2, "chunk") == 0) {
+				/* --chunk */
+				chunking = TRUE;
+				if (argv[i + 1] == NULL ||
+						!cdc_params_parse(argv[++i], &chunk_params)) {
+					printf("Chunk sizes must be min:avg:max or avg bytes, "
+							"with %d <= min <= avg <= max <= %lu\n\n",
+							CDC_WINDOW, CDC_MAX_LIMIT);
+					print_help(argv[0]);
+					return 1;
+				}
+			} else if (strcmp(argv[i] + 2, "block-size") == 0) {
+				/* --block-size */
+				if (argv[i + 1] == NULL ||
+						!blockmap_parse_size(argv[++i], &block_size)) {
+					printf("Block size must be from 1 byte to 1g\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+			} else if (strcmp(argv[i] + 2, "map") == 0) {
+				/* --map */
+				map_file = argv[++i];
+			} else if (strcmp(argv[i] + 2, "compare-maps") == 0) {
+				/* --compare-maps */
+				if (i + 2 >= argc) {
+					printf("Comparing needs two block maps\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+				compare_old = argv[++i];
+				compare_new = argv[++i];
+			} else if (strcmp(argv[i] + 2, "delta") == 0) {
+				/* --delta */
+				delta_map = argv[++i];
+			} else if (strcmp(argv[i] + 2, "known") == 0) {
+				/* --known */
+				known_index = argv[++i];
+			} else if (strcmp(argv[i] + 2, "build-known") == 0) {
+				/* --build-known (the rest of the arguments are lists) */
+				if (i + 2 >= argc) {
+					printf("Building a known set needs an index and at "
+							"least one hash list\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+				known_index = argv[++i];
+				known_lists = ++i;
+				i = argc - 1;
+			} else if (strcmp(argv[i] + 2, "direct") == 0) {
+				/* --direct */
+				direct = TRUE;
+			} else if (strcmp(argv[i] + 2, "threads") == 0) {
+				/* --threads */
+				if (argv[i + 1] == NULL ||
+						(pool_options.threads = strtoul(argv[++i], NULL,
+								10)) == 0) {
+					printf("Threads must be at least 1\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+			} else if (strcmp(argv[i] + 2, "cpus") == 0) {
+				/* --cpus */
+				if (argv[i + 1] == NULL || !pool_parse_cpus(argv[++i],
+						&pool_options.cpus, &pool_options.cpu_count)) {
+					printf("CPUs must be a list such as 0-3,8\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+			} else if (strcmp(argv[i] + 2, "numa") == 0 ||
+					strncmp(argv[i] + 2, "numa=", 5) == 0) {
+				/* --numa m, --numa=m */
+				char *mode = argv[i][6] == '=' ? argv[i] + 7 : argv[++i];
+				if (mode == NULL || !pool_parse_numa(mode,
+						&pool_options.numa)) {
+					printf("NUMA placement must be auto or off\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+			} else if (strcmp(argv[i] + 2, "per-record") == 0) {
+				/* --per-record */
+				per_record = TRUE;
+			} else if (strcmp(argv[i] + 2, "delim") == 0) {
+				/* --delim */
+				if (argv[i + 1] == NULL ||
+						!records_parse_delim(argv[++i], &record_delim)) {
+					printf("The delimiter must be a character, \\n or "
+							"\\0\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+				record_format = R_DELIMITED;
+			} else if (strcmp(argv[i] + 2, "len-prefixed") == 0) {
+				/* --len-prefixed */
+				record_format = R_LENGTH_PREFIXED;
+			} else if (strcmp(argv[i] + 2, "prefix-file") == 0) {
+				/* --prefix-file */
+				if (argv[i + 1] == NULL) {
+					printf("A prefix file must be given\n\n");
+					print_help(argv[0]);
+					return 1;
+				}
+				prefix_file = argv[++i];
+			} else if (strcmp(argv[i] + 2, "layout") == 0) {
+				/* --layout */
+				pool_options.layout = TRUE;
+			} else if (strcmp(argv[i] + 2, "unordered") == 0) {
+				/* --unordered */
+				pool_options.unordered = TRUE;
+			} else if (strcmp(argv[i] + 2, "daemon") == 0) {
+				/* --daemon */
+				run_daemon = TRUE;
+			} else if (strcmp(argv[i] + 2, "no-daemon") == 0) {
+				/* --no-daemon */
+				no_daemon = TRUE;
+			} else if (strcmp(argv[i] + 2, "stats") == 0) {
+				/* --stats */
+				stats_enabled = TRUE;
+			} else if (strcmp(argv[i] + 2, "many-bench") == 0) {
+				/* --many-bench */
+				many_benchmark = TRUE;
+			} else if (strcmp(argv[i] + 2, "salt") == 0) {
+				/* --salt */
+				salt = argv[++i];
 			} else if (strcmp(argv[i] + 2, "help") == 0) {
 				/* --help */
 				string_input = file_input = FALSE;
@@ -147,6 +628,7 @@ int main(int argc, char *argv[])
 			/* File Input (-f) */
 			file_input = TRUE;
 			file_to_process = argv[++i];
+			files[file_count++] = file_to_process;
 			break;
 		case 'h':
 			/* Help message (-h) */
@@ -165,176 +647,466 @@ int main(int argc, char *argv[])
 		i++;
 	}
 
-	/* Array of 32 bit unsigned ints for MD5, SHA1, SHA256, SHA224 */
-	unsigned int i_hash_out[8];
-	/* Array of 64 bit unsigned ints for SHA512, SHA384 */
-	unsigned long long ll_hash_out[8];
-	/* String for the hash representation */
-	char hash_out_str[129];
+	/* Digest bytes */
+	unsigned char digest_out[HASH_MAX_DIGEST];
+	/* Name given with the digest (JSON Lines only, to keep plain output) */
+	char *file_name = NULL;
 	/* File pointer for file input */
 	FILE *fp;
 
-	/* Start processing the hash */
-	switch (hash) {
-	case H_MD5:
-		/* Initialise MD5 hashing */
-		md5_init();
+	output_init(format, 1);
+	if (format == O_JSON && file_input)
+		file_name = file_to_process;
+	if (stats_enabled) {
+		stats_json = format == O_JSON;
+		atexit(print_stats);
+	}
+	/* --threads also caps the threads hashing one large BLAKE3 input */
+	if (pool_options.threads > 0)
+		blake3_set_threads(pool_options.threads);
+	pooled = file_count > 1 || (file_count == 1 &&
+			(pool_options.threads > 0 || pool_options.cpus != NULL));
+	/* Plain digests go to the daemon, unless asked how to read or pool */
+	daemon_wanted = !no_daemon && hmac_key_file == NULL &&
+			prefix_file == NULL && !direct && !stats_enabled &&
+			pool_options.threads == 0 && pool_options.cpus == NULL &&
+			!pool_options.layout;
 
-		if (string_input && string_to_process != NULL) {
-			/* Hash the string */
-			md5_add_string(string_to_process);
-		} else if (file_input && file_to_process != NULL) {
-			/* Hash the file */
-			fp = fopen(file_to_process, "r");
+	if (prefix_file != NULL) {
+		/* Compress the prefix once, for every input to start from */
+		if (hmac_key_file != NULL || chunking || block_size > 0 ||
+				pbkdf2_iterations > 0 || delta_map != NULL) {
+			printf("A prefix only applies to plain string and file "
+					"digests\n");
+			return 1;
+		}
+		if (!hash_reentrant(hash)) {
+			printf("A prefix needs an md5, sha1 or sha2 hash type\n");
+			return 1;
+		}
+		fp = fopen(prefix_file, "rb");
+		if (fp == NULL || !prefix_init_file(&prefix, hash, fp)) {
+			printf("Unable to read prefix file %s\n", prefix_file);
 			if (fp != NULL)
-				md5_add_file(fp);
+				fclose(fp);
+			return 1;
+		}
+		fclose(fp);
+		pool_options.prefix = &prefix;
+	}
+
+	if (run_daemon) {
+		/* Answer other runs until stopped */
+		daemon_serve(pool_options.threads);
+
+		return 1;
+	} else if (many_benchmark) {
+		/* Message length being measured */
+		size_t length;
+
+		printf("%s, %d lanes\n", hash_name(hash), SHA2_LANES);
+		for (length = 64; length <= 65536; length *= 4)
+			printf("%6lu bytes: %8.1f MB/s one at a time, "
+					"%8.1f MB/s batched\n", (unsigned long) length,
+					hash_many_bench(hash, length, FALSE),
+					hash_many_bench(hash, length, TRUE));
+
+		return 0;
+	} else if (chunking) {
+		/* Whether every chunk was recorded */
+		char chunked;
+
+		if (!file_input || file_to_process == NULL) {
+			printf("Chunking needs a file input\n");
+			return 1;
+		}
+		fp = fopen(file_to_process, "rb");
+		if (fp == NULL) {
+			printf("Unable to open file %s\n", file_to_process);
+			return 1;
 		}
+		STATS_ADD(S_FILES_OPENED, 1);
+		HASHER_PROBE1(file__open, file_to_process);
+		chunk_hash = hash_given ? hash : H_SHA256;
+		chunked = cdc_file(fp, &chunk_params, chunk_hash, print_chunk);
+		fclose(fp);
+		HASHER_PROBE1(file__close, file_to_process);
+		output_flush();
 
-		/* Get the hash */
-		md5_get_hash(i_hash_out);
-
-		/* Get the string representation of the hash */
-		sprintf(hash_out_str, "%08x%08x%08x%08x",
-				i_hash_out[0], i_hash_out[1],
-				i_hash_out[2], i_hash_out[3]);
-
-		/* Swap the characters around */
-		/* Outer loop: 4 groups of 8 */
-		for (i = 0; i < 4; i++) {
-			/* Inner loop: 2 pairs of 2 characters */
-			int j;
-			for (j = 0; j < 2; j++) {
-				char temp[2];
-
-				/* Save the left pair */
-				temp[0] = hash_out_str[(i * 8) + (j * 2)];
-                temp[1] = hash_out_str[(i * 8) + (j * 2) + 1];
-
-                /* Copy the right pair across */
-                hash_out_str[(i * 8) + (j * 2)] =
-                		hash_out_str[(i * 8) + (6 - (j * 2))];
-                hash_out_str[(i * 8) + (j * 2) + 1] =
-                		hash_out_str[(i * 8) + (7 - (j * 2))];
-
-                /* Copy the original left to the right */
-                hash_out_str[(i * 8) + (6 - (j * 2))] = temp[0];
-                hash_out_str[(i * 8) + (7 - (j * 2))] = temp[1];
+		return chunked ? 0 : 1;
+	} else if (compare_old != NULL) {
+		/* Maps of the file before and after */
+		struct blockmap maps[2];
+		/* Whether the files differ */
+		char changed;
+
+		for (i = 0; i < 2; i++) {
+			fp = fopen(i == 0 ? compare_old : compare_new, "rb");
+			if (fp == NULL || !blockmap_read(fp, &maps[i])) {
+				printf("Unable to read block map %s\n",
+						i == 0 ? compare_old : compare_new);
+				if (fp != NULL)
+					fclose(fp);
+				if (i == 1)
+					blockmap_free(&maps[0]);
+				return 2;
 			}
+			fclose(fp);
 		}
 
-		/* Print the string */
-		printf("%s\n", hash_out_str);
-		break;
-	case H_SHA1:
-		/* Initialise SHA1 hashing */
-		sha1_init();
+		if (!blockmap_compare(&maps[0], &maps[1], print_region, &changed)) {
+			printf("Block maps have different hash types or block sizes\n");
+			changed = 2;
+		}
+		blockmap_free(&maps[0]);
+		blockmap_free(&maps[1]);
 
-		if (string_input && string_to_process != NULL) {
-			/* Hash the string */
-			sha1_add_string(string_to_process);
-		} else if (file_input && file_to_process != NULL) {
-			/* Hash the file */
-			fp = fopen(file_to_process, "r");
+		/* Like cmp - 0 if the same, 1 if different, 2 on trouble */
+		return changed;
+	} else if (delta_map != NULL) {
+		/* Map of the old file */
+		struct blockmap map;
+		/* File descriptor of the new file */
+		int fd;
+		/* Whether the whole file was covered */
+		char covered;
+
+		if (!file_input || file_to_process == NULL) {
+			printf("A delta needs a file input\n");
+			return 1;
+		}
+		fp = fopen(delta_map, "rb");
+		if (fp == NULL || !blockmap_read(fp, &map) || map.weak == NULL) {
+			printf("Unable to read block map %s with rolling checksums\n",
+					delta_map);
 			if (fp != NULL)
-				sha1_add_file(fp);
+				fclose(fp);
+			return 1;
+		}
+		fclose(fp);
+
+		fd = open(file_to_process, O_RDONLY);
+		if (fd >= 0) {
+			STATS_ADD(S_FILES_OPENED, 1);
+			HASHER_PROBE1(file__open, file_to_process);
+		}
+		covered = fd >= 0 && delta_file(fd, &map, print_instruction);
+		if (fd >= 0) {
+			close(fd);
+			HASHER_PROBE1(file__close, file_to_process);
+		}
+		blockmap_free(&map);
+		if (!covered) {
+			printf("Unable to make a delta of %s\n", file_to_process);
+			return 1;
 		}
 
-		/* Get the hash */
-		sha1_get_hash(i_hash_out);
+		fprintf(stderr, "%llu bytes copied, %llu bytes literal\n",
+				delta_bytes[D_COPY], delta_bytes[D_LITERAL]);
 
-		/* Get the string representation and print */
-		printf("%08x%08x%08x%08x%08x\n",
-				i_hash_out[0], i_hash_out[1], i_hash_out[2],
-				i_hash_out[3], i_hash_out[4]);
-		break;
-	case H_SHA256:
-		/* Initialise SHA256 hashing */
-		sha2_init(SHA256);
+		return 0;
+	} else if (block_size > 0 && pooled) {
+		/* Block digests of the files, and which of them were hashed */
+		struct blockmap *maps = malloc((file_count + 1) * sizeof(*maps));
+		char *hashed = malloc(file_count + 1);
+		/* Whether every file was hashed */
+		char all;
+		/* File and block being printed */
+		unsigned int f;
+		unsigned long long b, offset;
 
-		if (string_input && string_to_process != NULL) {
-			/* Hash the string */
-			sha2_add_string(string_to_process);
-		} else if (file_input && file_to_process != NULL) {
-			/* Hash the file */
-			fp = fopen(file_to_process, "r");
-			if (fp != NULL)
-				sha2_add_file(fp);
+		if (map_file != NULL) {
+			printf("A block map holds the blocks of a single file\n");
+			return 1;
+		}
+		if (maps == NULL || hashed == NULL) {
+			printf("Unable to allocate block maps for %u files\n",
+					file_count);
+			return 1;
 		}
 
-		/* Get the hash */
-		sha2_get_hash(ll_hash_out);
+		all = pool_hash_blocks(hash, files, file_count, &pool_options,
+				block_size, maps, hashed);
 
-		/* Get the string representation and print */
-		printf("%08llx%08llx%08llx%08llx%08llx%08llx%08llx%08llx\n",
-			ll_hash_out[0], ll_hash_out[1], ll_hash_out[2], ll_hash_out[3],
-			ll_hash_out[4], ll_hash_out[5], ll_hash_out[6], ll_hash_out[7]);
-		break;
-	case H_SHA224:
-		/* Initialise SHA224 hashing */
-		sha2_init(SHA224);
+		for (f = 0; f < file_count; f++) {
+			if (!hashed[f]) {
+				fprintf(stderr, "Unable to hash the blocks of %s\n", files[f]);
+			} else {
+				for (b = 0; b < maps[f].count; b++) {
+					offset = b * maps[f].block_size;
+					output_chunk(hash, offset, maps[f].file_size - offset <
+							maps[f].block_size ? maps[f].file_size - offset :
+							maps[f].block_size,
+							maps[f].digests + (b * hash_digest_size(hash)),
+							files[f]);
+				}
+			}
+		}
+		output_flush();
 
-		if (string_input && string_to_process != NULL) {
-			/* Hash the string */
-			sha2_add_string(string_to_process);
-		} else if (file_input && file_to_process != NULL) {
-			/* Hash the file */
-			fp = fopen(file_to_process, "r");
-			if (fp != NULL)
-				sha2_add_file(fp);
+		for (f = 0; f < file_count; f++)
+			if (hashed[f])
+				blockmap_free(&maps[f]);
+		free(maps);
+		free(hashed);
+		free(pool_options.cpus);
+		free(files);
+
+		return all ? 0 : 1;
+	} else if (block_size > 0) {
+		/* The file's block digests */
+		struct blockmap map;
+		/* File descriptor of the file */
+		int fd;
+		/* Block being printed */
+		unsigned long long b, offset;
+
+		if (!file_input || file_to_process == NULL) {
+			printf("Block digests need a file input\n");
+			return 1;
+		}
+		fd = open(file_to_process, O_RDONLY);
+		if (fd >= 0) {
+			STATS_ADD(S_FILES_OPENED, 1);
+			HASHER_PROBE1(file__open, file_to_process);
+		}
+		if (fd < 0 || !blockmap_build(fd, hash, block_size, 0, &map)) {
+			printf("Unable to hash the blocks of %s\n", file_to_process);
+			if (fd >= 0)
+				close(fd);
+			return 1;
 		}
+		close(fd);
+		HASHER_PROBE1(file__close, file_to_process);
 
-		/* Get the hash */
-		sha2_get_hash(ll_hash_out);
+		if (map_file != NULL) {
+			fp = fopen(map_file, "wb");
+			if (fp == NULL || !blockmap_write(fp, &map)) {
+				printf("Unable to write block map %s\n", map_file);
+				if (fp != NULL)
+					fclose(fp);
+				blockmap_free(&map);
+				return 1;
+			}
+			fclose(fp);
+		} else {
+			for (b = 0; b < map.count; b++) {
+				offset = b * map.block_size;
+				output_chunk(hash, offset, map.file_size - offset <
+						map.block_size ? map.file_size - offset :
+						map.block_size,
+						map.digests + (b * hash_digest_size(hash)), NULL);
+			}
+			output_flush();
+		}
+		blockmap_free(&map);
+
+		return 0;
+	} else if (known_lists > 0) {
+		if (!known_build(known_index, hash, argv + known_lists,
+				argc - known_lists)) {
+			printf("Unable to build known set index %s\n", known_index);
+			return 1;
+		}
+
+		return 0;
+	} else if (pbkdf2_benchmark) {
+		/* Time a single derivation, then a full set of lanes */
+		double rate = pbkdf2_bench(hash, pbkdf2_iterations, FALSE);
+		if (rate == 0) {
+			printf("PBKDF2 needs a SHA2 hash type\n");
+			return 1;
+		}
+		printf("scalar: %.0f iterations/s per core\n", rate);
+		printf("%d lanes: %.0f iterations/s per core\n", SHA2_LANES,
+				pbkdf2_bench(hash, pbkdf2_iterations, TRUE));
+
+		return 0;
+	} else if (pbkdf2_iterations > 0) {
+		/* Derived key */
+		unsigned char key[HASH_MAX_DIGEST];
 
-		/* Get the string representation and print */
-		printf("%08llx%08llx%08llx%08llx%08llx%08llx%08llx\n",
-			ll_hash_out[0], ll_hash_out[1], ll_hash_out[2], ll_hash_out[3],
-			ll_hash_out[4], ll_hash_out[5], ll_hash_out[6]);
-		break;
-	case H_SHA512:
-		/* Initialise SHA512 hashing */
-		sha2_init(SHA512);
+		if (!string_input || string_to_process == NULL ||
+				!pbkdf2(hash, (unsigned char *) string_to_process,
+						strlen(string_to_process), (unsigned char *) salt,
+						strlen(salt), pbkdf2_iterations,
+						key, hash_digest_size(hash))) {
+			printf("PBKDF2 needs a SHA2 hash type and a string input\n");
+			return 1;
+		}
+		output_digest(hash, key, NULL);
+		output_flush();
+
+		return 0;
+	} else if (per_record) {
+		/* Whether every record was hashed */
+		char all;
+
+		if (file_input && file_to_process != NULL) {
+			fp = fopen(file_to_process, "rb");
+			if (fp == NULL) {
+				printf("Unable to open file %s\n", file_to_process);
+				return 1;
+			}
+			STATS_ADD(S_FILES_OPENED, 1);
+			HASHER_PROBE1(file__open, file_to_process);
+		} else {
+			fp = stdin;
+		}
+
+		all = records_hash(fp, hash, record_format, record_delim,
+				prefix_file != NULL ? &prefix : NULL, print_record);
+		output_flush();
+		if (fp != stdin) {
+			fclose(fp);
+			HASHER_PROBE1(file__close, file_to_process);
+		}
+		if (!all)
+			fprintf(stderr, "Unable to hash every record\n");
+
+		return all ? 0 : 1;
+	} else if (pooled) {
+		/* Sets of known digests */
+		struct known set;
+		/* Whether every file was hashed */
+		char all;
+		/* Number of files the daemon answered for */
+		unsigned int forwarded;
+
+		if (known_index != NULL && !open_known(known_index, hash, &set))
+			return 1;
+
+		/* Digests are printed as the pool gives them */
+		pooled_files = files;
+		pooled_hash = hash;
+		pooled_known = known_index != NULL ? &set : NULL;
+		if (daemon_wanted && daemon_connect(&daemon)) {
+			/* Files the daemon can't hash are hashed here */
+			pooled_failures = 0;
+			forwarded = daemon_hash_files(&daemon, hash, files, file_count,
+					print_forwarded);
+			daemon_disconnect(&daemon);
+			all = pooled_failures == 0;
+
+			/* If the daemon went, the pool hashes the rest */
+			if (forwarded < file_count) {
+				pooled_files = files + forwarded;
+				all = pool_hash_files(hash, pooled_files,
+						file_count - forwarded, &pool_options,
+						print_pooled) && all;
+			}
+		} else {
+			all = pool_hash_files(hash, files, file_count, &pool_options,
+					print_pooled);
+		}
+		output_flush();
+
+		if (known_index != NULL)
+			known_close(&set);
+		free(pool_options.cpus);
+		free(files);
+
+		return all ? 0 : 1;
+	} else if (hmac_key_file != NULL) {
+		/* Prepared HMAC key */
+		struct hmac_key key;
+		/* HMAC digest */
+		unsigned char digest[HASH_MAX_DIGEST];
+
+		/* Prepare the key's inner and outer midstates */
+		fp = fopen(hmac_key_file, "rb");
+		if (fp == NULL) {
+			printf("Unable to open key file %s\n", hmac_key_file);
+			return 1;
+		}
+		if (!hmac_key_init_file(&key, hash, fp)) {
+			printf("HMAC is not supported with this hash type\n");
+			fclose(fp);
+			return 1;
+		}
+		fclose(fp);
+
+		/* Initialise HMAC hashing */
+		hmac_init(&key);
 
 		if (string_input && string_to_process != NULL) {
 			/* Hash the string */
-			sha2_add_string(string_to_process);
+			hash_add_string(string_to_process);
 		} else if (file_input && file_to_process != NULL) {
 			/* Hash the file */
-			fp = fopen(file_to_process, "r");
-			if (fp != NULL)
-				sha2_add_file(fp);
+			hash_file(file_to_process, direct);
 		}
 
-		/* Get the hash */
-		sha2_get_hash(ll_hash_out);
+		/* Get the HMAC and print */
+		hmac_get_digest(&key, digest);
+		output_digest(hash, digest, file_name);
+		output_flush();
 
-		/* Get the string representation and print */
-		printf("%016llx%016llx%016llx%016llx%016llx%016llx%016llx%016llx\n",
-			ll_hash_out[0], ll_hash_out[1], ll_hash_out[2], ll_hash_out[3],
-			ll_hash_out[4], ll_hash_out[5], ll_hash_out[6], ll_hash_out[7]);
-		break;
-	case H_SHA384:
-		/* Initialise SHA384 hashing */
-		sha2_init(SHA384);
+		return 0;
+	}
 
-		if (string_input && string_to_process != NULL) {
-			/* Hash the string */
-			sha2_add_string(string_to_process);
-		} else if (file_input) {
+	if (string_input && string_to_process != NULL && prefix_file != NULL) {
+		/* Hash the string, carrying on from the prefix */
+		prefix_start(&prefix);
+		hash_add_string(string_to_process);
+		hash_get_digest(digest_out);
+	} else if (string_input && string_to_process != NULL &&
+			daemon_wanted && daemon_connect(&daemon)) {
+		/* Have the daemon hash the string, else hash it here */
+		if (!daemon_hash_bytes(&daemon, hash,
+				(unsigned char *) string_to_process,
+				strlen(string_to_process), digest_out))
+			hash_oneshot(hash, (unsigned char *) string_to_process,
+					strlen(string_to_process), digest_out);
+		daemon_disconnect(&daemon);
+	} else if (string_input && string_to_process != NULL) {
+		/* Hash the string in one go */
+		hash_oneshot(hash, (unsigned char *) string_to_process,
+				strlen(string_to_process), digest_out);
+	} else if (file_input && file_to_process != NULL && daemon_wanted &&
+			daemon_connect(&daemon)) {
+		/* Have the daemon hash the file, else hash it here */
+		daemon_file_digest = digest_out;
+		daemon_file_hashed = FALSE;
+		pooled_hash = hash;
+		daemon_hash_files(&daemon, hash, &file_to_process, 1,
+				keep_daemon_digest);
+		if (!daemon_file_hashed) {
+			hash_init(hash);
+			hash_file(file_to_process, direct);
+			hash_get_digest(digest_out);
+		}
+		daemon_disconnect(&daemon);
+	} else {
+		/* Hash the input, carrying on from any prefix */
+		if (prefix_file != NULL)
+			prefix_start(&prefix);
+		else
+			hash_init(hash);
+
+		if (file_input && file_to_process != NULL) {
 			/* Hash the file */
-			fp = fopen(file_to_process, "r");
-			if (fp != NULL)
-				sha2_add_file(fp);
+			hash_file(file_to_process, direct);
 		}
 
-		/* Get the hash */
-		sha2_get_hash(ll_hash_out);
+		/* Get the digest (in canonical byte order) */
+		hash_get_digest(digest_out);
+	}
 
-		/* Get the string representation and print */
-		printf("%016llx%016llx%016llx%016llx%016llx%016llx\n",
-				ll_hash_out[0], ll_hash_out[1], ll_hash_out[2],
-				ll_hash_out[3], ll_hash_out[4], ll_hash_out[5]);
-		break;
+	/* Print the digest */
+	if (known_index != NULL) {
+		/* Sets of known digests */
+		struct known set;
+
+		if (!open_known(known_index, hash, &set))
+			return 1;
+		output_known(hash, digest_out, file_name,
+				known_lookup(&set, digest_out));
+		output_flush();
+		known_close(&set);
+	} else {
+		output_digest(hash, digest_out, file_name);
+		output_flush();
 	}
 
 	return 0;
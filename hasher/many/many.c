@@ -0,0 +1,471 @@
+/**
+ * @file many.c
+ * Batch hashing of many independent messages, grouping messages of similar
+ *  length into the SHA2 multi-lane compression functions
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../global.h"
+#include "../hash.h"
+#include "../sha2/sha2.h"
+#include "../stats/stats.h"
+#include "many.h"
+
+/** 64 byte messages copied together for the fixed length SHA256 kernel */
+#define MANY_64_GROUP 64
+/** Bytes of messages hashed by each benchmark run */
+#define MANY_BENCH_BYTES (32UL << 20)
+
+/** A message waiting to be hashed, for sorting by length */
+struct many_msg {
+	/** Number of chunks in the padded message */
+	size_t chunks;
+	/** Position of the message in the caller's arrays */
+	size_t index;
+};
+
+/**
+ * Order messages by chunk count, then by position
+ *
+ * @param a First message
+ * @param b Second message
+ * @return Negative, zero or positive as for qsort
+ */
+int many_compare(const void *a, const void *b)
+{
+	const struct many_msg *x = a, *y = b;
+
+	if (x->chunks != y->chunks)
+		return x->chunks < y->chunks ? -1 : 1;
+
+	return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+/**
+ * Find the SHA2 function of a hash type
+ *
+ * @param type The hash type
+ * @param sha2 Set to the SHA2 function (SHA256 for double SHA256)
+ * @return 1 if it is a SHA2 type, else 0
+ */
+char many_sha2_type(enum hash_t type, enum sha2_t *sha2)
+{
+	switch (type) {
+	case H_SHA256:
+	case H_SHA256D:
+		*sha2 = SHA256;
+		return 1;
+	case H_SHA224:
+		*sha2 = SHA224;
+		return 1;
+	case H_SHA512:
+		*sha2 = SHA512;
+		return 1;
+	case H_SHA384:
+		*sha2 = SHA384;
+		return 1;
+	case H_SHA512_256:
+		*sha2 = SHA512_256;
+		return 1;
+	case H_SHA512_224:
+		*sha2 = SHA512_224;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Get a 32 bit chunk of a padded message as words
+ *
+ * @param msg Message bytes
+ * @param length Number of bytes in the message
+ * @param chunk Chunk number
+ * @param words Array of 16 unsigned ints to store the chunk
+ */
+void many_i_chunk(const unsigned char *msg, size_t length, size_t chunk,
+		unsigned int words[])
+{
+	unsigned char padded[64];
+	size_t offset = chunk * 64;
+	int i;
+
+	/* Whole chunks come straight from the message */
+	if (offset + 64 <= length) {
+		for (i = 0; i < 16; i++)
+			words[i] = be_i_b_to_w((unsigned char *) msg + offset + (i * 4));
+		return;
+	}
+
+	/* Message tail, a 1 bit, zeros, then the bit length in the last chunk */
+	memset(padded, 0, sizeof(padded));
+	if (offset < length)
+		memcpy(padded, msg + offset, length - offset);
+	if (offset <= length)
+		padded[length - offset] = 0x80;
+	if (chunk == ((length + 72) / 64) - 1)
+		be_ll_to_b(length << 3, padded + 56);
+
+	for (i = 0; i < 16; i++)
+		words[i] = be_i_b_to_w(padded + (i * 4));
+}
+
+/**
+ * Get a 64 bit chunk of a padded message as words
+ *
+ * @param msg Message bytes
+ * @param length Number of bytes in the message
+ * @param chunk Chunk number
+ * @param words Array of 16 unsigned double longs to store the chunk
+ */
+void many_ll_chunk(const unsigned char *msg, size_t length, size_t chunk,
+		unsigned long long words[])
+{
+	unsigned char padded[128];
+	size_t offset = chunk * 128;
+	int i;
+
+	if (offset + 128 <= length) {
+		for (i = 0; i < 16; i++)
+			words[i] = be_ll_b_to_w((unsigned char *) msg + offset + (i * 8));
+		return;
+	}
+
+	memset(padded, 0, sizeof(padded));
+	if (offset < length)
+		memcpy(padded, msg + offset, length - offset);
+	if (offset <= length)
+		padded[length - offset] = 0x80;
+	if (chunk == ((length + 144) / 128) - 1) {
+		/* 128 bit length */
+		be_ll_to_b((unsigned long long) length >> 61, padded + 112);
+		be_ll_to_b((unsigned long long) length << 3, padded + 120);
+	}
+
+	for (i = 0; i < 16; i++)
+		words[i] = be_ll_b_to_w(padded + (i * 8));
+}
+
+/**
+ * Hash a group of up to SHA2_LANES 32 bit messages
+ *
+ * Every message goes through the multi-lane compression for as many chunks
+ *  as the shortest one has, then each finishes on its own.
+ *
+ * @param msgs Messages
+ * @param lengths Number of bytes in each message
+ * @param chunks Number of padded chunks in each message
+ * @param lanes Number of messages (1 to SHA2_LANES)
+ * @param iv Initial hash values
+ * @param states Final states of each message
+ */
+void many_i_group(const unsigned char *msgs[], size_t lengths[],
+		size_t chunks[], unsigned int lanes, unsigned int iv[],
+		unsigned int states[][8])
+{
+	unsigned int hash[8][SHA2_LANES], words[16][SHA2_LANES];
+	unsigned int chunk[16];
+	size_t common = 0, c;
+	unsigned int l, src, i;
+
+	/* A lone message isn't worth the lanes */
+	if (lanes > 1) {
+		common = chunks[0];
+		for (l = 1; l < lanes; l++)
+			if (chunks[l] < common)
+				common = chunks[l];
+	}
+
+	for (l = 0; l < SHA2_LANES; l++)
+		for (i = 0; i < 8; i++)
+			hash[i][l] = iv[i];
+
+	for (c = 0; c < common; c++) {
+		/* Unused lanes repeat the first message */
+		for (l = 0; l < SHA2_LANES; l++) {
+			src = l < lanes ? l : 0;
+			many_i_chunk(msgs[src], lengths[src], c, chunk);
+			for (i = 0; i < 16; i++)
+				words[i][l] = chunk[i];
+		}
+		sha2_i_compress_lanes(hash, words);
+	}
+
+	for (l = 0; l < lanes; l++) {
+		for (i = 0; i < 8; i++)
+			states[l][i] = hash[i][l];
+		for (c = common; c < chunks[l]; c++) {
+			many_i_chunk(msgs[l], lengths[l], c, chunk);
+			sha2_i_compress(states[l], chunk);
+		}
+	}
+}
+
+/**
+ * Hash a group of up to SHA2_LANES 64 bit messages
+ *
+ * @param msgs Messages
+ * @param lengths Number of bytes in each message
+ * @param chunks Number of padded chunks in each message
+ * @param lanes Number of messages (1 to SHA2_LANES)
+ * @param iv Initial hash values
+ * @param states Final states of each message
+ */
+void many_ll_group(const unsigned char *msgs[], size_t lengths[],
+		size_t chunks[], unsigned int lanes, unsigned long long iv[],
+		unsigned long long states[][8])
+{
+	unsigned long long hash[8][SHA2_LANES], words[16][SHA2_LANES];
+	unsigned long long chunk[16];
+	size_t common = 0, c;
+	unsigned int l, src, i;
+
+	if (lanes > 1) {
+		common = chunks[0];
+		for (l = 1; l < lanes; l++)
+			if (chunks[l] < common)
+				common = chunks[l];
+	}
+
+	for (l = 0; l < SHA2_LANES; l++)
+		for (i = 0; i < 8; i++)
+			hash[i][l] = iv[i];
+
+	for (c = 0; c < common; c++) {
+		for (l = 0; l < SHA2_LANES; l++) {
+			src = l < lanes ? l : 0;
+			many_ll_chunk(msgs[src], lengths[src], c, chunk);
+			for (i = 0; i < 16; i++)
+				words[i][l] = chunk[i];
+		}
+		sha2_ll_compress_lanes(hash, words);
+	}
+
+	for (l = 0; l < lanes; l++) {
+		for (i = 0; i < 8; i++)
+			states[l][i] = hash[i][l];
+		for (c = common; c < chunks[l]; c++) {
+			many_ll_chunk(msgs[l], lengths[l], c, chunk);
+			sha2_ll_compress(states[l], chunk);
+		}
+	}
+}
+
+/**
+ * Hash 64 byte messages with SHA256 or double SHA256 through the fixed
+ *  length kernel, which skips the padding chunk's message schedule
+ *
+ * @param msgs Messages, 64 bytes each
+ * @param count Number of messages
+ * @param twice 1 for double SHA256, 0 for SHA256
+ * @param digests count * 32 bytes to store the digests
+ */
+void many_256_64(const void *msgs[], size_t count, char twice,
+		uint8_t *digests)
+{
+	unsigned char group[MANY_64_GROUP * 64];
+	size_t m, n, g;
+
+	for (m = 0; m < count; m += n) {
+		n = count - m < MANY_64_GROUP ? count - m : MANY_64_GROUP;
+		for (g = 0; g < n; g++)
+			memcpy(group + (g * 64), msgs[m + g], 64);
+		sha2_256_64_many(group, n, twice, digests + (m * 32));
+	}
+}
+
+/**
+ * Hash many independent messages
+ *
+ * SHA2 messages are sorted by padded length and handed out SHA2_LANES at a
+ *  time to the multi-lane compression functions, so messages sharing lanes
+ *  finish together, and batches of only 64 byte SHA256 messages (Merkle tree
+ *  levels) go to the fixed length kernel. Other hash types are hashed one
+ *  after another. No hash globals are used for MD5, SHA1 and SHA2, so those
+ *  batches may run on any number of threads at once.
+ *
+ * @param type The hash type
+ * @param msgs Messages
+ * @param lengths Number of bytes in each message
+ * @param count Number of messages
+ * @param digests count * hash_digest_size() bytes to store the digests, in
+ *                 the order of the messages
+ * @return 1 if every digest was copied, else 0
+ */
+char hash_many(enum hash_t type, const void *msgs[], const size_t lengths[],
+		size_t count, uint8_t *digests)
+{
+	unsigned int digest_size = hash_digest_size(type);
+	unsigned int i_iv[8], i_states[SHA2_LANES][8], outer[8][SHA2_LANES];
+	unsigned long long ll_iv[8], ll_states[SHA2_LANES][8];
+	unsigned char ll_digest[64];
+	const unsigned char *group_msgs[SHA2_LANES];
+	size_t group_lengths[SHA2_LANES], group_chunks[SHA2_LANES];
+	struct many_msg *order;
+	enum sha2_t sha2;
+	char ll = hash_block_size(type) == 128;
+	unsigned long long start, total = 0;
+	size_t m, index;
+	unsigned int lanes, l, i;
+
+	if (!many_sha2_type(type, &sha2)) {
+		for (m = 0; m < count; m++)
+			if (!hash_oneshot(type, msgs[m], lengths[m],
+					digests + (m * digest_size)))
+				return 0;
+		return 1;
+	}
+
+	start = stats_now();
+
+	if (type == H_SHA256 || type == H_SHA256D) {
+		for (m = 0; m < count && lengths[m] == 64; m++)
+			;
+		if (m == count) {
+			many_256_64(msgs, count, type == H_SHA256D, digests);
+			stats_hashed(start, count * 64ULL);
+			return 1;
+		}
+	}
+
+	sha2_iv(sha2, i_iv, ll_iv);
+
+	order = malloc(count * sizeof(struct many_msg));
+	if (order == NULL && count > 0)
+		return 0;
+
+	for (m = 0; m < count; m++) {
+		order[m].chunks = ll ? (lengths[m] + 144) / 128 :
+				(lengths[m] + 72) / 64;
+		order[m].index = m;
+		total += lengths[m];
+	}
+	qsort(order, count, sizeof(struct many_msg), many_compare);
+
+	for (m = 0; m < count; m += lanes) {
+		lanes = count - m < SHA2_LANES ? count - m : SHA2_LANES;
+
+		for (l = 0; l < lanes; l++) {
+			index = order[m + l].index;
+			group_msgs[l] = msgs[index];
+			group_lengths[l] = lengths[index];
+			group_chunks[l] = order[m + l].chunks;
+		}
+
+		if (ll)
+			many_ll_group(group_msgs, group_lengths, group_chunks, lanes,
+					ll_iv, ll_states);
+		else
+			many_i_group(group_msgs, group_lengths, group_chunks, lanes,
+					i_iv, i_states);
+
+		/* Double SHA256 hashes every state again, across the lanes */
+		if (type == H_SHA256D) {
+			for (l = 0; l < SHA2_LANES; l++)
+				for (i = 0; i < 8; i++)
+					outer[i][l] = i_states[l < lanes ? l : 0][i];
+			sha2_256_32_lanes(outer);
+			for (l = 0; l < lanes; l++)
+				for (i = 0; i < 8; i++)
+					i_states[l][i] = outer[i][l];
+		}
+
+		/* Big endian words, truncated as in hash_get_digest */
+		for (l = 0; l < lanes; l++) {
+			uint8_t *digest = digests + (order[m + l].index * digest_size);
+
+			if (ll) {
+				for (i = 0; i < 8; i++)
+					be_ll_to_b(ll_states[l][i], ll_digest + (i * 8));
+				memcpy(digest, ll_digest, digest_size);
+			} else {
+				for (i = 0; i < digest_size / 4; i++)
+					be_i_to_b(i_states[l][i], digest + (i * 4));
+			}
+		}
+	}
+
+	free(order);
+	stats_hashed(start, total);
+
+	return 1;
+}
+
+/**
+ * Measure the throughput of hashing many messages of one length
+ *
+ * @param type The hash type
+ * @param length Number of bytes in each message
+ * @param batched 1 to use hash_many, 0 to hash each message on its own
+ * @return Megabytes (10^6 bytes) of messages hashed per second, or 0 if the
+ *          memory couldn't be allocated
+ */
+double hash_many_bench(enum hash_t type, size_t length, char batched)
+{
+	size_t count = MANY_BENCH_BYTES / length, m;
+	unsigned char *data = malloc(count * length);
+	uint8_t *digests = malloc(count * hash_digest_size(type));
+	const void **msgs = malloc(count * sizeof(void *));
+	size_t *lengths = malloc(count * sizeof(size_t));
+	clock_t start, end;
+
+	if (data == NULL || digests == NULL || msgs == NULL || lengths == NULL) {
+		free(data);
+		free(digests);
+		free(msgs);
+		free(lengths);
+		return 0;
+	}
+
+	for (m = 0; m < count * length; m++)
+		data[m] = (unsigned char) m;
+	for (m = 0; m < count; m++) {
+		msgs[m] = data + (m * length);
+		lengths[m] = length;
+	}
+
+	start = clock();
+	if (batched)
+		hash_many(type, msgs, lengths, count, digests);
+	else
+		for (m = 0; m < count; m++)
+			hash_oneshot(type, msgs[m], length,
+					digests + (m * hash_digest_size(type)));
+	end = clock();
+
+	free(data);
+	free(digests);
+	free(msgs);
+	free(lengths);
+
+	/* Avoid dividing by zero for tiny runs */
+	if (end == start)
+		end = start + 1;
+
+	return ((double) count * length / 1e6) /
+			((double) (end - start) / CLOCKS_PER_SEC);
+}
@@ -22,10 +22,19 @@
  */
 /* Includes */
 #include <stdio.h>
+#include <string.h>
 
 #include "../global.h"
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "../sparse/sparse.h"
 #include "md5.h"
 
+/** Bytes read from a file at a time */
+#define MD5_BUFFER_SIZE 65536
+
+/** 32 bit left rotate - a macro so the compression loop stays inlined */
+#define MD5_ROT(X, S) (((X) << (S)) | ((X) >> (32 - (S))))
 /** Per-round function F (0 <= r < 16) */
 #define MD5_FUNC_F(X, Y, Z) (((X) & (Y)) | (~(X) & (Z)))
 /** Per-round function G (16 <= r < 32) */
@@ -103,21 +112,33 @@ char md5_init()
  * @return 1 if the string was added, else 0
  */
 char md5_add_string(char *str)
+{
+	return md5_add_bytes((unsigned char *) str, strlen(str));
+}
+
+/**
+ * Add an array of bytes into the current chunk
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char md5_add_bytes(unsigned char *bytes, unsigned int length)
 {
 	/* TODO: Ensure the hash type is MD5 */
 	/* Ensure we're currently hashing */
 	if (in_hash) {
-		int i;
-		/*
-		 * Loop through the string
-		 * character by character until null is reached
-		 */
-		for (i = 0; str[i] != '\0'; i++) {
+		unsigned int i;
+
+		HASHER_PROBE2(blocks__start, "md5", length);
+
+		/* Loop through the array byte by byte */
+		for (i = 0; i < length; i++) {
 			/*
 			 * Convert the chunk position into the 2d chunk address
 			 *  and store the byte
 			 */
-			cur_chunk[cur_chunk_pos / 4][cur_chunk_pos % 4] = str[i];
+			cur_chunk[cur_chunk_pos / 4][cur_chunk_pos % 4] = bytes[i];
 			/* Increment the chunk position */
 			cur_chunk_pos++;
 			/* Add 8 bits to the length */
@@ -133,6 +154,8 @@ char md5_add_string(char *str)
 			}
 		}
 
+		HASHER_PROBE2(blocks__done, "md5", length);
+
 		return 1;
 	} else {
 		return 0;
@@ -149,34 +172,21 @@ char md5_add_file(FILE *fp)
 {
 	/* Ensure we're currently hashing */
 	if (in_hash) {
-		/* Get the first character */
-		int c = fgetc(fp);
-		/* Loop until end-of-file is reached */
-		while (c != EOF) {
-			/*
-			 * Convert the chunk position into the 2d chunk address
-			 *  and store the byte
-			 */
-			cur_chunk[cur_chunk_pos / 4][cur_chunk_pos % 4] = (unsigned char)c;
-			/* Increment the chunk position */
-			cur_chunk_pos++;
-			/* Add 8 bits to the length */
-			hash_length += 8;
-
-			/*
-			 * If 64 bytes have been added, the chunk has
-			 *  been filled - process it
-			 */
-			if (cur_chunk_pos >= 64) {
-				md5_add_chunk();
-				cur_chunk_pos = 0;
-			}
+		unsigned char buffer[MD5_BUFFER_SIZE], *bytes;
+		unsigned long long start;
+		size_t read_length;
+		struct sparse sparse;
 
-			/* Get the next character */
-			c = fgetc(fp);
-		};
+		/* Read in large blocks, adding each as an array (holes unread) */
+		sparse_begin_file(&sparse, fp);
+		while ((read_length = sparse_read(&sparse, buffer, sizeof(buffer),
+				&bytes)) > 0) {
+			start = stats_now();
+			md5_add_bytes(bytes, read_length);
+			stats_hashed(start, read_length);
+		}
 
-		return 1;
+		return sparse_end(&sparse);
 	} else {
 		return 0;
 	}
@@ -251,12 +261,32 @@ char md5_get_hash(unsigned int hash_out[])
  * Process the current chunk
  */
 void md5_add_chunk()
+{
+	unsigned int words[16];
+	int i;
+
+	/* Convert the 16 word bytes into words */
+	for (i = 0; i < 16; i++)
+		words[i] = le_b_to_w(cur_chunk[i]);
+
+	md5_compress(i_hash, words);
+}
+
+/**
+ * Compress one chunk into a hash state
+ *
+ * @param hash Array of 4 unsigned ints holding the state to be updated
+ * @param chunk Array of the 16 words of the chunk
+ */
+void md5_compress(unsigned int hash[], unsigned int chunk[])
 {
 	unsigned int func_out, word_idx;
 	int i;
 
 	/* Copy the current hash into the chunk variables */
-	unsigned int a = i_hash[0], b = i_hash[1], c = i_hash[2], d = i_hash[3];
+	unsigned int a = hash[0], b = hash[1], c = hash[2], d = hash[3];
+
+	STATS_ADD(S_MD5_BLOCKS, 1);
 
 	/* Loop through 64 times */
 	for (i = 0; i < 64; i++) {
@@ -283,14 +313,58 @@ void md5_add_chunk()
 		d = c;
 		c = b;
 		unsigned int b_prerot_sum = a + func_out +
-				operation_constants[i] + le_b_to_w(cur_chunk[word_idx]);
-		b = b + i_l_rot(b_prerot_sum, rotate_amounts[i / 16][i % 4]);
+				operation_constants[i] + chunk[word_idx];
+		b = b + MD5_ROT(b_prerot_sum, rotate_amounts[i / 16][i % 4]);
 		a = tmp;
 	}
 
-	/* Add the chunk variables back into the current hash */
-	i_hash[0] += a;
-	i_hash[1] += b;
-	i_hash[2] += c;
-	i_hash[3] += d;
+	/* Add the chunk variables back into the hash */
+	hash[0] += a;
+	hash[1] += b;
+	hash[2] += c;
+	hash[3] += d;
+}
+
+/**
+ * Hash a whole message in one go, without touching the hash globals
+ *
+ * Whole chunks are read straight from the message and the padding is built
+ *  on the stack, so a message of up to 55 bytes is a single compression.
+ *
+ * @param bytes Message bytes
+ * @param length Number of bytes in the message
+ * @param hash_out Array of at least 4 unsigned ints
+ */
+void md5_oneshot(const unsigned char *bytes, size_t length,
+		unsigned int hash_out[])
+{
+	unsigned char tail[128];
+	unsigned int words[16];
+	size_t offset = 0, tail_length;
+	int i;
+
+	/* Initialise the hash variables - from RFC 1321 */
+	hash_out[0] = 0x67452301;
+	hash_out[1] = 0xEFCDAB89;
+	hash_out[2] = 0x98BADCFE;
+	hash_out[3] = 0x10325476;
+
+	for (; offset + 64 <= length; offset += 64) {
+		for (i = 0; i < 16; i++)
+			words[i] = le_b_to_w((unsigned char *) bytes + offset + (i * 4));
+		md5_compress(hash_out, words);
+	}
+
+	/* Tail, 0b10000000, 0's, then the bit length - one or two chunks */
+	tail_length = length - offset < 56 ? 64 : 128;
+	memset(tail, 0, tail_length);
+	memcpy(tail, bytes + offset, length - offset);
+	tail[length - offset] = 0x80;
+	le_ll_to_b((unsigned long long) length * 8, tail + tail_length - 8);
+
+	for (offset = 0; offset < tail_length; offset += 64) {
+		for (i = 0; i < 16; i++)
+			words[i] = le_b_to_w(tail + offset + (i * 4));
+		md5_compress(hash_out, words);
+	}
 }
@@ -25,7 +25,11 @@
 
 char md5_init();
 char md5_add_string(char *);
+char md5_add_bytes(unsigned char *, unsigned int);
 char md5_add_file(FILE *);
 char md5_get_hash(unsigned int []);
 
+void md5_compress(unsigned int [], unsigned int []);
+void md5_oneshot(const unsigned char *, size_t, unsigned int []);
+
 #endif /* MD5_H_ */
@@ -0,0 +1,500 @@
+/**
+ * @file output.c
+ * Encodes digests (hex, base64, raw or JSON Lines) into a buffer, and writes
+ *  them out in batches with writev
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "../global.h"
+#include "../hash.h"
+#include "../known/known.h"
+#include "output.h"
+
+/** Hex digit pairs for every byte value */
+const char output_hex[513] =
+	"000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f"
+	"303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f"
+	"505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f"
+	"707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f"
+	"909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+	"b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+	"d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+	"f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/** Base64 alphabet - from RFC 4648 */
+const char output_base64[65] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/** Current encoding */
+enum output_t output_type = O_HEX;
+/** File descriptor written to */
+int output_fd = 1;
+
+/** Encoded output waiting to be written */
+char output_buffer[OUTPUT_BUFFER_SIZE];
+/** Bytes used in the buffer */
+unsigned int output_used = 0;
+/** Pieces waiting to be written (in the buffer, or names in place) */
+struct iovec output_iov[OUTPUT_IOVECS];
+/** Pieces used */
+unsigned int output_count = 0;
+
+/**
+ * Set the encoding and destination of digests
+ *
+ * Anything still waiting for the old destination is written first.
+ *
+ * @param type Encoding
+ * @param fd File descriptor to write to
+ * @return 1 if the output was set up, else 0
+ */
+char output_init(enum output_t type, int fd)
+{
+	if (!output_flush())
+		return 0;
+
+	output_type = type;
+	output_fd = fd;
+
+	return 1;
+}
+
+/**
+ * Look up an encoding by name
+ *
+ * @param name hex, base64, raw or json
+ * @param type Encoding found
+ * @return 1 if the name is known, else 0
+ */
+char output_format(char *name, enum output_t *type)
+{
+	if (strcmp(name, "hex") == 0)
+		*type = O_HEX;
+	else if (strcmp(name, "base64") == 0)
+		*type = O_BASE64;
+	else if (strcmp(name, "raw") == 0)
+		*type = O_RAW;
+	else if (strcmp(name, "json") == 0)
+		*type = O_JSON;
+	else
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Write out everything waiting
+ *
+ * @return 1 if everything was written, else 0
+ */
+char output_flush()
+{
+	struct iovec *iov = output_iov;
+	unsigned int count = output_count;
+	ssize_t written;
+
+	/* Anything printed with stdio must come out first */
+	fflush(stdout);
+
+	while (count > 0) {
+		written = writev(output_fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			output_used = output_count = 0;
+			return 0;
+		}
+
+		/* Skip past whatever was written, which may end part way through */
+		while (count > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	output_used = output_count = 0;
+
+	return 1;
+}
+
+/**
+ * Make room for a piece in the buffer, writing out what's waiting if needed
+ *
+ * @param length Bytes needed (at most OUTPUT_BUFFER_SIZE)
+ * @return Where to encode the piece
+ */
+char *output_reserve(unsigned int length)
+{
+	if (output_used + length > OUTPUT_BUFFER_SIZE ||
+			output_count == OUTPUT_IOVECS)
+		output_flush();
+
+	return output_buffer + output_used;
+}
+
+/**
+ * Add a piece encoded in the buffer, joining it to the last piece if that
+ *  ends where this one starts
+ *
+ * @param length Bytes encoded at output_reserve()
+ */
+void output_commit(unsigned int length)
+{
+	struct iovec *last = output_iov + output_count - 1;
+
+	if (output_count > 0 &&
+			(char *) last->iov_base + last->iov_len ==
+					output_buffer + output_used) {
+		last->iov_len += length;
+	} else {
+		output_iov[output_count].iov_base = output_buffer + output_used;
+		output_iov[output_count].iov_len = length;
+		output_count++;
+	}
+	output_used += length;
+}
+
+/**
+ * Add a piece that is written from where it is
+ *
+ * @param bytes Bytes which must stay put until the next flush
+ * @param length Number of bytes
+ */
+void output_reference(char *bytes, unsigned int length)
+{
+	if (output_count == OUTPUT_IOVECS)
+		output_flush();
+
+	output_iov[output_count].iov_base = bytes;
+	output_iov[output_count].iov_len = length;
+	output_count++;
+}
+
+/**
+ * Copy a piece into the buffer
+ *
+ * @param bytes Bytes to copy
+ * @param length Number of bytes (at most OUTPUT_BUFFER_SIZE)
+ */
+void output_copy(char *bytes, unsigned int length)
+{
+	memcpy(output_reserve(length), bytes, length);
+	output_commit(length);
+}
+
+/**
+ * Encode bytes as lower case hex
+ *
+ * @param bytes Bytes to encode
+ * @param length Number of bytes
+ * @param out At least 2 * length characters
+ * @return Characters written
+ */
+unsigned int output_encode_hex(unsigned char bytes[], unsigned int length,
+		char *out)
+{
+	unsigned int i;
+
+	for (i = 0; i < length; i++) {
+		out[2 * i] = output_hex[2 * bytes[i]];
+		out[(2 * i) + 1] = output_hex[(2 * bytes[i]) + 1];
+	}
+
+	return 2 * length;
+}
+
+/**
+ * Encode bytes as padded base64
+ *
+ * @param bytes Bytes to encode
+ * @param length Number of bytes
+ * @param out At least 4 * ((length + 2) / 3) characters
+ * @return Characters written
+ */
+unsigned int output_encode_base64(unsigned char bytes[], unsigned int length,
+		char *out)
+{
+	unsigned int i, word, written = 0;
+
+	for (i = 0; i + 3 <= length; i += 3) {
+		word = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+		out[written++] = output_base64[word >> 18];
+		out[written++] = output_base64[(word >> 12) & 0x3F];
+		out[written++] = output_base64[(word >> 6) & 0x3F];
+		out[written++] = output_base64[word & 0x3F];
+	}
+
+	if (i < length) {
+		word = bytes[i] << 16;
+		if (i + 1 < length)
+			word |= bytes[i + 1] << 8;
+		out[written++] = output_base64[word >> 18];
+		out[written++] = output_base64[(word >> 12) & 0x3F];
+		out[written++] = i + 1 < length ?
+				output_base64[(word >> 6) & 0x3F] : '=';
+		out[written++] = '=';
+	}
+
+	return written;
+}
+
+/**
+ * Copy a string into the buffer as the inside of a JSON string
+ *
+ * @param str Null terminated string
+ */
+void output_json_string(char *str)
+{
+	char *out;
+	unsigned int written, i;
+	unsigned char c;
+
+	while (*str != '\0') {
+		/* 64 characters at a time, each at worst \u00XX */
+		out = output_reserve(6 * 64);
+		written = 0;
+
+		for (i = 0; i < 64 && *str != '\0'; i++) {
+			c = (unsigned char) *str++;
+			if (c == '"' || c == '\\') {
+				out[written++] = '\\';
+				out[written++] = c;
+			} else if (c < 0x20) {
+				memcpy(out + written, "\\u00", 4);
+				out[written + 4] = output_hex[2 * c];
+				out[written + 5] = output_hex[(2 * c) + 1];
+				written += 6;
+			} else {
+				out[written++] = c;
+			}
+		}
+
+		output_commit(written);
+	}
+}
+
+/**
+ * Encode a digest, and possibly its class, and queue it for writing
+ *
+ * @param type Hash type that made the digest
+ * @param digest Digest bytes (hash_digest_size() of them)
+ * @param name Name of what was hashed, or NULL (must stay put until the next
+ *              flush)
+ * @param classify Whether to include the class
+ * @param tag Tag of the known set holding the digest, or NULL if none does
+ * @return 1 if the digest was queued, else 0
+ */
+char output_record(enum hash_t type, unsigned char digest[], char *name,
+		char classify, const char *tag)
+{
+	unsigned int length = hash_digest_size(type), written;
+	char *out;
+
+	switch (output_type) {
+	case O_HEX:
+	case O_BASE64:
+		/* Encoded digest, separator (or newline) */
+		out = output_reserve((2 * HASH_MAX_DIGEST) + 3);
+		if (output_type == O_HEX)
+			written = output_encode_hex(digest, length, out);
+		else
+			written = output_encode_base64(digest, length, out);
+
+		if (classify) {
+			out[written++] = ' ';
+			output_commit(written);
+			tag = tag != NULL ? tag : "unknown";
+			out = output_reserve(KNOWN_TAG_SIZE + 2);
+			written = strlen(tag);
+			memcpy(out, tag, written);
+		}
+
+		if (name == NULL) {
+			out[written++] = '\n';
+			output_commit(written);
+		} else {
+			out[written++] = ' ';
+			out[written++] = ' ';
+			output_commit(written);
+			output_reference(name, strlen(name));
+			output_copy("\n", 1);
+		}
+		break;
+	case O_RAW:
+		output_copy((char *) digest, length);
+		break;
+	case O_JSON:
+		output_copy("{\"hash\":\"", 9);
+		output_copy(hash_name(type), strlen(hash_name(type)));
+		output_copy("\",\"digest\":\"", 12);
+		out = output_reserve((2 * HASH_MAX_DIGEST) + 1);
+		written = output_encode_hex(digest, length, out);
+		out[written++] = '"';
+		output_commit(written);
+
+		if (name != NULL) {
+			output_copy(",\"name\":\"", 9);
+			output_json_string(name);
+			output_copy("\"", 1);
+		}
+		if (classify && tag == NULL) {
+			output_copy(",\"known\":null", 13);
+		} else if (classify) {
+			output_copy(",\"known\":\"", 10);
+			output_json_string((char *) tag);
+			output_copy("\"", 1);
+		}
+		output_copy("}\n", 2);
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Encode a digest and queue it for writing
+ *
+ * Hex and base64 digests go one per line, followed by two spaces and the
+ *  name if there is one. Raw digests are the bytes alone. JSON Lines records
+ *  hold the hash name, the hex digest and the name if there is one.
+ *
+ * @param type Hash type that made the digest
+ * @param digest Digest bytes (hash_digest_size() of them)
+ * @param name Name of what was hashed, or NULL (must stay put until the next
+ *              flush)
+ * @return 1 if the digest was queued, else 0
+ */
+char output_digest(enum hash_t type, unsigned char digest[], char *name)
+{
+	return output_record(type, digest, name, 0, NULL);
+}
+
+/**
+ * Encode a digest and the known set it belongs to and queue it for writing
+ *
+ * Hex and base64 digests are followed by a space and the set's tag (or
+ *  "unknown"), then two spaces and the name if there is one. Raw digests
+ *  are the bytes alone. JSON Lines records gain a "known" member holding
+ *  the tag, or null.
+ *
+ * @param type Hash type that made the digest
+ * @param digest Digest bytes (hash_digest_size() of them)
+ * @param name Name of what was hashed, or NULL (must stay put until the next
+ *              flush)
+ * @param tag Tag of the known set holding the digest, or NULL if none does
+ * @return 1 if the digest was queued, else 0
+ */
+char output_known(enum hash_t type, unsigned char digest[], char *name,
+		const char *tag)
+{
+	return output_record(type, digest, name, 1, tag);
+}
+
+/**
+ * Encode the digest of one piece of a file and queue it for writing
+ *
+ * Hex and base64 records are the decimal offset and length, then the
+ *  digest, separated by spaces, then two spaces and the file's name if
+ *  there is one. Raw records are a big endian 64 bit offset and length,
+ *  then the digest bytes. JSON Lines records hold the offset, length, hash
+ *  name, hex digest and the name if there is one.
+ *
+ * @param type Hash type that made the digest
+ * @param offset Byte offset of the piece in the file
+ * @param length Number of bytes in the piece
+ * @param digest Digest bytes (hash_digest_size() of them)
+ * @param name Name of the file, or NULL (must stay put until the next flush)
+ * @return 1 if the record was queued, else 0
+ */
+char output_chunk(enum hash_t type, unsigned long long offset,
+		unsigned long long length, unsigned char digest[], char *name)
+{
+	unsigned int size = hash_digest_size(type), written;
+	char *out;
+
+	switch (output_type) {
+	case O_HEX:
+	case O_BASE64:
+		/* Two 20 digit numbers, two spaces, the digest and a newline */
+		out = output_reserve((2 * HASH_MAX_DIGEST) + 44);
+		written = sprintf(out, "%llu %llu ", offset, length);
+		if (output_type == O_HEX)
+			written += output_encode_hex(digest, size, out + written);
+		else
+			written += output_encode_base64(digest, size, out + written);
+		if (name == NULL) {
+			out[written++] = '\n';
+			output_commit(written);
+		} else {
+			out[written++] = ' ';
+			out[written++] = ' ';
+			output_commit(written);
+			output_reference(name, strlen(name));
+			output_copy("\n", 1);
+		}
+		break;
+	case O_RAW:
+		out = output_reserve(16 + HASH_MAX_DIGEST);
+		be_ll_to_b(offset, (unsigned char *) out);
+		be_ll_to_b(length, (unsigned char *) out + 8);
+		memcpy(out + 16, digest, size);
+		output_commit(16 + size);
+		break;
+	case O_JSON:
+		out = output_reserve((2 * HASH_MAX_DIGEST) + 100);
+		written = sprintf(out, "{\"offset\":%llu,\"length\":%llu,\"hash\":\"%s\","
+				"\"digest\":\"", offset, length, hash_name(type));
+		written += output_encode_hex(digest, size, out + written);
+		out[written++] = '"';
+		output_commit(written);
+		if (name != NULL) {
+			output_copy(",\"name\":\"", 9);
+			output_json_string(name);
+			output_copy("\"", 1);
+		}
+		output_copy("}\n", 2);
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file output.h
+ * Header for output.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+/** Digest encodings */
+enum output_t {O_HEX, O_BASE64, O_RAW, O_JSON};
+
+/** Bytes of encoded output held before writing */
+#define OUTPUT_BUFFER_SIZE 65536
+/** Pieces of output held before writing (Linux's IOV_MAX) */
+#define OUTPUT_IOVECS 1024
+
+char output_init(enum output_t, int);
+char output_format(char *, enum output_t *);
+char output_digest(enum hash_t, unsigned char [], char *);
+char output_known(enum hash_t, unsigned char [], char *, const char *);
+char output_chunk(enum hash_t, unsigned long long, unsigned long long,
+		unsigned char [], char *);
+char output_flush();
+
+#endif /* OUTPUT_H_ */
@@ -0,0 +1,509 @@
+/**
+ * @file pbkdf2.c
+ * An implementation of PBKDF2, described in RFC 2898, using HMAC-SHA2
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <time.h>
+
+#include "../global.h"
+#include "../hash.h"
+#include "../sha2/sha2.h"
+#include "../hmac/hmac.h"
+#include "pbkdf2.h"
+
+char pbkdf2_first(struct hmac_key *, unsigned char *, unsigned int,
+		unsigned long, unsigned char []);
+void pbkdf2_i_iterate(struct hmac_key *, unsigned int [], unsigned int [],
+		unsigned long);
+void pbkdf2_ll_iterate(struct hmac_key *, unsigned long long [],
+		unsigned long long [], unsigned long);
+void pbkdf2_i_iterate_lanes(struct hmac_key [], unsigned int [][SHA2_LANES],
+		unsigned int [][SHA2_LANES], unsigned long []);
+void pbkdf2_ll_iterate_lanes(struct hmac_key [],
+		unsigned long long [][SHA2_LANES], unsigned long long [][SHA2_LANES],
+		unsigned long []);
+
+/**
+ * Check whether PBKDF2 supports a hash type
+ *
+ * Only SHA2 is supported, and not SHA512/224 as its digest isn't a whole
+ *  number of words.
+ *
+ * @param type The hash type
+ * @return 1 if the hash type is supported, else 0
+ */
+char pbkdf2_supported(enum hash_t type)
+{
+	return type == H_SHA256 || type == H_SHA224 ||
+			type == H_SHA512 || type == H_SHA384 || type == H_SHA512_256;
+}
+
+/**
+ * Check whether a SHA2 hash type uses 64 bit words
+ *
+ * @param type The hash type
+ * @return 1 if the hash type uses 64 bit words, else 0
+ */
+char pbkdf2_is_ll(enum hash_t type)
+{
+	return type == H_SHA512 || type == H_SHA384 ||
+			type == H_SHA512_256 || type == H_SHA512_224;
+}
+
+/**
+ * Compute the first iteration, U1 = HMAC(password, salt || INT(block))
+ *
+ * @param key Prepared password
+ * @param salt Salt bytes
+ * @param salt_length Number of bytes in the salt
+ * @param block Block index, starting at 1
+ * @param digest Array of at least hash_digest_size() bytes to store U1
+ * @return 1 if U1 was computed, else 0
+ */
+char pbkdf2_first(struct hmac_key *key, unsigned char *salt,
+		unsigned int salt_length, unsigned long block, unsigned char digest[])
+{
+	unsigned char block_b[4];
+
+	if (!hmac_init(key))
+		return 0;
+
+	be_i_to_b((unsigned int) block, block_b);
+	hash_add_bytes(salt, salt_length);
+	hash_add_bytes(block_b, 4);
+
+	return hmac_get_digest(key, digest);
+}
+
+/**
+ * Run iterations 2 to c for a 32 bit SHA2 type
+ *
+ * Every iteration is HMAC of exactly one digest, so both the inner and outer
+ *  hash are a single fixed-length chunk after the key midstates: the padding
+ *  and length words are written once and only the digest words change.
+ *
+ * @param key Prepared password
+ * @param u U1 as words, replaced with the last U
+ * @param t Running XOR of the Us (starting as U1), updated in place
+ * @param iterations Iteration count
+ */
+void pbkdf2_i_iterate(struct hmac_key *key, unsigned int u[], unsigned int t[],
+		unsigned long iterations)
+{
+	unsigned int digest_words = hash_digest_size(key->type) / 4;
+	unsigned int chunk[16], state[8];
+	unsigned long j;
+	unsigned int i;
+
+	/* Fixed padding - a one bit, zeros and the (chunk + digest) length */
+	for (i = digest_words; i < 16; i++)
+		chunk[i] = 0;
+	chunk[digest_words] = 0x80000000;
+	chunk[15] = (64 + (digest_words * 4)) * 8;
+
+	for (j = 1; j < iterations; j++) {
+		/* Inner hash of the previous U */
+		for (i = 0; i < 8; i++)
+			state[i] = key->i_inner[i];
+		for (i = 0; i < digest_words; i++)
+			chunk[i] = u[i];
+		sha2_i_compress(state, chunk);
+
+		/* Outer hash of the inner digest */
+		for (i = 0; i < digest_words; i++)
+			chunk[i] = state[i];
+		for (i = 0; i < 8; i++)
+			state[i] = key->i_outer[i];
+		sha2_i_compress(state, chunk);
+
+		for (i = 0; i < digest_words; i++) {
+			u[i] = state[i];
+			t[i] ^= state[i];
+		}
+	}
+}
+
+/**
+ * Run iterations 2 to c for a 64 bit SHA2 type
+ *
+ * @param key Prepared password
+ * @param u U1 as words, replaced with the last U
+ * @param t Running XOR of the Us (starting as U1), updated in place
+ * @param iterations Iteration count
+ */
+void pbkdf2_ll_iterate(struct hmac_key *key, unsigned long long u[],
+		unsigned long long t[], unsigned long iterations)
+{
+	unsigned int digest_words = hash_digest_size(key->type) / 8;
+	unsigned long long chunk[16], state[8];
+	unsigned long j;
+	unsigned int i;
+
+	/* Fixed padding - a one bit, zeros and the (chunk + digest) length */
+	for (i = digest_words; i < 16; i++)
+		chunk[i] = 0;
+	chunk[digest_words] = 0x8000000000000000ULL;
+	chunk[15] = (128 + (digest_words * 8)) * 8;
+
+	for (j = 1; j < iterations; j++) {
+		/* Inner hash of the previous U */
+		for (i = 0; i < 8; i++)
+			state[i] = key->ll_inner[i];
+		for (i = 0; i < digest_words; i++)
+			chunk[i] = u[i];
+		sha2_ll_compress(state, chunk);
+
+		/* Outer hash of the inner digest */
+		for (i = 0; i < digest_words; i++)
+			chunk[i] = state[i];
+		for (i = 0; i < 8; i++)
+			state[i] = key->ll_outer[i];
+		sha2_ll_compress(state, chunk);
+
+		for (i = 0; i < digest_words; i++) {
+			u[i] = state[i];
+			t[i] ^= state[i];
+		}
+	}
+}
+
+/**
+ * Run iterations 2 to c for SHA2_LANES independent 32 bit derivations
+ *
+ * The lanes run in lock-step until the longest iteration count is reached;
+ *  a lane only accumulates into its t while it is within its own count.
+ *
+ * @param keys SHA2_LANES prepared passwords (all of the same hash type)
+ * @param u U1 of each lane as words, indexed [word][lane]
+ * @param t Running XOR of the Us of each lane, indexed [word][lane]
+ * @param iterations Iteration count of each lane
+ */
+void pbkdf2_i_iterate_lanes(struct hmac_key keys[],
+		unsigned int u[][SHA2_LANES], unsigned int t[][SHA2_LANES],
+		unsigned long iterations[])
+{
+	unsigned int digest_words = hash_digest_size(keys[0].type) / 4;
+	unsigned int chunk[16][SHA2_LANES], state[8][SHA2_LANES];
+	unsigned long j, max_iterations = 0;
+	unsigned int i, l;
+
+	/* Fixed padding - a one bit, zeros and the (chunk + digest) length */
+	for (l = 0; l < SHA2_LANES; l++) {
+		for (i = digest_words; i < 16; i++)
+			chunk[i][l] = 0;
+		chunk[digest_words][l] = 0x80000000;
+		chunk[15][l] = (64 + (digest_words * 4)) * 8;
+
+		if (iterations[l] > max_iterations)
+			max_iterations = iterations[l];
+	}
+
+	for (j = 1; j < max_iterations; j++) {
+		/* Inner hashes of the previous Us */
+		for (i = 0; i < 8; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				state[i][l] = keys[l].i_inner[i];
+		for (i = 0; i < digest_words; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				chunk[i][l] = u[i][l];
+		sha2_i_compress_lanes(state, chunk);
+
+		/* Outer hashes of the inner digests */
+		for (i = 0; i < digest_words; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				chunk[i][l] = state[i][l];
+		for (i = 0; i < 8; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				state[i][l] = keys[l].i_outer[i];
+		sha2_i_compress_lanes(state, chunk);
+
+		for (l = 0; l < SHA2_LANES; l++) {
+			for (i = 0; i < digest_words; i++) {
+				u[i][l] = state[i][l];
+				if (j < iterations[l])
+					t[i][l] ^= state[i][l];
+			}
+		}
+	}
+}
+
+/**
+ * Run iterations 2 to c for SHA2_LANES independent 64 bit derivations
+ *
+ * @param keys SHA2_LANES prepared passwords (all of the same hash type)
+ * @param u U1 of each lane as words, indexed [word][lane]
+ * @param t Running XOR of the Us of each lane, indexed [word][lane]
+ * @param iterations Iteration count of each lane
+ */
+void pbkdf2_ll_iterate_lanes(struct hmac_key keys[],
+		unsigned long long u[][SHA2_LANES], unsigned long long t[][SHA2_LANES],
+		unsigned long iterations[])
+{
+	unsigned int digest_words = hash_digest_size(keys[0].type) / 8;
+	unsigned long long chunk[16][SHA2_LANES], state[8][SHA2_LANES];
+	unsigned long j, max_iterations = 0;
+	unsigned int i, l;
+
+	/* Fixed padding - a one bit, zeros and the (chunk + digest) length */
+	for (l = 0; l < SHA2_LANES; l++) {
+		for (i = digest_words; i < 16; i++)
+			chunk[i][l] = 0;
+		chunk[digest_words][l] = 0x8000000000000000ULL;
+		chunk[15][l] = (128 + (digest_words * 8)) * 8;
+
+		if (iterations[l] > max_iterations)
+			max_iterations = iterations[l];
+	}
+
+	for (j = 1; j < max_iterations; j++) {
+		/* Inner hashes of the previous Us */
+		for (i = 0; i < 8; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				state[i][l] = keys[l].ll_inner[i];
+		for (i = 0; i < digest_words; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				chunk[i][l] = u[i][l];
+		sha2_ll_compress_lanes(state, chunk);
+
+		/* Outer hashes of the inner digests */
+		for (i = 0; i < digest_words; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				chunk[i][l] = state[i][l];
+		for (i = 0; i < 8; i++)
+			for (l = 0; l < SHA2_LANES; l++)
+				state[i][l] = keys[l].ll_outer[i];
+		sha2_ll_compress_lanes(state, chunk);
+
+		for (l = 0; l < SHA2_LANES; l++) {
+			for (i = 0; i < digest_words; i++) {
+				u[i][l] = state[i][l];
+				if (j < iterations[l])
+					t[i][l] ^= state[i][l];
+			}
+		}
+	}
+}
+
+/**
+ * Derive a key with PBKDF2
+ *
+ * @param type The hash type (SHA2 types only)
+ * @param password Password bytes
+ * @param password_length Number of bytes in the password
+ * @param salt Salt bytes
+ * @param salt_length Number of bytes in the salt
+ * @param iterations Iteration count (at least 1)
+ * @param key Array to store the derived key
+ * @param key_length Number of bytes of key to derive
+ * @return 1 if the key was derived, else 0
+ */
+char pbkdf2(enum hash_t type, unsigned char *password,
+		unsigned int password_length, unsigned char *salt,
+		unsigned int salt_length, unsigned long iterations,
+		unsigned char *key, unsigned int key_length)
+{
+	struct pbkdf2_job job;
+
+	job.password = password;
+	job.password_length = password_length;
+	job.salt = salt;
+	job.salt_length = salt_length;
+	job.iterations = iterations;
+	job.key = key;
+	job.key_length = key_length;
+
+	return pbkdf2_many(type, &job, 1);
+}
+
+/**
+ * Derive several keys with PBKDF2
+ *
+ * Each digest-sized block of each key is a separate task; tasks are handed
+ *  out SHA2_LANES at a time to the multi-lane iteration functions, and a
+ *  lone task runs through the scalar ones. Jobs with similar iteration
+ *  counts should be next to each other, as a group of lanes runs for the
+ *  longest count within it.
+ *
+ * @param type The hash type (SHA2 types only)
+ * @param jobs Array of derivations
+ * @param count Number of derivations
+ * @return 1 if all of the keys were derived, else 0
+ */
+char pbkdf2_many(enum hash_t type, struct pbkdf2_job jobs[],
+		unsigned int count)
+{
+	unsigned int digest_size = hash_digest_size(type);
+	unsigned int word_size = pbkdf2_is_ll(type) ? 8 : 4;
+	unsigned int digest_words = digest_size / word_size;
+
+	/* Current task - job and block within the job */
+	unsigned int job = 0;
+	unsigned long block = 1;
+
+	if (!pbkdf2_supported(type))
+		return 0;
+
+	while (job < count) {
+		struct hmac_key keys[SHA2_LANES];
+		unsigned long iterations[SHA2_LANES];
+		unsigned int task_job[SHA2_LANES];
+		unsigned long task_block[SHA2_LANES];
+		unsigned int i_u[8][SHA2_LANES], i_t[8][SHA2_LANES];
+		unsigned long long ll_u[8][SHA2_LANES], ll_t[8][SHA2_LANES];
+		unsigned char digest[HASH_MAX_DIGEST];
+		unsigned int lanes = 0, l, i;
+
+		/* Gather up to SHA2_LANES tasks and compute their U1 */
+		while (lanes < SHA2_LANES && job < count) {
+			struct pbkdf2_job *cur = &jobs[job];
+
+			if (!hmac_key_init(&keys[lanes], type, cur->password,
+					cur->password_length))
+				return 0;
+			if (!pbkdf2_first(&keys[lanes], cur->salt, cur->salt_length,
+					block, digest))
+				return 0;
+
+			for (i = 0; i < digest_words; i++) {
+				if (word_size == 8) {
+					ll_u[i][lanes] = be_ll_b_to_w(digest + (i * 8));
+					ll_t[i][lanes] = ll_u[i][lanes];
+				} else {
+					i_u[i][lanes] = be_i_b_to_w(digest + (i * 4));
+					i_t[i][lanes] = i_u[i][lanes];
+				}
+			}
+
+			iterations[lanes] = cur->iterations;
+			task_job[lanes] = job;
+			task_block[lanes] = block;
+			lanes++;
+
+			/* Move on to the next block, or the next job */
+			if (block * digest_size >= cur->key_length) {
+				job++;
+				block = 1;
+			} else {
+				block++;
+			}
+		}
+
+		if (lanes == 1) {
+			/* A lone task - no point filling the other lanes */
+			if (word_size == 8) {
+				unsigned long long u[8], t[8];
+				for (i = 0; i < digest_words; i++) {
+					u[i] = ll_u[i][0];
+					t[i] = ll_t[i][0];
+				}
+				pbkdf2_ll_iterate(&keys[0], u, t, iterations[0]);
+				for (i = 0; i < digest_words; i++)
+					ll_t[i][0] = t[i];
+			} else {
+				unsigned int u[8], t[8];
+				for (i = 0; i < digest_words; i++) {
+					u[i] = i_u[i][0];
+					t[i] = i_t[i][0];
+				}
+				pbkdf2_i_iterate(&keys[0], u, t, iterations[0]);
+				for (i = 0; i < digest_words; i++)
+					i_t[i][0] = t[i];
+			}
+		} else {
+			/* Unused lanes repeat the first lane without accumulating */
+			for (l = lanes; l < SHA2_LANES; l++) {
+				keys[l] = keys[0];
+				iterations[l] = 1;
+				for (i = 0; i < digest_words; i++) {
+					if (word_size == 8)
+						ll_u[i][l] = ll_u[i][0];
+					else
+						i_u[i][l] = i_u[i][0];
+				}
+			}
+
+			if (word_size == 8)
+				pbkdf2_ll_iterate_lanes(keys, ll_u, ll_t, iterations);
+			else
+				pbkdf2_i_iterate_lanes(keys, i_u, i_t, iterations);
+		}
+
+		/* Copy each task's block into its key */
+		for (l = 0; l < lanes; l++) {
+			struct pbkdf2_job *cur = &jobs[task_job[l]];
+			unsigned long offset = (task_block[l] - 1) * digest_size;
+
+			for (i = 0; i < digest_words; i++) {
+				if (word_size == 8)
+					be_ll_to_b(ll_t[i][l], digest + (i * 8));
+				else
+					be_i_to_b(i_t[i][l], digest + (i * 4));
+			}
+
+			for (i = 0; i < digest_size && offset + i < cur->key_length; i++)
+				cur->key[offset + i] = digest[i];
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Measure the PBKDF2 iteration rate of one core
+ *
+ * @param type The hash type (SHA2 types only)
+ * @param iterations Iteration count of each derivation
+ * @param lanes 1 to derive SHA2_LANES keys at once, 0 for a single key
+ * @return Iterations per second, or 0 if the hash type isn't supported
+ */
+double pbkdf2_bench(enum hash_t type, unsigned long iterations, char lanes)
+{
+	struct pbkdf2_job jobs[SHA2_LANES];
+	unsigned char keys[SHA2_LANES][HASH_MAX_DIGEST];
+	unsigned char password[] = "password";
+	unsigned char salt[] = "salt";
+	unsigned int count = lanes ? SHA2_LANES : 1;
+	unsigned int l;
+	clock_t start, end;
+
+	for (l = 0; l < count; l++) {
+		jobs[l].password = password;
+		jobs[l].password_length = sizeof(password) - 1;
+		jobs[l].salt = salt;
+		jobs[l].salt_length = sizeof(salt) - 1;
+		jobs[l].iterations = iterations;
+		jobs[l].key = keys[l];
+		jobs[l].key_length = hash_digest_size(type);
+	}
+
+	start = clock();
+	if (!pbkdf2_many(type, jobs, count))
+		return 0;
+	end = clock();
+
+	/* Avoid dividing by zero for tiny runs */
+	if (end == start)
+		end = start + 1;
+
+	return ((double) iterations * count) /
+			((double) (end - start) / CLOCKS_PER_SEC);
+}
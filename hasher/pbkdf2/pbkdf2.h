@@ -0,0 +1,49 @@
+/**
+ * @file pbkdf2.h
+ * Header for pbkdf2.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PBKDF2_H_
+#define PBKDF2_H_
+
+/** A single PBKDF2 derivation, for pbkdf2_many */
+struct pbkdf2_job {
+	/** Password bytes */
+	unsigned char *password;
+	/** Number of bytes in the password */
+	unsigned int password_length;
+	/** Salt bytes */
+	unsigned char *salt;
+	/** Number of bytes in the salt */
+	unsigned int salt_length;
+	/** Iteration count (at least 1) */
+	unsigned long iterations;
+	/** Array to store the derived key */
+	unsigned char *key;
+	/** Number of bytes of key to derive */
+	unsigned int key_length;
+};
+
+char pbkdf2(enum hash_t, unsigned char *, unsigned int, unsigned char *,
+		unsigned int, unsigned long, unsigned char *, unsigned int);
+char pbkdf2_many(enum hash_t, struct pbkdf2_job [], unsigned int);
+double pbkdf2_bench(enum hash_t, unsigned long, char);
+
+#endif /* PBKDF2_H_ */
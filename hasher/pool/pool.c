@@ -0,0 +1,1130 @@
+/**
+ * @file pool.c
+ * Worker pool for hashing many files - workers pinned to CPUs, with
+ *  buffers on their own NUMA node, files routed to the node of their
+ *  device, idle workers stealing the largest work left, and digests put
+ *  back in order through a bounded ring
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* CPU affinity, realpath */
+#define _GNU_SOURCE
+
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+#include "../hash.h"
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "../blockmap/blockmap.h"
+#include "../layout/layout.h"
+#include "../sparse/sparse.h"
+#include "../prefix/prefix.h"
+#include "pool.h"
+
+/** A piece of work - a whole file, or a run of the blocks of one */
+struct pool_task {
+	/** Index of the file */
+	unsigned int file;
+	/** First block of the run (block digests only) */
+	unsigned long long first;
+	/** Number of blocks in the run (block digests only) */
+	unsigned long long count;
+	/** Bytes the task reads, which orders the work */
+	unsigned long long bytes;
+	/** Where the file lies, which orders the work instead (disk order) */
+	struct layout where;
+};
+
+/**
+ * A worker's tasks, largest first
+ *
+ * The owner and thieves alike take from the head, so the largest work is
+ *  always started first. A task running to more blocks than a segment is
+ *  not taken whole - a segment is split off the front of it, leaving the
+ *  rest at the head for whoever comes next.
+ */
+struct pool_deque {
+	/** The tasks */
+	struct pool_task *tasks;
+	/** Next task to take */
+	unsigned int head;
+	/** One past the last task */
+	unsigned int tail;
+	/** Bytes left in the tasks from head on */
+	unsigned long long bytes;
+	/** Guards head, the task at head and bytes */
+	pthread_mutex_t lock;
+};
+
+/** A digest waiting in the reorder ring */
+struct pool_slot {
+	/** Set by the worker once the rest is filled in, cleared when given */
+	char ready;
+	/** Whether the file was hashed */
+	char ok;
+	/** Index of the file */
+	unsigned int file;
+	/** The digest */
+	unsigned char digest[HASH_MAX_DIGEST];
+};
+
+/**
+ * Digests on their way to the caller (whole file digests)
+ *
+ * A digest's place in the sequence is its file's index, or with unordered
+ *  output, the order it was claimed in. It goes in the slot of its place
+ *  modulo POOL_RING_SLOTS, and whichever worker holds draining gives the
+ *  digests from next on for as long as they are ready. No lock is taken -
+ *  ordered runs only hand out files less than POOL_RING_SLOTS past next,
+ *  so a worker never waits for its slot to free up.
+ */
+struct pool_ring {
+	/** The slots */
+	struct pool_slot *slots;
+	/** Place of the next digest to give */
+	unsigned long long next;
+	/** Places claimed so far (unordered output) */
+	unsigned long long claimed;
+	/** Set while a worker is giving digests */
+	char draining;
+	/** Whether places are claimed in the order digests finish */
+	char unordered;
+	/** Called with each digest */
+	pool_result_t result;
+};
+
+/** A run of the pool */
+struct pool {
+	/** The hash type */
+	enum hash_t type;
+	/** Paths of the files */
+	char **files;
+	/** Prefix each file's digest starts from, or NULL */
+	const struct hash_ctx *prefix;
+	/** Digests of the files (whole file digests) */
+	struct pool_ring ring;
+	/** Block digests of each file (block digests), or NULL */
+	struct blockmap *maps;
+	/** Blocks split off a large file's task at a time (block digests) */
+	unsigned long long segment;
+	/** Whether each file was hashed (cleared on failure) */
+	char *ok;
+	/** A deque per worker */
+	struct pool_deque *deques;
+	/** Number of workers */
+	unsigned int workers;
+};
+
+/** A worker of the pool */
+struct pool_worker {
+	/** The pool */
+	struct pool *pool;
+	/** Index of the worker, and of its deque */
+	unsigned int index;
+	/** CPU to pin to, or -1 */
+	int cpu;
+	/** NUMA node of the CPU, or -1 */
+	int node;
+};
+
+/**
+ * Parse a CPU list, as in /sys (e.g. 0-3,8,10-11)
+ *
+ * @param arg The list
+ * @param cpus Set to an array of the CPUs (free with free)
+ * @param count Set to the number of CPUs
+ * @return 1 if the list was parsed, else 0
+ */
+char pool_parse_cpus(char *arg, int **cpus, unsigned int *count)
+{
+	long first, last, c;
+	char *end;
+
+	*cpus = malloc(POOL_MAX_CPUS * sizeof(int));
+	*count = 0;
+	if (*cpus == NULL)
+		return 0;
+
+	while (*arg != '\0') {
+		first = strtol(arg, &end, 10);
+		last = first;
+		if (end == arg || first < 0)
+			break;
+		if (*end == '-') {
+			arg = end + 1;
+			last = strtol(arg, &end, 10);
+			if (end == arg || last < first)
+				break;
+		}
+		for (c = first; c <= last && *count < POOL_MAX_CPUS; c++)
+			(*cpus)[(*count)++] = (int) c;
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			break;
+		arg = end;
+	}
+
+	if (*arg != '\0' || *count == 0) {
+		free(*cpus);
+		*cpus = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Parse a NUMA placement mode
+ *
+ * @param arg auto or off
+ * @param numa Set to the mode
+ * @return 1 if the mode was parsed, else 0
+ */
+char pool_parse_numa(char *arg, enum pool_numa_t *numa)
+{
+	if (strcmp(arg, "auto") == 0)
+		*numa = POOL_NUMA_AUTO;
+	else if (strcmp(arg, "off") == 0)
+		*numa = POOL_NUMA_OFF;
+	else
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Find the NUMA node of every CPU
+ *
+ * @param nodes Array of POOL_MAX_CPUS to store the node of each CPU (-1 if
+ *               unknown, as without NUMA)
+ */
+void pool_cpu_nodes(int nodes[])
+{
+	char path[64], list[4096];
+	unsigned int count, c;
+	int node, *cpus;
+	FILE *fp;
+
+	for (c = 0; c < POOL_MAX_CPUS; c++)
+		nodes[c] = -1;
+
+	for (node = 0; node < POOL_MAX_NODES; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+				node);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			continue;
+		if (fgets(list, sizeof(list), fp) != NULL) {
+			list[strcspn(list, "\n")] = '\0';
+			if (pool_parse_cpus(list, &cpus, &count)) {
+				for (c = 0; c < count; c++)
+					if (cpus[c] < POOL_MAX_CPUS)
+						nodes[cpus[c]] = node;
+				free(cpus);
+			}
+		}
+		fclose(fp);
+	}
+}
+
+/**
+ * Find the NUMA node a file's device is attached to
+ *
+ * The device's directory in /sys and those of its parents (partition, disk,
+ *  controller, PCI device) are searched for a numa_node file.
+ *
+ * @param path The file
+ * @return The node, or -1 if unknown (always, other than on Linux)
+ */
+int pool_file_node(char *path)
+{
+#ifdef __linux__
+	char link[64], dir[PATH_MAX], *slash;
+	struct stat st;
+	dev_t dev;
+	int node = -1;
+	FILE *fp;
+
+	if (stat(path, &st) < 0)
+		return -1;
+	dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(dev),
+			minor(dev));
+	if (realpath(link, dir) == NULL)
+		return -1;
+
+	while (strncmp(dir, "/sys/devices/", 13) == 0) {
+		slash = dir + strlen(dir);
+		if (slash + 11 - dir >= PATH_MAX)
+			break;
+		strcpy(slash, "/numa_node");
+		fp = fopen(dir, "r");
+		*slash = '\0';
+		if (fp != NULL) {
+			if (fscanf(fp, "%d", &node) != 1)
+				node = -1;
+			fclose(fp);
+			if (node >= 0)
+				return node;
+		}
+
+		slash = strrchr(dir, '/');
+		if (slash == NULL)
+			break;
+		*slash = '\0';
+	}
+#endif
+
+	return -1;
+}
+
+/**
+ * Get the CPUs to run workers on, spread over the NUMA nodes
+ *
+ * The CPUs this process may run on are taken a node at a time in turn, so
+ *  fewer workers than CPUs still cover every node.
+ *
+ * @param cpus Array of POOL_MAX_CPUS to store the CPUs
+ * @param nodes Node of each CPU, from pool_cpu_nodes
+ * @return Number of CPUs (0 other than on Linux, where workers aren't pinned)
+ */
+unsigned int pool_allowed_cpus(int cpus[], const int nodes[])
+{
+#ifdef __linux__
+	unsigned int count = 0, total = 0, most = 0, c, r;
+	unsigned int seen[POOL_MAX_NODES + 1], *ranks;
+	int cpu, *allowed;
+	cpu_set_t set;
+
+	if (sched_getaffinity(0, sizeof(set), &set) < 0)
+		return 0;
+	ranks = malloc(POOL_MAX_CPUS * sizeof(unsigned int));
+	allowed = malloc(POOL_MAX_CPUS * sizeof(int));
+	if (ranks == NULL || allowed == NULL) {
+		free(ranks);
+		free(allowed);
+		return 0;
+	}
+
+	/* Rank each allowed CPU among those of its node */
+	memset(seen, 0, sizeof(seen));
+	for (cpu = 0; cpu < CPU_SETSIZE && cpu < POOL_MAX_CPUS; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		allowed[total] = cpu;
+		ranks[total] = seen[nodes[cpu] + 1]++;
+		if (ranks[total] >= most)
+			most = ranks[total] + 1;
+		total++;
+	}
+
+	/* Then take the first of each node, the second of each, ... */
+	for (r = 0; r < most; r++)
+		for (c = 0; c < total; c++)
+			if (ranks[c] == r)
+				cpus[count++] = allowed[c];
+
+	free(ranks);
+	free(allowed);
+
+	return count;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Hash a file with a hash context, reading it into a worker's buffer
+ *
+ * @param type The hash type (reentrant)
+ * @param prefix Prefix to start from (of the hash type), or NULL
+ * @param path The file
+ * @param buffer POOL_BUFFER_SIZE bytes to read into
+ * @param digest Array to store the digest
+ * @return 1 if the whole file was hashed, else 0
+ */
+char pool_hash_file(enum hash_t type, const struct hash_ctx *prefix,
+		char *path, unsigned char *buffer, unsigned char digest[])
+{
+	struct hash_ctx ctx;
+	struct sparse sparse;
+	unsigned char *bytes;
+	size_t got;
+	char ok;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	STATS_ADD(S_FILES_OPENED, 1);
+	HASHER_PROBE1(file__open, path);
+#ifdef __linux__
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	/* Holes are added as zeros without reading them */
+	if (prefix != NULL)
+		prefix_copy(&ctx, prefix);
+	else
+		hash_ctx_init(&ctx, type);
+	sparse_begin_fd(&sparse, fd);
+	while ((got = sparse_read(&sparse, buffer, POOL_BUFFER_SIZE, &bytes)) > 0)
+		hash_ctx_add(&ctx, bytes, got);
+	ok = sparse_end(&sparse);
+
+	close(fd);
+	HASHER_PROBE1(file__close, path);
+	hash_ctx_final(&ctx, digest);
+
+	return ok;
+}
+
+/**
+ * Hash a file with the hash globals (one worker only)
+ *
+ * @param type The hash type
+ * @param path The file
+ * @param digest Array to store the digest
+ * @return 1 if the file was hashed, else 0
+ */
+char pool_hash_file_globals(enum hash_t type, char *path,
+		unsigned char digest[])
+{
+	FILE *fp = fopen(path, "rb");
+	char ok;
+
+	if (fp == NULL)
+		return 0;
+	STATS_ADD(S_FILES_OPENED, 1);
+	HASHER_PROBE1(file__open, path);
+
+	ok = hash_init(type) && hash_add_file(fp) && !ferror(fp);
+	fclose(fp);
+	HASHER_PROBE1(file__close, path);
+
+	return hash_get_digest(digest) && ok;
+}
+
+/**
+ * Hash a run of the blocks of a file
+ *
+ * @param pool The pool
+ * @param task The task
+ * @param buffer A block's worth of bytes to read into
+ * @return 1 if every block of the run was hashed, else 0
+ */
+char pool_hash_task_blocks(struct pool *pool, const struct pool_task *task,
+		unsigned char *buffer)
+{
+	struct blockmap *map = &pool->maps[task->file];
+	unsigned int size = hash_digest_size(pool->type);
+	unsigned long long b, offset, length;
+	char ok = 1;
+	int fd;
+
+	fd = open(pool->files[task->file], O_RDONLY);
+	if (fd < 0)
+		return 0;
+	STATS_ADD(S_FILES_OPENED, 1);
+	HASHER_PROBE1(file__open, pool->files[task->file]);
+
+	for (b = task->first; ok && b < task->first + task->count; b++) {
+		offset = b * map->block_size;
+		length = map->file_size - offset < map->block_size ?
+				map->file_size - offset : map->block_size;
+		ok = blockmap_pread(fd, buffer, length, offset) &&
+				hash_oneshot(pool->type, buffer, length,
+						map->digests + (b * size));
+	}
+
+	close(fd);
+	HASHER_PROBE1(file__close, pool->files[task->file]);
+
+	return ok;
+}
+
+/**
+ * Take the task at the head of a deque, or a segment split off it
+ *
+ * @param pool The pool
+ * @param deque The deque
+ * @param limit Files from this index on are not yet to be taken
+ * @param task Task to be filled in
+ * @return 1 if a task was taken, else 0 (the deque is empty, or the task
+ *          at its head is not yet to be taken)
+ */
+char pool_take_from(struct pool *pool, struct pool_deque *deque,
+		unsigned long long limit, struct pool_task *task)
+{
+	struct pool_task *rest;
+	char taken = 0;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->head < deque->tail && deque->tasks[deque->head].file < limit) {
+		rest = &deque->tasks[deque->head];
+		*task = *rest;
+		if (pool->maps != NULL && task->count > pool->segment) {
+			/* Not the last segment, so every block is whole */
+			task->count = pool->segment;
+			task->bytes = task->count * pool->maps[task->file].block_size;
+			rest->first += task->count;
+			rest->count -= task->count;
+			rest->bytes -= task->bytes;
+		} else {
+			deque->head++;
+		}
+		deque->bytes -= task->bytes;
+		taken = 1;
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return taken;
+}
+
+/**
+ * Take the next task for a worker
+ *
+ * A worker takes from its own deque until it is empty, then steals from
+ *  whichever deque has the most bytes left, so the largest remaining work
+ *  is spread first. With ordered digests, only files with a slot in the
+ *  ring free are taken - the tasks are dealt a ring's worth of files at a
+ *  time, so the earliest file not given is always at the head of a deque
+ *  or being hashed, and waiting for it ends.
+ *
+ * @param worker The worker
+ * @param task Task to be filled in
+ * @return 1 if a task was taken, else 0 (there are none left)
+ */
+char pool_take(struct pool_worker *worker, struct pool_task *task)
+{
+	struct pool *pool = worker->pool;
+	struct pool_deque *deque;
+	unsigned long long most = 0, limit = ~0ULL;
+	unsigned int w;
+	char left;
+	long victim;
+
+	for (;;) {
+		if (pool->ring.slots != NULL && !pool->ring.unordered)
+			limit = __atomic_load_n(&pool->ring.next, __ATOMIC_ACQUIRE) +
+					POOL_RING_SLOTS;
+		if (pool_take_from(pool, &pool->deques[worker->index], limit, task))
+			return 1;
+
+		victim = -1;
+		left = 0;
+		for (w = 0; w < pool->workers; w++) {
+			deque = &pool->deques[w];
+			pthread_mutex_lock(&deque->lock);
+			if (deque->head < deque->tail) {
+				left = 1;
+				if (deque->tasks[deque->head].file < limit &&
+						(victim < 0 || deque->bytes > most)) {
+					victim = w;
+					most = deque->bytes;
+				}
+			}
+			pthread_mutex_unlock(&deque->lock);
+		}
+		if (!left)
+			return 0;
+
+		/* The victim may have been emptied since, so look again if so */
+		if (victim >= 0 && pool_take_from(pool, &pool->deques[victim], limit,
+				task)) {
+			STATS_ADD(S_TASKS_STOLEN, 1);
+			return 1;
+		}
+		if (victim < 0)
+			sched_yield();
+	}
+}
+
+/**
+ * Give the digests in the ring that are ready, in order
+ *
+ * Only one worker gives digests at a time. One that finds another doing so
+ *  leaves its digest for that worker, which looks once more after letting
+ *  go.
+ *
+ * @param ring The ring
+ */
+void pool_drain(struct pool_ring *ring)
+{
+	struct pool_slot *slot;
+	unsigned long long next;
+
+	for (;;) {
+		if (__atomic_exchange_n(&ring->draining, 1, __ATOMIC_SEQ_CST))
+			return;
+
+		/* The next place is read atomically - the last drainer moved it */
+		for (;;) {
+			next = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+			slot = &ring->slots[next & (POOL_RING_SLOTS - 1)];
+			if (!__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE))
+				break;
+			ring->result(slot->file, slot->digest, slot->ok);
+			__atomic_store_n(&slot->ready, 0, __ATOMIC_RELEASE);
+			__atomic_store_n(&ring->next, next + 1, __ATOMIC_RELEASE);
+		}
+
+		__atomic_store_n(&ring->draining, 0, __ATOMIC_SEQ_CST);
+		next = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+		slot = &ring->slots[next & (POOL_RING_SLOTS - 1)];
+		if (!__atomic_load_n(&slot->ready, __ATOMIC_SEQ_CST))
+			return;
+	}
+}
+
+/**
+ * Put a file's digest in the ring, and give what is ready
+ *
+ * @param ring The ring
+ * @param file Index of the file
+ * @param digest The digest
+ * @param ok Whether the file was hashed
+ */
+void pool_publish(struct pool_ring *ring, unsigned int file,
+		const unsigned char digest[], char ok)
+{
+	unsigned long long place = file;
+	struct pool_slot *slot;
+
+	/* Places before this one are claimed by workers about to fill them */
+	if (ring->unordered) {
+		place = __atomic_fetch_add(&ring->claimed, 1, __ATOMIC_RELAXED);
+		while (place >= __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE) +
+				POOL_RING_SLOTS) {
+			pool_drain(ring);
+			sched_yield();
+		}
+	}
+
+	slot = &ring->slots[place & (POOL_RING_SLOTS - 1)];
+	slot->file = file;
+	slot->ok = ok;
+	memcpy(slot->digest, digest, HASH_MAX_DIGEST);
+	__atomic_store_n(&slot->ready, 1, __ATOMIC_SEQ_CST);
+
+	pool_drain(ring);
+}
+
+/**
+ * Hash tasks until there are none left
+ *
+ * The worker pins itself first, so its buffer (touched here) comes from
+ *  its own node, as does its stack holding the hash contexts.
+ *
+ * @param arg The worker
+ * @return NULL
+ */
+void *pool_worker(void *arg)
+{
+	struct pool_worker *worker = arg;
+	struct pool *pool = worker->pool;
+	unsigned char *buffer = NULL, digest[HASH_MAX_DIGEST];
+	size_t length = POOL_BUFFER_SIZE;
+	struct pool_task task;
+	char ok;
+#ifdef __linux__
+	cpu_set_t set;
+
+	if (worker->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#endif
+
+	/* Block digests read whole blocks, which may be larger */
+	if (pool->maps != NULL && pool->maps[0].block_size > length)
+		length = pool->maps[0].block_size;
+	if (pool->maps != NULL || hash_reentrant(pool->type)) {
+		/* Anything left is stolen by the other workers */
+		if (posix_memalign((void **) &buffer, 4096, length) != 0)
+			return NULL;
+		memset(buffer, 0, length);
+	}
+
+	while (pool_take(worker, &task)) {
+		if (pool->maps != NULL) {
+			if (!pool_hash_task_blocks(pool, &task, buffer))
+				pool->ok[task.file] = 0;
+			continue;
+		}
+
+		memset(digest, 0, sizeof(digest));
+		if (buffer != NULL)
+			ok = pool_hash_file(pool->type, pool->prefix,
+					pool->files[task.file], buffer, digest);
+		else
+			ok = pool_hash_file_globals(pool->type, pool->files[task.file],
+					digest);
+		if (!ok)
+			pool->ok[task.file] = 0;
+		pool_publish(&pool->ring, task.file, digest, ok);
+	}
+
+	free(buffer);
+
+	return NULL;
+}
+
+/**
+ * Order tasks largest first
+ *
+ * @param a A task
+ * @param b Another task
+ * @return Less than, equal to or greater than 0 as a is larger than, the
+ *          same size as or smaller than b
+ */
+int pool_task_compare(const void *a, const void *b)
+{
+	unsigned long long x = ((const struct pool_task *) a)->bytes;
+	unsigned long long y = ((const struct pool_task *) b)->bytes;
+
+	return x > y ? -1 : x < y;
+}
+
+/**
+ * Order tasks cached first, then in the order they lie on disk
+ *
+ * @param a A task
+ * @param b Another task
+ * @return Less than, equal to or greater than 0 as a goes before, with or
+ *          after b
+ */
+int pool_task_compare_layout(const void *a, const void *b)
+{
+	return layout_compare(&((const struct pool_task *) a)->where,
+			&((const struct pool_task *) b)->where);
+}
+
+/**
+ * Order tasks a ring's worth of files at a time, then largest first
+ *
+ * @param a A task
+ * @param b Another task
+ * @return Less than, equal to or greater than 0 as a goes before, with or
+ *          after b
+ */
+int pool_task_compare_ordered(const void *a, const void *b)
+{
+	unsigned int x = ((const struct pool_task *) a)->file / POOL_RING_SLOTS;
+	unsigned int y = ((const struct pool_task *) b)->file / POOL_RING_SLOTS;
+
+	return x != y ? (x < y ? -1 : 1) : pool_task_compare(a, b);
+}
+
+/**
+ * Order tasks a ring's worth of files at a time, then cached first and in
+ *  the order they lie on disk
+ *
+ * @param a A task
+ * @param b Another task
+ * @return Less than, equal to or greater than 0 as a goes before, with or
+ *          after b
+ */
+int pool_task_compare_ordered_layout(const void *a, const void *b)
+{
+	unsigned int x = ((const struct pool_task *) a)->file / POOL_RING_SLOTS;
+	unsigned int y = ((const struct pool_task *) b)->file / POOL_RING_SLOTS;
+
+	return x != y ? (x < y ? -1 : 1) : pool_task_compare_layout(a, b);
+}
+
+/**
+ * Pick the worker to deal a task to
+ *
+ * @param workers The workers
+ * @param threads Number of workers
+ * @param node Node of the task's file, or -1 for any worker
+ * @param turn Turn counter of the node, advanced
+ * @return Index of the worker
+ */
+unsigned int pool_deal(const struct pool_worker workers[], unsigned int threads,
+		int node, unsigned int *turn)
+{
+	unsigned int t, i;
+
+	for (i = 0; i < threads; i++) {
+		t = (*turn)++ % threads;
+		if (node < 0 || workers[t].node == node)
+			return t;
+	}
+
+	return 0;
+}
+
+/**
+ * Fail the files never taken, giving their digests in order
+ *
+ * @param pool The pool, with an ok flag of 2 for each file never taken
+ * @param count Number of files
+ */
+void pool_untaken(struct pool *pool, unsigned int count)
+{
+	unsigned char none[HASH_MAX_DIGEST];
+	unsigned int f;
+
+	memset(none, 0, sizeof(none));
+	for (f = 0; f < count; f++) {
+		if (pool->ok[f] != 2)
+			continue;
+		pool->ok[f] = 0;
+		if (pool->ring.slots != NULL)
+			pool_publish(&pool->ring, f, none, 0);
+	}
+}
+
+/**
+ * Run the pool over the files
+ *
+ * Workers are pinned to the CPUs given, or with NUMA placement on, to the
+ *  CPUs this process may use spread over the nodes. Tasks are sorted
+ *  largest first (or with the layout option, cached files first and the
+ *  rest in the order they lie on disk, so a disk's heads sweep across it
+ *  rather than seek back and forth) and dealt in turn to the workers'
+ *  deques - with NUMA placement, to the workers on the node the file's
+ *  device is attached to. Hash types that use the hash globals get a
+ *  single worker.
+ *
+ * @param pool The pool, with the hash type, files, outputs and ok flags
+ *              (files already failed are skipped) filled in
+ * @param count Number of files
+ * @param sizes Bytes in each file
+ * @param options Threads, CPUs and NUMA placement
+ * @return 1 if every file was hashed, else 0
+ */
+char pool_run(struct pool *pool, unsigned int count,
+		const unsigned long long sizes[], const struct pool_options *options)
+{
+	struct pool_worker *workers;
+	struct pool_task *tasks;
+	pthread_t *ids;
+#ifdef __linux__
+	cpu_set_t saved;
+#endif
+	int *cpus = options->cpus, *placed, node;
+	int allowed[POOL_MAX_CPUS], cpu_nodes[POOL_MAX_CPUS];
+	unsigned int cpu_count = options->cpu_count, threads = options->threads;
+	unsigned int turns[POOL_MAX_NODES + 1], *owners, *filled;
+	unsigned int f, n, t, started, nodes = 0, total = 0;
+	char all = 1, pinned;
+
+	/* Without a CPU list, NUMA placement pins to the allowed CPUs */
+	if (options->numa == POOL_NUMA_AUTO)
+		pool_cpu_nodes(cpu_nodes);
+	if (cpus == NULL && options->numa == POOL_NUMA_AUTO) {
+		cpu_count = pool_allowed_cpus(allowed, cpu_nodes);
+		cpus = cpu_count > 0 ? allowed : NULL;
+	}
+	pinned = cpus != NULL;
+
+	if (threads == 0) {
+		if (pinned) {
+			threads = cpu_count;
+		} else {
+			long online = sysconf(_SC_NPROCESSORS_ONLN);
+			threads = online > 0 ? (unsigned int) online : 1;
+		}
+	}
+	if (!hash_reentrant(pool->type))
+		threads = 1;
+
+	placed = malloc((count + 1) * sizeof(int));
+	tasks = malloc((count + 1) * sizeof(*tasks));
+	owners = malloc((count + 1) * sizeof(unsigned int));
+	filled = malloc(threads * sizeof(unsigned int));
+	workers = malloc(threads * sizeof(*workers));
+	pool->deques = malloc(threads * sizeof(*pool->deques));
+	ids = malloc(threads * sizeof(*ids));
+	if (placed == NULL || tasks == NULL || owners == NULL || filled == NULL ||
+			workers == NULL || pool->deques == NULL || ids == NULL) {
+		for (f = 0; f < count; f++)
+			if (pool->ok[f])
+				pool->ok[f] = 2;
+		pool_untaken(pool, count);
+		free(placed);
+		free(tasks);
+		free(owners);
+		free(filled);
+		free(workers);
+		free(pool->deques);
+		free(ids);
+		return 0;
+	}
+	pool->workers = threads;
+
+	for (t = 0; t < threads; t++) {
+		workers[t].pool = pool;
+		workers[t].index = t;
+		workers[t].cpu = pinned ? cpus[t % cpu_count] : -1;
+		workers[t].node = -1;
+		if (pinned && options->numa == POOL_NUMA_AUTO &&
+				workers[t].cpu < POOL_MAX_CPUS)
+			workers[t].node = cpu_nodes[workers[t].cpu];
+		if (workers[t].node >= (int) nodes)
+			nodes = workers[t].node + 1;
+	}
+
+	/* A task per file, largest first */
+	for (f = 0; f < count; f++) {
+		if (!pool->ok[f])
+			continue;
+		node = nodes > 1 ? pool_file_node(pool->files[f]) : -1;
+		placed[f] = node >= 0 && node < (int) nodes ? node : -1;
+		tasks[total].file = f;
+		tasks[total].first = 0;
+		tasks[total].count = pool->maps != NULL ? pool->maps[f].count : 0;
+		tasks[total].bytes = sizes[f];
+		if (options->layout)
+			layout_probe(pool->files[f], &tasks[total].where);
+		total++;
+	}
+	if (pool->ring.slots != NULL && !pool->ring.unordered)
+		qsort(tasks, total, sizeof(*tasks), options->layout ?
+				pool_task_compare_ordered_layout : pool_task_compare_ordered);
+	else
+		qsort(tasks, total, sizeof(*tasks), options->layout ?
+				pool_task_compare_layout : pool_task_compare);
+
+	/* Dealt in turn, so each deque stays largest first */
+	memset(turns, 0, sizeof(turns));
+	for (t = 0; t < threads; t++) {
+		pool->deques[t].head = 0;
+		pool->deques[t].tail = 0;
+		pool->deques[t].bytes = 0;
+		filled[t] = 0;
+	}
+	for (n = 0; n < total; n++) {
+		node = placed[tasks[n].file];
+		owners[n] = pool_deal(workers, threads, node, &turns[node + 1]);
+		pool->deques[owners[n]].tail++;
+		pool->deques[owners[n]].bytes += tasks[n].bytes;
+	}
+	for (t = 0; t < threads; t++) {
+		pool->deques[t].tasks = malloc((pool->deques[t].tail + 1) *
+				sizeof(struct pool_task));
+		if (pool->deques[t].tasks == NULL)
+			all = 0;
+		pthread_mutex_init(&pool->deques[t].lock, NULL);
+	}
+	if (all)
+		for (n = 0; n < total; n++)
+			pool->deques[owners[n]].tasks[filled[owners[n]]++] = tasks[n];
+
+	if (all) {
+		for (t = 1; t < threads; t++)
+			if (pthread_create(&ids[t], NULL, pool_worker, &workers[t]))
+				break;
+		started = t;
+
+		/*
+		 * The calling thread is worker 0, and is unpinned again after.
+		 *  Deques of workers not started are stolen from.
+		 */
+#ifdef __linux__
+		if (workers[0].cpu >= 0)
+			sched_getaffinity(0, sizeof(saved), &saved);
+#endif
+		pool_worker(&workers[0]);
+#ifdef __linux__
+		if (workers[0].cpu >= 0)
+			sched_setaffinity(0, sizeof(saved), &saved);
+#endif
+
+		for (t = 1; t < started; t++)
+			pthread_join(ids[t], NULL);
+
+		/* Anything left when no worker could allocate its buffer */
+		for (t = 0; t < threads; t++)
+			for (n = pool->deques[t].head; n < pool->deques[t].tail; n++)
+				pool->ok[pool->deques[t].tasks[n].file] = 2;
+	} else {
+		for (f = 0; f < count; f++)
+			if (pool->ok[f])
+				pool->ok[f] = 2;
+	}
+
+	pool_untaken(pool, count);
+
+	for (f = 0; f < count; f++)
+		if (!pool->ok[f])
+			all = 0;
+
+	for (t = 0; t < threads; t++) {
+		free(pool->deques[t].tasks);
+		pthread_mutex_destroy(&pool->deques[t].lock);
+	}
+	free(placed);
+	free(tasks);
+	free(owners);
+	free(filled);
+	free(workers);
+	free(pool->deques);
+	free(ids);
+
+	return all;
+}
+
+/**
+ * Hash many files with a pool of workers, a digest per file
+ *
+ * Each file is a task of its own, as its digest must be made in order.
+ *  Digests are given while the pool runs, in the order of the files unless
+ *  the options allow any order. At most POOL_RING_SLOTS of them are held
+ *  waiting for an earlier file.
+ *
+ * @param type The hash type
+ * @param files Paths of the files
+ * @param count Number of files
+ * @param options Threads, CPUs, NUMA placement and ordering
+ * @param result Called with the digest of each file
+ * @return 1 if every file was hashed, else 0
+ */
+char pool_hash_files(enum hash_t type, char *files[], unsigned int count,
+		const struct pool_options *options, pool_result_t result)
+{
+	struct pool pool;
+	unsigned long long *sizes = calloc(count + 1, sizeof(*sizes));
+	char *ok = malloc(count + 1);
+	struct stat st;
+	unsigned int f;
+	char all;
+
+	pool.ring.slots = calloc(POOL_RING_SLOTS, sizeof(struct pool_slot));
+	if (sizes == NULL || ok == NULL || pool.ring.slots == NULL) {
+		free(sizes);
+		free(ok);
+		free(pool.ring.slots);
+		return 0;
+	}
+	for (f = 0; f < count; f++) {
+		ok[f] = 1;
+		sizes[f] = stat(files[f], &st) == 0 ? (unsigned long long) st.st_size :
+				0;
+	}
+
+	pool.type = type;
+	pool.files = files;
+	pool.prefix = options->prefix;
+	pool.ring.next = 0;
+	pool.ring.claimed = 0;
+	pool.ring.draining = 0;
+	pool.ring.unordered = options->unordered;
+	pool.ring.result = result;
+	pool.maps = NULL;
+	pool.segment = 0;
+	pool.ok = ok;
+	all = pool_run(&pool, count, sizes, options);
+	free(sizes);
+	free(ok);
+	free(pool.ring.slots);
+
+	return all;
+}
+
+/**
+ * Hash each block of many files with a pool of workers
+ *
+ * Each file is a task, but one running to more than POOL_SEGMENT_SIZE
+ *  bytes is taken a segment at a time, so idle workers share a large file
+ *  rather than wait on the one worker hashing it.
+ *
+ * @param type The hash type
+ * @param files Paths of the files
+ * @param count Number of files
+ * @param options Threads, CPUs and NUMA placement
+ * @param block_size Bytes in each block
+ * @param maps count maps to be filled in (free each hashed with
+ *              blockmap_free - they hold no rolling checksums, and those of
+ *              files not hashed are freed already)
+ * @param ok count flags, set for each file hashed
+ * @return 1 if every file was hashed, else 0
+ */
+char pool_hash_blocks(enum hash_t type, char *files[], unsigned int count,
+		const struct pool_options *options, unsigned long long block_size,
+		struct blockmap *maps, char *ok)
+{
+	struct pool pool;
+	unsigned long long *sizes = calloc(count + 1, sizeof(*sizes));
+	unsigned int f;
+	off_t end;
+	char all;
+	int fd;
+
+	if (sizes == NULL || block_size == 0) {
+		free(sizes);
+		for (f = 0; f < count; f++)
+			ok[f] = 0;
+		return 0;
+	}
+
+	/* Block devices have no size in stat, but can seek to their end */
+	for (f = 0; f < count; f++) {
+		fd = open(files[f], O_RDONLY);
+		end = fd >= 0 ? lseek(fd, 0, SEEK_END) : -1;
+		if (fd >= 0)
+			close(fd);
+
+		sizes[f] = end > 0 ? (unsigned long long) end : 0;
+		maps[f].type = type;
+		maps[f].block_size = block_size;
+		maps[f].file_size = sizes[f];
+		maps[f].count = (sizes[f] + block_size - 1) / block_size;
+		maps[f].digests = NULL;
+		maps[f].weak = NULL;
+		if (end >= 0)
+			maps[f].digests = malloc((maps[f].count * hash_digest_size(type))
+					+ 1);
+		ok[f] = maps[f].digests != NULL;
+	}
+
+	pool.type = type;
+	pool.files = files;
+	pool.prefix = NULL;
+	pool.ring.slots = NULL;
+	pool.maps = maps;
+	pool.segment = POOL_SEGMENT_SIZE / block_size > 0 ?
+			POOL_SEGMENT_SIZE / block_size : 1;
+	pool.ok = ok;
+	all = pool_run(&pool, count, sizes, options);
+	free(sizes);
+	for (f = 0; f < count; f++)
+		if (!ok[f])
+			blockmap_free(&maps[f]);
+
+	return all;
+}
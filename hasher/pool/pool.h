@@ -0,0 +1,75 @@
+/**
+ * @file pool.h
+ * Header for pool.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef POOL_H_
+#define POOL_H_
+
+/** Most NUMA nodes told apart (files on higher nodes go to any worker) */
+#define POOL_MAX_NODES 64
+/** Most CPUs a CPU list may name */
+#define POOL_MAX_CPUS 4096
+/** Bytes each worker reads at a time */
+#define POOL_BUFFER_SIZE (1024 * 1024)
+/** Bytes of a large file's blocks a worker takes at a time (at least one) */
+#define POOL_SEGMENT_SIZE (64ULL * 1024 * 1024)
+/** Digests held waiting for those of earlier files (a power of 2) */
+#define POOL_RING_SLOTS 4096
+
+/** Whether to place workers and files by NUMA node */
+enum pool_numa_t {
+	POOL_NUMA_AUTO,
+	POOL_NUMA_OFF
+};
+
+/** How to run a worker pool */
+struct pool_options {
+	/** Number of workers, or 0 for one per CPU used */
+	unsigned int threads;
+	/** CPUs to pin the workers to in turn, or NULL for any CPU */
+	int *cpus;
+	/** Number of CPUs in cpus */
+	unsigned int cpu_count;
+	/** NUMA placement */
+	enum pool_numa_t numa;
+	/** Whether digests may be given in the order they finish */
+	char unordered;
+	/** Whether to hash cached files first, then the rest in disk order */
+	char layout;
+	/** Prefix every file's digest starts from (whole file digests), or NULL */
+	const struct hash_ctx *prefix;
+};
+
+/**
+ * Called with the index, digest and success of each file, one call at a
+ *  time (but from any worker)
+ */
+typedef void (*pool_result_t)(unsigned int, unsigned char [], char);
+
+char pool_parse_cpus(char *, int **, unsigned int *);
+char pool_parse_numa(char *, enum pool_numa_t *);
+char pool_hash_files(enum hash_t, char *[], unsigned int,
+		const struct pool_options *, pool_result_t);
+char pool_hash_blocks(enum hash_t, char *[], unsigned int,
+		const struct pool_options *, unsigned long long, struct blockmap *,
+		char *);
+
+#endif /* POOL_H_ */
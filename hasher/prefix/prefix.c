@@ -0,0 +1,127 @@
+/**
+ * @file prefix.c
+ * Shared prefix midstates - messages that all begin with the same bytes
+ *  start from the state after them, rather than hashing them each time
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <string.h>
+
+#include "../hash.h"
+#include "../stats/stats.h"
+#include "prefix.h"
+
+extern unsigned int i_hash[8];
+extern unsigned long long ll_hash[8];
+extern unsigned long long hash_length, hash_length2;
+
+/**
+ * Compress a prefix, keeping the midstate for messages that begin with it
+ *
+ * @param prefix Context to hold the prefix
+ * @param type The hash type
+ * @param bytes The prefix
+ * @param length Number of bytes in the prefix
+ * @return 1 if the prefix was compressed, else 0 (for BLAKE3, CRC32C and
+ *          XXH3, which have no midstate to keep)
+ */
+char prefix_init(struct hash_ctx *prefix, enum hash_t type,
+		const unsigned char *bytes, size_t length)
+{
+	if (!hash_ctx_init(prefix, type))
+		return 0;
+	hash_ctx_add(prefix, bytes, length);
+
+	return 1;
+}
+
+/**
+ * Compress a prefix read from a file
+ *
+ * @param prefix Context to hold the prefix
+ * @param type The hash type
+ * @param fp File pointer to read the prefix from
+ * @return 1 if the whole file was compressed, else 0
+ */
+char prefix_init_file(struct hash_ctx *prefix, enum hash_t type, FILE *fp)
+{
+	unsigned char buffer[4096];
+	size_t got;
+
+	if (!hash_ctx_init(prefix, type))
+		return 0;
+	while ((got = stats_fread(buffer, sizeof(buffer), fp)) > 0)
+		hash_ctx_add(prefix, buffer, got);
+
+	return !ferror(fp);
+}
+
+/**
+ * Start a hash of the hash globals from a prefix, as if the prefix had
+ *  been added
+ *
+ * Only the bytes past the prefix's whole chunks are added again.
+ *
+ * @param prefix The prefix
+ * @return 1 if hashing was initialised, else 0
+ */
+char prefix_start(const struct hash_ctx *prefix)
+{
+	unsigned char tail[HASH_MAX_BLOCK];
+	unsigned int i;
+
+	if (!hash_init(prefix->type))
+		return 0;
+
+	for (i = 0; i < 8; i++) {
+		i_hash[i] = prefix->i_state[i];
+		ll_hash[i] = prefix->ll_state[i];
+	}
+
+	/* The whole chunks count towards the message length, in bits */
+	hash_length = (prefix->length - prefix->buffered) * 8;
+	hash_length2 = 0;
+
+	if (prefix->buffered > 0) {
+		memcpy(tail, prefix->chunk, prefix->buffered);
+		hash_add_bytes(tail, prefix->buffered);
+	}
+	STATS_ADD(S_PREFIX_HITS, 1);
+
+	return 1;
+}
+
+/**
+ * Start a hash context from a prefix, as if the prefix had been added
+ *
+ * @param ctx Context to start
+ * @param prefix The prefix
+ */
+void prefix_copy(struct hash_ctx *ctx, const struct hash_ctx *prefix)
+{
+	ctx->type = prefix->type;
+	ctx->length = prefix->length;
+	ctx->buffered = prefix->buffered;
+	memcpy(ctx->i_state, prefix->i_state, sizeof(ctx->i_state));
+	memcpy(ctx->ll_state, prefix->ll_state, sizeof(ctx->ll_state));
+	memcpy(ctx->chunk, prefix->chunk, prefix->buffered);
+	STATS_ADD(S_PREFIX_HITS, 1);
+}
@@ -0,0 +1,38 @@
+/**
+ * @file prefix.h
+ * Header for prefix.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PREFIX_H_
+#define PREFIX_H_
+
+/*
+ * A prefix is kept as a hash context that has had the prefix added - its
+ *  state is the midstate after the prefix's whole chunks, and the bytes
+ *  past them wait in its chunk (none, for a prefix of whole chunks).
+ */
+
+char prefix_init(struct hash_ctx *, enum hash_t, const unsigned char *,
+		size_t);
+char prefix_init_file(struct hash_ctx *, enum hash_t, FILE *);
+char prefix_start(const struct hash_ctx *);
+void prefix_copy(struct hash_ctx *, const struct hash_ctx *);
+
+#endif /* PREFIX_H_ */
@@ -0,0 +1,60 @@
+/**
+ * @file probes.h
+ * USDT (user-level statically defined tracing) probes for systemtap and
+ *  bpftrace
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PROBES_H_
+#define PROBES_H_
+
+/*
+ * Probes are only compiled in when building with make USDT=1 (which
+ *  defines HASHER_USDT), which needs <sys/sdt.h> (systemtap-sdt-dev or
+ *  systemtap-sdt-devel). Each probe is then a single nop in the code and a
+ *  note in the ELF file, patched into a breakpoint only while a tracer is
+ *  attached. Without the option they compile to nothing.
+ *
+ * Probes (provider "hasher"):
+ *  - file__open(path), file__close(path) - around the hashing of an input
+ *    file
+ *  - read__start(requested), read__done(got) - around each read call
+ *  - blocks__start(hash, bytes), blocks__done(hash, bytes) - around each
+ *    batch of bytes added to the MD5, SHA1 or SHA2 chunk functions (hash
+ *    is the name, "md5", "sha1" or "sha2")
+ *  - digest(hash, size) - a digest has been completed (hash is the
+ *    enum hash_t value)
+ *
+ * See file-latency.bt and read-sizes.bt for examples.
+ */
+#ifdef HASHER_USDT
+#include <sys/sdt.h>
+
+/** Fire a probe with one argument */
+#define HASHER_PROBE1(name, a) DTRACE_PROBE1(hasher, name, a)
+/** Fire a probe with two arguments */
+#define HASHER_PROBE2(name, a, b) DTRACE_PROBE2(hasher, name, a, b)
+#else
+/** Fire a probe with one argument (probes not built) */
+#define HASHER_PROBE1(name, a) do { } while (0)
+/** Fire a probe with two arguments (probes not built) */
+#define HASHER_PROBE2(name, a, b) do { } while (0)
+#endif
+
+#endif /* PROBES_H_ */
@@ -0,0 +1,304 @@
+/**
+ * @file records.c
+ * Per-record hashing - a digest for each line or other record of a
+ *  stream, found with a vector delimiter scan and hashed in batches
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../hash.h"
+#include "../many/many.h"
+#include "../prefix/prefix.h"
+#include "../stats/stats.h"
+#include "records.h"
+
+/*
+ * Compare 16 (SSE2, always there on x86-64) or 32 (AVX2, only run if the
+ *  processor has it) bytes at once with the delimiter
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define RECORDS_X86
+#include <immintrin.h>
+#endif
+
+/** Whether to scan with AVX2 */
+char records_avx2 = 0;
+
+/**
+ * Parse a delimiter - a single character, or \n, \0, \t or \r
+ *
+ * @param arg The delimiter
+ * @param delim Set to the delimiter byte
+ * @return 1 if the delimiter was parsed, else 0
+ */
+char records_parse_delim(char *arg, unsigned char *delim)
+{
+	if (arg[0] != '\0' && arg[1] == '\0') {
+		*delim = (unsigned char) arg[0];
+		return 1;
+	}
+	if (arg[0] != '\\' || arg[1] == '\0' || arg[2] != '\0')
+		return 0;
+
+	switch (arg[1]) {
+	case 'n':
+		*delim = '\n';
+		break;
+	case '0':
+		*delim = '\0';
+		break;
+	case 't':
+		*delim = '\t';
+		break;
+	case 'r':
+		*delim = '\r';
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+#ifdef RECORDS_X86
+/**
+ * Find delimiters 16 bytes at a time
+ *
+ * @param bytes Bytes to scan
+ * @param length Number of bytes
+ * @param delim The delimiter
+ * @param ends Array to store the offset of each delimiter found
+ * @param max Most delimiters to find
+ * @param found Number of delimiters found so far, advanced
+ * @return Offset scanned up to (the rest is left to the caller)
+ */
+size_t records_scan_sse2(const unsigned char *bytes, size_t length,
+		unsigned char delim, size_t ends[], size_t max, size_t *found)
+{
+	__m128i match = _mm_set1_epi8((char) delim);
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(match,
+				_mm_loadu_si128((const __m128i *) (bytes + i))));
+		while (mask != 0) {
+			ends[(*found)++] = i + __builtin_ctz(mask);
+			if (*found == max)
+				return ends[max - 1] + 1;
+			mask &= mask - 1;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * Find delimiters 32 bytes at a time
+ *
+ * @param bytes Bytes to scan
+ * @param length Number of bytes
+ * @param delim The delimiter
+ * @param ends Array to store the offset of each delimiter found
+ * @param max Most delimiters to find
+ * @param found Number of delimiters found so far, advanced
+ * @return Offset scanned up to (the rest is left to the caller)
+ */
+__attribute__((target("avx2")))
+size_t records_scan_avx2(const unsigned char *bytes, size_t length,
+		unsigned char delim, size_t ends[], size_t max, size_t *found)
+{
+	__m256i match = _mm256_set1_epi8((char) delim);
+	unsigned int mask;
+	size_t i;
+
+	for (i = 0; i + 32 <= length; i += 32) {
+		mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(match,
+				_mm256_loadu_si256((const __m256i *) (bytes + i))));
+		while (mask != 0) {
+			ends[(*found)++] = i + __builtin_ctz(mask);
+			if (*found == max)
+				return ends[max - 1] + 1;
+			mask &= mask - 1;
+		}
+	}
+
+	return i;
+}
+#endif
+
+/**
+ * Find the delimiters in a run of bytes
+ *
+ * @param bytes Bytes to scan
+ * @param length Number of bytes
+ * @param delim The delimiter
+ * @param ends Array to store the offset of each delimiter found
+ * @param max Most delimiters to find
+ * @return Number of delimiters found
+ */
+size_t records_scan(const unsigned char *bytes, size_t length,
+		unsigned char delim, size_t ends[], size_t max)
+{
+	size_t found = 0, i = 0;
+
+#ifdef RECORDS_X86
+	if (records_avx2)
+		i = records_scan_avx2(bytes, length, delim, ends, max, &found);
+	else
+		i = records_scan_sse2(bytes, length, delim, ends, max, &found);
+#endif
+
+	for (; i < length && found < max; i++)
+		if (bytes[i] == delim)
+			ends[found++] = i;
+
+	return found;
+}
+
+/**
+ * Hash each record of a stream
+ *
+ * The stream is read in large blocks and the whole records in each are
+ *  hashed RECORDS_BATCH at a time with hash_many, so SHA2 records share
+ *  the multi-lane compression functions. Records starting from a prefix
+ *  are hashed one at a time from its midstate instead.
+ *
+ * @param fp File pointer to read from
+ * @param type The hash type
+ * @param format How records are split
+ * @param delim Delimiter ending each record (delimited records)
+ * @param prefix Prefix every record's digest starts from, or NULL
+ * @param digest Called with the digest of each record, in order
+ * @return 1 if every record was hashed, else 0 (a read failed, or the last
+ *          length prefixed record was cut short)
+ */
+char records_hash(FILE *fp, enum hash_t type, enum records_t format,
+		unsigned char delim, const struct hash_ctx *prefix,
+		records_digest_t digest)
+{
+	unsigned int size = hash_digest_size(type);
+	size_t capacity = RECORDS_BUFFER_SIZE, used = 0, start = 0, count, got;
+	size_t r, length, previous;
+	unsigned char *buffer = malloc(capacity), *digests, *grown;
+	const void **msgs = malloc(RECORDS_BATCH * sizeof(void *));
+	size_t *lengths = malloc(RECORDS_BATCH * sizeof(size_t));
+	size_t *ends = malloc(RECORDS_BATCH * sizeof(size_t));
+	struct hash_ctx ctx;
+	char eof = 0, ok = 1;
+
+	digests = malloc(RECORDS_BATCH * HASH_MAX_DIGEST);
+	if (buffer == NULL || msgs == NULL || lengths == NULL || ends == NULL ||
+			digests == NULL)
+		ok = 0;
+#ifdef RECORDS_X86
+	records_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+	while (ok) {
+		/* Split off the whole records */
+		count = 0;
+		if (format == R_LENGTH_PREFIXED) {
+			while (count < RECORDS_BATCH && used - start >= 4) {
+				length = ((size_t) buffer[start] << 24) |
+						((size_t) buffer[start + 1] << 16) |
+						((size_t) buffer[start + 2] << 8) | buffer[start + 3];
+				if (used - start - 4 < length)
+					break;
+				msgs[count] = buffer + start + 4;
+				lengths[count++] = length;
+				start += 4 + length;
+			}
+		} else {
+			count = records_scan(buffer + start, used - start, delim, ends,
+					RECORDS_BATCH);
+			for (r = 0, previous = 0; r < count; r++) {
+				msgs[r] = buffer + start + previous;
+				lengths[r] = ends[r] - previous;
+				previous = ends[r] + 1;
+			}
+			start += previous;
+		}
+
+		if (count == 0 && eof) {
+			/* A last record without its delimiter, or cut short */
+			if (start == used)
+				break;
+			if (format == R_LENGTH_PREFIXED) {
+				ok = 0;
+				break;
+			}
+			msgs[0] = buffer + start;
+			lengths[0] = used - start;
+			start = used;
+			count = 1;
+		}
+
+		if (count == 0) {
+			/* Keep the partial record, and read more after it */
+			memmove(buffer, buffer + start, used - start);
+			used -= start;
+			start = 0;
+			if (used == capacity) {
+				grown = realloc(buffer, capacity * 2);
+				if (grown == NULL) {
+					ok = 0;
+					break;
+				}
+				buffer = grown;
+				capacity *= 2;
+			}
+			got = stats_fread(buffer + used, capacity - used, fp);
+			used += got;
+			if (got == 0) {
+				eof = 1;
+				ok = !ferror(fp);
+			}
+			continue;
+		}
+
+		STATS_ADD(S_RECORDS, count);
+		if (prefix != NULL) {
+			for (r = 0; r < count; r++) {
+				prefix_copy(&ctx, prefix);
+				hash_ctx_add(&ctx, msgs[r], lengths[r]);
+				hash_ctx_final(&ctx, digests + (r * size));
+			}
+		} else if (!hash_many(type, msgs, lengths, count, digests)) {
+			ok = 0;
+			break;
+		}
+
+		for (r = 0; r < count && ok; r++)
+			ok = digest(type, digests + (r * size));
+	}
+
+	free(buffer);
+	free(msgs);
+	free(lengths);
+	free(ends);
+	free(digests);
+
+	return ok;
+}
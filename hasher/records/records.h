@@ -0,0 +1,48 @@
+/**
+ * @file records.h
+ * Header for records.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RECORDS_H_
+#define RECORDS_H_
+
+/** How records are split */
+enum records_t {
+	/** Ended by a delimiter byte (the last may lack one) */
+	R_DELIMITED,
+	/** Each preceded by its length, as a big endian 32 bit number */
+	R_LENGTH_PREFIXED
+};
+
+/** Bytes read at a time (grown to fit a longer record) */
+#define RECORDS_BUFFER_SIZE (4 * 1024 * 1024)
+/** Most records hashed together */
+#define RECORDS_BATCH 4096
+
+/** Called with the digest of each record, in order */
+typedef char (*records_digest_t)(enum hash_t, unsigned char []);
+
+char records_parse_delim(char *, unsigned char *);
+size_t records_scan(const unsigned char *, size_t, unsigned char, size_t [],
+		size_t);
+char records_hash(FILE *, enum hash_t, enum records_t, unsigned char,
+		const struct hash_ctx *, records_digest_t);
+
+#endif /* RECORDS_H_ */
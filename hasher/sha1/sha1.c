@@ -22,10 +22,19 @@
  */
 /* Includes */
 #include <stdio.h>
+#include <string.h>
 
 #include "../global.h"
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "../sparse/sparse.h"
 #include "sha1.h"
 
+/** Bytes read from a file at a time */
+#define SHA1_BUFFER_SIZE 65536
+
+/** 32 bit left rotate - a macro so the compression loop stays inlined */
+#define SHA1_ROT(X, S) (((X) << (S)) | ((X) >> (32 - (S))))
 /** Per-round Ch function (0 <= r < 20) - from FIPS 180-3 */
 #define SHA1_CH(X, Y, Z) (((X) & (Y)) ^ (~(X) & (Z)))
 /** Per-round parity function (20 <= r < 40, 60 <= r < 80) - from FIPS 180-3 */
@@ -77,20 +86,32 @@ char sha1_init()
  * @return 1 if the string was added, else 0
  */
 char sha1_add_string(char *str)
+{
+	return sha1_add_bytes((unsigned char *) str, strlen(str));
+}
+
+/**
+ * Add an array of bytes into the current chunk
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char sha1_add_bytes(unsigned char *bytes, unsigned int length)
 {
 	/* Ensure we're currently hashing */
 	if (in_hash) {
-		int i;
-		/*
-		 * Loop through the string
-		 * character by character until null is reached
-		 */
-		for (i = 0; str[i] != '\0'; i++) {
+		unsigned int i;
+
+		HASHER_PROBE2(blocks__start, "sha1", length);
+
+		/* Loop through the array byte by byte */
+		for (i = 0; i < length; i++) {
 			/*
 			 * Convert the chunk position into the 2d chunk address
 			 *  and store the byte
 			 */
-			cur_chunk[cur_chunk_pos / 4][cur_chunk_pos % 4] = str[i];
+			cur_chunk[cur_chunk_pos / 4][cur_chunk_pos % 4] = bytes[i];
 			/* Increment the chunk position */
 			cur_chunk_pos++;
 			/* Add 8 bits to the length */
@@ -106,6 +127,8 @@ char sha1_add_string(char *str)
 			}
 		}
 
+		HASHER_PROBE2(blocks__done, "sha1", length);
+
 		return 1;
 	} else {
 		return 0;
@@ -122,34 +145,21 @@ char sha1_add_file(FILE *fp)
 {
 	/* Ensure we're currently hashing */
 	if (in_hash) {
-		/* Get the first character */
-		int c = fgetc(fp);
-		/* Loop until end-of-file is reached */
-		while (c != EOF) {
-			/*
-			 * Convert the chunk position into the 2d chunk address
-			 *  and store the byte
-			 */
-			cur_chunk[cur_chunk_pos / 4][cur_chunk_pos % 4] = (unsigned char)c;
-			/* Increment the chunk position */
-			cur_chunk_pos++;
-			/* Add 8 bits to the length */
-			hash_length += 8;
+		unsigned char buffer[SHA1_BUFFER_SIZE], *bytes;
+		unsigned long long start;
+		size_t read_length;
+		struct sparse sparse;
 
-			/*
-			 * If 64 bytes have been added, the chunk has
-			 *  been filled - process it
-			 */
-			if (cur_chunk_pos >= 64) {
-				sha1_add_chunk();
-				cur_chunk_pos = 0;
-			}
-
-			/* Get the next character */
-			c = fgetc(fp);
-		};
+		/* Read in large blocks, adding each as an array (holes unread) */
+		sparse_begin_file(&sparse, fp);
+		while ((read_length = sparse_read(&sparse, buffer, sizeof(buffer),
+				&bytes)) > 0) {
+			start = stats_now();
+			sha1_add_bytes(bytes, read_length);
+			stats_hashed(start, read_length);
+		}
 
-		return 1;
+		return sparse_end(&sparse);
 	} else {
 		return 0;
 	}
@@ -225,31 +235,46 @@ char sha1_get_hash(unsigned int hash_out[])
  * Process the current chunk
  */
 void sha1_add_chunk()
+{
+	unsigned int words[16];
+	int i;
+
+	/* Convert the first 16 word bytes into words */
+	for (i = 0; i < 16; i++)
+		words[i] = be_i_b_to_w(cur_chunk[i]);
+
+	sha1_compress(i_hash, words);
+}
+
+/**
+ * Compress one chunk into a hash state
+ *
+ * @param hash Array of 5 unsigned ints holding the state to be updated
+ * @param chunk Array of the 16 words of the chunk
+ */
+void sha1_compress(unsigned int hash[], unsigned int chunk[])
 {
 	unsigned int func_out, constant;
+	unsigned int words[80];
 	int i;
 
 	/* Copy the current hash into the chunk variables */
-	unsigned int a = i_hash[0], b = i_hash[1], c = i_hash[2];
-	unsigned int d = i_hash[3], e = i_hash[4];
+	unsigned int a = hash[0], b = hash[1], c = hash[2];
+	unsigned int d = hash[3], e = hash[4];
 
-	/* Compute the remaining 64 words */
-	for (i = 16; i < 80; i++) {
-		/*
-		 * XOR the 3rd, 8th, 14th and 16th previous
-		 *  words to make the current one
-		 */
-		cur_chunk[i][0] = cur_chunk[i - 3][0] ^ cur_chunk[i - 8][0] ^
-				cur_chunk[i - 14][0] ^ cur_chunk[i - 16][0];
-		cur_chunk[i][1] = cur_chunk[i - 3][1] ^ cur_chunk[i - 8][1] ^
-				cur_chunk[i - 14][1] ^ cur_chunk[i - 16][1];
-		cur_chunk[i][2] = cur_chunk[i - 3][2] ^ cur_chunk[i - 8][2] ^
-				cur_chunk[i - 14][2] ^ cur_chunk[i - 16][2];
-		cur_chunk[i][3] = cur_chunk[i - 3][3] ^ cur_chunk[i - 8][3] ^
-				cur_chunk[i - 14][3] ^ cur_chunk[i - 16][3];
-		/* Left rotate the current word */
-		be_w_l_rot(cur_chunk[i], 1);
-	}
+	STATS_ADD(S_SHA1_BLOCKS, 1);
+
+	/* Copy the first 16 words */
+	for (i = 0; i < 16; i++)
+		words[i] = chunk[i];
+
+	/*
+	 * Compute the remaining 64 words - XOR the 3rd, 8th, 14th and 16th
+	 *  previous words and left rotate
+	 */
+	for (i = 16; i < 80; i++)
+		words[i] = SHA1_ROT(words[i - 3] ^ words[i - 8] ^
+				words[i - 14] ^ words[i - 16], 1);
 
 	/* Loop through each of the words */
 	for (i = 0; i < 80; i++) {
@@ -272,19 +297,64 @@ void sha1_add_chunk()
 		}
 
 		/* Do the shift and generate the new a */
-		unsigned int temp = i_l_rot(a, 5) + func_out + e +
-				constant + be_i_b_to_w(cur_chunk[i]);
+		unsigned int temp = SHA1_ROT(a, 5) + func_out + e +
+				constant + words[i];
 		e = d;
 		d = c;
-		c = i_l_rot(b, 30);
+		c = SHA1_ROT(b, 30);
 		b = a;
 		a = temp;
 	}
 
-	/* Add the chunk variables back into the current hash */
-	i_hash[0] += a;
-	i_hash[1] += b;
-	i_hash[2] += c;
-	i_hash[3] += d;
-	i_hash[4] += e;
+	/* Add the chunk variables back into the hash */
+	hash[0] += a;
+	hash[1] += b;
+	hash[2] += c;
+	hash[3] += d;
+	hash[4] += e;
+}
+
+/**
+ * Hash a whole message in one go, without touching the hash globals
+ *
+ * Whole chunks are read straight from the message and the padding is built
+ *  on the stack, so a message of up to 55 bytes is a single compression.
+ *
+ * @param bytes Message bytes
+ * @param length Number of bytes in the message
+ * @param hash_out Array of at least 5 unsigned ints
+ */
+void sha1_oneshot(const unsigned char *bytes, size_t length,
+		unsigned int hash_out[])
+{
+	unsigned char tail[128];
+	unsigned int words[16];
+	size_t offset = 0, tail_length;
+	int i;
+
+	/* Initialise the hash variables - from FIPS 180-3 */
+	hash_out[0] = 0x67452301;
+	hash_out[1] = 0xEFCDAB89;
+	hash_out[2] = 0x98BADCFE;
+	hash_out[3] = 0x10325476;
+	hash_out[4] = 0xC3D2E1F0;
+
+	for (; offset + 64 <= length; offset += 64) {
+		for (i = 0; i < 16; i++)
+			words[i] = be_i_b_to_w((unsigned char *) bytes + offset + (i * 4));
+		sha1_compress(hash_out, words);
+	}
+
+	/* Tail, 0b10000000, 0's, then the bit length - one or two chunks */
+	tail_length = length - offset < 56 ? 64 : 128;
+	memset(tail, 0, tail_length);
+	memcpy(tail, bytes + offset, length - offset);
+	tail[length - offset] = 0x80;
+	be_ll_to_b((unsigned long long) length * 8, tail + tail_length - 8);
+
+	for (offset = 0; offset < tail_length; offset += 64) {
+		for (i = 0; i < 16; i++)
+			words[i] = be_i_b_to_w(tail + offset + (i * 4));
+		sha1_compress(hash_out, words);
+	}
 }
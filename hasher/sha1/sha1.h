@@ -25,7 +25,11 @@
 
 char sha1_init();
 char sha1_add_string(char *);
+char sha1_add_bytes(unsigned char *, unsigned int);
 char sha1_add_file(FILE *);
 char sha1_get_hash(unsigned int[]);
 
+void sha1_compress(unsigned int [], unsigned int []);
+void sha1_oneshot(const unsigned char *, size_t, unsigned int []);
+
 #endif /* SHA1_H_ */
@@ -1,7 +1,8 @@
 /**
  * @file sha2.c
  * An implementation of the SHA2 collection of algorithms (SHA256, SHA224,
- *  SHA512, SHA384), described in FIPS 180-2 (and after)
+ *  SHA512, SHA384, SHA512/256, SHA512/224), described in FIPS 180-2
+ *  (and after - the SHA512/t variants are from FIPS 180-4)
  * @author	FergoFrog <fergofrog@fergofrog.com>
  * @version 0.3
  *
@@ -23,32 +24,52 @@
  */
 /* Includes */
 #include <stdio.h>
+#include <string.h>
 
 #include "../global.h"
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "../sparse/sparse.h"
 #include "sha2.h"
 
+/** Bytes read from a file at a time */
+#define SHA2_BUFFER_SIZE 65536
+
 /** Per-round Ch function - from FIPS 180-3 */
 #define SHA2_CH(X, Y, Z) (((X) & (Y)) ^ (~(X) & (Z)))
 /** Per-round Maj function - from FIPS 180-3 */
 #define SHA2_MAJ(X, Y, Z) (((X) & (Y)) ^ ((X) & (Z)) ^ ((Y) & (Z)))
 
-/** Per-round 32 bit upper-case sigma 0 function - from FIPS 180-3 */
-#define SHA2_I_SIG_0(X) (i_r_rot((X), 2) ^ i_r_rot((X), 13) ^ i_r_rot((X), 22))
-/** Per-round 32 bit upper-case sigma 1 function - from FIPS 180-3 */
-#define SHA2_I_SIG_1(X) (i_r_rot((X), 6) ^ i_r_rot((X), 11) ^ i_r_rot((X), 25))
-/** Per-round 32 bit lower-case sigma 0 function - from FIPS 180-3 */
-#define SHA2_I_LSIG_0(X) (i_r_rot((X), 7) ^ i_r_rot((X), 18) ^ ((X) >> 3))
-/** Per-round 32 bit lower-case sigma 1 function - from FIPS 180-3 */
-#define SHA2_I_LSIG_1(X) (i_r_rot((X), 17) ^ i_r_rot((X), 19) ^ ((X) >> 10))
-
-/** Per-round 64 bit upper-case sigma 0 function */
-#define SHA2_LL_SIG_0(X) (ll_r_rot((X), 28) ^ ll_r_rot((X), 34) ^ ll_r_rot((X), 39))
-/** Per-round 64 bit upper-case sigma 1 function */
-#define SHA2_LL_SIG_1(X) (ll_r_rot((X), 14) ^ ll_r_rot((X), 18) ^ ll_r_rot((X), 41))
-/** Per-round 64 bit lower-case sigma 0 function */
-#define SHA2_LL_LSIG_0(X) (ll_r_rot((X), 1) ^ ll_r_rot((X), 8) ^ ((X) >> 7ULL))
-/** Per-round 64 bit lower-case sigma 1 function */
-#define SHA2_LL_LSIG_1(X) (ll_r_rot((X), 19) ^ ll_r_rot((X), 61) ^ ((X) >> 6ULL))
+/** 32 bit right rotate - a macro so the compression loops stay inlined */
+#define SHA2_I_ROT(X, S) (((X) >> (S)) | ((X) << (32 - (S))))
+/** 64 bit right rotate - a macro so the compression loops stay inlined */
+#define SHA2_LL_ROT(X, S) (((X) >> (S)) | ((X) << (64 - (S))))
+
+/** 32 bit upper-case sigma 0 function - from FIPS 180-3 */
+#define SHA2_I_SIG_0(X) (SHA2_I_ROT((X), 2) ^ SHA2_I_ROT((X), 13) ^ \
+		SHA2_I_ROT((X), 22))
+/** 32 bit upper-case sigma 1 function - from FIPS 180-3 */
+#define SHA2_I_SIG_1(X) (SHA2_I_ROT((X), 6) ^ SHA2_I_ROT((X), 11) ^ \
+		SHA2_I_ROT((X), 25))
+/** 32 bit lower-case sigma 0 function - from FIPS 180-3 */
+#define SHA2_I_LSIG_0(X) (SHA2_I_ROT((X), 7) ^ SHA2_I_ROT((X), 18) ^ \
+		((X) >> 3))
+/** 32 bit lower-case sigma 1 function - from FIPS 180-3 */
+#define SHA2_I_LSIG_1(X) (SHA2_I_ROT((X), 17) ^ SHA2_I_ROT((X), 19) ^ \
+		((X) >> 10))
+
+/** 64 bit upper-case sigma 0 function - from FIPS 180-3 */
+#define SHA2_LL_SIG_0(X) (SHA2_LL_ROT((X), 28) ^ SHA2_LL_ROT((X), 34) ^ \
+		SHA2_LL_ROT((X), 39))
+/** 64 bit upper-case sigma 1 function - from FIPS 180-3 */
+#define SHA2_LL_SIG_1(X) (SHA2_LL_ROT((X), 14) ^ SHA2_LL_ROT((X), 18) ^ \
+		SHA2_LL_ROT((X), 41))
+/** 64 bit lower-case sigma 0 function - from FIPS 180-3 */
+#define SHA2_LL_LSIG_0(X) (SHA2_LL_ROT((X), 1) ^ SHA2_LL_ROT((X), 8) ^ \
+		((X) >> 7))
+/** 64 bit lower-case sigma 1 function - from FIPS 180-3 */
+#define SHA2_LL_LSIG_1(X) (SHA2_LL_ROT((X), 19) ^ SHA2_LL_ROT((X), 61) ^ \
+		((X) >> 6))
 
 /** Per-round 32 bit addition constants - from FIPS 180-3 */
 const unsigned int sha2_i_operation_constants[64] = {
@@ -94,6 +115,24 @@ const unsigned long long sha2_ll_operation_constants[80] = {
 		0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a,
 		0x5fcb6fab3ad6faec, 0x6c44198c4a475817};
 
+/**
+ * Round constants plus message schedule of the SHA256 padding chunk of a
+ *  64 byte message (0b10000000, 0's, then a bit length of 512) - every word
+ *  is known in advance, so the chunk is only the rounds
+ */
+const unsigned int sha2_i_pad64_schedule[64] = {
+		0xc28a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+		0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf374, 0x649b69c1, 0xf0fe4786,
+		0x0fe1edc6, 0x240cf254, 0x4fe9346f, 0x6cc984be, 0x61b9411e, 0x16f988fa,
+		0xf2c65152, 0xa88e5a6d, 0xb019fc65, 0xb9d99ec7, 0x9a1231c3, 0xe70eeaa0,
+		0xfdb1232b, 0xc7353eb0, 0x3069bad5, 0xcb976d5f, 0x5a0f118f, 0xdc1eeefd,
+		0x0a35b689, 0xde0b7a04, 0x58f4ca9d, 0xe15d5b16, 0x007f3e86, 0x37088980,
+		0xa507ea32, 0x6fab9537, 0x17406110, 0x0d8cd6f1, 0xcdaa3b6d, 0xc0bbbe37,
+		0x83613bda, 0xdb48a363, 0x0b02e931, 0x6fd15ca7, 0x521afaca, 0x31338431,
+		0x6ed41a95, 0x6d437890, 0xc39c91f2, 0x9eccabbd, 0xb5c9a0e6, 0x532fb63c,
+		0xd2c741c6, 0x07237ea3, 0xa4954b68, 0x4c191d76};
+
 extern unsigned int i_hash[8];
 extern unsigned long long ll_hash[8];
 extern unsigned long long hash_length, hash_length2;
@@ -106,6 +145,81 @@ enum sha2_t sha2_type;
 
 void sha2_add_chunk();
 
+/**
+ * Get the initial hash values of a SHA2 type
+ *
+ * @param type The SHA2 hash type
+ * @param i_iv Array of 8 unsigned ints for SHA256 and SHA224 values
+ * @param ll_iv Array of 8 unsigned double longs for the SHA512 types' values
+ */
+void sha2_iv(enum sha2_t type, unsigned int i_iv[], unsigned long long ll_iv[])
+{
+	/* Different for each hash type - from FIPS 180-3 */
+	switch (type) {
+	case SHA256:
+		i_iv[0] = 0x6A09E667;
+		i_iv[1] = 0xBB67AE85;
+		i_iv[2] = 0x3C6EF372;
+		i_iv[3] = 0xA54FF53A;
+		i_iv[4] = 0x510E527F;
+		i_iv[5] = 0x9B05688C;
+		i_iv[6] = 0x1F83D9AB;
+		i_iv[7] = 0x5BE0CD19;
+		break;
+	case SHA224:
+		i_iv[0] = 0xC1059ED8;
+		i_iv[1] = 0x367CD507;
+		i_iv[2] = 0x3070DD17;
+		i_iv[3] = 0xF70E5939;
+		i_iv[4] = 0xFFC00B31;
+		i_iv[5] = 0x68581511;
+		i_iv[6] = 0x64F98FA7;
+		i_iv[7] = 0xBEFA4FA4;
+		break;
+	case SHA512:
+		ll_iv[0] = 0x6a09e667f3bcc908;
+		ll_iv[1] = 0xbb67ae8584caa73b;
+		ll_iv[2] = 0x3c6ef372fe94f82b;
+		ll_iv[3] = 0xa54ff53a5f1d36f1;
+		ll_iv[4] = 0x510e527fade682d1;
+		ll_iv[5] = 0x9b05688c2b3e6c1f;
+		ll_iv[6] = 0x1f83d9abfb41bd6b;
+		ll_iv[7] = 0x5be0cd19137e2179;
+		break;
+	case SHA384:
+		ll_iv[0] = 0xcbbb9d5dc1059ed8;
+		ll_iv[1] = 0x629a292a367cd507;
+		ll_iv[2] = 0x9159015a3070dd17;
+		ll_iv[3] = 0x152fecd8f70e5939;
+		ll_iv[4] = 0x67332667ffc00b31;
+		ll_iv[5] = 0x8eb44a8768581511;
+		ll_iv[6] = 0xdb0c2e0d64f98fa7;
+		ll_iv[7] = 0x47b5481dbefa4fa4;
+		break;
+	case SHA512_256:
+		/* SHA512/t initial values - from FIPS 180-4 */
+		ll_iv[0] = 0x22312194fc2bf72c;
+		ll_iv[1] = 0x9f555fa3c84c64c2;
+		ll_iv[2] = 0x2393b86b6f53b151;
+		ll_iv[3] = 0x963877195940eabd;
+		ll_iv[4] = 0x96283ee2a88effe3;
+		ll_iv[5] = 0xbe5e1e2553863992;
+		ll_iv[6] = 0x2b0199fc2c85b8aa;
+		ll_iv[7] = 0x0eb72ddc81c52ca2;
+		break;
+	case SHA512_224:
+		ll_iv[0] = 0x8c3d37c819544da2;
+		ll_iv[1] = 0x73e1996689dcd4d6;
+		ll_iv[2] = 0x1dfab7ae32ff9c82;
+		ll_iv[3] = 0x679dd514582f9fcf;
+		ll_iv[4] = 0x0f6d2b697bd44da8;
+		ll_iv[5] = 0x77e36f7304c48942;
+		ll_iv[6] = 0x3f9d85a86a1d36c8;
+		ll_iv[7] = 0x1112e6ad91d692a1;
+		break;
+	}
+}
+
 /**
  * Initialise SHA2 hashing
  *
@@ -116,53 +230,8 @@ char sha2_init(enum sha2_t type)
 {
 	/* Begin hashing if not currently hashing */
 	if (!in_hash) {
-		/*
-		 * Initialise the hash variables
-		 * (different for each hash type)
-		 *  - from FIPS 180-3
-		 */
-		switch (type) {
-		case SHA256:
-			i_hash[0] = 0x6A09E667;
-			i_hash[1] = 0xBB67AE85;
-			i_hash[2] = 0x3C6EF372;
-			i_hash[3] = 0xA54FF53A;
-			i_hash[4] = 0x510E527F;
-			i_hash[5] = 0x9B05688C;
-			i_hash[6] = 0x1F83D9AB;
-			i_hash[7] = 0x5BE0CD19;
-			break;
-		case SHA224:
-			i_hash[0] = 0xC1059ED8;
-			i_hash[1] = 0x367CD507;
-			i_hash[2] = 0x3070DD17;
-			i_hash[3] = 0xF70E5939;
-			i_hash[4] = 0xFFC00B31;
-			i_hash[5] = 0x68581511;
-			i_hash[6] = 0x64F98FA7;
-			i_hash[7] = 0xBEFA4FA4;
-			break;
-		case SHA512:
-			ll_hash[0] = 0x6a09e667f3bcc908;
-			ll_hash[1] = 0xbb67ae8584caa73b;
-			ll_hash[2] = 0x3c6ef372fe94f82b;
-			ll_hash[3] = 0xa54ff53a5f1d36f1;
-			ll_hash[4] = 0x510e527fade682d1;
-			ll_hash[5] = 0x9b05688c2b3e6c1f;
-			ll_hash[6] = 0x1f83d9abfb41bd6b;
-			ll_hash[7] = 0x5be0cd19137e2179;
-			break;
-		case SHA384:
-			ll_hash[0] = 0xcbbb9d5dc1059ed8;
-			ll_hash[1] = 0x629a292a367cd507;
-			ll_hash[2] = 0x9159015a3070dd17;
-			ll_hash[3] = 0x152fecd8f70e5939;
-			ll_hash[4] = 0x67332667ffc00b31;
-			ll_hash[5] = 0x8eb44a8768581511;
-			ll_hash[6] = 0xdb0c2e0d64f98fa7;
-			ll_hash[7] = 0x47b5481dbefa4fa4;
-			break;
-		}
+		/* Initialise the hash variables */
+		sha2_iv(type, i_hash, ll_hash);
 
 		/* Store the hash type */
 		sha2_type = type;
@@ -188,10 +257,23 @@ char sha2_init(enum sha2_t type)
  * @return 1 if the string was added, else 0
  */
 char sha2_add_string(char *str)
+{
+	return sha2_add_bytes((unsigned char *) str, strlen(str));
+}
+
+/**
+ * Add an array of bytes into the current chunk
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char sha2_add_bytes(unsigned char *bytes, unsigned int length)
 {
 	/* Ensure we're currently hashing */
 	if (in_hash) {
-		int i, bytes_per_word;
+		unsigned int i;
+		int bytes_per_word;
 
 		/*
 		 * Determine the number of bytes per word
@@ -203,17 +285,16 @@ char sha2_add_string(char *str)
 			bytes_per_word = 8;
 		}
 
-		/*
-		 * Loop through the string
-		 * character by character until null is reached
-		 */
-		for (i = 0; str[i] != '\0'; i++) {
+		HASHER_PROBE2(blocks__start, "sha2", length);
+
+		/* Loop through the array byte by byte */
+		for (i = 0; i < length; i++) {
 			/*
 			 * Convert the chunk position into the 2d chunk address
 			 *  and store the byte
 			 */
 			cur_chunk[cur_chunk_pos / bytes_per_word]
-			         [cur_chunk_pos % bytes_per_word] = str[i];
+			         [cur_chunk_pos % bytes_per_word] = bytes[i];
 			/* Increment the chunk position */
 			cur_chunk_pos++;
 			/* Add 8 bits to the length */
@@ -235,6 +316,8 @@ char sha2_add_string(char *str)
 			}
 		}
 
+		HASHER_PROBE2(blocks__done, "sha2", length);
+
 		return 1;
 	} else {
 		return 0;
@@ -251,53 +334,21 @@ char sha2_add_file(FILE *fp)
 {
 	/* Ensure we're currently hashing */
 	if (in_hash) {
-		/* Get the first character */
-		int c = fgetc(fp);
+		unsigned char buffer[SHA2_BUFFER_SIZE], *bytes;
+		unsigned long long start;
+		size_t read_length;
+		struct sparse sparse;
 
-		/*
-		 * Determine the number of bytes per word
-		 *  - used for the chunk position to 2d chunk address
-		 */
-		int bytes_per_word;
-		if (sha2_type == SHA256 || sha2_type == SHA224) {
-			bytes_per_word = 4;
-		} else {
-			bytes_per_word = 8;
+		/* Read in large blocks, adding each as an array (holes unread) */
+		sparse_begin_file(&sparse, fp);
+		while ((read_length = sparse_read(&sparse, buffer, sizeof(buffer),
+				&bytes)) > 0) {
+			start = stats_now();
+			sha2_add_bytes(bytes, read_length);
+			stats_hashed(start, read_length);
 		}
 
-		/* Loop until end-of-file is reached */
-		while (c != EOF) {
-			/*
-			 * Convert the chunk position into the 2d chunk address
-			 *  and store the byte
-			 */
-			cur_chunk[cur_chunk_pos / bytes_per_word]
-			         [cur_chunk_pos % bytes_per_word] = (unsigned char) c;
-			/* Increment the chunk position */
-			cur_chunk_pos++;
-			/* Add 8 bits to the length */
-			hash_length += 8;
-
-			/* Check whether the hash_length has overflowed */
-			if (hash_length == 0) {
-				/* Overflowed - add one to the upper length variable */
-				hash_length2 += 1;
-			}
-
-			/*
-			 * If 64 bytes have been added, the chunk has
-			 *  been filled - process it
-			 */
-			if (cur_chunk_pos >= 16 * bytes_per_word) {
-				sha2_add_chunk();
-				cur_chunk_pos = 0;
-			}
-
-			/* Get the next character */
-			c = fgetc(fp);
-		};
-
-		return 1;
+		return sparse_end(&sparse);
 	} else {
 		return 0;
 	}
@@ -308,7 +359,8 @@ char sha2_add_file(FILE *fp)
  *
  * @param hash_out Array of at least:
  *                  - 8 unsigned ints - SHA256, SHA224
- *                  - 8 unsigned double longs - SHA512, SHA384
+ *                  - 8 unsigned double longs - SHA512, SHA384,
+ *                     SHA512/256, SHA512/224 (truncate to the digest size)
  * @return 1 if the hash was copied, else 0
  */
 char sha2_get_hash(unsigned long long hash_out[])
@@ -414,100 +466,689 @@ void sha2_add_chunk()
 	int i;
 
 	if (sha2_type == SHA256 || sha2_type == SHA224) {
-		unsigned int temp[2];
-		unsigned int words[64];
-
-		/* Copy the current hash into the chunk variables */
-		unsigned int a = i_hash[0], b = i_hash[1], c = i_hash[2];
-		unsigned int d = i_hash[3], e = i_hash[4], f = i_hash[5];
-		unsigned int g = i_hash[6], h = i_hash[7];
+		unsigned int words[16];
 
 		/* Convert the existing 16 word bytes into words */
 		for (i = 0; i < 16; i++) {
 			words[i] = be_i_b_to_w(cur_chunk[i]);
 		}
 
-		/* Compute the remaining 48 words */
-		for (i = 16; i < 64; i++) {
-			words[i] =
-					SHA2_I_LSIG_1(words[i - 2]) + words[i - 7] +
-					SHA2_I_LSIG_0(words[i - 15]) + words[i - 16];
+		sha2_i_compress(i_hash, words);
+	} else {
+		unsigned long long words[16];
+
+		/* Convert the existing 16 word bytes into words */
+		for (i = 0; i < 16; i++) {
+			words[i] = be_ll_b_to_w(cur_chunk[i]);
 		}
 
-		/* Loop through each of the words */
-		for (i = 0; i < 64; i++) {
+		sha2_ll_compress(ll_hash, words);
+	}
+}
+
+/**
+ * Compress one 32 bit (SHA256, SHA224) chunk into a hash state
+ *
+ * @param hash Array of 8 unsigned ints holding the state to be updated
+ * @param chunk Array of the 16 words of the chunk
+ */
+void sha2_i_compress(unsigned int hash[], unsigned int chunk[])
+{
+	int i;
+	unsigned int temp[2];
+	unsigned int words[64];
+
+	/* Copy the current hash into the chunk variables */
+	unsigned int a = hash[0], b = hash[1], c = hash[2];
+	unsigned int d = hash[3], e = hash[4], f = hash[5];
+	unsigned int g = hash[6], h = hash[7];
+
+	STATS_ADD(S_SHA256_BLOCKS, 1);
+
+	/* Copy the first 16 words */
+	for (i = 0; i < 16; i++) {
+		words[i] = chunk[i];
+	}
+
+	/* Compute the remaining 48 words */
+	for (i = 16; i < 64; i++) {
+		words[i] =
+				SHA2_I_LSIG_1(words[i - 2]) + words[i - 7] +
+				SHA2_I_LSIG_0(words[i - 15]) + words[i - 16];
+	}
+
+	/* Loop through each of the words */
+	for (i = 0; i < 64; i++) {
+		/* Compute the two temporary variables */
+		temp[0] = h + SHA2_I_SIG_1(e) + SHA2_CH(e, f, g) +
+				sha2_i_operation_constants[i] + words[i];
+		temp[1] = SHA2_I_SIG_0(a) + SHA2_MAJ(a, b, c);
+
+		/* Shift the variables and generate the new a */
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp[0];
+		d = c;
+		c = b;
+		b = a;
+		a = temp[0] + temp[1];
+	}
+
+	/* Add the chunk variables back into the hash */
+	hash[0] += a;
+	hash[1] += b;
+	hash[2] += c;
+	hash[3] += d;
+	hash[4] += e;
+	hash[5] += f;
+	hash[6] += g;
+	hash[7] += h;
+}
+
+/**
+ * Compress one 64 bit (SHA512, SHA384) chunk into a hash state
+ *
+ * @param hash Array of 8 unsigned double longs holding the state to be updated
+ * @param chunk Array of the 16 words of the chunk
+ */
+void sha2_ll_compress(unsigned long long hash[], unsigned long long chunk[])
+{
+	int i;
+	unsigned long long temp[2];
+	unsigned long long words[80];
+
+	/* Copy the current hash into the chunk variables */
+	unsigned long long a = hash[0], b = hash[1], c = hash[2];
+	unsigned long long d = hash[3], e = hash[4], f = hash[5];
+	unsigned long long g = hash[6], h = hash[7];
+
+	STATS_ADD(S_SHA512_BLOCKS, 1);
+
+	/* Copy the first 16 words */
+	for (i = 0; i < 16; i++) {
+		words[i] = chunk[i];
+	}
+
+	/* Compute the remaining 64 words */
+	for (i = 16; i < 80; i++) {
+		words[i] =
+				SHA2_LL_LSIG_1(words[i - 2]) + words[i - 7] +
+				SHA2_LL_LSIG_0(words[i - 15]) + words[i - 16];
+	}
+
+	/* Loop through each of the words */
+	for (i = 0; i < 80; i++) {
+		/* Compute the two temporary variables */
+		temp[0] = h + SHA2_LL_SIG_1(e) + SHA2_CH(e, f, g) +
+				sha2_ll_operation_constants[i] + words[i];
+		temp[1] = SHA2_LL_SIG_0(a) + SHA2_MAJ(a, b, c);
+
+		/* Shift the variables and generate the new a */
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp[0];
+		d = c;
+		c = b;
+		b = a;
+		a = temp[0] + temp[1];
+	}
+
+	/* Add the chunk variables back into the hash */
+	hash[0] += a;
+	hash[1] += b;
+	hash[2] += c;
+	hash[3] += d;
+	hash[4] += e;
+	hash[5] += f;
+	hash[6] += g;
+	hash[7] += h;
+}
+
+/**
+ * Compress SHA2_LANES independent 32 bit chunks into SHA2_LANES hash states
+ *
+ * Each step of the compression is done for every lane before moving on, so
+ *  the lanes are independent instruction streams the processor can overlap
+ *  and the compiler can vectorise.
+ *
+ * @param hash States to be updated, indexed [word][lane]
+ * @param chunk Chunks to be compressed, indexed [word][lane]
+ */
+void sha2_i_compress_lanes(unsigned int hash[][SHA2_LANES],
+		unsigned int chunk[][SHA2_LANES])
+{
+	int i, l;
+	unsigned int temp[2][SHA2_LANES];
+	unsigned int words[64][SHA2_LANES];
+	unsigned int a[SHA2_LANES], b[SHA2_LANES], c[SHA2_LANES];
+	unsigned int d[SHA2_LANES], e[SHA2_LANES], f[SHA2_LANES];
+	unsigned int g[SHA2_LANES], h[SHA2_LANES];
+
+	STATS_ADD(S_SHA256_BLOCKS, SHA2_LANES);
+
+	/* Copy the current hashes into the chunk variables */
+	for (l = 0; l < SHA2_LANES; l++) {
+		a[l] = hash[0][l];
+		b[l] = hash[1][l];
+		c[l] = hash[2][l];
+		d[l] = hash[3][l];
+		e[l] = hash[4][l];
+		f[l] = hash[5][l];
+		g[l] = hash[6][l];
+		h[l] = hash[7][l];
+	}
+
+	/* Copy the first 16 words */
+	for (i = 0; i < 16; i++)
+		for (l = 0; l < SHA2_LANES; l++)
+			words[i][l] = chunk[i][l];
+
+	/* Compute the remaining 48 words */
+	for (i = 16; i < 64; i++)
+		for (l = 0; l < SHA2_LANES; l++)
+			words[i][l] =
+					SHA2_I_LSIG_1(words[i - 2][l]) + words[i - 7][l] +
+					SHA2_I_LSIG_0(words[i - 15][l]) + words[i - 16][l];
+
+	/* Loop through each of the words */
+	for (i = 0; i < 64; i++) {
+		for (l = 0; l < SHA2_LANES; l++) {
 			/* Compute the two temporary variables */
-			temp[0] = h + SHA2_I_SIG_1(e) + SHA2_CH(e, f, g) +
-					sha2_i_operation_constants[i] + words[i];
-			temp[1] = SHA2_I_SIG_0(a) + SHA2_MAJ(a, b, c);
+			temp[0][l] = h[l] + SHA2_I_SIG_1(e[l]) +
+					SHA2_CH(e[l], f[l], g[l]) +
+					sha2_i_operation_constants[i] + words[i][l];
+			temp[1][l] = SHA2_I_SIG_0(a[l]) + SHA2_MAJ(a[l], b[l], c[l]);
 
 			/* Shift the variables and generate the new a */
-			h = g;
-			g = f;
-			f = e;
-			e = d + temp[0];
-			d = c;
-			c = b;
-			b = a;
-			a = temp[0] + temp[1];
+			h[l] = g[l];
+			g[l] = f[l];
+			f[l] = e[l];
+			e[l] = d[l] + temp[0][l];
+			d[l] = c[l];
+			c[l] = b[l];
+			b[l] = a[l];
+			a[l] = temp[0][l] + temp[1][l];
 		}
+	}
+
+	/* Add the chunk variables back into the hashes */
+	for (l = 0; l < SHA2_LANES; l++) {
+		hash[0][l] += a[l];
+		hash[1][l] += b[l];
+		hash[2][l] += c[l];
+		hash[3][l] += d[l];
+		hash[4][l] += e[l];
+		hash[5][l] += f[l];
+		hash[6][l] += g[l];
+		hash[7][l] += h[l];
+	}
+}
+
+/**
+ * Compress SHA2_LANES independent 64 bit chunks into SHA2_LANES hash states
+ *
+ * @param hash States to be updated, indexed [word][lane]
+ * @param chunk Chunks to be compressed, indexed [word][lane]
+ */
+void sha2_ll_compress_lanes(unsigned long long hash[][SHA2_LANES],
+		unsigned long long chunk[][SHA2_LANES])
+{
+	int i, l;
+	unsigned long long temp[2][SHA2_LANES];
+	unsigned long long words[80][SHA2_LANES];
+	unsigned long long a[SHA2_LANES], b[SHA2_LANES], c[SHA2_LANES];
+	unsigned long long d[SHA2_LANES], e[SHA2_LANES], f[SHA2_LANES];
+	unsigned long long g[SHA2_LANES], h[SHA2_LANES];
+
+	STATS_ADD(S_SHA512_BLOCKS, SHA2_LANES);
+
+	/* Copy the current hashes into the chunk variables */
+	for (l = 0; l < SHA2_LANES; l++) {
+		a[l] = hash[0][l];
+		b[l] = hash[1][l];
+		c[l] = hash[2][l];
+		d[l] = hash[3][l];
+		e[l] = hash[4][l];
+		f[l] = hash[5][l];
+		g[l] = hash[6][l];
+		h[l] = hash[7][l];
+	}
+
+	/* Copy the first 16 words */
+	for (i = 0; i < 16; i++)
+		for (l = 0; l < SHA2_LANES; l++)
+			words[i][l] = chunk[i][l];
 
-		/* Add the chunk variables back into the current hash */
-		i_hash[0] += a;
-		i_hash[1] += b;
-		i_hash[2] += c;
-		i_hash[3] += d;
-		i_hash[4] += e;
-		i_hash[5] += f;
-		i_hash[6] += g;
-		i_hash[7] += h;
+	/* Compute the remaining 64 words */
+	for (i = 16; i < 80; i++)
+		for (l = 0; l < SHA2_LANES; l++)
+			words[i][l] =
+					SHA2_LL_LSIG_1(words[i - 2][l]) + words[i - 7][l] +
+					SHA2_LL_LSIG_0(words[i - 15][l]) + words[i - 16][l];
+
+	/* Loop through each of the words */
+	for (i = 0; i < 80; i++) {
+		for (l = 0; l < SHA2_LANES; l++) {
+			/* Compute the two temporary variables */
+			temp[0][l] = h[l] + SHA2_LL_SIG_1(e[l]) +
+					SHA2_CH(e[l], f[l], g[l]) +
+					sha2_ll_operation_constants[i] + words[i][l];
+			temp[1][l] = SHA2_LL_SIG_0(a[l]) + SHA2_MAJ(a[l], b[l], c[l]);
+
+			/* Shift the variables and generate the new a */
+			h[l] = g[l];
+			g[l] = f[l];
+			f[l] = e[l];
+			e[l] = d[l] + temp[0][l];
+			d[l] = c[l];
+			c[l] = b[l];
+			b[l] = a[l];
+			a[l] = temp[0][l] + temp[1][l];
+		}
+	}
+
+	/* Add the chunk variables back into the hashes */
+	for (l = 0; l < SHA2_LANES; l++) {
+		hash[0][l] += a[l];
+		hash[1][l] += b[l];
+		hash[2][l] += c[l];
+		hash[3][l] += d[l];
+		hash[4][l] += e[l];
+		hash[5][l] += f[l];
+		hash[6][l] += g[l];
+		hash[7][l] += h[l];
+	}
+}
+
+/**
+ * Hash a whole message in one go, without touching the hash globals
+ *
+ * Whole chunks are read straight from the message and the padding is built
+ *  on the stack, so a message of up to 55 bytes (111 for the SHA512 types)
+ *  is a single compression.
+ *
+ * @param type The SHA2 hash type
+ * @param bytes Message bytes
+ * @param length Number of bytes in the message
+ * @param hash_out Array of at least 8 unsigned double longs, as from
+ *                  sha2_get_hash
+ */
+void sha2_oneshot(enum sha2_t type, const unsigned char *bytes, size_t length,
+		unsigned long long hash_out[])
+{
+	unsigned char tail[256];
+	unsigned int i_state[8], i_words[16];
+	unsigned long long ll_state[8], ll_words[16];
+	size_t offset = 0, tail_length;
+	int i;
+
+	sha2_iv(type, i_state, ll_state);
+
+	if (type == SHA256 || type == SHA224) {
+		for (; offset + 64 <= length; offset += 64) {
+			for (i = 0; i < 16; i++)
+				i_words[i] = be_i_b_to_w((unsigned char *) bytes + offset +
+						(i * 4));
+			sha2_i_compress(i_state, i_words);
+		}
+
+		/* Tail, 0b10000000, 0's, then the bit length - one or two chunks */
+		tail_length = length - offset < 56 ? 64 : 128;
+		memset(tail, 0, tail_length);
+		memcpy(tail, bytes + offset, length - offset);
+		tail[length - offset] = 0x80;
+		be_ll_to_b((unsigned long long) length * 8, tail + tail_length - 8);
+
+		for (offset = 0; offset < tail_length; offset += 64) {
+			for (i = 0; i < 16; i++)
+				i_words[i] = be_i_b_to_w(tail + offset + (i * 4));
+			sha2_i_compress(i_state, i_words);
+		}
+
+		for (i = 0; i < 8; i++)
+			hash_out[i] = i_state[i];
 	} else {
-		unsigned long long temp[2];
-		unsigned long long words[80];
+		for (; offset + 128 <= length; offset += 128) {
+			for (i = 0; i < 16; i++)
+				ll_words[i] = be_ll_b_to_w((unsigned char *) bytes + offset +
+						(i * 8));
+			sha2_ll_compress(ll_state, ll_words);
+		}
 
-		/* Copy the current hash into the chunk variables */
-		unsigned long long a = ll_hash[0], b = ll_hash[1], c = ll_hash[2];
-		unsigned long long d = ll_hash[3], e = ll_hash[4], f = ll_hash[5];
-		unsigned long long g = ll_hash[6], h = ll_hash[7];
+		/* As above, with a 128 bit length */
+		tail_length = length - offset < 112 ? 128 : 256;
+		memset(tail, 0, tail_length);
+		memcpy(tail, bytes + offset, length - offset);
+		tail[length - offset] = 0x80;
+		be_llll_to_b((unsigned long long) length >> 61,
+				(unsigned long long) length << 3, tail + tail_length - 16);
 
-		/* Convert the existing 16 word bytes into words */
-		for (i = 0; i < 16; i++) {
-			words[i] = be_ll_b_to_w(cur_chunk[i]);
+		for (offset = 0; offset < tail_length; offset += 128) {
+			for (i = 0; i < 16; i++)
+				ll_words[i] = be_ll_b_to_w(tail + offset + (i * 8));
+			sha2_ll_compress(ll_state, ll_words);
 		}
 
-		/* Compute the remaining 64 words */
-		for (i = 16; i < 80; i++) {
-			words[i] =
-					SHA2_LL_LSIG_1(words[i - 2]) + words[i - 7] +
-					SHA2_LL_LSIG_0(words[i - 15]) + words[i - 16];
+		for (i = 0; i < 8; i++)
+			hash_out[i] = ll_state[i];
+	}
+}
+
+/**
+ * Run the 64 rounds of a 32 bit chunk whose round constants have already
+ *  been added into its message schedule
+ *
+ * @param hash Array of 8 unsigned ints holding the state to be updated
+ * @param schedule Array of the 64 round constant plus schedule words
+ */
+void sha2_i_rounds(unsigned int hash[], const unsigned int schedule[])
+{
+	int i;
+	unsigned int temp[2];
+
+	/* Copy the current hash into the chunk variables */
+	unsigned int a = hash[0], b = hash[1], c = hash[2];
+	unsigned int d = hash[3], e = hash[4], f = hash[5];
+	unsigned int g = hash[6], h = hash[7];
+
+	STATS_ADD(S_SHA256_BLOCKS, 1);
+
+	for (i = 0; i < 64; i++) {
+		temp[0] = h + SHA2_I_SIG_1(e) + SHA2_CH(e, f, g) + schedule[i];
+		temp[1] = SHA2_I_SIG_0(a) + SHA2_MAJ(a, b, c);
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp[0];
+		d = c;
+		c = b;
+		b = a;
+		a = temp[0] + temp[1];
+	}
+
+	hash[0] += a;
+	hash[1] += b;
+	hash[2] += c;
+	hash[3] += d;
+	hash[4] += e;
+	hash[5] += f;
+	hash[6] += g;
+	hash[7] += h;
+}
+
+/**
+ * Run the 64 rounds of SHA2_LANES 32 bit chunks whose round constants have
+ *  already been added into their message schedules
+ *
+ * @param hash States to be updated, indexed [word][lane]
+ * @param schedule Round constant plus schedule words, indexed
+ *                  [(word * stride) + lane], or [word] if stride is 0
+ * @param stride SHA2_LANES for a schedule per lane, or 0 for one schedule
+ *                shared by every lane
+ */
+void sha2_i_rounds_lanes(unsigned int hash[][SHA2_LANES],
+		const unsigned int schedule[], unsigned int stride)
+{
+	int i, l;
+	unsigned int temp[2][SHA2_LANES], words[SHA2_LANES];
+	unsigned int a[SHA2_LANES], b[SHA2_LANES], c[SHA2_LANES];
+	unsigned int d[SHA2_LANES], e[SHA2_LANES], f[SHA2_LANES];
+	unsigned int g[SHA2_LANES], h[SHA2_LANES];
+
+	STATS_ADD(S_SHA256_BLOCKS, SHA2_LANES);
+
+	for (l = 0; l < SHA2_LANES; l++) {
+		a[l] = hash[0][l];
+		b[l] = hash[1][l];
+		c[l] = hash[2][l];
+		d[l] = hash[3][l];
+		e[l] = hash[4][l];
+		f[l] = hash[5][l];
+		g[l] = hash[6][l];
+		h[l] = hash[7][l];
+	}
+
+	for (i = 0; i < 64; i++) {
+		for (l = 0; l < SHA2_LANES; l++)
+			words[l] = schedule[stride ? (i * stride) + l : i];
+
+		for (l = 0; l < SHA2_LANES; l++) {
+			temp[0][l] = h[l] + SHA2_I_SIG_1(e[l]) +
+					SHA2_CH(e[l], f[l], g[l]) + words[l];
+			temp[1][l] = SHA2_I_SIG_0(a[l]) + SHA2_MAJ(a[l], b[l], c[l]);
+
+			h[l] = g[l];
+			g[l] = f[l];
+			f[l] = e[l];
+			e[l] = d[l] + temp[0][l];
+			d[l] = c[l];
+			c[l] = b[l];
+			b[l] = a[l];
+			a[l] = temp[0][l] + temp[1][l];
 		}
+	}
 
-		/* Loop through each of the words */
-		for (i = 0; i < 80; i++) {
-			/* Compute the two temporary variables */
-			temp[0] = h + SHA2_LL_SIG_1(e) + SHA2_CH(e, f, g) +
-					sha2_ll_operation_constants[i] + words[i];
-			temp[1] = SHA2_LL_SIG_0(a) + SHA2_MAJ(a, b, c);
+	for (l = 0; l < SHA2_LANES; l++) {
+		hash[0][l] += a[l];
+		hash[1][l] += b[l];
+		hash[2][l] += c[l];
+		hash[3][l] += d[l];
+		hash[4][l] += e[l];
+		hash[5][l] += f[l];
+		hash[6][l] += g[l];
+		hash[7][l] += h[l];
+	}
+}
 
-			/* Shift the variables and generate the new a */
-			h = g;
-			g = f;
-			f = e;
-			e = d + temp[0];
-			d = c;
-			c = b;
-			b = a;
-			a = temp[0] + temp[1];
+/**
+ * Build the message schedule of the single chunk of a 32 byte SHA256 message
+ *
+ * Words 8 to 15 are the padding (0b10000000, 0's, then a bit length of 256),
+ *  so the terms they give words 16 to 31 are either constants or zero and
+ *  are folded in or left out.
+ *
+ * @param schedule Array of 64 unsigned ints, the first 8 holding the message
+ *                  words - filled in with the round constants added
+ */
+void sha2_i_schedule_32(unsigned int schedule[])
+{
+	unsigned int *w = schedule;
+	int i;
+
+	w[8] = 0x80000000U;
+	for (i = 9; i < 15; i++)
+		w[i] = 0;
+	w[15] = 0x100U;
+
+	w[16] = SHA2_I_LSIG_0(w[1]) + w[0];
+	w[17] = SHA2_I_LSIG_1(0x100U) + SHA2_I_LSIG_0(w[2]) + w[1];
+	w[18] = SHA2_I_LSIG_1(w[16]) + SHA2_I_LSIG_0(w[3]) + w[2];
+	w[19] = SHA2_I_LSIG_1(w[17]) + SHA2_I_LSIG_0(w[4]) + w[3];
+	w[20] = SHA2_I_LSIG_1(w[18]) + SHA2_I_LSIG_0(w[5]) + w[4];
+	w[21] = SHA2_I_LSIG_1(w[19]) + SHA2_I_LSIG_0(w[6]) + w[5];
+	w[22] = SHA2_I_LSIG_1(w[20]) + 0x100U + SHA2_I_LSIG_0(w[7]) + w[6];
+	w[23] = SHA2_I_LSIG_1(w[21]) + w[16] + SHA2_I_LSIG_0(0x80000000U) + w[7];
+	w[24] = SHA2_I_LSIG_1(w[22]) + w[17] + 0x80000000U;
+	for (i = 25; i < 30; i++)
+		w[i] = SHA2_I_LSIG_1(w[i - 2]) + w[i - 7];
+	w[30] = SHA2_I_LSIG_1(w[28]) + w[23] + SHA2_I_LSIG_0(0x100U);
+	w[31] = SHA2_I_LSIG_1(w[29]) + w[24] + SHA2_I_LSIG_0(w[16]) + 0x100U;
+
+	for (i = 32; i < 64; i++)
+		w[i] = SHA2_I_LSIG_1(w[i - 2]) + w[i - 7] +
+				SHA2_I_LSIG_0(w[i - 15]) + w[i - 16];
+
+	for (i = 0; i < 64; i++)
+		w[i] += sha2_i_operation_constants[i];
+}
+
+/**
+ * Hash a 32 byte message (such as another SHA256 digest) with SHA256
+ *
+ * @param words The message as 8 big endian words
+ * @param hash_out Array of 8 unsigned ints to store the hash - may be the
+ *                  same array as words
+ */
+void sha2_256_32(const unsigned int words[], unsigned int hash_out[])
+{
+	unsigned int schedule[64];
+	unsigned long long ll_iv[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		schedule[i] = words[i];
+	sha2_i_schedule_32(schedule);
+
+	sha2_iv(SHA256, hash_out, ll_iv);
+	sha2_i_rounds(hash_out, schedule);
+}
+
+/**
+ * Hash SHA2_LANES 32 byte messages with SHA256, in place
+ *
+ * @param hash The messages as big endian words, indexed [word][lane] - each
+ *              replaced by its hash
+ */
+void sha2_256_32_lanes(unsigned int hash[][SHA2_LANES])
+{
+	unsigned int schedule[64 * SHA2_LANES], words[64];
+	unsigned int iv[8];
+	unsigned long long ll_iv[8];
+	int i, l;
+
+	sha2_iv(SHA256, iv, ll_iv);
+
+	for (l = 0; l < SHA2_LANES; l++) {
+		for (i = 0; i < 8; i++) {
+			words[i] = hash[i][l];
+			hash[i][l] = iv[i];
 		}
+		sha2_i_schedule_32(words);
+		for (i = 0; i < 64; i++)
+			schedule[(i * SHA2_LANES) + l] = words[i];
+	}
+
+	sha2_i_rounds_lanes(hash, schedule, SHA2_LANES);
+}
+
+/**
+ * Hash a 64 byte message (such as two child digests of a Merkle tree node)
+ *  with SHA256 - the message chunk, then the precomputed padding chunk
+ *
+ * @param bytes The 64 message bytes
+ * @param hash_out Array of 8 unsigned ints to store the hash
+ */
+void sha2_256_64_words(const unsigned char bytes[], unsigned int hash_out[])
+{
+	unsigned int words[16];
+	unsigned long long ll_iv[8];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		words[i] = be_i_b_to_w((unsigned char *) bytes + (i * 4));
+
+	sha2_iv(SHA256, hash_out, ll_iv);
+	sha2_i_compress(hash_out, words);
+	sha2_i_rounds(hash_out, sha2_i_pad64_schedule);
+}
+
+/**
+ * Hash a 64 byte message with SHA256
+ *
+ * @param bytes The 64 message bytes
+ * @param digest Array of 32 bytes to store the digest
+ */
+void sha2_256_64(const unsigned char bytes[], unsigned char digest[])
+{
+	unsigned int hash[8];
+	int i;
+
+	sha2_256_64_words(bytes, hash);
+
+	for (i = 0; i < 8; i++)
+		be_i_to_b(hash[i], digest + (i * 4));
+}
+
+/**
+ * Hash a message with double SHA256 - the SHA256 of its SHA256 digest
+ *
+ * The outer hash is always of 32 bytes, so it is a single chunk with a
+ *  mostly constant schedule, and 64 byte messages take the precomputed
+ *  padding chunk.
+ *
+ * @param bytes Message bytes
+ * @param length Number of bytes in the message
+ * @param digest Array of 32 bytes to store the digest
+ */
+void sha2_256d(const unsigned char *bytes, size_t length,
+		unsigned char digest[])
+{
+	unsigned int hash[8];
+	unsigned long long ll_hash_out[8];
+	int i;
+
+	if (length == 64) {
+		sha2_256_64_words(bytes, hash);
+	} else {
+		sha2_oneshot(SHA256, bytes, length, ll_hash_out);
+		for (i = 0; i < 8; i++)
+			hash[i] = (unsigned int) ll_hash_out[i];
+	}
+
+	sha2_256_32(hash, hash);
+
+	for (i = 0; i < 8; i++)
+		be_i_to_b(hash[i], digest + (i * 4));
+}
+
+/**
+ * Hash back to back 64 byte messages (such as a level of a Merkle tree)
+ *  with SHA256 or double SHA256, SHA2_LANES at a time
+ *
+ * @param bytes count * 64 bytes of messages
+ * @param count Number of messages
+ * @param twice 1 for double SHA256, 0 for SHA256
+ * @param digests count * 32 bytes to store the digests
+ */
+void sha2_256_64_many(const unsigned char *bytes, size_t count, char twice,
+		unsigned char *digests)
+{
+	unsigned int hash[8][SHA2_LANES], words[16][SHA2_LANES];
+	unsigned int iv[8];
+	unsigned long long ll_iv[8];
+	size_t m;
+	int i, l;
+
+	sha2_iv(SHA256, iv, ll_iv);
+
+	for (m = 0; m + SHA2_LANES <= count; m += SHA2_LANES) {
+		for (l = 0; l < SHA2_LANES; l++) {
+			for (i = 0; i < 8; i++)
+				hash[i][l] = iv[i];
+			for (i = 0; i < 16; i++)
+				words[i][l] = be_i_b_to_w((unsigned char *) bytes +
+						((m + l) * 64) + (i * 4));
+		}
+
+		/* Every lane shares the padding chunk's schedule */
+		sha2_i_compress_lanes(hash, words);
+		sha2_i_rounds_lanes(hash, sha2_i_pad64_schedule, 0);
+		if (twice)
+			sha2_256_32_lanes(hash);
+
+		for (l = 0; l < SHA2_LANES; l++)
+			for (i = 0; i < 8; i++)
+				be_i_to_b(hash[i][l], digests + ((m + l) * 32) + (i * 4));
+	}
 
-		/* Add the chunk variables back into the current hash */
-		ll_hash[0] += a;
-		ll_hash[1] += b;
-		ll_hash[2] += c;
-		ll_hash[3] += d;
-		ll_hash[4] += e;
-		ll_hash[5] += f;
-		ll_hash[6] += g;
-		ll_hash[7] += h;
+	/* The last few messages on their own */
+	for (; m < count; m++) {
+		if (twice)
+			sha2_256d(bytes + (m * 64), 64, digests + (m * 32));
+		else
+			sha2_256_64(bytes + (m * 64), digests + (m * 32));
 	}
 }
@@ -23,17 +23,46 @@
 #ifndef SHA2_H_
 #define SHA2_H_
 
+/** Number of independent messages compressed together by the lane functions */
+#define SHA2_LANES 4
+
 /** Enumeration of SHA2 types */
 enum sha2_t {
 	SHA256,
 	SHA224,
 	SHA512,
-	SHA384
+	SHA384,
+	SHA512_256,
+	SHA512_224
 };
 
 char sha2_init();
 char sha2_add_string(char *);
+char sha2_add_bytes(unsigned char *, unsigned int);
 char sha2_add_file(FILE *);
 char sha2_get_hash(unsigned long long[]);
 
+void sha2_iv(enum sha2_t, unsigned int [], unsigned long long []);
+void sha2_oneshot(enum sha2_t, const unsigned char *, size_t,
+		unsigned long long []);
+
+void sha2_i_compress(unsigned int [], unsigned int []);
+void sha2_ll_compress(unsigned long long [], unsigned long long []);
+void sha2_i_compress_lanes(unsigned int [][SHA2_LANES],
+		unsigned int [][SHA2_LANES]);
+void sha2_ll_compress_lanes(unsigned long long [][SHA2_LANES],
+		unsigned long long [][SHA2_LANES]);
+
+void sha2_i_rounds(unsigned int [], const unsigned int []);
+void sha2_i_rounds_lanes(unsigned int [][SHA2_LANES], const unsigned int [],
+		unsigned int);
+void sha2_i_schedule_32(unsigned int []);
+
+void sha2_256_32(const unsigned int [], unsigned int []);
+void sha2_256_32_lanes(unsigned int [][SHA2_LANES]);
+void sha2_256_64_words(const unsigned char [], unsigned int []);
+void sha2_256_64(const unsigned char [], unsigned char []);
+void sha2_256d(const unsigned char *, size_t, unsigned char []);
+void sha2_256_64_many(const unsigned char *, size_t, char, unsigned char *);
+
 #endif /* SHA2_H_ */
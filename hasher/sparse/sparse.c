@@ -0,0 +1,211 @@
+/**
+ * @file sparse.c
+ * Sparse file reading - holes are given as zeros without reading them
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* SEEK_DATA, SEEK_HOLE */
+#define _GNU_SOURCE
+
+/* Includes */
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../probes/probes.h"
+#include "../stats/stats.h"
+#include "sparse.h"
+
+/** Zeros given for holes */
+unsigned char sparse_zeros[SPARSE_ZERO_SIZE];
+
+/**
+ * Set up reading from a file descriptor's current offset
+ *
+ * @param sparse Reader to set up
+ * @param fd File descriptor
+ */
+void sparse_begin_fd(struct sparse *sparse, int fd)
+{
+	struct stat st;
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+
+	sparse->fp = NULL;
+	sparse->fd = fd;
+	sparse->offset = offset > 0 ? (unsigned long long) offset : 0;
+	sparse->size = 0;
+	sparse->run_end = sparse->offset;
+	sparse->in_hole = 0;
+	sparse->ok = 1;
+
+	/* Only worth looking for holes with fewer blocks than bytes */
+	sparse->holes = offset >= 0 && fstat(fd, &st) == 0 &&
+			S_ISREG(st.st_mode) &&
+			(unsigned long long) st.st_blocks * 512 <
+					(unsigned long long) st.st_size;
+	if (sparse->holes)
+		sparse->size = (unsigned long long) st.st_size;
+}
+
+/**
+ * Set up reading from a file pointer's current offset
+ *
+ * Holes are only skipped if nothing is buffered yet, as the file is then
+ *  read through its descriptor.
+ *
+ * @param sparse Reader to set up
+ * @param fp File pointer
+ */
+void sparse_begin_file(struct sparse *sparse, FILE *fp)
+{
+	off_t offset = ftello(fp);
+
+	sparse_begin_fd(sparse, fileno(fp));
+	sparse->fp = fp;
+	if (offset < 0 || (unsigned long long) offset != sparse->offset)
+		sparse->holes = 0;
+}
+
+/**
+ * Stop skipping holes, reading the rest of the file from where it got to
+ *
+ * @param sparse The reader
+ */
+void sparse_plain(struct sparse *sparse)
+{
+	sparse->holes = 0;
+	if (sparse->fp != NULL)
+		fseeko(sparse->fp, (off_t) sparse->offset, SEEK_SET);
+	else
+		lseek(sparse->fd, (off_t) sparse->offset, SEEK_SET);
+}
+
+/**
+ * Read the next bytes of the file
+ *
+ * @param sparse The reader
+ * @param buffer Where to read to
+ * @param length Most bytes to read
+ * @param bytes Set to the bytes - the buffer, or zeros for a hole
+ * @return Number of bytes, 0 at the end of the file (or a failed read)
+ */
+size_t sparse_read(struct sparse *sparse, unsigned char *buffer,
+		size_t length, unsigned char **bytes)
+{
+	unsigned long long start, left;
+	off_t next;
+	ssize_t got;
+
+	*bytes = buffer;
+	if (sparse->holes && sparse->offset >= sparse->size)
+		return 0;
+
+	if (sparse->holes && sparse->offset >= sparse->run_end) {
+#ifdef SEEK_DATA
+		/* A hole up to the next data, or data up to the next hole */
+		next = lseek(sparse->fd, (off_t) sparse->offset, SEEK_DATA);
+		if (next < 0 && errno == ENXIO)
+			next = (off_t) sparse->size;
+		if (next < 0) {
+			sparse_plain(sparse);
+		} else if ((unsigned long long) next > sparse->offset) {
+			sparse->in_hole = 1;
+			sparse->run_end = (unsigned long long) next;
+		} else {
+			next = lseek(sparse->fd, (off_t) sparse->offset, SEEK_HOLE);
+			sparse->in_hole = 0;
+			sparse->run_end = next < 0 ? sparse->size :
+					(unsigned long long) next;
+		}
+		if (sparse->run_end > sparse->size)
+			sparse->run_end = sparse->size;
+#else
+		/* No way to find holes - read everything */
+		sparse_plain(sparse);
+#endif
+	}
+
+	if (!sparse->holes) {
+		if (sparse->fp != NULL)
+			return stats_fread(buffer, length, sparse->fp);
+
+		for (;;) {
+			start = stats_now();
+			HASHER_PROBE1(read__start, length);
+			got = read(sparse->fd, buffer, length);
+			HASHER_PROBE1(read__done, got < 0 ? 0 : got);
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got < 0) {
+				sparse->ok = 0;
+				return 0;
+			}
+			stats_read(start, got);
+
+			return got;
+		}
+	}
+
+	left = sparse->run_end - sparse->offset;
+	if (sparse->in_hole) {
+		length = length < SPARSE_ZERO_SIZE ? length : SPARSE_ZERO_SIZE;
+		length = left < length ? left : length;
+		STATS_ADD(S_BYTES_SKIPPED, length);
+		sparse->offset += length;
+		*bytes = sparse_zeros;
+
+		return length;
+	}
+
+	length = left < length ? left : length;
+	for (;;) {
+		start = stats_now();
+		HASHER_PROBE1(read__start, length);
+		got = pread(sparse->fd, buffer, length, (off_t) sparse->offset);
+		HASHER_PROBE1(read__done, got < 0 ? 0 : got);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			sparse->ok = 0;
+		if (got <= 0) {
+			/* Cut short - end there, as reading the file would have */
+			sparse->size = sparse->offset;
+			return 0;
+		}
+		stats_read(start, got);
+		sparse->offset += got;
+
+		return got;
+	}
+}
+
+/**
+ * Finish reading, leaving a file pointer where the reading got to
+ *
+ * @param sparse The reader
+ * @return 1 if every read succeeded, else 0
+ */
+char sparse_end(struct sparse *sparse)
+{
+	if (sparse->holes && sparse->fp != NULL)
+		fseeko(sparse->fp, (off_t) sparse->offset, SEEK_SET);
+
+	return sparse->ok && (sparse->fp == NULL || !ferror(sparse->fp));
+}
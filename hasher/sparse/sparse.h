@@ -0,0 +1,60 @@
+/**
+ * @file sparse.h
+ * Header for sparse.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SPARSE_H_
+#define SPARSE_H_
+
+/** Bytes of zeros given at a time for a hole */
+#define SPARSE_ZERO_SIZE 65536
+
+/**
+ * A file being read with its holes skipped
+ *
+ * Holes (found with SEEK_DATA and SEEK_HOLE) are given as runs of zeros
+ *  without reading them. Files with every block allocated, and anything
+ *  other than a regular file, are simply read.
+ */
+struct sparse {
+	/** File pointer read from, or NULL to read the file descriptor */
+	FILE *fp;
+	/** File descriptor of the file */
+	int fd;
+	/** Offset of the next byte */
+	unsigned long long offset;
+	/** Bytes in the file, when it began to be read */
+	unsigned long long size;
+	/** End of the hole or data being read */
+	unsigned long long run_end;
+	/** Whether the run being read is a hole */
+	char in_hole;
+	/** Whether holes are being skipped */
+	char holes;
+	/** 1 until a read fails */
+	char ok;
+};
+
+void sparse_begin_file(struct sparse *, FILE *);
+void sparse_begin_fd(struct sparse *, int);
+size_t sparse_read(struct sparse *, unsigned char *, size_t, unsigned char **);
+char sparse_end(struct sparse *);
+
+#endif /* SPARSE_H_ */
@@ -0,0 +1,211 @@
+/**
+ * @file stats.c
+ * Runtime statistics - per-thread counters of reading and hashing work,
+ *  summed and reported at exit
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../probes/probes.h"
+#include "stats.h"
+
+/** Whether counters are being kept (set before any threads start) */
+char stats_enabled = 0;
+/** Counters of the calling thread, NULL until its first count */
+__thread struct stats *stats_local = NULL;
+
+/** Every thread's counters */
+struct stats *stats_threads = NULL;
+/** Guards stats_threads (taken once per thread) */
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Names of the counters, for the reports */
+const char *stats_names[S_COUNTERS] = {
+		"bytes_read", "reads", "read_ns", "bytes_mapped", "files_opened",
+		"bytes_hashed", "hash_ns", "md5_blocks", "sha1_blocks", "sha256_blocks",
+		"sha512_blocks", "blake3_blocks", "crc32c_bytes", "xxh3_bytes",
+		"known_lookups", "known_hits", "tasks_stolen", "bytes_skipped",
+		"prefix_hits", "records"};
+
+/**
+ * Get the calling thread's counters, making them on its first count
+ *
+ * The counters outlive the thread, so a worker's counts are still there
+ *  to be summed after it has been joined.
+ *
+ * @return The thread's counters (a shared spare if out of memory)
+ */
+struct stats *stats_thread()
+{
+	static struct stats spare;
+	struct stats *stats = calloc(1, sizeof(struct stats));
+
+	if (stats == NULL) {
+		stats_local = &spare;
+		return &spare;
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	stats->next = stats_threads;
+	stats_threads = stats;
+	pthread_mutex_unlock(&stats_lock);
+
+	stats_local = stats;
+
+	return stats;
+}
+
+/**
+ * Get a timestamp for timing work
+ *
+ * @return Monotonic nanoseconds, or 0 if statistics are off (so the clock
+ *          isn't read)
+ */
+unsigned long long stats_now()
+{
+	struct timespec ts;
+
+	if (!stats_enabled)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((unsigned long long) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Count a read call
+ *
+ * @param start stats_now() from before the read
+ * @param length Bytes read
+ */
+void stats_read(unsigned long long start, unsigned long long length)
+{
+	if (!stats_enabled)
+		return;
+
+	STATS_ADD(S_READS, 1);
+	STATS_ADD(S_BYTES_READ, length);
+	STATS_ADD(S_READ_NS, stats_now() - start);
+}
+
+/**
+ * Read from a file, counting the call
+ *
+ * @param buffer Where to read to
+ * @param length Most bytes to read
+ * @param fp File pointer to read from
+ * @return Bytes read, as from fread
+ */
+size_t stats_fread(void *buffer, size_t length, FILE *fp)
+{
+	unsigned long long start = stats_now();
+	size_t got;
+
+	HASHER_PROBE1(read__start, length);
+	got = fread(buffer, 1, length, fp);
+	HASHER_PROBE1(read__done, got);
+	stats_read(start, got);
+
+	return got;
+}
+
+/**
+ * Count bytes hashed and the time spent on them
+ *
+ * @param start stats_now() from before the hashing
+ * @param length Bytes hashed
+ */
+void stats_hashed(unsigned long long start, unsigned long long length)
+{
+	if (!stats_enabled)
+		return;
+
+	STATS_ADD(S_BYTES_HASHED, length);
+	STATS_ADD(S_HASH_NS, stats_now() - start);
+}
+
+/**
+ * Sum the counters of every thread
+ *
+ * Only call this once the worker threads have been joined.
+ *
+ * @param totals Array of S_COUNTERS to store the sums
+ */
+void stats_total(unsigned long long totals[])
+{
+	struct stats *stats;
+	unsigned int c;
+
+	for (c = 0; c < S_COUNTERS; c++)
+		totals[c] = 0;
+
+	pthread_mutex_lock(&stats_lock);
+	for (stats = stats_threads; stats != NULL; stats = stats->next)
+		for (c = 0; c < S_COUNTERS; c++)
+			totals[c] += stats->counts[c];
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Write a report of the summed counters
+ *
+ * The human-readable report has one counter per line, with times in
+ *  seconds and the read and hash rates. The JSON report is a single object
+ *  of the raw counters.
+ *
+ * @param fp Where to write the report
+ * @param json Whether to write JSON rather than text
+ */
+void stats_report(FILE *fp, char json)
+{
+	unsigned long long totals[S_COUNTERS];
+	unsigned int c;
+
+	stats_total(totals);
+
+	if (json) {
+		fprintf(fp, "{");
+		for (c = 0; c < S_COUNTERS; c++)
+			fprintf(fp, "%s\"%s\":%llu", c == 0 ? "" : ",", stats_names[c],
+					totals[c]);
+		fprintf(fp, "}\n");
+
+		return;
+	}
+
+	for (c = 0; c < S_COUNTERS; c++) {
+		if (c == S_READ_NS || c == S_HASH_NS)
+			fprintf(fp, "%-16s%17.6f s\n", c == S_READ_NS ? "read_time" :
+					"hash_time", totals[c] / 1e9);
+		else
+			fprintf(fp, "%-16s%20llu\n", stats_names[c], totals[c]);
+	}
+	if (totals[S_READ_NS] > 0)
+		fprintf(fp, "%-16s%15.1f MB/s\n", "read_rate",
+				(totals[S_BYTES_READ] / 1e6) / (totals[S_READ_NS] / 1e9));
+	if (totals[S_HASH_NS] > 0)
+		fprintf(fp, "%-16s%15.1f MB/s\n", "hash_rate",
+				(totals[S_BYTES_HASHED] / 1e6) /
+				(totals[S_HASH_NS] / 1e9));
+}
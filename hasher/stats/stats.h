@@ -0,0 +1,104 @@
+/**
+ * @file stats.h
+ * Header for stats.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+/** Runtime counters */
+enum stats_counter_t {
+	/** Bytes read from files */
+	S_BYTES_READ,
+	/** Read calls made */
+	S_READS,
+	/** Nanoseconds spent reading */
+	S_READ_NS,
+	/** Bytes of files hashed through a memory mapping */
+	S_BYTES_MAPPED,
+	/** Files opened for hashing */
+	S_FILES_OPENED,
+	/** Bytes hashed */
+	S_BYTES_HASHED,
+	/** Nanoseconds spent hashing */
+	S_HASH_NS,
+	/** MD5 chunks compressed */
+	S_MD5_BLOCKS,
+	/** SHA1 chunks compressed */
+	S_SHA1_BLOCKS,
+	/** SHA256 and SHA224 chunks compressed (and lanes of them) */
+	S_SHA256_BLOCKS,
+	/** SHA512 family chunks compressed (and lanes of them) */
+	S_SHA512_BLOCKS,
+	/** BLAKE3 blocks compressed (and lanes of them) */
+	S_BLAKE3_BLOCKS,
+	/** Bytes checksummed by CRC32C (it has no blocks) */
+	S_CRC32C_BYTES,
+	/** Bytes hashed by XXH3 */
+	S_XXH3_BYTES,
+	/** Digests looked up in known sets */
+	S_KNOWN_LOOKUPS,
+	/** Digests found in known sets */
+	S_KNOWN_HITS,
+	/** Tasks a pool worker took from another worker's deque */
+	S_TASKS_STOLEN,
+	/** Bytes of holes in sparse files hashed as zeros without reading */
+	S_BYTES_SKIPPED,
+	/** Messages started from a prefix's midstate */
+	S_PREFIX_HITS,
+	/** Records hashed one by one from a stream */
+	S_RECORDS,
+	/** Number of counters */
+	S_COUNTERS
+};
+
+/** One thread's counters, kept until exit */
+struct stats {
+	/** Counts, indexed by enum stats_counter_t */
+	unsigned long long counts[S_COUNTERS];
+	/** The next thread's counters */
+	struct stats *next;
+};
+
+extern char stats_enabled;
+extern __thread struct stats *stats_local;
+
+/**
+ * Add to a counter of the calling thread
+ *
+ * Costs a test of stats_enabled when statistics are off. Each thread writes
+ *  only its own counters, so no locks or atomics are needed.
+ */
+#define STATS_ADD(counter, n) \
+	do { \
+		if (stats_enabled) \
+			(stats_local != NULL ? stats_local : stats_thread())-> \
+					counts[counter] += (n); \
+	} while (0)
+
+struct stats *stats_thread();
+unsigned long long stats_now();
+void stats_read(unsigned long long, unsigned long long);
+size_t stats_fread(void *, size_t, FILE *);
+void stats_hashed(unsigned long long, unsigned long long);
+void stats_total(unsigned long long []);
+void stats_report(FILE *, char);
+
+#endif /* STATS_H_ */
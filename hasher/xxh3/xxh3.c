@@ -0,0 +1,778 @@
+/**
+ * @file xxh3.c
+ * An implementation of XXH3 (64 and 128 bit, default secret, seed 0), from
+ *  the xxHash specification
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Includes */
+#include <stdio.h>
+#include <string.h>
+
+#include "../stats/stats.h"
+#include "../sparse/sparse.h"
+#include "xxh3.h"
+
+/** Bytes in a stripe */
+#define XXH3_STRIPE_LEN 64
+/** Secret bytes consumed per stripe */
+#define XXH3_SECRET_CONSUME_RATE 8
+/** Bytes in the default secret */
+#define XXH3_SECRET_SIZE 192
+/** Smallest secret the short paths read */
+#define XXH3_SECRET_SIZE_MIN 136
+/** Secret offset used to merge accumulators */
+#define XXH3_SECRET_MERGEACCS_START 11
+/** Secret offset (from the end) for the last stripe */
+#define XXH3_SECRET_LASTACC_START 7
+/** Largest input hashed without the accumulators */
+#define XXH3_MID_SIZE_MAX 240
+/** Bytes buffered between calls (a multiple of the stripe length) */
+#define XXH3_BUFFER_SIZE 256
+/** Stripes between scrambles */
+#define XXH3_STRIPES_PER_BLOCK \
+	((XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / XXH3_SECRET_CONSUME_RATE)
+
+#define XXH_PRIME32_1 0x9E3779B1ULL
+#define XXH_PRIME32_2 0x85EBCA77ULL
+#define XXH_PRIME32_3 0xC2B2AE3DULL
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+/** Little endian loads - a macro so the stripe loop can be vectorised */
+#define XXH3_READ32(P) ((unsigned int) (P)[0] | \
+		((unsigned int) (P)[1] << 8) | \
+		((unsigned int) (P)[2] << 16) | \
+		((unsigned int) (P)[3] << 24))
+#define XXH3_READ64(P) ((unsigned long long) XXH3_READ32(P) | \
+		((unsigned long long) XXH3_READ32((P) + 4) << 32))
+
+/** 64 bit left rotate */
+#define XXH3_ROTL64(X, S) (((X) << (S)) | ((X) >> (64 - (S))))
+
+/*
+ * Use SSE2 (always there on x86-64) and AVX2 (only run if the processor has
+ *  it) for the stripe loop - the lane swap stops it being vectorised
+ *  automatically
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define XXH3_X86
+#include <immintrin.h>
+#endif
+
+extern char in_hash;
+
+/** Default secret - from the xxHash specification */
+const unsigned char xxh3_secret[XXH3_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+	0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+	0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+	0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+	0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+	0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e,
+	0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f,
+	0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+	0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3,
+	0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49,
+	0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+	0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28,
+	0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+/** Output width being hashed */
+enum xxh3_t xxh3_type;
+/** Accumulators */
+unsigned long long xxh3_acc[8];
+/** Buffered input (the last stripe is kept for finishing short tails) */
+unsigned char xxh3_buffer[XXH3_BUFFER_SIZE];
+/** Bytes in the buffer */
+unsigned int xxh3_buffered;
+/** Stripes accumulated since the last scramble */
+unsigned int xxh3_stripes;
+/** Total bytes added */
+unsigned long long xxh3_length;
+/** Whether the processor has AVX2 */
+char xxh3_avx2 = 0;
+
+/**
+ * Multiply two 64 bit numbers into a 128 bit product
+ *
+ * @param a First number
+ * @param b Second number
+ * @param high High 64 bits of the product
+ * @return Low 64 bits of the product
+ */
+unsigned long long xxh3_mul128(unsigned long long a, unsigned long long b,
+		unsigned long long *high)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 product = (unsigned __int128) a * b;
+
+	*high = (unsigned long long) (product >> 64);
+	return (unsigned long long) product;
+#else
+	unsigned long long lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	unsigned long long hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+	unsigned long long lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+	unsigned long long hi_hi = (a >> 32) * (b >> 32);
+	unsigned long long cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+
+	*high = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	return (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+/**
+ * Multiply two 64 bit numbers and fold the 128 bit product
+ *
+ * @param a First number
+ * @param b Second number
+ * @return Low 64 bits xor high 64 bits of the product
+ */
+unsigned long long xxh3_mul128_fold64(unsigned long long a,
+		unsigned long long b)
+{
+	unsigned long long high, low = xxh3_mul128(a, b, &high);
+
+	return low ^ high;
+}
+
+/**
+ * XXH64's final mix
+ *
+ * @param h Value to mix
+ * @return Mixed value
+ */
+unsigned long long xxh64_avalanche(unsigned long long h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/**
+ * XXH3's final mix
+ *
+ * @param h Value to mix
+ * @return Mixed value
+ */
+unsigned long long xxh3_avalanche(unsigned long long h)
+{
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/**
+ * Stronger mix for the 4 to 8 byte inputs
+ *
+ * @param h Value to mix
+ * @param length Input length
+ * @return Mixed value
+ */
+unsigned long long xxh3_rrmxmx(unsigned long long h, unsigned long long length)
+{
+	h ^= XXH3_ROTL64(h, 49) ^ XXH3_ROTL64(h, 24);
+	h *= 0x9FB21C651E98DF25ULL;
+	h ^= (h >> 35) + length;
+	h *= 0x9FB21C651E98DF25ULL;
+	h ^= h >> 28;
+
+	return h;
+}
+
+/**
+ * Mix 16 bytes of input with 16 bytes of secret
+ *
+ * @param input 16 bytes of input
+ * @param secret 16 bytes of secret
+ * @return Mixed value
+ */
+unsigned long long xxh3_mix16b(const unsigned char *input,
+		const unsigned char *secret)
+{
+	return xxh3_mul128_fold64(XXH3_READ64(input) ^ XXH3_READ64(secret),
+			XXH3_READ64(input + 8) ^ XXH3_READ64(secret + 8));
+}
+
+/**
+ * Mix two 16 byte inputs into a 128 bit accumulator
+ *
+ * @param acc Low then high half of the accumulator
+ * @param input1 First 16 bytes of input
+ * @param input2 Second 16 bytes of input
+ * @param secret 32 bytes of secret
+ */
+void xxh3_mix32b(unsigned long long acc[], const unsigned char *input1,
+		const unsigned char *input2, const unsigned char *secret)
+{
+	acc[0] += xxh3_mix16b(input1, secret);
+	acc[0] ^= XXH3_READ64(input2) + XXH3_READ64(input2 + 8);
+	acc[1] += xxh3_mix16b(input2, secret + 16);
+	acc[1] ^= XXH3_READ64(input1) + XXH3_READ64(input1 + 8);
+}
+
+#ifdef XXH3_X86
+/**
+ * Accumulate a run of stripes, 2 lanes at a time
+ *
+ * @param acc Accumulators
+ * @param input Stripes of input
+ * @param secret Secret for the first stripe (advancing 8 bytes per stripe)
+ * @param stripes Number of stripes
+ */
+void xxh3_accumulate_sse2(unsigned long long acc[], const unsigned char *input,
+		const unsigned char *secret, unsigned int stripes)
+{
+	__m128i lanes[4], data, key;
+	unsigned int n, i;
+
+	for (i = 0; i < 4; i++)
+		lanes[i] = _mm_loadu_si128((__m128i *) acc + i);
+
+	for (n = 0; n < stripes; n++) {
+		for (i = 0; i < 4; i++) {
+			data = _mm_loadu_si128((__m128i *) input + i);
+			key = _mm_xor_si128(data,
+					_mm_loadu_si128((__m128i *) secret + i));
+			/* Low half of the key by its high half, plus the swapped data */
+			lanes[i] = _mm_add_epi64(lanes[i], _mm_mul_epu32(key,
+					_mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1))));
+			lanes[i] = _mm_add_epi64(lanes[i],
+					_mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+		}
+		input += XXH3_STRIPE_LEN;
+		secret += XXH3_SECRET_CONSUME_RATE;
+	}
+
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i *) acc + i, lanes[i]);
+}
+
+/**
+ * Accumulate a run of stripes, 4 lanes at a time
+ *
+ * @param acc Accumulators
+ * @param input Stripes of input
+ * @param secret Secret for the first stripe (advancing 8 bytes per stripe)
+ * @param stripes Number of stripes
+ */
+__attribute__((target("avx2")))
+void xxh3_accumulate_avx2(unsigned long long acc[], const unsigned char *input,
+		const unsigned char *secret, unsigned int stripes)
+{
+	__m256i lanes[2], data, key;
+	unsigned int n, i;
+
+	for (i = 0; i < 2; i++)
+		lanes[i] = _mm256_loadu_si256((__m256i *) acc + i);
+
+	for (n = 0; n < stripes; n++) {
+		for (i = 0; i < 2; i++) {
+			data = _mm256_loadu_si256((__m256i *) input + i);
+			key = _mm256_xor_si256(data,
+					_mm256_loadu_si256((__m256i *) secret + i));
+			lanes[i] = _mm256_add_epi64(lanes[i], _mm256_mul_epu32(key,
+					_mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1))));
+			lanes[i] = _mm256_add_epi64(lanes[i],
+					_mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+		}
+		input += XXH3_STRIPE_LEN;
+		secret += XXH3_SECRET_CONSUME_RATE;
+	}
+
+	for (i = 0; i < 2; i++)
+		_mm256_storeu_si256((__m256i *) acc + i, lanes[i]);
+}
+#endif
+
+/**
+ * Accumulate a run of stripes
+ *
+ * @param acc Accumulators
+ * @param input Stripes of input
+ * @param secret Secret for the first stripe (advancing 8 bytes per stripe)
+ * @param stripes Number of stripes
+ */
+void xxh3_accumulate(unsigned long long acc[], const unsigned char *input,
+		const unsigned char *secret, unsigned int stripes)
+{
+#ifdef XXH3_X86
+	if (xxh3_avx2)
+		xxh3_accumulate_avx2(acc, input, secret, stripes);
+	else
+		xxh3_accumulate_sse2(acc, input, secret, stripes);
+#else
+	unsigned long long data, key;
+	unsigned int n, i;
+
+	for (n = 0; n < stripes; n++) {
+		for (i = 0; i < 8; i++) {
+			data = XXH3_READ64(input + (8 * i));
+			key = data ^ XXH3_READ64(secret + (8 * i));
+			acc[i ^ 1] += data;
+			acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+		}
+		input += XXH3_STRIPE_LEN;
+		secret += XXH3_SECRET_CONSUME_RATE;
+	}
+#endif
+}
+
+/**
+ * Scramble the accumulators at the end of a block
+ *
+ * @param acc Accumulators
+ * @param secret 64 bytes of secret
+ */
+void xxh3_scramble(unsigned long long acc[], const unsigned char *secret)
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= XXH3_READ64(secret + (8 * i));
+		acc[i] *= XXH_PRIME32_1;
+	}
+}
+
+/**
+ * Accumulate stripes, scrambling at the end of each block
+ *
+ * @param acc Accumulators
+ * @param input Stripes of input
+ * @param stripes Number of stripes (never more than a block)
+ * @param done Stripes already accumulated in the current block
+ * @return Stripes accumulated in the current block afterwards
+ */
+unsigned int xxh3_consume(unsigned long long acc[], const unsigned char *input,
+		unsigned int stripes, unsigned int done)
+{
+	unsigned int to_end = XXH3_STRIPES_PER_BLOCK - done;
+
+	if (stripes >= to_end) {
+		xxh3_accumulate(acc, input,
+				xxh3_secret + (done * XXH3_SECRET_CONSUME_RATE), to_end);
+		xxh3_scramble(acc, xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+		xxh3_accumulate(acc, input + (to_end * XXH3_STRIPE_LEN), xxh3_secret,
+				stripes - to_end);
+		return stripes - to_end;
+	} else {
+		xxh3_accumulate(acc, input,
+				xxh3_secret + (done * XXH3_SECRET_CONSUME_RATE), stripes);
+		return done + stripes;
+	}
+}
+
+/**
+ * Merge the accumulators into 64 bits
+ *
+ * @param acc Accumulators
+ * @param secret 64 bytes of secret
+ * @param start Starting value
+ * @return Merged value
+ */
+unsigned long long xxh3_merge(unsigned long long acc[],
+		const unsigned char *secret, unsigned long long start)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		start += xxh3_mul128_fold64(acc[2 * i] ^ XXH3_READ64(secret + (16 * i)),
+				acc[(2 * i) + 1] ^ XXH3_READ64(secret + (16 * i) + 8));
+
+	return xxh3_avalanche(start);
+}
+
+/**
+ * Hash up to 240 bytes (64 bit output)
+ *
+ * @param input Input
+ * @param length Bytes of input
+ * @return Hash
+ */
+unsigned long long xxh3_64_short(const unsigned char *input,
+		unsigned int length)
+{
+	const unsigned char *secret = xxh3_secret;
+	unsigned long long acc, lo, hi;
+	unsigned int combo, i;
+
+	if (length == 0) {
+		return xxh64_avalanche(XXH3_READ64(secret + 56) ^
+				XXH3_READ64(secret + 64));
+	} else if (length <= 3) {
+		combo = ((unsigned int) input[0] << 16) |
+				((unsigned int) input[length >> 1] << 24) |
+				input[length - 1] | (length << 8);
+		return xxh64_avalanche(combo ^
+				(unsigned long long) (XXH3_READ32(secret) ^
+						XXH3_READ32(secret + 4)));
+	} else if (length <= 8) {
+		acc = XXH3_READ32(input + length - 4) +
+				((unsigned long long) XXH3_READ32(input) << 32);
+		acc ^= XXH3_READ64(secret + 8) ^ XXH3_READ64(secret + 16);
+		return xxh3_rrmxmx(acc, length);
+	} else if (length <= 16) {
+		lo = XXH3_READ64(input) ^
+				XXH3_READ64(secret + 24) ^ XXH3_READ64(secret + 32);
+		hi = XXH3_READ64(input + length - 8) ^
+				XXH3_READ64(secret + 40) ^ XXH3_READ64(secret + 48);
+		acc = length + __builtin_bswap64(lo) + hi +
+				xxh3_mul128_fold64(lo, hi);
+		return xxh3_avalanche(acc);
+	} else if (length <= 128) {
+		acc = length * XXH_PRIME64_1;
+		if (length > 32) {
+			if (length > 64) {
+				if (length > 96) {
+					acc += xxh3_mix16b(input + 48, secret + 96);
+					acc += xxh3_mix16b(input + length - 64, secret + 112);
+				}
+				acc += xxh3_mix16b(input + 32, secret + 64);
+				acc += xxh3_mix16b(input + length - 48, secret + 80);
+			}
+			acc += xxh3_mix16b(input + 16, secret + 32);
+			acc += xxh3_mix16b(input + length - 32, secret + 48);
+		}
+		acc += xxh3_mix16b(input, secret);
+		acc += xxh3_mix16b(input + length - 16, secret + 16);
+		return xxh3_avalanche(acc);
+	} else {
+		acc = length * XXH_PRIME64_1;
+		for (i = 0; i < 8; i++)
+			acc += xxh3_mix16b(input + (16 * i), secret + (16 * i));
+		acc = xxh3_avalanche(acc);
+		for (i = 8; i < length / 16; i++)
+			acc += xxh3_mix16b(input + (16 * i), secret + (16 * (i - 8)) + 3);
+		acc += xxh3_mix16b(input + length - 16,
+				secret + XXH3_SECRET_SIZE_MIN - 17);
+		return xxh3_avalanche(acc);
+	}
+}
+
+/**
+ * Hash up to 240 bytes (128 bit output)
+ *
+ * @param input Input
+ * @param length Bytes of input
+ * @param hash_out High then low 64 bits of the hash
+ */
+void xxh3_128_short(const unsigned char *input, unsigned int length,
+		unsigned long long hash_out[])
+{
+	const unsigned char *secret = xxh3_secret;
+	unsigned long long acc[2], lo, hi, keyed;
+	unsigned int combo, i;
+
+	if (length == 0) {
+		hash_out[0] = xxh64_avalanche(XXH3_READ64(secret + 80) ^
+				XXH3_READ64(secret + 88));
+		hash_out[1] = xxh64_avalanche(XXH3_READ64(secret + 64) ^
+				XXH3_READ64(secret + 72));
+	} else if (length <= 3) {
+		combo = ((unsigned int) input[0] << 16) |
+				((unsigned int) input[length >> 1] << 24) |
+				input[length - 1] | (length << 8);
+		hash_out[1] = xxh64_avalanche(combo ^
+				(unsigned long long) (XXH3_READ32(secret) ^
+						XXH3_READ32(secret + 4)));
+		combo = __builtin_bswap32(combo);
+		combo = (combo << 13) | (combo >> 19);
+		hash_out[0] = xxh64_avalanche(combo ^
+				(unsigned long long) (XXH3_READ32(secret + 8) ^
+						XXH3_READ32(secret + 12)));
+	} else if (length <= 8) {
+		keyed = XXH3_READ32(input) +
+				((unsigned long long) XXH3_READ32(input + length - 4) << 32);
+		keyed ^= XXH3_READ64(secret + 16) ^ XXH3_READ64(secret + 24);
+		lo = xxh3_mul128(keyed, XXH_PRIME64_1 + (length << 2), &hi);
+		hi += lo << 1;
+		lo ^= hi >> 3;
+		lo ^= lo >> 35;
+		lo *= 0x9FB21C651E98DF25ULL;
+		lo ^= lo >> 28;
+		hash_out[0] = xxh3_avalanche(hi);
+		hash_out[1] = lo;
+	} else if (length <= 16) {
+		lo = XXH3_READ64(input);
+		hi = XXH3_READ64(input + length - 8);
+		acc[0] = xxh3_mul128(lo ^ hi ^ XXH3_READ64(secret + 32) ^
+				XXH3_READ64(secret + 40), XXH_PRIME64_1, &acc[1]);
+		acc[0] += (unsigned long long) (length - 1) << 54;
+		hi ^= XXH3_READ64(secret + 48) ^ XXH3_READ64(secret + 56);
+		acc[1] += hi + ((hi & 0xFFFFFFFF) * (XXH_PRIME32_2 - 1));
+		acc[0] ^= __builtin_bswap64(acc[1]);
+		lo = xxh3_mul128(acc[0], XXH_PRIME64_2, &hi);
+		hi += acc[1] * XXH_PRIME64_2;
+		hash_out[0] = xxh3_avalanche(hi);
+		hash_out[1] = xxh3_avalanche(lo);
+	} else {
+		acc[0] = length * XXH_PRIME64_1;
+		acc[1] = 0;
+		if (length <= 128) {
+			if (length > 32) {
+				if (length > 64) {
+					if (length > 96)
+						xxh3_mix32b(acc, input + 48, input + length - 64,
+								secret + 96);
+					xxh3_mix32b(acc, input + 32, input + length - 48,
+							secret + 64);
+				}
+				xxh3_mix32b(acc, input + 16, input + length - 32,
+						secret + 32);
+			}
+			xxh3_mix32b(acc, input, input + length - 16, secret);
+		} else {
+			for (i = 0; i < 4; i++)
+				xxh3_mix32b(acc, input + (32 * i), input + (32 * i) + 16,
+						secret + (32 * i));
+			acc[0] = xxh3_avalanche(acc[0]);
+			acc[1] = xxh3_avalanche(acc[1]);
+			for (i = 4; i < length / 32; i++)
+				xxh3_mix32b(acc, input + (32 * i), input + (32 * i) + 16,
+						secret + (32 * (i - 4)) + 3);
+			xxh3_mix32b(acc, input + length - 16, input + length - 32,
+					secret + XXH3_SECRET_SIZE_MIN - 17 - 16);
+		}
+		hash_out[1] = xxh3_avalanche(acc[0] + acc[1]);
+		hash_out[0] = 0 - xxh3_avalanche((acc[0] * XXH_PRIME64_1) +
+				(acc[1] * XXH_PRIME64_4) +
+				((unsigned long long) length * XXH_PRIME64_2));
+	}
+}
+
+/**
+ * Initialise XXH3 hashing
+ *
+ * @param type Output width to be used
+ * @return 1 if XXH3 hashing was initialised (nothing else initialised), else
+ *          0
+ */
+char xxh3_init(enum xxh3_t type)
+{
+	/* Begin hashing if not currently hashing */
+	if (!in_hash) {
+		xxh3_type = type;
+#ifdef XXH3_X86
+		xxh3_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+		/* Accumulators - from the xxHash specification */
+		xxh3_acc[0] = XXH_PRIME32_3;
+		xxh3_acc[1] = XXH_PRIME64_1;
+		xxh3_acc[2] = XXH_PRIME64_2;
+		xxh3_acc[3] = XXH_PRIME64_3;
+		xxh3_acc[4] = XXH_PRIME64_4;
+		xxh3_acc[5] = XXH_PRIME32_2;
+		xxh3_acc[6] = XXH_PRIME64_5;
+		xxh3_acc[7] = XXH_PRIME32_1;
+
+		xxh3_buffered = 0;
+		xxh3_stripes = 0;
+		xxh3_length = 0;
+
+		/* Now in hash */
+		in_hash = 1;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Add a string into the current hash
+ *
+ * @param str Null terminated string
+ * @return 1 if the string was added, else 0
+ */
+char xxh3_add_string(char *str)
+{
+	return xxh3_add_bytes((unsigned char *) str, strlen(str));
+}
+
+/**
+ * Add an array of bytes into the current hash
+ *
+ * Input is buffered until more than a buffer's worth is waiting, so the last
+ *  (possibly partial) stripe is always left for xxh3_get_hash.
+ *
+ * @param bytes Array of bytes (may contain nulls)
+ * @param length Number of bytes in the array
+ * @return 1 if the bytes were added, else 0
+ */
+char xxh3_add_bytes(unsigned char *bytes, unsigned int length)
+{
+	unsigned int fill;
+
+	/* Ensure we're currently hashing */
+	if (in_hash) {
+		STATS_ADD(S_XXH3_BYTES, length);
+		xxh3_length += length;
+
+		if (xxh3_buffered + length <= XXH3_BUFFER_SIZE) {
+			memcpy(xxh3_buffer + xxh3_buffered, bytes, length);
+			xxh3_buffered += length;
+			return 1;
+		}
+
+		/* Top up and consume the buffer */
+		if (xxh3_buffered > 0) {
+			fill = XXH3_BUFFER_SIZE - xxh3_buffered;
+			memcpy(xxh3_buffer + xxh3_buffered, bytes, fill);
+			bytes += fill;
+			length -= fill;
+			xxh3_stripes = xxh3_consume(xxh3_acc, xxh3_buffer,
+					XXH3_BUFFER_SIZE / XXH3_STRIPE_LEN, xxh3_stripes);
+			xxh3_buffered = 0;
+		}
+
+		/* Consume straight from the input, keeping the last stripe seen */
+		if (length > XXH3_BUFFER_SIZE) {
+			do {
+				xxh3_stripes = xxh3_consume(xxh3_acc, bytes,
+						XXH3_BUFFER_SIZE / XXH3_STRIPE_LEN, xxh3_stripes);
+				bytes += XXH3_BUFFER_SIZE;
+				length -= XXH3_BUFFER_SIZE;
+			} while (length > XXH3_BUFFER_SIZE);
+			memcpy(xxh3_buffer + XXH3_BUFFER_SIZE - XXH3_STRIPE_LEN,
+					bytes - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+		}
+
+		memcpy(xxh3_buffer, bytes, length);
+		xxh3_buffered = length;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Add a file into the current hash
+ *
+ * @param fp File pointer to the file to be read from
+ * @return 1 if the file's contents was added, else 0
+ */
+char xxh3_add_file(FILE *fp)
+{
+	/* Ensure we're currently hashing */
+	if (in_hash) {
+		unsigned char buffer[256 * XXH3_BUFFER_SIZE], *bytes;
+		unsigned long long start;
+		size_t read_length;
+		struct sparse sparse;
+
+		sparse_begin_file(&sparse, fp);
+		while ((read_length = sparse_read(&sparse, buffer, sizeof(buffer),
+				&bytes)) > 0) {
+			start = stats_now();
+			xxh3_add_bytes(bytes, read_length);
+			stats_hashed(start, read_length);
+		}
+
+		return sparse_end(&sparse);
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Complete hashing and get a copy of the hash
+ *
+ * @param hash_out Array of 1 (64 bit) or 2 (128 bit, high then low) unsigned
+ *                  long longs
+ * @return 1 if the hash was copied, else 0
+ */
+char xxh3_get_hash(unsigned long long hash_out[])
+{
+	unsigned long long acc[8];
+	unsigned char last[XXH3_STRIPE_LEN];
+	unsigned int catchup;
+
+	if (in_hash) {
+		if (xxh3_length <= XXH3_MID_SIZE_MAX) {
+			/* Everything is still in the buffer */
+			if (xxh3_type == XXH3_128)
+				xxh3_128_short(xxh3_buffer, xxh3_buffered, hash_out);
+			else
+				hash_out[0] = xxh3_64_short(xxh3_buffer, xxh3_buffered);
+		} else {
+			memcpy(acc, xxh3_acc, sizeof(acc));
+
+			if (xxh3_buffered >= XXH3_STRIPE_LEN) {
+				xxh3_consume(acc, xxh3_buffer,
+						(xxh3_buffered - 1) / XXH3_STRIPE_LEN, xxh3_stripes);
+				xxh3_accumulate(acc,
+						xxh3_buffer + xxh3_buffered - XXH3_STRIPE_LEN,
+						xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN -
+						XXH3_SECRET_LASTACC_START, 1);
+			} else {
+				/* Complete the last stripe from the previous buffer */
+				catchup = XXH3_STRIPE_LEN - xxh3_buffered;
+				memcpy(last, xxh3_buffer + XXH3_BUFFER_SIZE - catchup,
+						catchup);
+				memcpy(last + catchup, xxh3_buffer, xxh3_buffered);
+				xxh3_accumulate(acc, last, xxh3_secret + XXH3_SECRET_SIZE -
+						XXH3_STRIPE_LEN - XXH3_SECRET_LASTACC_START, 1);
+			}
+
+			if (xxh3_type == XXH3_128) {
+				hash_out[0] = xxh3_merge(acc, xxh3_secret + XXH3_SECRET_SIZE -
+						sizeof(acc) - XXH3_SECRET_MERGEACCS_START,
+						~(xxh3_length * XXH_PRIME64_2));
+				hash_out[1] = xxh3_merge(acc,
+						xxh3_secret + XXH3_SECRET_MERGEACCS_START,
+						xxh3_length * XXH_PRIME64_1);
+			} else {
+				hash_out[0] = xxh3_merge(acc,
+						xxh3_secret + XXH3_SECRET_MERGEACCS_START,
+						xxh3_length * XXH_PRIME64_1);
+			}
+		}
+
+		/* End hashing */
+		in_hash = 0;
+
+		return 1;
+	} else {
+		return 0;
+	}
+}
@@ -0,0 +1,35 @@
+/**
+ * @file xxh3.h
+ * Header for xxh3.c
+ * @author	FergoFrog <fergofrog@fergofrog.com>
+ * @version 0.3
+ *
+ * @section LICENSE
+ * Copyright (C) 2011 FergoFrog
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef XXH3_H_
+#define XXH3_H_
+
+/** Output width of XXH3 */
+enum xxh3_t {XXH3_64, XXH3_128};
+
+char xxh3_init(enum xxh3_t);
+char xxh3_add_string(char *);
+char xxh3_add_bytes(unsigned char *, unsigned int);
+char xxh3_add_file(FILE *);
+char xxh3_get_hash(unsigned long long []);
+
+#endif /* XXH3_H_ */